@@ -0,0 +1,42 @@
+#define DEBUG_TYPE "PLR"
+
+#include "../dataflowProtection/dataflowProtection.h"
+
+#include <llvm/Pass.h>
+#include <llvm/PassSupport.h>
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/Debug.h>
+
+using namespace llvm;
+
+cl::opt<int> plrReplicasOpt ("plrReplicas", cl::desc("Number of processes to run the program in (COAST_PLR_REPLICAS overrides it at run time)"), cl::init(3));
+
+//--------------------------------------------------------------------------//
+// Top level behavior
+//--------------------------------------------------------------------------//
+class PLR : public ModulePass {
+public:
+  static char ID;
+  PLR() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M);
+  void getAnalysisUsage(AnalysisUsage& AU) const ;
+};
+
+char PLR::ID = 0;
+static RegisterPass<PLR> X("PLR",
+		"Process-level redundancy, votes on library calls across replicated processes", false, false);
+
+bool PLR::runOnModule(Module &M) {
+
+	dataflowProtection DP;
+
+	return DP.runPLR(M, plrReplicasOpt);
+}
+
+//set pass dependencies
+void PLR::getAnalysisUsage(AnalysisUsage& AU) const {
+	ModulePass::getAnalysisUsage(AU);
+}
@@ -11,20 +11,37 @@
 #include <vector>
 #include <string>
 #include <list>
+#include <cmath>
 
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/DIBuilder.h>
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <llvm/Analysis/AliasSetTracker.h>
 #include <llvm-c/Core.h>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "dataflowProtection"
+
+STATISTIC(NumInstsCloned, "Number of instructions replicated");
+STATISTIC(NumGlobalsCloned, "Number of global variables replicated");
+STATISTIC(NumFnsResigned, "Number of functions recreated with a new signature");
+STATISTIC(NumConstGlobalsShared, "Number of constant globals kept as a single copy");
+STATISTIC(NumConstBytesSaved, "Number of bytes saved by not replicating constant globals");
+STATISTIC(NumConstChecksumBytes, "Number of bytes of checksums added for constant globals");
+STATISTIC(NumGlobalsPacked, "Number of global variables packed together with their copies");
+STATISTIC(NumAddrsFolded, "Number of replica addresses computed as a constant offset from the original");
+STATISTIC(NumInstsNotReplicated, "Number of instructions left out because of their low vulnerability");
+STATISTIC(NumGlobalsScrubbed, "Number of replicated globals registered with the background scrubber");
+
 
 // Arrays of function pointers are partially developed
 #define NO_FN_PTR_ARRAY
@@ -35,9 +52,19 @@ extern std::list<std::string> ignoreGlbl;
 extern std::list<std::string> skipLibCalls;
 extern std::list<std::string> coarseGrainedUserFunctions;
 extern std::list<std::string> protectedLib;
+extern std::list<std::string> parityGlbl;
 extern cl::opt<bool> noMemReplicationFlag;
 extern cl::opt<bool> verboseFlag;
 extern cl::opt<bool> noCloneOperandsCheckFlag;
+extern cl::opt<double> replicateFractionOpt;
+extern cl::opt<double> vulnerabilityThresholdOpt;
+extern cl::opt<double> compareVulnerabilityOpt;
+extern cl::opt<GlobalLayout> globalLayoutOpt;
+extern cl::opt<bool> replicaOffsetsFlag;
+extern cl::opt<MemOpFusion> fuseMemOpsOpt;
+extern cl::opt<bool> noConstReplicationFlag;
+extern cl::opt<bool> checkConstGlobalsFlag;
+extern cl::opt<bool> scrubGlobalsFlag;
 
 // other shared variables
 extern std::set<StoreInst*> syncGlobalStores;
@@ -66,225 +93,432 @@ void dataflowProtection::populateValuesToClone(Module& M) {
 	instsToClone.insert(instsToCloneAnno.begin(), instsToCloneAnno.end());
 	constantExprToClone.clear();
 
-	static std::set<Value*> warnValueLater;
-
 	// make sure DIBuilder set up
 	if (dBuilder == nullptr) {
 		dBuilder = new DIBuilder(M);
 	}
 
 	for (auto F : fnsToClone) {
-		if (isCoarseGrainedFunction(F->getName())) {
-//			errs() << F->getName() << " is coarse grained. Not replicating.\n";
-			continue;
+		populateInstsToClone(F);
+	}
+
+	for (GlobalVariable & g : M.getGlobalList()) {
+		if (xMR_default && globalCanBeCloned(g)) {
+			globalsToClone.insert(&g);
 		}
+	}
 
-		for (auto & bb : *F) {
-			for (auto & I : bb) {
+}
+
+
+/*
+ * Returns true if g should be cloned when everything is protected by default.
+ * This is the part of populateValuesToClone() that planProtectionBudget() uses
+ *  to know which globals will be protected.
+ */
+bool dataflowProtection::globalCanBeCloned(GlobalVariable& g) {
+	StringRef globalName = g.getName();
+
+	if (globalName.startswith("llvm")) {
+//		errs() << "WARNING: not duplicating global value " << g.getName() << ", assuming it is llvm-created\n";
+		return false;
+	}
+
+	// Don't clone ISR function pointers
+	if (g.getType()->isPointerTy() && g.getNumOperands() == 1) {
+		auto gVal = g.getOperand(0);
+		if (auto gFuncVal = dyn_cast<Function>(gVal)) {
+			if (isISR(*gFuncVal)) {
+				return false;
+			}
+		}
+	}
+
+	// Externally available globals without initializer -> external global
+	if (g.hasExternalLinkage() && !g.hasInitializer())
+		return false;
+
+	if (globalsToSkip.find(&g) != globalsToSkip.end()) {
+//		errs() << "WARNING: not duplicating global variable " << g.getName() << "\n";
+		return false;
+	}
+
+	if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g.getName().str()) != ignoreGlbl.end()) {
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Adds the instructions in F which should be cloned to instsToClone.
+ * This is the per-function part of populateValuesToClone(), so that the list can be
+ *  kept up to date when only one function has changed.
+ */
+void dataflowProtection::populateInstsToClone(Function* F) {
+	static std::set<Value*> warnValueLater;
+
+	if (isCoarseGrainedFunction(F->getName())) {
+//		errs() << F->getName() << " is coarse grained. Not replicating.\n";
+		return;
+	}
+
+	for (auto & bb : *F) {
+		for (auto & I : bb) {
+
+			if (willBeSkipped(&I)) {
+//				errs() << "Not cloning instruction " << I << "\n";
+				continue;
+			}
 
-				if (willBeSkipped(&I)) {
-//					errs() << "Not cloning instruction " << I << "\n";
+			// If store instructions not cloned, skip them
+			if (noMemReplicationFlag) {
+				if (dyn_cast<StoreInst>(&I)) {
 					continue;
 				}
+			}
 
-				// If store instructions not cloned, skip them
-				if (noMemReplicationFlag) {
-					if (dyn_cast<StoreInst>(&I)) {
-						continue;
-					}
-				}
+			if (CallInst * ci = dyn_cast<CallInst>(&I)) {
 
-				if (CallInst * ci = dyn_cast<CallInst>(&I)) {
+				// Don't touch/clone inline assembly
+				if (ci->isInlineAsm()) {
+					continue;
+				}
 
-					// Don't touch/clone inline assembly
-					if (ci->isInlineAsm()) {
-						continue;
-					}
+				// Skip special clone after call
+				if (cloneAfterCallArgMap.find(ci) != cloneAfterCallArgMap.end()) {
+					continue;
+				}
 
-					// Skip special clone after call
-					if (cloneAfterCallArgMap.find(ci) != cloneAfterCallArgMap.end()) {
-						continue;
+				// Clone constants in the function call
+				for (unsigned int i = 0; i < ci->getNumArgOperands(); i++) {
+					Value * arg = ci->getArgOperand(i);
+					if (ConstantExpr * e = dyn_cast<ConstantExpr>(arg)) {
+						constantExprToClone.insert(e);
 					}
+				}
 
-					// Clone constants in the function call
-					for (unsigned int i = 0; i < ci->getNumArgOperands(); i++) {
-						Value * arg = ci->getArgOperand(i);
-						if (ConstantExpr * e = dyn_cast<ConstantExpr>(arg)) {
-							constantExprToClone.insert(e);
-						}
-					}
+				// skip bitcasts and print a warning message, because this might skip more than bitcasts
+				if (!isIndirectFunctionCall(ci, "populateValuesToClone", false)) {
+					Function* cF = ci->getCalledFunction();
 
-					// skip bitcasts and print a warning message, because this might skip more than bitcasts
-					if (!isIndirectFunctionCall(ci, "populateValuesToClone", false)) {
-						Function* cF = ci->getCalledFunction();
+					// C standard library header atomics.h is not supported
+					if (cF->getName().startswith("atomic_")) {
+						errs() << err_string << " function \"" << cF->getName() << "\" not supported in.\n";
+						errs() << "COAST does not work well with atomic operations.\n";
 
-						// C standard library header atomics.h is not supported
-						if (cF->getName().startswith("atomic_")) {
-							errs() << err_string << " function \"" << cF->getName() << "\" not supported in.\n";
-							errs() << "COAST does not work well with atomic operations.\n";
+						std::exit(-1);
+						assert(false && "Atomic instructions not supported");
+					}
 
-							std::exit(-1);
-							assert(false && "Atomic instructions not supported");
-						}
+					if (std::find(skipLibCalls.begin(), skipLibCalls.end(),
+							cF->getName()) != skipLibCalls.end()) {
+//						errs() << "Skipping the libcall " << cF->getName() << "\n";
+						continue;
+					}
 
-						if (std::find(skipLibCalls.begin(), skipLibCalls.end(),
-								cF->getName()) != skipLibCalls.end()) {
-//							errs() << "Skipping the libcall " << cF->getName() << "\n";
+					// Only replicate coarseGrained user functions
+					if ( !(cF->hasExternalLinkage() && cF->isDeclaration()) ) {
+						if (!isCoarseGrainedFunction(cF->getName())) {
+//							errs() << cF->getName() << " is coarse-grained user function\n";
 							continue;
 						}
+					}
 
-						// Only replicate coarseGrained user functions
-						if ( !(cF->hasExternalLinkage() && cF->isDeclaration()) ) {
-							if (!isCoarseGrainedFunction(cF->getName())) {
-//								errs() << cF->getName() << " is coarse-grained user function\n";
-								continue;
-							}
-						}
-
-						if (!isCoarseGrainedFunction(cF->getName())) {
-							// If this isn't in the list of function calls to clone,
-							//  and it's a declaration
-							if (cF->isDeclaration()) {
-								// If none of the operands are going to be cloned,
-								//  then don't need to clone the instruction itself
-								bool opsWillBeCloned = false;
-								for (unsigned opNum = 0; opNum < ci->getNumOperands(); opNum++) {
-									auto op = ci->getOperand(opNum);
-									if (willBeCloned(op)) {
-										opsWillBeCloned = true;
-										break;
-									}
-								}
-								if (!opsWillBeCloned) {
-									continue;
+					if (!isCoarseGrainedFunction(cF->getName())) {
+						// If this isn't in the list of function calls to clone,
+						//  and it's a declaration
+						if (cF->isDeclaration()) {
+							// If none of the operands are going to be cloned,
+							//  then don't need to clone the instruction itself
+							bool opsWillBeCloned = false;
+							for (unsigned opNum = 0; opNum < ci->getNumOperands(); opNum++) {
+								auto op = ci->getOperand(opNum);
+								if (willBeCloned(op)) {
+									opsWillBeCloned = true;
+									break;
 								}
 							}
+							if (!opsWillBeCloned) {
+								continue;
+							}
 						}
+					}
 
-						// skip replicating debug function calls, the debugger only knows about the
-						//  original variable names anyway.
-						if (cF->getName().startswith_lower("llvm.dbg.") ||
-								cF->getName().startswith_lower("llvm.lifetime.")) {
-							continue;
-						}
+					// skip replicating debug function calls, the debugger only knows about the
+					//  original variable names anyway.
+					if (cF->getName().startswith_lower("llvm.dbg.") ||
+							cF->getName().startswith_lower("llvm.lifetime.")) {
+						continue;
+					}
 
-					} else {	// it is an indirect function call
+				} else {	// it is an indirect function call
 
-						Value* calledValue = ci->getCalledValue();
+					Value* calledValue = ci->getCalledValue();
 
-						if (auto* cexpr = dyn_cast<ConstantExpr>(calledValue)) {
+					if (auto* cexpr = dyn_cast<ConstantExpr>(calledValue)) {
 
-							// then see if we've got a name for a function in there
-							if (Function* indirectF = dyn_cast<Function>(calledValue->stripPointerCasts())) {
-								StringRef indirectName = indirectF->getName();
-//								errs() << "The name of the indirect function called is " << indirectName << "\n";
+						// then see if we've got a name for a function in there
+						if (Function* indirectF = dyn_cast<Function>(calledValue->stripPointerCasts())) {
+							StringRef indirectName = indirectF->getName();
+//							errs() << "The name of the indirect function called is " << indirectName << "\n";
 
-								// perform the same checks as above for the function name
-								if (std::find(skipLibCalls.begin(), skipLibCalls.end(),
-										indirectF->getName()) != skipLibCalls.end()) {
+							// perform the same checks as above for the function name
+							if (std::find(skipLibCalls.begin(), skipLibCalls.end(),
+									indirectF->getName()) != skipLibCalls.end()) {
+								continue;
+							}
+							if ( !(indirectF->hasExternalLinkage() && indirectF->isDeclaration()) ) {
+								if (!isCoarseGrainedFunction(indirectName)) {
 									continue;
 								}
-								if ( !(indirectF->hasExternalLinkage() && indirectF->isDeclaration()) ) {
-									if (!isCoarseGrainedFunction(indirectName)) {
-										continue;
-									}
-								}
-							}
-
-							// see if we've got a bitcast
-							if (cexpr->isCast()) {
-								// TODO
-								errs() << "We have found a bitcast:\n";
-								errs() << "\t" << *calledValue << "\n";
 							}
+						}
 
+						// see if we've got a bitcast
+						if (cexpr->isCast()) {
+							// TODO
+							errs() << "We have found a bitcast:\n";
+							errs() << "\t" << *calledValue << "\n";
 						}
-						// if not, print some kind of warning message
-						else {
-							if (warnValueLater.find(calledValue) == warnValueLater.end()) {
-								if (verboseFlag) {
-									errs() << warn_string << " unidentified indirect function call is being added to the clone list:\n";
-									errs() << *calledValue << "\n";
-								}
-								warnValueLater.insert(calledValue);
+
+					}
+					// if not, print some kind of warning message
+					else {
+						if (warnValueLater.find(calledValue) == warnValueLater.end()) {
+							if (verboseFlag) {
+								errs() << warn_string << " unidentified indirect function call is being added to the clone list:\n";
+								errs() << *calledValue << "\n";
 							}
+							warnValueLater.insert(calledValue);
 						}
-
 					}
 
 				}
 
-				// We don't clone terminators
-				// Invoke is "designed to operate as a standard call instruction in most regards" - don't clone
-				if (I.isTerminator() || isa<InvokeInst>(I)) {
-					// we do need to clone the invokes if the function they call is marked as coarse-grained
-					if (InvokeInst* invInst = dyn_cast<InvokeInst>(&I)) {
-						if (isCoarseGrainedFunction(invInst->getCalledFunction()->getName())) {
-							;	// add it to the list
-						} else {
-							continue;
-						}
+			}
+
+			// We don't clone terminators
+			// Invoke is "designed to operate as a standard call instruction in most regards" - don't clone
+			if (I.isTerminator() || isa<InvokeInst>(I)) {
+				// we do need to clone the invokes if the function they call is marked as coarse-grained
+				if (InvokeInst* invInst = dyn_cast<InvokeInst>(&I)) {
+					if (isCoarseGrainedFunction(invInst->getCalledFunction()->getName())) {
+						;	// add it to the list
 					} else {
 						continue;
 					}
+				} else {
+					continue;
 				}
+			}
 
-				// Don't clone stores to external globals - assumed to be devices
-				if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
-					if (GlobalVariable* GV = dyn_cast<GlobalVariable>(SI->getPointerOperand())) {
-						assert(GV && "GV?");
-						if (GV->hasExternalLinkage() && !(GV->hasInitializer())) {
-							continue;
-						}
+			// Don't clone stores to external globals - assumed to be devices
+			if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+				if (GlobalVariable* GV = dyn_cast<GlobalVariable>(SI->getPointerOperand())) {
+					assert(GV && "GV?");
+					if (GV->hasExternalLinkage() && !(GV->hasInitializer())) {
+						continue;
 					}
 				}
+			}
 
-				// don't clone landingpad instructions; there can only be one at the head of a basic block
-				if (isa<LandingPadInst>(&I)) {
-					continue;
-				}
-
-				instsToClone.insert(&I);
+			// don't clone landingpad instructions; there can only be one at the head of a basic block
+			if (isa<LandingPadInst>(&I)) {
+				continue;
 			}
+
+			instsToClone.insert(&I);
 		}
 	}
+}
 
-	for (GlobalVariable & g : M.getGlobalList()) {
-		StringRef globalName = g.getName();
+/*
+ * Removes the instructions in F from instsToClone, for when F is being replaced.
+ */
+void dataflowProtection::forgetInstsToClone(Function* F) {
+	for (auto & bb : *F) {
+		for (auto & I : bb) {
+			instsToClone.erase(&I);
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Vulnerability ranking
+//----------------------------------------------------------------------------//
+/*
+ * How much of a fault in operand opNum of user is expected to make it through
+ *  to the result of user.  Outputs of the function (stores, returns, calls and
+ *  control flow) pass everything through, since they are where corrupted data
+ *  becomes visible.
+ */
+static double faultPropagation(Instruction* user, unsigned opNum) {
+	if (isa<DbgInfoIntrinsic>(user)) {
+		return 0.0;
+	}
+	if (IntrinsicInst* II = dyn_cast<IntrinsicInst>(user)) {
+		if ((II->getIntrinsicID() == Intrinsic::lifetime_start) ||
+				(II->getIntrinsicID() == Intrinsic::lifetime_end)) {
+			return 0.0;
+		}
+	}
+
+	if (BinaryOperator* BO = dyn_cast<BinaryOperator>(user)) {
+		unsigned bits = BO->getType()->getScalarSizeInBits();
+		ConstantInt* other = dyn_cast<ConstantInt>(BO->getOperand(1 - opNum));
+		if (!bits || !other) {
+			return 1.0;
+		}
+		double ones = other->getValue().countPopulation();
+		switch (BO->getOpcode()) {
+			// only the bits that get through the mask matter
+			case Instruction::And:
+				return ones / bits;
+			case Instruction::Or:
+				return (bits - ones) / bits;
+			// bits shifted out are lost
+			case Instruction::Shl:
+			case Instruction::LShr:
+			case Instruction::AShr:
+				if (opNum == 0) {
+					return (bits - std::min<uint64_t>(other->getLimitedValue(), bits)) / (double)bits;
+				}
+				return 1.0;
+			default:
+				return 1.0;
+		}
+	} else if (isa<CmpInst>(user)) {
+		// most faults don't change which way a comparison goes
+		return compareVulnerabilityOpt;
+	} else if (SelectInst* SI = dyn_cast<SelectInst>(user)) {
+		// only one of the values is chosen
+		return (opNum == 0) ? 1.0 : (double)compareVulnerabilityOpt;
+	} else if (TruncInst* TI = dyn_cast<TruncInst>(user)) {
+		return (double)TI->getDestTy()->getScalarSizeInBits() / TI->getSrcTy()->getScalarSizeInBits();
+	}
+	return 1.0;
+}
+
+/*
+ * Gives each instruction in F a score between 0 and 1 for how likely a fault in it
+ *  is to reach an output (stores, returns, calls, branches).  The score of an
+ *  instruction is the best score of any path through its users, reduced by how
+ *  much of the fault each user masks.  Values with no users score 0.
+ * Scores only go up, and a loop through PHI nodes can't raise them past the best
+ *  path without the loop, so the worklist always runs dry.
+ */
+void dataflowProtection::rankInstVulnerability(Function* F, std::map<Instruction*, double>& scores) {
+	// users come before the values they use, so most scores are right the first time
+	std::deque<Instruction*> worklist;
+	std::set<Instruction*> inWorklist;
+	for (auto& bb : *F) {
+		for (auto& I : bb) {
+			worklist.push_front(&I);
+			inWorklist.insert(&I);
+			scores[&I] = 0.0;
+		}
+	}
 
-		if (globalName.startswith("llvm")) {
-//			errs() << "WARNING: not duplicating global value " << g.getName() << ", assuming it is llvm-created\n";
+	while (!worklist.empty()) {
+		Instruction* I = worklist.front();
+		worklist.pop_front();
+		inWorklist.erase(I);
+
+		double best = 0.0;
+		for (auto& U : I->uses()) {
+			Instruction* user = dyn_cast<Instruction>(U.getUser());
+			if (!user) {
+				continue;
+			}
+			double userScore;
+			if (isa<StoreInst>(user) || isa<CallInst>(user) || isa<InvokeInst>(user) ||
+					user->isTerminator()) {
+				userScore = 1.0;
+			} else {
+				auto found = scores.find(user);
+				userScore = (found != scores.end()) ? found->second : 1.0;
+			}
+			best = std::max(best, userScore * faultPropagation(user, U.getOperandNo()));
+		}
+		if (best <= scores[I]) {
 			continue;
 		}
+		scores[I] = best;
 
-		// Don't clone ISR function pointers
-		if (g.getType()->isPointerTy() && g.getNumOperands() == 1) {
-			auto gVal = g.getOperand(0);
-			if (auto gFuncVal = dyn_cast<Function>(gVal)) {
-				if (isISR(*gFuncVal)) {
-					continue;
-				}
+		// the values this one uses might be more vulnerable now
+		for (auto& op : I->operands()) {
+			Instruction* opInst = dyn_cast<Instruction>(op);
+			if (opInst && (opInst->getFunction() == F) && !inWorklist.count(opInst)) {
+				worklist.push_back(opInst);
+				inWorklist.insert(opInst);
 			}
 		}
+	}
+}
 
-		// Externally available globals without initializer -> external global
-		if (g.hasExternalLinkage() && !g.hasInitializer())
-			continue;
+/*
+ * With -replicateFraction or -vulnerabilityThreshold, the arithmetic that is least
+ *  likely to cause silent data corruption is left out of the Scope of Replication
+ *  (added to instsToSkip).  The replicas then share the one copy of the value.
+ * Only side effect free scalar arithmetic, comparisons, casts and selects are
+ *  considered; memory accesses, calls, PHI nodes, pointers and vectors are always
+ *  replicated so that the copies of memory stay consistent.
+ */
+void dataflowProtection::skipLowVulnerabilityInsts(Module& M) {
+	if ((replicateFractionOpt >= 1.0) && (vulnerabilityThresholdOpt <= 0.0)) {
+		return;
+	}
 
-		if (globalsToSkip.find(&g) != globalsToSkip.end()) {
-//			errs() << "WARNING: not duplicating global variable " << g.getName() << "\n";
+	std::vector<std::pair<double, Instruction*> > ranked;
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration() || isCoarseGrainedFunction(F->getName())) {
 			continue;
 		}
 
-		if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g.getName().str()) != ignoreGlbl.end()) {
-			continue;
+		std::map<Instruction*, double> scores;
+		rankInstVulnerability(F, scores);
+		for (auto& bb : *F) {
+			for (auto& I : bb) {
+				if (!(isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<CastInst>(I) || isa<SelectInst>(I))) {
+					continue;
+				}
+				// the copies of pointers and vectors have to be different, see verifyCloningSuccess()
+				if (I.getType()->isPointerTy() || I.getType()->isVectorTy() ||
+						(isa<CastInst>(I) && I.getOperand(0)->getType()->isPtrOrPtrVectorTy())) {
+					continue;
+				}
+				// the user asked for these
+				if (instsToCloneAnno.find(&I) != instsToCloneAnno.end()) {
+					continue;
+				}
+				ranked.push_back(std::make_pair(scores[&I], &I));
+			}
 		}
+	}
 
-		if (xMR_default) {
-			globalsToClone.insert(&g);
+	// most vulnerable first
+	std::stable_sort(ranked.begin(), ranked.end(),
+		[](const std::pair<double, Instruction*>& a, const std::pair<double, Instruction*>& b) {
+			return a.first > b.first;
+	});
+
+	size_t numToKeep = (size_t)std::ceil(std::max(0.0, (double)replicateFractionOpt) * ranked.size());
+	size_t numSkipped = 0;
+	for (size_t i = 0; i < ranked.size(); i++) {
+		if ((i >= numToKeep) || (ranked[i].first < vulnerabilityThresholdOpt)) {
+			instsToSkip.insert(ranked[i].second);
+			numSkipped++;
 		}
 	}
+	NumInstsNotReplicated += numSkipped;
 
+	if (verboseFlag) {
+		errs() << info_string << " Not replicating " << numSkipped << " of " << ranked.size()
+			   << " arithmetic instructions with low vulnerability\n";
+	}
 }
 
 
@@ -422,9 +656,11 @@ void dataflowProtection::populateFnWorklist(Module& M) {
 	}
 
 	// Make sure coarse grained functions aren't modified
-	for (auto it : fnsToClone) {
-		if (isCoarseGrainedFunction(it->getName())) {
-			fnsToClone.erase(it);
+	for (auto it = fnsToClone.begin(); it != fnsToClone.end(); ) {
+		if (isCoarseGrainedFunction((*it)->getName())) {
+			it = fnsToClone.erase(it);
+		} else {
+			++it;
 		}
 	}
 
@@ -752,14 +988,14 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 				argItNew->setName(argIt->getName() + "_DWC");
 				Value* v1 = &*argItNew;
 
-				Value* v2;
+				Value* v2 = nullptr;
 				if (TMR) {
 					argItNew++;
 					argItNew->setName(argIt->getName() + "_TMR");
 					v2 = &*argItNew;
 				}
 
-				cloneMap[argNew] = ValuePair(v1,v2);
+				cloneRegistry.insert(argNew, {v1, v2});
 			}
 			argIt++;
 			argItNew++;
@@ -778,6 +1014,7 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 		origFunctions.push_back(F);
 		fnsToClone.insert(Fnew);
 		fnsToClone.erase(F);
+		NumFnsResigned++;
 //		errs() << "\nReplacing " << F->getName() << " with " << Fnew->getName() << "\n";
 
 		// if there's an entry already for this, it's from cloneFunctionReturnVals
@@ -800,8 +1037,10 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 		 *  so nothing in the new function was listed in instsToClone.
 		 * This led to the pass refusing to replace the cloned arguments in calls when
 		 *  the call lived in a new function, because none of the insts in it were in instsToClone.
+		 * Only this function changed, so there's no need to look through the whole module again.
 		 */
-		populateValuesToClone(M);
+		forgetInstsToClone(F);
+		populateInstsToClone(Fnew);
 		// there are also some special lists that may need to be updated
 		updateInstLists(F, Fnew);
 
@@ -1122,7 +1361,7 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
  * NOTE: should we do anything differently based on the calling convention?
  *
  * The reason this is called before cloneInsns() is because we want the functions to
- *  exist so that the clones will actually be in the cloneMap for later.
+ *  exist so that the clones will actually be in the clone registry for later.
  * There is another function that will finish up the functionality for this.
  */
 void dataflowProtection::cloneFunctionReturnVals(Module& M) {
@@ -1187,11 +1426,11 @@ void dataflowProtection::cloneFunctionReturnVals(Module& M) {
 
 			// see if it's in the clone map
 			if (isCloned(arg)) {
-				Value *v1, *v2;
+				Value *v1, *v2 = nullptr;
 				v1 = &*(argItNew + 1);
 				if (TMR)
 					v2 = &*(argItNew + 2);
-				cloneMap[argNew] = ValuePair(v1, v2);
+				cloneRegistry.insert(argNew, {v1, v2});
 			}
 
 			argIt++;
@@ -1217,6 +1456,7 @@ void dataflowProtection::cloneFunctionReturnVals(Module& M) {
 
 		// record these things
 		fnsToClone.insert(newFunc);
+		NumFnsResigned++;
 		if (verboseFlag) {
 			errs() << info_string << " Created new function named '"
 				   << newFunc->getName() << "'\n";
@@ -1314,7 +1554,7 @@ void dataflowProtection::updateRRFuncs(Module& M) {
 				loadRet,			/* pointer where to store */
 				ret					/* InsertBefore */
 			);
-			StoreInst* storeRet2;
+			StoreInst* storeRet2 = nullptr;
 			if (TMR) {
 				LoadInst* loadRet2 = new LoadInst(alloc2, "loadRet2", ret);
 				storeRet2 = new StoreInst(
@@ -1328,7 +1568,7 @@ void dataflowProtection::updateRRFuncs(Module& M) {
 			//  so segmenting works
 			auto retIt = startOfSyncLogic.find(ret);
 			if (retIt == startOfSyncLogic.end()) {
-				syncPoints.push_back(ret);
+				syncPoints.insert(ret);
 				// if not specific spot already, make it the load
 				startOfSyncLogic[ret] = loadRet;
 			} else if (retIt->second == ret) {
@@ -1336,7 +1576,7 @@ void dataflowProtection::updateRRFuncs(Module& M) {
 			}
 
 			// also register as clones
-			cloneMap[ret] = ValuePair(storeRet, storeRet2);
+			cloneRegistry.insert(ret, {storeRet, storeRet2});
 			// PRINT_VALUE(storeRet);
 			// if (ret->getParent()->getName() == "prvInitialiseMutex.exit")
 			// 	PRINT_VALUE(ret->getParent());
@@ -1490,14 +1730,14 @@ void dataflowProtection::updateRRFuncs(Module& M) {
 				LoadInst* loadRet1 = new LoadInst(
 						callAlloca1, newInst->getName() + ".DWC");
 				loadRet1->insertAfter(newInst);
-				LoadInst* loadRet2;
+				LoadInst* loadRet2 = nullptr;
 				if (TMR) {
 					loadRet2 = new LoadInst(
 							callAlloca2, newInst->getName() + ".TMR");
 					loadRet2->insertAfter(loadRet1);
 				}
 				// register them as clones
-				cloneMap[newInst] = ValuePair(loadRet1, loadRet2);
+				cloneRegistry.insert(newInst, {loadRet1, loadRet2});
 				
 				// PRINT_VALUE(loadRet1);
 
@@ -1904,7 +2144,7 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 		if (isCloned(_op)) {
 //						errs() << *_op << "\n";
 			ConstantExpr* ce1 = dyn_cast<ConstantExpr>(clone.first->getOperand(i));
-			Value* _op1 = cloneMap[_op].first;
+			Value* _op1 = cloneRegistry.getReplica(_op, 0);
 			assert(_op1 && "valid clone");
 //						errs() << *_op1 << "\n";
 			Constant* _nop1 = dyn_cast<Constant>(_op1);
@@ -1913,7 +2153,7 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 			clone.first->setOperand(i, nce1);
 			if (TMR) {
 				ConstantExpr* ce2 = dyn_cast<ConstantExpr>(clone.second->getOperand(i));
-				Value* _op2 = cloneMap[_op].second;
+				Value* _op2 = cloneRegistry.getReplica(_op, 1);
 				assert(_op2 && "valid second clone");
 				Constant* _nop2 = dyn_cast<Constant>(_op2);
 				Constant* nce2 = ce2->getWithOperandReplaced(0, _nop2);
@@ -1936,7 +2176,7 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 			// have to check if it's been cloned
 			if (isCloned(GEPvalOrig)) {
 				// get the clone
-				Value* GEPvalClone1 = cloneMap[GEPvalOrig].first;
+				Value* GEPvalClone1 = cloneRegistry.getReplica(GEPvalOrig, 0);
 				assert(GEPvalClone1 && "valid clone");
 
 				// replace uses
@@ -1951,7 +2191,7 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 				if (TMR) {
 					ConstantExpr* ce2 = dyn_cast<ConstantExpr>(clone.second->getOperand(i));
 					ConstantExpr* innerGEPclone2 = dyn_cast<ConstantExpr>(ce2->getOperand(0));
-					Value* GEPvalClone2 = cloneMap[GEPvalOrig].second;
+					Value* GEPvalClone2 = cloneRegistry.getReplica(GEPvalOrig, 1);
 					assert(GEPvalClone2 && "valid second clone");
 					Constant* newGEPclone2 = innerGEPclone2->getWithOperandReplaced(
 							0, dyn_cast<Constant>(GEPvalClone2));
@@ -1975,19 +2215,18 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 	}
 
 	/*
-	 * Error checking here for things missing in the cloneMap.
-	 * If this is NULL, then that means we just inserted the operand
-	 *  into the map, and therefore it wasn't in there before.
+	 * Error checking here for things missing in the clone registry.
+	 * If this is NULL, then the operand wasn't registered as cloned.
 	 *
 	 * Trying to dereference 0 is a bad idea
 	 * How did this get in the list, but not in the map?
 	 */
-	Value* v_temp = cloneMap[ce->getOperand(0)].first;
+	Value* v_temp = cloneRegistry.getReplica(ce->getOperand(0), 0);
 	if (v_temp == nullptr) {
 		errs() << err_string << " in cloneInsns!\n";
 		errs() << *ce << "\n";
 	}
-	assert(v_temp && "ConstantExpr is in cloneMap");
+	assert(v_temp && "ConstantExpr is in clone registry");
 
 	Constant* newOp1 = dyn_cast<Constant>(v_temp);
 	assert(newOp1 && "Null Constant newOp1");
@@ -1997,7 +2236,7 @@ void dataflowProtection::cloneConstantExprOperands(ConstantExpr* ce, Instruction
 	clone.first->setOperand(i, eNew1);
 
 	if (TMR) {
-		Constant* newOp2 = dyn_cast<Constant>(cloneMap[ce->getOperand(0)].second);
+		Constant* newOp2 = dyn_cast<Constant>(cloneRegistry.getReplica(ce->getOperand(0), 1));
 		assert(newOp2 && "Null Constant newOp2");
 		Constant* c2 = ce->getWithOperandReplaced(0, newOp2);
 		ConstantExpr* eNew2 = dyn_cast<ConstantExpr>(c2);
@@ -2041,7 +2280,7 @@ void dataflowProtection::cloneConstantVectorOperands(ConstantVector* constVec, I
 
 				if (isCloned(_op)) {
 //					errs() << *_op << "\n";
-					Value* _op1 = cloneMap[_op].first;
+					Value* _op1 = cloneRegistry.getReplica(_op, 0);
 					assert(_op1 && "valid clone");
 					Constant* _nop1 = dyn_cast<Constant>(_op1);
 //					errs() << *_nop1 << "\n";
@@ -2062,7 +2301,7 @@ void dataflowProtection::cloneConstantVectorOperands(ConstantVector* constVec, I
 //					errs() << *constVec_clone << "\n";
 
 					if (TMR) {
-						Value* _op2 = cloneMap[_op].second;
+						Value* _op2 = cloneRegistry.getReplica(_op, 1);
 						assert(_op2 && "valid clone");
 						Constant* _nop2 = dyn_cast<Constant>(_op2);
 
@@ -2114,7 +2353,7 @@ bool dataflowProtection::cloneInsns() {
 	// Populate the clone list
 	for (auto I : instsToClone) {
 		Instruction* newI1;
-		Instruction* newI2;
+		Instruction* newI2 = nullptr;
 		if (InvokeInst* invInst = dyn_cast<InvokeInst>(I) ) {
 			if (invInst->getCalledFunction()->getReturnType()->isVoidTy()) {
 				continue;
@@ -2205,7 +2444,8 @@ bool dataflowProtection::cloneInsns() {
 		}
 
 		instsCloned.push_back(std::make_pair(newI1, newI2));
-		cloneMap[I] = ValuePair(newI1, newI2);
+		cloneRegistry.insert(I, {newI1, newI2});
+		NumInstsCloned++;
 	}
 
 	// Iterate over the clone list and change references
@@ -2254,9 +2494,9 @@ bool dataflowProtection::cloneInsns() {
 							clone.second->setOperand(i, op);
 						}
 					} else { 								// Else update as normal
-						clone.first->setOperand(i, cloneMap[op].first);
+						clone.first->setOperand(i, cloneRegistry.getReplica(op, 0));
 						if (TMR) {
-							clone.second->setOperand(i, cloneMap[op].second);
+							clone.second->setOperand(i, cloneRegistry.getReplica(op, 1));
 						}
 					}
 				} else { 									// Replicating memory
@@ -2266,9 +2506,9 @@ bool dataflowProtection::cloneInsns() {
 					}
 					// otherwise, it's simple to handle
 					else {
-						clone.first->setOperand(i, cloneMap[op].first);
+						clone.first->setOperand(i, cloneRegistry.getReplica(op, 0));
 						if (TMR) {
-							clone.second->setOperand(i, cloneMap[op].second);
+							clone.second->setOperand(i, cloneRegistry.getReplica(op, 1));
 						}
 					}
 				}
@@ -2309,8 +2549,7 @@ void dataflowProtection::verifyCloningSuccess() {
 		 * Sanity check: are any of the operands of the clones
 		 *  equal to the operands of the original?
 		 */
-		for (auto entry : cloneMap) {
-			Value* v0 = entry.first;
+		for (auto v0 : cloneRegistry.getOriginals()) {
 			if (Instruction* i0 = dyn_cast<Instruction>(v0)) {
 
 				// Exception: comes from a single function call
@@ -2330,7 +2569,7 @@ void dataflowProtection::verifyCloningSuccess() {
 					}
 				}
 
-				Instruction* i1 = dyn_cast<Instruction>(entry.second.first);
+				Instruction* i1 = dyn_cast<Instruction>(cloneRegistry.getReplica(v0, 0));
 
 				// Iterate over the operands in the instruction
 				for (unsigned i = 0; i < i0->getNumOperands(); i++) {
@@ -2392,7 +2631,7 @@ void dataflowProtection::cloneConstantExpr() {
 			ConstantExpr* e1 = dyn_cast<ConstantExpr>(c1);
 			assert(e1);
 
-			ConstantExpr* e2;
+			ConstantExpr* e2 = nullptr;
 			if (TMR) {
 				Constant* constantOp2 = dyn_cast<Constant>(clones.second);
 				assert(constantOp2);
@@ -2402,7 +2641,7 @@ void dataflowProtection::cloneConstantExpr() {
 			}
 
 			// assert(eNew->isGEPWithNoNotionalOverIndexing());
-			cloneMap[e] = ValuePair(e1, e2);
+			cloneRegistry.insert(e, {e1, e2});
 		} else {
 //			TODO: what could cause this to fail?
 			assert(false && "Constant expr to clone not matching expected form");
@@ -2416,8 +2655,12 @@ void dataflowProtection::cloneConstantExpr() {
 //----------------------------------------------------------------------------//
 void dataflowProtection::cloneGlobals(Module & M) {
 
-	if (noMemReplicationFlag)
+	if (noMemReplicationFlag) {
+		// nothing is shared, but the application may still call __COAST_checkConstGlobals()
+		if (checkConstGlobalsFlag)
+			shareConstGlobals(M, {});
 		return;
+	}
 
 	if (verboseFlag) {
 		for (auto g : globalsToClone) {
@@ -2432,6 +2675,7 @@ void dataflowProtection::cloneGlobals(Module & M) {
 		}
 	}
 
+	std::vector<GlobalVariable*> sharedConstGlobals;
 	for (auto g : globalsToClone) {
 		// Skip specified globals
 		if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g->getName().str()) != ignoreGlbl.end()) {
@@ -2439,14 +2683,35 @@ void dataflowProtection::cloneGlobals(Module & M) {
 			continue;
 		}
 
+		// one copy, with parity, see insertParityChecks()
+		if (std::find(parityGlbl.begin(), parityGlbl.end(), g->getName().str()) != parityGlbl.end()) {
+			parityGlobals.insert(g);
+		}
+		if (parityGlobals.find(g) != parityGlobals.end()) {
+			if (canProtectWithParity(g)) {
+				if (verboseFlag) errs() << "Protecting " << g->getName() << " with parity\n";
+				continue;
+			}
+			errs() << warn_string << " can't protect global '" << g->getName() << "' with parity, replicating it instead\n";
+			parityGlobals.erase(g);
+		}
+
+		// the program can't write to these, so one copy is enough
+		if ((noConstReplicationFlag || checkConstGlobalsFlag) && canShareConstGlobal(g)) {
+			if (verboseFlag) errs() << "Not replicating constant " << g->getName() << "\n";
+			sharedConstGlobals.push_back(g);
+			continue;
+		}
+
 		GlobalVariable* gNew = copyGlobal(M, g, g->getName().str() + "_DWC");
 
-		GlobalVariable* gNew2;
+		GlobalVariable* gNew2 = nullptr;
 		if (TMR) {
 			gNew2 = copyGlobal(M, g, g->getName().str() + "_TMR");
 		}
 
-		cloneMap[g] = ValuePair(gNew, gNew2);
+		cloneRegistry.insert(g, {gNew, gNew2});
+		NumGlobalsCloned++;
 		/*
 		 * One thing that's slightly annoying, is the ordering that these globals
 		 *  end up in.  The constructor for GlobalVariable requires a parameter
@@ -2459,6 +2724,13 @@ void dataflowProtection::cloneGlobals(Module & M) {
 		 */
 	}
 
+	// the code that uses them shouldn't look for their copies
+	for (auto g : sharedConstGlobals)
+		globalsToClone.erase(g);
+
+	// always done, so __COAST_checkConstGlobals() exists even if nothing is shared
+	if (noConstReplicationFlag || checkConstGlobalsFlag)
+		shareConstGlobals(M, sharedConstGlobals);
 }
 
 /*
@@ -2539,6 +2811,7 @@ GlobalVariable * dataflowProtection::copyGlobal(Module & M, GlobalVariable* copy
 
 /*
  * For all globals that need to be initialized at runtime, insert memcpy calls at the start of main
+ * With -fuseMemOps and TMR, a single loop reads the original once and writes both copies.
  */
 void dataflowProtection::addGlobalRuntimeInit(Module & M) {
 	for (auto g : globalsToRuntimeInit) {
@@ -2557,10 +2830,27 @@ void dataflowProtection::addGlobalRuntimeInit(Module & M) {
 		Function * fun = Intrinsic::getDeclaration(&M, Intrinsic::memcpy, arg_type);
 		IRBuilder<> Builder(&(*(M.getFunction("main")->begin()->begin())));
 
+		if (TMR && (fuseMemOpsOpt != FuseNone)) {
+			uint64_t size = getArrayTypeSize(M, arrayType);
+			unsigned width = 8;
+			while (width > 1 && (width > g->getAlignment() || size % width != 0))
+				width /= 2;
+
+			Type* i64 = Type::getInt64Ty(M.getContext());
+			Function* fusedFn = getFusedMemFunction(M, false, 2, 1, width, false, i64);
+			Builder.CreateCall(fusedFn, {
+				ConstantExpr::getBitCast(cast<Constant>(cloneRegistry.getReplica(g, 0)), Type::getInt8PtrTy(M.getContext())),
+				ConstantExpr::getBitCast(cast<Constant>(cloneRegistry.getReplica(g, 1)), Type::getInt8PtrTy(M.getContext())),
+				ConstantExpr::getBitCast(cast<Constant>(g), Type::getInt8PtrTy(M.getContext())),
+				ConstantInt::get(i64, size)
+			});
+			continue;
+		}
+
 		std::vector<Value *> args_v;
 
 		// 1st argument is destination pointer (cast to i8*)
-		args_v.push_back(ConstantExpr::getBitCast(cast<Constant>(cloneMap[g].first), Type::getInt8PtrTy(M.getContext())));
+		args_v.push_back(ConstantExpr::getBitCast(cast<Constant>(cloneRegistry.getReplica(g, 0)), Type::getInt8PtrTy(M.getContext())));
 
 		// 2nd argument is source pointer (cast to i8*)
 		args_v.push_back(ConstantExpr::getBitCast(cast<Constant>(g), Type::getInt8PtrTy(M.getContext())));
@@ -2579,7 +2869,7 @@ void dataflowProtection::addGlobalRuntimeInit(Module & M) {
 		Builder.CreateCall(fun, args);
 
 		if (TMR) {
-			args_v[0] = ConstantExpr::getBitCast(cast<Constant>(cloneMap[g].second), Type::getInt8PtrTy(M.getContext()));
+			args_v[0] = ConstantExpr::getBitCast(cast<Constant>(cloneRegistry.getReplica(g, 1)), Type::getInt8PtrTy(M.getContext()));
 			args = ArrayRef<Value*>(args_v);
 			Builder.CreateCall(fun, args);
 		}
@@ -2588,6 +2878,655 @@ void dataflowProtection::addGlobalRuntimeInit(Module & M) {
 }
 
 
+//----------------------------------------------------------------------------//
+// Single copy constant globals
+//----------------------------------------------------------------------------//
+/*
+ * With -noConstReplication, constant globals (like lookup tables) are not
+ *  replicated, since the program never writes to them.  All of the copies of
+ *  the code read from the same one.
+ * With -checkConstGlobals, each of these is also split into blocks, and the
+ *  checksum of each block is stored alongside it.  COAST creates a function
+ *      unsigned int __COAST_checkConstGlobals(void)
+ *  that recomputes all of the checksums and returns how many blocks don't match.
+ *  The application is expected to call it from a background task.
+ */
+
+// how many bytes each checksum covers
+#define CONST_CHECKSUM_BLOCK_SIZE 256
+
+// Globals are only shared if they can't point to anything that is replicated
+static bool containsPointer(Type* t) {
+	if (t->isPointerTy())
+		return true;
+	for (Type* sub : t->subtypes()) {
+		if (containsPointer(sub))
+			return true;
+	}
+	return false;
+}
+
+bool dataflowProtection::canShareConstGlobal(GlobalVariable* g) {
+	if (!g->isConstant() || !g->hasInitializer())
+		return false;
+	// these are filled in at runtime
+	if (globalsToRuntimeInit.find(g) != globalsToRuntimeInit.end())
+		return false;
+	return !containsPointer(g->getValueType());
+}
+
+/*
+ * Flattens the initializer of a (possibly nested) array of integers or floating
+ *  point numbers into the bit patterns of its elements.
+ * Returns the scalar element type, or nullptr for anything else, like structs,
+ *  since they can have padding that the checksum can't see.
+ */
+static Type* flattenConstArray(Constant* init, std::vector<uint64_t>& elements) {
+	Type* t = init->getType();
+	// the checksum only looks at 64 bits at a time
+	if (t->isSingleValueType() && t->getPrimitiveSizeInBits() > 64)
+		return nullptr;
+	if (ConstantInt* CI = dyn_cast<ConstantInt>(init)) {
+		elements.push_back(CI->getZExtValue());
+		return t;
+	} else if (ConstantFP* CF = dyn_cast<ConstantFP>(init)) {
+		elements.push_back(CF->getValueAPF().bitcastToAPInt().getZExtValue());
+		return t;
+	} else if (!t->isArrayTy()) {
+		return nullptr;
+	}
+
+	Type* scalarType = nullptr;
+	for (uint64_t i = 0; i < t->getArrayNumElements(); i++) {
+		Constant* elem = init->getAggregateElement(i);
+		if (!elem)
+			return nullptr;
+		scalarType = flattenConstArray(elem, elements);
+		if (!scalarType)
+			return nullptr;
+	}
+	return scalarType;
+}
+
+/*
+ * The checksum of a block of elements.  It has to match the code that
+ *  getConstChecksumFunction() creates.
+ */
+static uint32_t constChecksum(ArrayRef<uint64_t> elements) {
+	uint32_t sum = 0;
+	for (uint64_t e : elements) {
+		sum = ((sum << 5) | (sum >> 27)) ^ (uint32_t)(e ^ (e >> 32));
+	}
+	return sum;
+}
+
+void dataflowProtection::shareConstGlobals(Module& M, ArrayRef<GlobalVariable*> sharedGlobals) {
+	const DataLayout& DL = M.getDataLayout();
+	uint64_t bytesSaved = 0;
+	for (auto g : sharedGlobals) {
+		bytesSaved += DL.getTypeAllocSize(g->getValueType()) * (TMR ? 2 : 1);
+	}
+	NumConstGlobalsShared += sharedGlobals.size();
+	NumConstBytesSaved += bytesSaved;
+	if (verboseFlag) {
+		errs() << info_string << " Keeping a single copy of " << sharedGlobals.size()
+			   << " constant globals, saving " << bytesSaved << " bytes\n";
+	}
+
+	if (!checkConstGlobalsFlag)
+		return;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+
+	std::string checkName = "__COAST_checkConstGlobals";
+	Function* checkFn = M.getFunction(checkName);
+	if (checkFn && !checkFn->isDeclaration()) {
+		errs() << warn_string << " " << checkName << " is already defined, constant globals won't be checked\n";
+		return;
+	} else if (!checkFn) {
+		checkFn = Function::Create(FunctionType::get(i32, false), GlobalValue::ExternalLinkage, checkName, &M);
+	}
+	// the application is the one that calls it
+	usedFunctions.insert(checkFn);
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", checkFn);
+	IRBuilder<> builder(entryBB);
+	Value* numBad = ConstantInt::get(i32, 0);
+	uint64_t checksumBytes = 0;
+
+	for (auto g : sharedGlobals) {
+		std::vector<uint64_t> elements;
+		Type* elemType = flattenConstArray(g->getInitializer(), elements);
+		if (!elemType || elements.empty()) {
+			if (verboseFlag)
+				errs() << info_string << " No checksum for " << g->getName() << "\n";
+			continue;
+		}
+
+		uint64_t elemSize = DL.getTypeAllocSize(elemType);
+		// the runtime check reads whole elements, so there can't be any padding bits
+		if (DL.getTypeSizeInBits(elemType) != elemSize * 8) {
+			if (verboseFlag)
+				errs() << info_string << " No checksum for " << g->getName() << "\n";
+			continue;
+		}
+		uint64_t perBlock = std::max<uint64_t>(CONST_CHECKSUM_BLOCK_SIZE / elemSize, 1);
+		uint64_t numBlocks = (elements.size() + perBlock - 1) / perBlock;
+
+		std::vector<uint32_t> sums;
+		for (uint64_t b = 0; b < numBlocks; b++) {
+			uint64_t start = b * perBlock;
+			uint64_t len = std::min<uint64_t>(perBlock, elements.size() - start);
+			sums.push_back(constChecksum(ArrayRef<uint64_t>(elements).slice(start, len)));
+		}
+		GlobalVariable* sumTable = new GlobalVariable(M,
+				ArrayType::get(i32, numBlocks), true, GlobalValue::InternalLinkage,
+				ConstantDataArray::get(C, sums), g->getName() + ".cksum");
+		globalsToSkip.insert(sumTable);
+		checksumBytes += numBlocks * 4;
+
+		// loop over the blocks, adding up how many don't match
+		IntegerType* bitsType = IntegerType::get(C, elemSize * 8);
+		Function* sumFn = getConstChecksumFunction(M, bitsType);
+		Value* base = builder.CreateBitCast(g, bitsType->getPointerTo(g->getAddressSpace()));
+
+		BasicBlock* loopBB = BasicBlock::Create(C, g->getName() + ".check", checkFn);
+		BasicBlock* prevBB = builder.GetInsertBlock();
+		builder.CreateBr(loopBB);
+		builder.SetInsertPoint(loopBB);
+		PHINode* block = builder.CreatePHI(i64, 2, "block");
+		PHINode* badSoFar = builder.CreatePHI(i32, 2, "numBad");
+		block->addIncoming(ConstantInt::get(i64, 0), prevBB);
+		badSoFar->addIncoming(numBad, prevBB);
+
+		Value* start = builder.CreateMul(block, ConstantInt::get(i64, perBlock));
+		Value* remaining = builder.CreateSub(ConstantInt::get(i64, elements.size()), start);
+		Value* len = builder.CreateSelect(
+				builder.CreateICmpULT(remaining, ConstantInt::get(i64, perBlock)),
+				remaining, ConstantInt::get(i64, perBlock));
+		Value* sum = builder.CreateCall(sumFn, {builder.CreateGEP(bitsType, base, start), len});
+		Value* expected = builder.CreateLoad(i32, builder.CreateInBoundsGEP(
+				sumTable->getValueType(), sumTable, {ConstantInt::get(i64, 0), block}));
+		Value* bad = builder.CreateZExt(builder.CreateICmpNE(sum, expected), i32);
+		numBad = builder.CreateAdd(badSoFar, bad);
+
+		Value* nextBlock = builder.CreateAdd(block, ConstantInt::get(i64, 1));
+		block->addIncoming(nextBlock, loopBB);
+		badSoFar->addIncoming(numBad, loopBB);
+
+		BasicBlock* nextBB = BasicBlock::Create(C, "", checkFn);
+		builder.CreateCondBr(builder.CreateICmpULT(nextBlock, ConstantInt::get(i64, numBlocks)), loopBB, nextBB);
+		builder.SetInsertPoint(nextBB);
+	}
+	builder.CreateRet(numBad);
+
+	NumConstChecksumBytes += checksumBytes;
+	if (verboseFlag)
+		errs() << info_string << " Added " << checksumBytes << " bytes of checksums for constant globals\n";
+}
+
+/*
+ * Gets (or creates) the function that computes the checksum of n elements of
+ *  the given integer type, the same way constChecksum() does.
+ * The loads are volatile, so they can't be folded into the constant initializer.
+ */
+Function* dataflowProtection::getConstChecksumFunction(Module& M, IntegerType* elemType) {
+	std::string name = "__COAST_constChecksum_i" + std::to_string(elemType->getBitWidth());
+	if (Function* existing = M.getFunction(name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	Function* sumFn = Function::Create(
+			FunctionType::get(i32, {elemType->getPointerTo(), i64}, false),
+			GlobalValue::InternalLinkage, name, &M);
+	sumFn->addFnAttr(Attribute::NoUnwind);
+	Value* ptr = &*sumFn->arg_begin();
+	Value* len = &*std::next(sumFn->arg_begin());
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", sumFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", sumFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", sumFn);
+	IRBuilder<> builder(entryBB);
+	builder.CreateCondBr(builder.CreateICmpEQ(len, ConstantInt::get(i64, 0)), exitBB, loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(i64, 2, "i");
+	PHINode* sum = builder.CreatePHI(i32, 2, "sum");
+	idx->addIncoming(ConstantInt::get(i64, 0), entryBB);
+	sum->addIncoming(ConstantInt::get(i32, 0), entryBB);
+
+	LoadInst* elem = builder.CreateLoad(elemType, builder.CreateGEP(elemType, ptr, idx));
+	elem->setVolatile(true);
+	Value* wide = builder.CreateZExtOrTrunc(elem, i64);
+	Value* folded = builder.CreateTrunc(builder.CreateXor(wide, builder.CreateLShr(wide, 32)), i32);
+	Value* rotated = builder.CreateOr(builder.CreateShl(sum, 5), builder.CreateLShr(sum, 27));
+	Value* nextSum = builder.CreateXor(rotated, folded);
+
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(i64, 1));
+	idx->addIncoming(nextIdx, loopBB);
+	sum->addIncoming(nextSum, loopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, len), loopBB, exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	PHINode* result = builder.CreatePHI(i32, 2, "sum");
+	result->addIncoming(ConstantInt::get(i32, 0), entryBB);
+	result->addIncoming(nextSum, loopBB);
+	builder.CreateRet(result);
+
+	return sumFn;
+}
+
+
+//----------------------------------------------------------------------------//
+// Background scrubbing
+//----------------------------------------------------------------------------//
+/*
+ * The copies of a global are only compared when one of its values reaches a
+ *  sync point, so an upset in data that is rarely read can sit there until
+ *  another one hits a second copy.
+ * With -scrubGlobals, every replicated global is registered with the run-time
+ *  in tests/COAST_scrub.c, with its size and the addresses of its copies.  The
+ *  application calls __COAST_scrub() from an idle hook or a timer, and each
+ *  call compares a bounded part of them, writing back the majority with TMR.
+ * The table is registered by a constructor, so modules without main() work too.
+ */
+static const std::string scrub_prefix = "__COAST_scrub";
+
+/*
+ * Padding bytes aren't copied by the stores to a global, so its copies can
+ *  have different garbage there.  Only globals without any are scrubbed.
+ */
+static bool hasPadding(Type* t, const DataLayout& DL) {
+	if (StructType* ST = dyn_cast<StructType>(t)) {
+		uint64_t fieldBytes = 0;
+		for (Type* field : ST->elements()) {
+			if (hasPadding(field, DL))
+				return true;
+			fieldBytes += DL.getTypeAllocSize(field);
+		}
+		return fieldBytes != DL.getTypeAllocSize(ST);
+	} else if (ArrayType* AT = dyn_cast<ArrayType>(t)) {
+		return hasPadding(AT->getElementType(), DL);
+	} else if (VectorType* VT = dyn_cast<VectorType>(t)) {
+		return DL.getTypeAllocSizeInBits(VT) != DL.getTypeSizeInBits(VT);
+	}
+	return DL.getTypeAllocSizeInBits(t) != DL.getTypeSizeInBits(t);
+}
+
+void dataflowProtection::registerScrubGlobals(Module& M, int numClones) {
+	if (!scrubGlobalsFlag)
+		return;
+	if (noMemReplicationFlag) {
+		errs() << warn_string << " -scrubGlobals needs the globals to be replicated, ignoring it\n";
+		return;
+	}
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	PointerType* i8ptr = Type::getInt8PtrTy(C);
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	// struct { void* copy[3]; uint64_t size; }, copy[2] is null for DWC
+	ArrayType* copiesType = ArrayType::get(i8ptr, 3);
+	StructType* regionType = StructType::get(C, {copiesType, i64});
+
+	// in module order, so the scrubber always goes through them the same way
+	std::vector<Constant*> regions;
+	uint64_t totalBytes = 0;
+	for (GlobalVariable& g : M.globals()) {
+		if (!cloneRegistry.contains(&g))
+			continue;
+		// read only, or each thread has its own
+		if (g.isConstant() || g.isThreadLocal() || !g.getValueType()->isSized())
+			continue;
+		// the copies of a pointer point to the matching copies of what it points to
+		if (containsPointer(g.getValueType()) || hasPadding(g.getValueType(), DL)) {
+			if (verboseFlag)
+				errs() << info_string << " Not scrubbing " << g.getName() << "\n";
+			continue;
+		}
+
+		std::vector<Constant*> copies = {ConstantExpr::getBitCast(&g, i8ptr)};
+		for (unsigned n = 0; n < cloneRegistry.getNumReplicas(&g); n++) {
+			GlobalVariable* copy = dyn_cast_or_null<GlobalVariable>(cloneRegistry.getReplica(&g, n));
+			if (copy)
+				copies.push_back(ConstantExpr::getBitCast(copy, i8ptr));
+		}
+		if (copies.size() != (unsigned)numClones)
+			continue;
+		while (copies.size() < copiesType->getNumElements())
+			copies.push_back(ConstantPointerNull::get(i8ptr));
+
+		uint64_t size = DL.getTypeAllocSize(g.getValueType());
+		totalBytes += size;
+		regions.push_back(ConstantStruct::get(regionType, {
+				ConstantArray::get(copiesType, copies), ConstantInt::get(i64, size)}));
+	}
+	if (regions.empty()) {
+		errs() << info_string << " No replicated globals to scrub\n";
+		return;
+	}
+
+	FunctionType* registerType = FunctionType::get(Type::getVoidTy(C), {i8ptr, i32}, false);
+	Function* registerFn = M.getFunction(scrub_prefix + "_register");
+	if (!registerFn) {
+		registerFn = Function::Create(registerType, GlobalValue::ExternalLinkage, scrub_prefix + "_register", &M);
+	} else if (registerFn->getFunctionType() != registerType) {
+		errs() << warn_string << " " << registerFn->getName() << " has an unexpected type, globals won't be scrubbed\n";
+		return;
+	}
+
+	ArrayType* tableType = ArrayType::get(regionType, regions.size());
+	GlobalVariable* table = new GlobalVariable(M, tableType, true, GlobalValue::InternalLinkage,
+			ConstantArray::get(tableType, regions), scrub_prefix + "Regions");
+
+	Function* initFn = Function::Create(FunctionType::get(Type::getVoidTy(C), false),
+			GlobalValue::InternalLinkage, scrub_prefix + "Init", &M);
+	initFn->addFnAttr(Attribute::NoUnwind);
+	IRBuilder<> builder(BasicBlock::Create(C, "entry", initFn));
+	builder.CreateCall(registerFn, {ConstantExpr::getBitCast(table, i8ptr), ConstantInt::get(i32, regions.size())});
+	builder.CreateRetVoid();
+	appendToGlobalCtors(M, initFn, 65535);
+	usedFunctions.insert(initFn);
+
+	NumGlobalsScrubbed += regions.size();
+	if (verboseFlag)
+		errs() << info_string << " Scrubbing " << regions.size() << " globals, " << totalBytes << " bytes each copy\n";
+}
+
+
+//----------------------------------------------------------------------------//
+// Layout of global copies
+//----------------------------------------------------------------------------//
+/*
+ * Decides where the copies of each global end up in memory, see -globalLayout.
+ * By default the copies are declared right before the original, so they are
+ *  usually next to each other, but that is up to the linker.
+ * "packed" puts the original and its copies in one aggregate, so each element
+ *  of a copy is always a constant distance from the same element in the original.
+ *  Small globals end up in the same cache line.
+ * "separated" moves all of the copies after all of the originals, so a
+ *  multi-bit upset is less likely to hit more than one copy of a variable.
+ * -replicaOffsets needs the packed layout.
+ */
+void dataflowProtection::layoutGlobalCopies(Module& M, int numClones) {
+	GlobalLayout layout = globalLayoutOpt;
+	if (replicaOffsetsFlag) {
+		if (layout == LayoutSeparated)
+			errs() << warn_string << " -replicaOffsets packs the copies of globals together, ignoring -globalLayout=separated\n";
+		layout = LayoutPacked;
+	}
+	if (noMemReplicationFlag || layout == LayoutAdjacent)
+		return;
+
+	// Go in module order so the result doesn't depend on pointer values
+	std::vector<std::vector<GlobalVariable*> > groups;
+	for (GlobalVariable& g : M.globals()) {
+		if (!cloneRegistry.contains(&g))
+			continue;
+
+		std::vector<GlobalVariable*> copies = {&g};
+		for (unsigned n = 0; n < cloneRegistry.getNumReplicas(&g); n++) {
+			GlobalVariable* copy = dyn_cast_or_null<GlobalVariable>(cloneRegistry.getReplica(&g, n));
+			if (copy)
+				copies.push_back(copy);
+		}
+		// all of the copies have to still be there
+		if (copies.size() == (unsigned)numClones)
+			groups.push_back(copies);
+	}
+
+	if (layout == LayoutSeparated) {
+		// all of the first copies, then all of the second copies
+		for (int n = 1; n < numClones; n++) {
+			for (auto& copies : groups) {
+				copies[n]->removeFromParent();
+				M.getGlobalList().push_back(copies[n]);
+			}
+		}
+		return;
+	}
+
+	for (auto& copies : groups) {
+		if (!canPackGlobal(copies[0])) {
+			if (verboseFlag)
+				errs() << info_string << " Not packing global " << copies[0]->getName() << "\n";
+			continue;
+		}
+		packGlobalCopies(M, copies);
+	}
+
+	if (replicaOffsetsFlag)
+		foldReplicaAddresses();
+}
+
+/*
+ * Packing turns the global into an alias, which only works for globals
+ *  that are defined here and can be placed anywhere.
+ */
+bool dataflowProtection::canPackGlobal(GlobalVariable* g) {
+	if (!g->hasInitializer() || g->isThreadLocal() || g->isExternallyInitialized())
+		return false;
+	// the linker script may depend on these
+	if (g->hasSection() || g->hasComdat())
+		return false;
+	// aliases can't have common or weak linkage
+	if (!g->hasExternalLinkage() && !g->hasLocalLinkage())
+		return false;
+	return g->getValueType()->isSized();
+}
+
+/*
+ * Creates a single global with one field for each of the copies, and replaces
+ *  each copy with an alias to its field, so all of the names and uses stay the same.
+ * Each copy is padded out to the alignment of the original, because code may
+ *  have been vectorized assuming that alignment.
+ */
+void dataflowProtection::packGlobalCopies(Module& M, ArrayRef<GlobalVariable*> copies) {
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	GlobalVariable* g = copies[0];
+	Type* valueType = g->getValueType();
+
+	uint64_t size = DL.getTypeAllocSize(valueType);
+	uint64_t align = std::max<uint64_t>(g->getAlignment(), 1);
+	uint64_t padding = (align - size % align) % align;
+
+	// each copy is followed by padding, if needed, except for the last one
+	std::vector<Type*> fields;
+	std::vector<Constant*> initializers;
+	std::vector<unsigned> fieldIndex;
+	for (unsigned n = 0; n < copies.size(); n++) {
+		if (n > 0 && padding > 0) {
+			ArrayType* padType = ArrayType::get(Type::getInt8Ty(C), padding);
+			fields.push_back(padType);
+			initializers.push_back(ConstantAggregateZero::get(padType));
+		}
+		fieldIndex.push_back(fields.size());
+		fields.push_back(valueType);
+		initializers.push_back(copies[n]->getInitializer());
+	}
+	StructType* packType = StructType::get(C, fields);
+
+	GlobalVariable* pack = new GlobalVariable(
+		M,									/* Module */
+		packType,							/* Type */
+		g->isConstant(),					/* isConstant */
+		GlobalValue::InternalLinkage,		/* Linkage */
+		ConstantStruct::get(packType, initializers),	/* Initializer */
+		g->getName() + ".xMR",				/* Name */
+		g									/* InsertBefore */
+	);
+	// this brings the alignment along, but the aliases keep the visibility
+	pack->copyAttributesFrom(g);
+	pack->setVisibility(GlobalValue::DefaultVisibility);
+	pack->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+	pack->setUnnamedAddr(GlobalValue::UnnamedAddr::None);
+
+	const StructLayout* layout = DL.getStructLayout(packType);
+	GlobalAlias* origAlias = nullptr;
+	for (unsigned n = 0; n < copies.size(); n++) {
+		GlobalVariable* copy = copies[n];
+		Constant* idx[] = {
+			ConstantInt::get(Type::getInt32Ty(C), 0),
+			ConstantInt::get(Type::getInt32Ty(C), fieldIndex[n])
+		};
+		Constant* addr = ConstantExpr::getInBoundsGetElementPtr(packType, pack, idx);
+
+		GlobalAlias* alias = GlobalAlias::create(valueType, copy->getAddressSpace(),
+				copy->getLinkage(), "", addr, &M);
+		alias->takeName(copy);
+		alias->setVisibility(copy->getVisibility());
+		alias->setDLLStorageClass(copy->getDLLStorageClass());
+		alias->setUnnamedAddr(copy->getUnnamedAddr());
+		if (n == 0)
+			origAlias = alias;
+
+		// aliases can't have debug info, so the pack gets it, with an offset
+		uint64_t offset = layout->getElementOffset(fieldIndex[n]);
+		SmallVector<DIGlobalVariableExpression*, 4> debugInfo;
+		copy->getDebugInfo(debugInfo);
+		for (auto dbg : debugInfo) {
+			DIExpression* expr = dbg->getExpression();
+			if (offset > 0) {
+				SmallVector<uint64_t, 8> ops = {dwarf::DW_OP_plus_uconst, offset};
+				ops.append(expr->elements_begin(), expr->elements_end());
+				expr = DIExpression::get(C, ops);
+			}
+			pack->addDebugInfo(DIGlobalVariableExpression::get(C, dbg->getVariable(), expr));
+		}
+
+		copy->replaceAllUsesWith(alias);
+		copy->eraseFromParent();
+	}
+
+	// how far apart the copies are, see foldReplicaAddresses()
+	uint64_t stride = layout->getElementOffset(fieldIndex[1]);
+	for (unsigned n = 1; n < copies.size(); n++) {
+		assert((layout->getElementOffset(fieldIndex[n]) == n * stride) && "copies are evenly spaced");
+	}
+	replicaStrides[origAlias] = stride;
+	NumGlobalsPacked++;
+	if (verboseFlag)
+		errs() << info_string << " Packed " << pack->getName() << "\n";
+}
+
+/*
+ * Once the copies of a global are a constant distance apart, the address of an
+ *  element in a copy doesn't need its own arithmetic.  Each cloned GEP into a
+ *  packed global is replaced with the original address plus the distance to the
+ *  copy, which the back end folds into the displacement of the load or store.
+ * The copies in memory are still separate, so a fault in one copy of the data is
+ *  still detected.  However, a fault in the one address calculation that is left
+ *  affects every copy the same way, so it is not.
+ */
+void dataflowProtection::foldReplicaAddresses() {
+	// follow the pointers derived from each packed global, in the order they're derived
+	std::deque<Value*> worklist;
+	for (auto& entry : replicaStrides)
+		worklist.push_back(entry.first);
+
+	std::vector<GetElementPtrInst*> toFold;
+	while (!worklist.empty()) {
+		Value* base = worklist.front();
+		worklist.pop_front();
+		uint64_t stride = replicaStrides[base];
+
+		for (User* u : base->users()) {
+			if (replicaStrides.find(u) != replicaStrides.end())
+				continue;
+			// constant GEPs don't need any arithmetic, but instructions can use them
+			if (isa<ConstantExpr>(u)) {
+				replicaStrides[u] = stride;
+				worklist.push_back(u);
+			} else if (isa<BitCastInst>(u) || isa<GetElementPtrInst>(u)) {
+				if (!cloneRegistry.contains(u))
+					continue;
+				replicaStrides[u] = stride;
+				worklist.push_back(u);
+				// vectors of pointers are left alone
+				if (isa<GetElementPtrInst>(u) && !u->getType()->isVectorTy())
+					toFold.push_back(cast<GetElementPtrInst>(u));
+			}
+		}
+	}
+
+	std::set<Instruction*> maybeDead;
+	unsigned numFolded = 0;
+	for (auto gep : toFold) {
+		uint64_t stride = replicaStrides[gep];
+		unsigned numReplicas = cloneRegistry.getNumReplicas(gep);
+		Type* bytePtrType = Type::getInt8PtrTy(gep->getContext(), gep->getType()->getPointerAddressSpace());
+
+		// replacing all of the copies first keeps the registry entry alive
+		std::vector<Instruction*> oldClones;
+		for (unsigned n = 0; n < numReplicas; n++) {
+			GetElementPtrInst* cloneGep = dyn_cast_or_null<GetElementPtrInst>(cloneRegistry.getReplica(gep, n));
+			if (!cloneGep)
+				continue;
+
+			IRBuilder<> builder(cloneGep);
+			Value* addr = builder.CreateBitCast(gep, bytePtrType);
+			addr = builder.CreateGEP(builder.getInt8Ty(), addr, builder.getInt64((n + 1) * stride));
+			addr = builder.CreateBitCast(addr, gep->getType(), cloneGep->getName());
+
+			cloneGep->replaceAllUsesWith(addr);
+			oldClones.push_back(cloneGep);
+			numFolded++;
+		}
+
+		for (auto cloneGep : oldClones) {
+			for (Value* op : cloneGep->operands()) {
+				if (Instruction* opInst = dyn_cast<Instruction>(op))
+					maybeDead.insert(opInst);
+			}
+			maybeDead.erase(cloneGep);
+			cloneGep->eraseFromParent();
+		}
+	}
+
+	// The copies of the indices may not be needed anymore.  All of the copies of a
+	//  value go at once, because erasing one of them drops the registry entry.
+	while (!maybeDead.empty()) {
+		Instruction* I = *maybeDead.begin();
+		maybeDead.erase(maybeDead.begin());
+		Value* orig = cloneRegistry.getOriginal(I);
+		if (!orig)
+			continue;
+
+		std::vector<Instruction*> replicas;
+		for (unsigned n = 0; n < cloneRegistry.getNumReplicas(orig); n++) {
+			if (Instruction* replica = dyn_cast_or_null<Instruction>(cloneRegistry.getReplica(orig, n)))
+				replicas.push_back(replica);
+		}
+		bool allDead = std::all_of(replicas.begin(), replicas.end(), [](Instruction* replica) {
+			return replica->use_empty() && !replica->mayHaveSideEffects() && !isa<PHINode>(replica);
+		});
+		if (!allDead)
+			continue;
+
+		for (auto replica : replicas) {
+			for (Value* op : replica->operands()) {
+				if (Instruction* opInst = dyn_cast<Instruction>(op))
+					maybeDead.insert(opInst);
+			}
+		}
+		for (auto replica : replicas) {
+			maybeDead.erase(replica);
+			replica->eraseFromParent();
+		}
+	}
+
+	NumAddrsFolded += numFolded;
+	if (verboseFlag)
+		errs() << info_string << " Folded " << numFolded << " replica addresses into constant offsets\n";
+}
+
+
 //----------------------------------------------------------------------------//
 // Cloning debug information
 //----------------------------------------------------------------------------//
@@ -4,6 +4,8 @@
 
 #include <llvm/Support/raw_ostream.h>
 #include "llvm/Support/CommandLine.h"
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/ErrorHandling.h>
 
 using namespace llvm;
 
@@ -30,21 +32,58 @@ cl::list<std::string> cloneGlblCl ("cloneGlbls", cl::desc("Specify global(s) to
 // specify function names which should return multiple values
 cl::list<std::string> replReturnCl ("cloneReturn", cl::desc("Specify function(s) which should return multiple values. Defaults to none."), cl::CommaSeparated, cl::ZeroOrMore);
 cl::list<std::string> cloneAfterCallCl ("cloneAfterCall", cl::desc("Specify function(s) of which the argument(s) should be cloned after the function is called once (ie. scanf)"), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> parityGlblCl ("parityGlobals", cl::desc("Specify global(s) to keep as a single copy protected by block parity, instead of replicating them"), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> rmtFnCl ("rmtFns", cl::desc("Specify function(s) to run once, and check with a trailing copy in a second thread (DWC only)"), cl::CommaSeparated, cl::ZeroOrMore);
 cl::list<std::string> protectedLibCl ("protectedLibFn", cl::desc("Specify function(s) which should be treated as protected library functions."), cl::CommaSeparated, cl::ZeroOrMore);
 
 // Other options
 cl::opt<std::string> configFileLocation ("configFile", cl::desc("Location of configuration file"));
+cl::opt<std::string> profileFileLocation ("profileFile", cl::desc("Function call counts from the SmallProfile pass, used by -overheadBudget"));
+cl::opt<double> overheadBudgetOpt ("overheadBudget", cl::desc("Only protect as much of the program as fits in this run time overhead (for example 1.6)"), cl::init(0.0));
 cl::opt<bool> ReportErrorsFlag ("countErrors", cl::desc("Instrument TMR'd code so it counts the number of corrections"), cl::value_desc("TMR error counting"));
 cl::opt<bool> OriginalReportErrorsFlag ("reportErrors", cl::desc("Instrument TMR'd code so it reports if TMR corrected an error (deprecated)"), cl::value_desc("TMR error signaling (deprecated)"));
 cl::opt<bool> InterleaveFlag ("i", cl::desc("Interleave instructions, rather than segmenting within a basic block. Default behavior."));
 cl::opt<bool> SegmentFlag ("s", cl::desc("Segment instructions, rather than interleaving within a basic block"));
 cl::list<std::string> globalsToRuntimeInitCl ("runtimeInitGlobals", cl::CommaSeparated, cl::ZeroOrMore);
 cl::opt<bool> dumpModuleFlag ("dumpModule", cl::desc("Print out the module immediately before pass concludes. Option is for pass debugging."));
+cl::opt<bool> verifyCloneRegistryFlag ("verifyCloneRegistry", cl::desc("Check that the originals and their copies are still matched up after each phase. Option is for pass debugging."));
 cl::opt<bool> verboseFlag ("verbose", cl::desc("Increase the amount of output"));
 cl::opt<bool> noMainFlag ("noMain", cl::desc("There is no 'main' function in this module"));
 cl::opt<bool> noCloneOperandsCheckFlag ("noCloneOpsCheck", cl::desc("Continue compilation even if instruction operands weren't correctly cloned."));
 cl::opt<bool> countSyncsFlag ("countSyncs", cl::desc("Dynamic count of synchronization points"));
 cl::opt<bool> protectStackFlag ("protectStack", cl::desc("Vote on values of return address and frame pointer before returning from function call."));
+cl::opt<bool> bitwiseVoteFlag ("bitwiseVote", cl::desc("Use a bitwise majority voter for TMR instead of compare and select"));
+cl::opt<bool> threadCountersFlag ("threadCounters", cl::desc("Keep the -countErrors and -countSyncs counters separately for each thread, in their own cache line (needs tests/COAST_counters.c)"));
+cl::opt<bool> profileSyncsFlag ("profileSyncs", cl::desc("Count how often each sync point runs and how many errors it corrects, and print them by source location at exit"));
+cl::opt<bool> loopSyncsFlag ("loopSyncs", cl::desc("Move syncs on loop-invariant values out of loops, and check induction variables once at the loop exit"));
+cl::opt<double> replicateFractionOpt ("replicateFraction", cl::desc("Only replicate this fraction of the arithmetic instructions, the ones most likely to cause silent data corruption"), cl::init(1.0));
+cl::opt<double> vulnerabilityThresholdOpt ("vulnerabilityThreshold", cl::desc("Don't replicate arithmetic instructions whose vulnerability score (0 to 1) is below this"), cl::init(0.0));
+cl::opt<double> compareVulnerabilityOpt ("compareVulnerability", cl::desc("How much of a fault in a compared or selected value changes the result, for the vulnerability scores"), cl::init(0.5));
+cl::opt<bool> syncElimFlag ("syncElim", cl::desc("Skip syncs on values that an earlier sync already checked or voted on"));
+cl::opt<bool> coalesceChecksFlag ("coalesceChecks", cl::desc("Merge DWC checks from consecutive blocks into a single branch"));
+cl::opt<DeferredCheckLevel> deferChecksOpt ("deferChecks", cl::desc("Fold DWC comparisons into a running check, and only branch to the error handler at certain points"),
+	cl::values(
+		clEnumValN(DeferNone, "none", "Check at every sync point (default)"),
+		clEnumValN(DeferLoop, "loop", "Check at loop latches, function exits, and before calls to unprotected functions"),
+		clEnumValN(DeferFunction, "function", "Check at function exits, and before calls to unprotected functions")),
+	cl::init(DeferNone));
+cl::opt<MemOpFusion> fuseMemOpsOpt ("fuseMemOps", cl::desc("Combine the copies of each replicated memcpy and memset into a single loop"),
+	cl::values(
+		clEnumValN(FuseNone, "none", "Each copy has its own call (default)"),
+		clEnumValN(FuseCheck, "check", "One loop writes all of the copies, and votes on (TMR) or compares (DWC) the sources")),
+	cl::init(FuseNone));
+cl::opt<GlobalLayout> globalLayoutOpt ("globalLayout", cl::desc("Where the copies of each global variable are placed in memory"),
+	cl::values(
+		clEnumValN(LayoutAdjacent, "adjacent", "Each copy is a separate global, declared right before the original (default)"),
+		clEnumValN(LayoutPacked, "packed", "The original and its copies are packed into one aggregate, at a constant offset from each other"),
+		clEnumValN(LayoutSeparated, "separated", "All of the originals come first, followed by all of the copies, to keep them far apart")),
+	cl::init(LayoutAdjacent));
+cl::opt<bool> noConstReplicationFlag ("noConstReplication", cl::desc("Keep a single copy of constant globals, since the program can't write to them"));
+cl::opt<bool> checkConstGlobalsFlag ("checkConstGlobals", cl::desc("Keep a single copy of constant globals, and create __COAST_checkConstGlobals() to verify their checksums"));
+cl::opt<bool> scrubGlobalsFlag ("scrubGlobals", cl::desc("Register the copies of replicated globals with the background scrubber in tests/COAST_scrub.c"));
+cl::opt<bool> rollbackFlag ("rollback", cl::desc("On a DWC error, undo the stores since the last checkpoint and run again from it, instead of aborting"));
+cl::opt<unsigned> rollbackLogSizeOpt ("rollbackLogSize", cl::desc("Number of stores the undo log for -rollback can hold between checkpoints"), cl::init(4096));
+cl::opt<bool> replicaOffsetsFlag ("replicaOffsets", cl::desc("Pack the copies of each global together, and address them at a constant offset from the original instead of cloning the address arithmetic"));
 
 
 //--------------------------------------------------------------------------//
@@ -61,12 +100,31 @@ bool dataflowProtection::runOnModule(Module &M) {
 }
 
 bool dataflowProtection::run(Module &M, int numClones) {
+	// Each phase gets its own timer, reported along with -time-passes
+	std::unique_ptr<NamedRegionTimer> phaseTimer;
+	std::string lastPhase;
+	auto checkRegistry = [this, &lastPhase]() {
+		if (verifyCloneRegistryFlag && !cloneRegistry.verify(errs()))
+			report_fatal_error(Twine("Clone registry is inconsistent after ") + lastPhase);
+	};
+	auto startPhase = [&phaseTimer, &lastPhase, &checkRegistry](StringRef name, StringRef desc) {
+		// stop the last one before starting the next
+		phaseTimer.reset();
+		if (!lastPhase.empty())
+			checkRegistry();
+		lastPhase = name.str();
+		phaseTimer.reset(new NamedRegionTimer(name, desc, "coast",
+				"COAST dataflow protection phases", TimePassesIsEnabled));
+	};
+
+	startPhase("removeUnusedFunctions", "Remove unused functions");
 	// Remove user functions that are never called in the module to reduce code size, processing time
 	// These are mainly inlined by prior optimizations
 	if (verboseFlag)
 		PRINT_STRING("The following functions are unused, removing them:");
 	removeUnusedFunctions(M);
 
+	startPhase("processAnnotations", "Process annotations");
 	// Process user commands inside of the source code
 	// Must happen before processCommandLine to make sure we don't clone things if not needed
 	processAnnotations(M);
@@ -74,18 +132,25 @@ bool dataflowProtection::run(Module &M, int numClones) {
 	// Remove annotations here so they aren't cloned
 	removeAnnotations(M);
 
+	startPhase("processCommandLine", "Process command line");
 	// Make sure that the command line options are correct
 	processCommandLine(M, numClones);
 
+	startPhase("populateValuesToClone", "Find values to clone");
 	// Populate the list of functions to touch
 	populateFnWorklist(M);
 
+	// Functions run with redundant multithreading are taken out of the list
+	outlineRMTFunctions(M);
+
 	// First figure out which instructions are going to be cloned
 	populateValuesToClone(M);
 
+	startPhase("verifyOptions", "Verify options");
 	// validate that the configuration parameters can be followed safely
 	verifyOptions(M);
 
+	startPhase("cloneFunctionArguments", "Clone function arguments");
 	// Now add new arguments to functions
 	// (In LLVM you can't change a function signature, so we have to make new functions)
 	// populateValuesToClone has to be called before this so we know which
@@ -93,54 +158,100 @@ bool dataflowProtection::run(Module &M, int numClones) {
 	cloneFunctionArguments(M);
 	cloneFunctionReturnVals(M);
 
+	startPhase("updateFnWrappers", "Update function wrappers");
 	// deal with function wrappers
 	updateFnWrappers(M);
 
+	startPhase("processLocalAnnotations", "Process local annotations");
 	// Parse the annotations on local variables within functions so that
 	//  list of values to clone is up to date
 	processLocalAnnotations(M);
 	removeLocalAnnotations(M);
 
+	startPhase("repopulateValuesToClone", "Find values to clone again");
 	// Once again figure out which instructions are going to be cloned
-	// This need to be re-run after creating the new functions as the old
-	// pointers will be stale
+	// The clone registry and cloneFunctionArguments() keep the earlier results up to date,
+	//  but the local annotations, function wrappers, and the new functions for replicated
+	//  return values can all change which instructions should be cloned
+	// The functions are final now, so this is also when the least vulnerable
+	//  instructions can be taken out of scope
+	skipLowVulnerabilityInsts(M);
 	populateValuesToClone(M);
 
+	startPhase("cloneGlobals", "Clone globals and constants");
 	// Do the actual cloning
 	cloneGlobals(M);
 	cloneConstantExpr();
+	startPhase("cloneInsns", "Clone instructions");
 	cloneInsns();
 
+	startPhase("updateCallInsns", "Update calls");
 	// Change clones to depend on the duplications
 	updateCallInsns(M);
 	updateInvokeInsns(M);
 
+	startPhase("createErrorBlocks", "Create error blocks");
 	// Insert error detection/handling
 	insertErrorFunction(M, numClones);
 	createErrorBlocks(M, numClones);
 
+	startPhase("populateSyncPoints", "Find sync points");
 	// Determine where synchronization logic needs to be
 	populateSyncPoints(M);
 
+	startPhase("processSyncPoints", "Insert sync logic");
 	// Insert synchronization statements
 	processSyncPoints(M, numClones);
 
+	startPhase("fuseMemIntrinsics", "Fuse replicated memcpy and memset");
+	// Done after the sync logic, so the fused calls aren't treated as calls to unprotected functions
+	fuseMemIntrinsics(M);
+
+	startPhase("insertParityChecks", "Parity protected globals");
+	// Also after the sync logic, so the checks aren't replicated
+	insertParityChecks(M);
+
+	startPhase("insertRMTChecks", "Redundant multithreading checks");
+	// Needs the error blocks, and the calls to wait for the trailing thread aren't sync points
+	insertRMTChecks(M);
+
+	startPhase("addGlobalRuntimeInit", "Runtime initialization");
 	// Global runtime initialization
 	addGlobalRuntimeInit(M);
 	updateRRFuncs(M);
 
+	startPhase("insertStackProtection", "Stack protection");
 	// stack protection
 	insertStackProtection(M);
 
+	startPhase("cleanUp", "Clean up");
 	// Clean up
 	removeUnusedErrorBlocks(M);
 	checkForUnusedClones(M);
 	removeOrigFunctions();
 	removeUnusedGlobals(M);
 
+	startPhase("registerScrubGlobals", "Register globals with the scrubber");
+	// Before the layout, which updates the addresses in the table along with everything else
+	registerScrubGlobals(M, numClones);
+
+	startPhase("layoutGlobalCopies", "Lay out global copies");
+	// Only the globals that are still used get a place in the layout
+	layoutGlobalCopies(M, numClones);
+
+	startPhase("moveClonesToEndIfSegmented", "Segment clones");
 	// This is executed if code is segmented instead of interleaved
 	moveClonesToEndIfSegmented(M);
 
+	startPhase("inlineThreadCounters", "Inline per-thread counters");
+	// Splits blocks, so only once the sync logic won't be moved any more
+	inlineThreadCounters(M);
+
+	startPhase("insertRollback", "Checkpoint and rollback");
+	// After the clones have been moved, so the stores are logged where they end up
+	insertRollback(M);
+
+	startPhase("removeUnusedFunctionsFinal", "Remove unused functions (fix-point)");
 	if (verboseFlag)
 		PRINT_STRING("Removing unused functions...");
 	/*
@@ -155,7 +266,10 @@ bool dataflowProtection::run(Module &M, int numClones) {
 		numRemoved = removeUnusedFunctions(M);
 	} while (numRemoved > 0);
 	// Make sure old calls to functions with replicated return values are removed
+	startPhase("validateRRFuncs", "Validate replicated return functions");
 	validateRRFuncs();
+	phaseTimer.reset();
+	checkRegistry();
 
 	// Option executed when -dumpModule is passed in
 	dumpModule(M);
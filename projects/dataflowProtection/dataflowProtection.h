@@ -6,10 +6,17 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <memory>
 
 #include <llvm/Pass.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Dominators.h>
 
 using namespace llvm;
 
@@ -45,6 +52,144 @@ typedef std::pair<Instruction*, Instruction*> InstructionPair;
 typedef std::tuple< Value*, GlobalVariable*, Function* > LoadRecordType;
 typedef std::tuple< StoreInst*, GlobalVariable*, Function* > StoreRecordType;
 typedef std::tuple< CallInst*, GlobalVariable*, Function* , long > CallRecordType;
+// a global used on the wrong side of the scope boundary, and if it is the protected one
+typedef std::tuple< GlobalVariable*, Function*, bool > CrossingRecordType;
+
+// where DWC checks its comparisons, see -deferChecks
+enum DeferredCheckLevel {
+  DeferNone,      // branch to the error block at every sync point
+  DeferLoop,      // at loop latches, function exits and externally visible calls
+  DeferFunction   // only at function exits and externally visible calls
+};
+
+// how replicated memcpy and memset calls are combined, see -fuseMemOps
+enum MemOpFusion {
+  FuseNone,   // each copy keeps its own call
+  FuseCheck   // one loop writes all of the copies, and votes on (TMR) or compares (DWC) the sources
+};
+
+// where the copies of a global variable are put in memory, see -globalLayout
+enum GlobalLayout {
+  LayoutAdjacent,   // each copy is its own global, declared next to the original
+  LayoutPacked,     // the copies share one aggregate, at a constant offset from each other
+  LayoutSeparated   // all the originals first, then all of the copies
+};
+
+//----------------------------------------------------------------------------//
+// Clone registry
+//----------------------------------------------------------------------------//
+/*
+ * Maps each original value to its replicas, and each replica back to its original.
+ * Every value is tracked by a CallbackVH:
+ *  - if an original is RAUW'd, the entry follows the new value
+ *  - if a replica is RAUW'd, the new value takes its place
+ *  - if either one is deleted, the whole entry is dropped, since the original
+ *    can no longer be treated as replicated
+ */
+class CloneRegistry {
+public:
+  CloneRegistry() = default;
+  CloneRegistry(const CloneRegistry&) = delete;
+  CloneRegistry& operator=(const CloneRegistry&) = delete;
+
+  // null replicas are ignored, so DWC can pass the same pair as TMR
+  void insert(Value* orig, ArrayRef<Value*> replicas);
+  void erase(Value* orig);
+  void clear();
+
+  bool contains(Value* orig) const { return forward.count(orig) != 0; }
+  size_t size() const { return forward.size(); }
+  unsigned getNumReplicas(Value* orig) const;
+  // nullptr if there is no such replica
+  Value* getReplica(Value* orig, unsigned n) const;
+  // nullptr if v isn't a replica of anything
+  Value* getOriginal(Value* v) const;
+  // copy of all the originals, safe to use while entries are being erased
+  std::vector<Value*> getOriginals() const;
+  // false if the originals and replicas don't match up, see -verifyCloneRegistry
+  bool verify(raw_ostream& OS) const;
+
+private:
+  class CloneHandle : public CallbackVH {
+    CloneRegistry* registry;
+  public:
+    CloneHandle(Value* V, CloneRegistry* R) : CallbackVH(V), registry(R) {}
+    void deleted() override;
+    void allUsesReplacedWith(Value* newV) override;
+  };
+
+  struct Entry {
+    CloneHandle orig;
+    SmallVector<CloneHandle, 2> replicas;
+    Entry(Value* V, CloneRegistry* R) : orig(V, R) {}
+  };
+
+  void valueDeleted(Value* V);
+  void valueReplaced(Value* oldV, Value* newV);
+
+  DenseMap<Value*, std::unique_ptr<Entry> > forward;
+  DenseMap<Value*, Value*> reverse;
+};
+
+
+//----------------------------------------------------------------------------//
+// Sync point registry
+//----------------------------------------------------------------------------//
+/*
+ * Keeps the sync points in the order they were found, along with a hashed index
+ *  so membership tests and removal don't have to search the whole list.
+ * Entries which are invalidated (explicitly, or because the instruction was erased)
+ *  are cleared from their slot, so indices stay stable, and remembered separately.
+ * The per-block lists are built by indexBlocks().  Splitting a block moves sync
+ *  points into a different block without the registry knowing, so it has to be
+ *  called again after the CFG changes.
+ */
+class SyncPointRegistry {
+public:
+  typedef std::vector<Instruction*> BlockList;
+
+  SyncPointRegistry() = default;
+  SyncPointRegistry(const SyncPointRegistry&) = delete;
+  SyncPointRegistry& operator=(const SyncPointRegistry&) = delete;
+
+  bool insert(Instruction* I);
+  void invalidate(Instruction* I);
+  void clear();
+
+  bool contains(Instruction* I) const { return index.count(I) != 0; }
+  bool wasInvalidated(Instruction* I) const { return invalidated.count(I) != 0; }
+  bool empty() const { return index.empty(); }
+  // number of slots, including ones which have been invalidated
+  size_t size() const { return slots.size(); }
+  // nullptr if the sync point in this slot was invalidated
+  Instruction* operator[](size_t idx) const {
+    return static_cast<Instruction*>(static_cast<Value*>(slots[idx]));
+  }
+
+  // groups the sync points by the block they are in right now
+  void indexBlocks();
+  // sync points in BB when indexBlocks() was called, in the order they were added
+  const BlockList& getBlockSyncPoints(BasicBlock* BB);
+
+private:
+  // drops the entry automatically if the instruction is deleted
+  class SyncPointHandle : public CallbackVH {
+    SyncPointRegistry* registry;
+  public:
+    SyncPointHandle(Instruction* I, SyncPointRegistry* R) : CallbackVH(I), registry(R) {}
+    void release() { setValPtr(nullptr); }
+    void deleted() override;
+  };
+
+  void forget(Instruction* I);
+
+  std::vector<SyncPointHandle> slots;
+  DenseMap<Instruction*, size_t> index;
+  DenseSet<Instruction*> invalidated;
+  DenseMap<BasicBlock*, BlockList> blockIndex;
+  bool blockIndexDirty = true;
+};
+
 
 //----------------------------------------------------------------------------//
 // Class definition
@@ -56,6 +201,8 @@ public:
 
   bool runOnModule(Module&M);
   bool run(Module&M, int numClones);
+  // process-level redundancy, see processes.cpp
+  bool runPLR(Module& M, int numReplicas);
   void getAnalysisUsage(AnalysisUsage& AU) const ;
 
 private:
@@ -69,6 +216,7 @@ private:
   const std::string no_xMR_anno    = "no_xMR";
   const std::string xMR_anno       = "xMR";
   const std::string xMR_call_anno  = "xMR_call";
+  const std::string parity_anno    = "xMR_parity";
   const std::string skip_call_anno = "coast_call_once";
   const std::string default_xMR    = "set_xMR_default";
   const std::string default_no_xMR = "set_no_xMR_default";
@@ -106,6 +254,8 @@ private:
   std::set<GlobalVariable*> globalsToClone;
   std::set<GlobalVariable*> globalsToSkip;
   std::set<GlobalVariable*> volatileGlobals;
+  std::set<GlobalVariable*> parityGlobals;	    /* a single copy, protected with parity */
+  std::set<Function*> rmtFns;               /* checked by a trailing thread */
   std::set<Function*> usedFunctions; 	    /* marked with __attribute__((used)) */
   std::set<Function*> isrFunctions;		    /* marked with directive as ISR */
   std::set<Function*> replReturn; 		    /* marked to replicate return values */
@@ -118,10 +268,16 @@ private:
   std::set<Instruction*> wrapperInsts;
   std::map<CallInst*, std::vector<int> > cloneAfterCallArgMap;
 
-  std::vector<Instruction*> syncPoints;
+  SyncPointRegistry syncPoints;
   std::vector<Instruction*> newSyncPoints;		// added while processing old ones
-  std::map<Value*,ValuePair> cloneMap;
+  CloneRegistry cloneRegistry;
   std::map<Function*, BasicBlock*> errBlockMap;
+  // DWC comparisons waiting to be folded into the running check of each function
+  std::map<Function*, std::vector<Instruction*> > deferredDWCChecks;
+  // sync points that were already taken care of by placeLoopSyncs()
+  std::set<Instruction*> movedLoopSyncs;
+  // the checks (DWC) or votes (TMR) on each value so far, see getDominatingSync()
+  std::map<Value*, std::vector<Instruction*> > verifiedValues;
   std::map<Function*, Function*> functionMap;
   std::map<Function*, SmallVector<ReturnInst*, 8>> replRetMap;
 
@@ -138,13 +294,39 @@ private:
   // For TMR, map the sync instruction to the start of the logic chain
   std::map<Instruction*, Instruction*> startOfSyncLogic;
   // in the case of SIMD instructions, need special support for compare logic
-  std::map<Instruction*, std::tuple<Instruction*, Instruction*, Instruction*> > simdMap;
+  std::map<Instruction*, std::pair<Instruction*, Instruction*> > simdMap;
+
+  // Analyses needed while inserting sync logic, built once per function on first use
+  //  and updated in place as blocks are split, instead of rebuilt at every sync point
+  std::map<Function*, std::unique_ptr<DominatorTree> > domTreeCache;
+
+  // distance between the copies of each packed global, and of the pointers into it
+  std::map<Value*, uint64_t> replicaStrides;
+
+  // comparisons in each trailing function, waiting for the error blocks to exist
+  std::map<Function*, std::vector<Instruction*> > rmtChecks;
+
+  // -profileSyncs, see numberSyncSites()
+  struct SyncSite {
+    std::string function, block, kind, file;
+    unsigned line, col;
+  };
+  std::vector<SyncSite> syncSites;
+  std::map<Instruction*, unsigned> syncSiteIds;
+  GlobalVariable* syncSiteCounts = nullptr;
+  // the site whose sync logic is being inserted right now, or -1
+  int currentSyncSite = -1;
 
   //----------------------------------------------------------------------------//
   // cloning.cpp
   //----------------------------------------------------------------------------//
   // Initialization
   void populateValuesToClone(Module& M);
+  void populateInstsToClone(Function* F);
+  bool globalCanBeCloned(GlobalVariable& g);
+  void forgetInstsToClone(Function* F);
+  void rankInstVulnerability(Function* F, std::map<Instruction*, double>& scores);
+  void skipLowVulnerabilityInsts(Module& M);
   // Modify functions
   void populateFnWorklist(Module& M);
   void cloneFunctionArguments(Module& M);
@@ -164,6 +346,14 @@ private:
   void cloneGlobals(Module& M);
   GlobalVariable* copyGlobal(Module& M, GlobalVariable* copyFrom, std::string newName);
   void addGlobalRuntimeInit(Module& M);
+  bool canShareConstGlobal(GlobalVariable* g);
+  void shareConstGlobals(Module& M, ArrayRef<GlobalVariable*> sharedGlobals);
+  Function* getConstChecksumFunction(Module& M, IntegerType* elemType);
+  void registerScrubGlobals(Module& M, int numClones);
+  void layoutGlobalCopies(Module& M, int numClones);
+  bool canPackGlobal(GlobalVariable* g);
+  void packGlobalCopies(Module& M, ArrayRef<GlobalVariable*> copies);
+  void foldReplicaAddresses();
   // cloning debug information
   void cloneMetadata(Module& M, Function* Fnew);
   // fix instruction lists
@@ -181,6 +371,26 @@ private:
   void processCallSync(CallInst* currCallInst, GlobalVariable* TMRErrorDetected);
   void syncTerminator(TerminatorInst* currTerminator, GlobalVariable* TMRErrorDetected);
   Instruction* splitBlocks(Instruction* I, BasicBlock* errBlock);
+  // Redundant sync elimination
+  void recordSync(Value* orig, Instruction* syncInst);
+  Instruction* getDominatingSync(Value* orig, Instruction* I);
+  // Deferred DWC checks
+  void deferDWCCheck(Instruction* cmpInst);
+  void insertDeferredDWCChecks(Function* F);
+  void insertDeferredDWCCheck(Instruction* checkPoint, Value* allMatch, BasicBlock* errBlock);
+  // Loop-aware sync placement
+  void placeLoopSyncs(Function* F, GlobalVariable* TMRErrorDetected);
+  Value* syncLoopValue(Value* v, Instruction* insertBefore, GlobalVariable* TMRErrorDetected,
+                       std::vector<Instruction*>& syncInsts);
+  // Coalescing sync checks
+  void coalesceSyncChecks(Function* F);
+  bool collectCheckLogic(BranchInst* check, std::vector<Instruction*>& checkLogic);
+  // Cached analyses
+  DominatorTree* getDomTree(Function* F);
+  void updateDomTreeAfterSplit(BasicBlock* oldBB, BasicBlock* newBB);
+  void updateDomTreeAfterNewBlock(BasicBlock* newBB, BasicBlock* idomBB);
+  void updateDomTreeAfterNewEdge(BasicBlock* fromBB, BasicBlock* toBB);
+  void clearAnalysisCache();
   // DWC error handling
   void insertErrorFunction(Module& M, int numClones);
   void createErrorBlocks(Module& M, int numClones);
@@ -188,9 +398,46 @@ private:
   void insertTMRDetectionFlag(Instruction* cmpInst, GlobalVariable* TMRErrorDetected);
   void insertTMRCorrectionCount(Instruction* cmpInst, GlobalVariable* TMRErrorDetected, bool updateSyncPoint = false);
   void insertVectorTMRCorrectionCount(Instruction* cmpInst, Instruction* cmpInst2, GlobalVariable* TMRErrorDetected);
+  // per-thread counters
+  std::vector<Instruction*> insertCounterAdd(GlobalVariable* counter, Value* amount, Instruction* insertBefore);
+  void redirectCounterAccesses(Module& M, GlobalVariable* counter);
+  void inlineThreadCounters(Module& M);
+  // sync profiling
+  void numberSyncSites(Module& M);
+  void selectSyncSite(Instruction* syncPoint);
+  void countSyncSite(Instruction* insertBefore);
+  void emitSyncProfile(Module& M);
+  // bitwise voting
+  Instruction* insertBitwiseVoter(Value* orig, Value* clone1, Value* clone2, Instruction* insertBefore,
+                                  GlobalVariable* TMRErrorDetected, std::vector<Instruction*>& voterInsts);
+  // fused memory intrinsics
+  void fuseMemIntrinsics(Module& M);
+  bool fuseMemIntrinsic(Module& M, CallInst* origCall);
+  Function* getFusedMemFunction(Module& M, bool isSet, unsigned numDests, unsigned numSrcs,
+                                unsigned width, bool check, Type* lenType);
+  // parity protected globals
+  bool canProtectWithParity(GlobalVariable* g);
+  void insertParityChecks(Module& M);
+  Function* getParityCheckFunction(Module& M);
+  Function* getParityUpdateFunction(Module& M);
   // stack protection
   void insertStackProtection(Module& M);
 
+  //----------------------------------------------------------------------------//
+  // multithreading.cpp
+  //----------------------------------------------------------------------------//
+  bool canRunRMT(Function& F);
+  void outlineRMTFunctions(Module& M);
+  Function* createTrailingFunction(Module& M, Function* F);
+  void insertRMTChecks(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // rollback.cpp
+  //----------------------------------------------------------------------------//
+  bool isRollbackCommit(Instruction* I, std::set<Function*>& commitFns);
+  void findRollbackCommitFunctions(std::set<Function*>& commitFns);
+  void insertRollback(Module& M);
+
   //----------------------------------------------------------------------------//
   // utils.cpp
   //----------------------------------------------------------------------------//
@@ -219,6 +466,8 @@ private:
   bool comesFromSingleCall(Instruction* storeUse);
   void walkUnPtStores(StoreRecordType &record);
   void verifyOptions(Module& M);
+  void findScopeCrossings(Module& M);
+  bool checkGlobalScope(Module& M, std::set<CrossingRecordType>& crossings);
   void printGlobalScopeErrorMessage(GlobalFunctionSetMap &globalMap,
   		bool globalPt, std::string directionMessage);
   
@@ -246,6 +495,8 @@ private:
   //----------------------------------------------------------------------------//
   void getFunctionsFromCL();
   int getFunctionsFromConfig();
+  int getProfileCounts(std::map<std::string, uint64_t>& callCounts);
+  void planProtectionBudget(Module& M, int numClones);
   void processCommandLine(Module& M, int numClones);
   void processAnnotations(Module& M);
   void processLocalAnnotations(Module& M);
@@ -56,15 +56,15 @@ bool dataflowProtection::willBeCloned(Value* v) {
 
 
 bool dataflowProtection::isCloned(Value * v) {
-	return cloneMap.find(v) != cloneMap.end();
+	return cloneRegistry.contains(v);
 }
 
 
 ValuePair dataflowProtection::getClone(Value* I) {
-	if (cloneMap.find(I) == cloneMap.end()) {
+	if (!cloneRegistry.contains(I)) {
 		return ValuePair(I,I);
 	} else {
-		return cloneMap[I];
+		return ValuePair(cloneRegistry.getReplica(I, 0), cloneRegistry.getReplica(I, 1));
 	}
 }
 
@@ -73,16 +73,174 @@ ValuePair dataflowProtection::getClone(Value* I) {
  * Returns nullptr if the input value isn't a clone of anything.
  */
 Value* dataflowProtection::getCloneOrig(Value* v) {
-	for (auto cloneIt : cloneMap) {
-		Value* orig = cloneIt.first;
-		ValuePair clones = cloneIt.second;
-		Value* clone1 = clones.first;
-		Value* clone2 = clones.second;
-		if ( (clone1 == v) || (clone2 == v) ) {
-			return orig;
+	return cloneRegistry.getOriginal(v);
+}
+
+
+void CloneRegistry::insert(Value* orig, ArrayRef<Value*> replicas) {
+	erase(orig);
+
+	Entry* entry = new Entry(orig, this);
+	for (auto r : replicas) {
+		if (!r)
+			continue;
+		entry->replicas.push_back(CloneHandle(r, this));
+		// a copy can be replaced by the original itself, which isn't a copy of anything
+		if (r != orig)
+			reverse[r] = orig;
+	}
+	forward[orig] = std::unique_ptr<Entry>(entry);
+}
+
+void CloneRegistry::erase(Value* orig) {
+	auto found = forward.find(orig);
+	if (found == forward.end())
+		return;
+
+	for (auto& r : found->second->replicas) {
+		auto rev = reverse.find(r);
+		// the replica could have been registered again for something else
+		if (rev != reverse.end() && rev->second == orig)
+			reverse.erase(rev);
+	}
+	// this destroys the handles
+	forward.erase(found);
+}
+
+void CloneRegistry::clear() {
+	forward.clear();
+	reverse.clear();
+}
+
+/*
+ * Checks that the two maps agree with each other, and prints what doesn't.
+ * The values in the reverse map aren't tracked, so a stale entry there could
+ *  point to something that was deleted, and isn't printed.
+ */
+bool CloneRegistry::verify(raw_ostream& OS) const {
+	bool ok = true;
+	for (auto& entry : forward) {
+		Value* orig = entry.first;
+		if (entry.second->orig != orig) {
+			OS << "Clone registry entry moved away from " << *orig << "\n";
+			ok = false;
+		}
+		for (auto& r : entry.second->replicas) {
+			if (!r) {
+				OS << "Replica of " << *orig << " is gone\n";
+				ok = false;
+				continue;
+			} else if (r == orig) {
+				continue;
+			}
+			// it's allowed to be registered again as a copy of something else
+			if (!getOriginal(r)) {
+				OS << "Replica " << *r << " of " << *orig << " doesn't map back to anything\n";
+				ok = false;
+			}
+		}
+	}
+
+	for (auto& rev : reverse) {
+		auto found = forward.find(rev.second);
+		bool listed = false;
+		if (found != forward.end()) {
+			for (auto& r : found->second->replicas) {
+				listed |= (r == rev.first);
+			}
+		}
+		if (!listed) {
+			OS << "Clone registry has a replica that its original doesn't list\n";
+			ok = false;
 		}
 	}
-	return nullptr;
+	return ok;
+}
+
+unsigned CloneRegistry::getNumReplicas(Value* orig) const {
+	auto found = forward.find(orig);
+	if (found == forward.end())
+		return 0;
+	return found->second->replicas.size();
+}
+
+Value* CloneRegistry::getReplica(Value* orig, unsigned n) const {
+	auto found = forward.find(orig);
+	if (found == forward.end() || n >= found->second->replicas.size())
+		return nullptr;
+	return found->second->replicas[n];
+}
+
+Value* CloneRegistry::getOriginal(Value* v) const {
+	auto found = reverse.find(v);
+	if (found == reverse.end())
+		return nullptr;
+	return found->second;
+}
+
+std::vector<Value*> CloneRegistry::getOriginals() const {
+	std::vector<Value*> originals;
+	originals.reserve(forward.size());
+	for (auto& entry : forward) {
+		originals.push_back(entry.first);
+	}
+	return originals;
+}
+
+void CloneRegistry::valueDeleted(Value* V) {
+	if (Value* orig = getOriginal(V))
+		erase(orig);
+	erase(V);
+}
+
+void CloneRegistry::valueReplaced(Value* oldV, Value* newV) {
+	/*
+	 * The original changed, move the replicas over to the new value.
+	 * If the new value already has replicas of its own, those are kept, and
+	 *  the old ones only fill in the copies it doesn't have.
+	 */
+	auto found = forward.find(oldV);
+	if (found != forward.end()) {
+		SmallVector<Value*, 2> replicas(found->second->replicas.begin(), found->second->replicas.end());
+		auto existing = forward.find(newV);
+		if (existing != forward.end()) {
+			auto& newReplicas = existing->second->replicas;
+			for (unsigned i = 0; i < newReplicas.size(); i++) {
+				if (i < replicas.size())
+					replicas[i] = newReplicas[i];
+				else
+					replicas.push_back(newReplicas[i]);
+			}
+		}
+		insert(newV, replicas);
+		erase(oldV);
+	}
+
+	// a replica changed, swap it out in the list of its original
+	if (Value* orig = getOriginal(oldV)) {
+		SmallVector<Value*, 2> replicas;
+		for (auto& r : forward[orig]->replicas) {
+			replicas.push_back((r == oldV) ? newV : static_cast<Value*>(r));
+		}
+		insert(orig, replicas);
+	}
+}
+
+/*
+ * The registry callbacks may destroy this handle, so don't touch any members
+ *  after calling them.
+ */
+void CloneRegistry::CloneHandle::deleted() {
+	Value* V = getValPtr();
+	CloneRegistry* R = registry;
+	setValPtr(nullptr);
+	R->valueDeleted(V);
+}
+
+void CloneRegistry::CloneHandle::allUsesReplacedWith(Value* newV) {
+	Value* V = getValPtr();
+	CloneRegistry* R = registry;
+	R->valueReplaced(V, newV);
 }
 
 
@@ -102,12 +260,77 @@ bool dataflowProtection::isCoarseGrainedFunction(StringRef fnName) {
 //----------------------------------------------------------------------------//
 bool dataflowProtection::isSyncPoint(Instruction* I) {
 	if (isa<StoreInst>(I) || isa<CallInst>(I) || isa<TerminatorInst>(I) || isa<GetElementPtrInst>(I))
-		return std::find(syncPoints.begin(), syncPoints.end(), I) != syncPoints.end();
+		return syncPoints.contains(I);
 	else
 		return false;
 }
 
 
+/*
+ * Returns false if I was already a sync point.
+ */
+bool SyncPointRegistry::insert(Instruction* I) {
+	if (index.count(I))
+		return false;
+
+	// the memory of an invalidated instruction may have been reused
+	invalidated.erase(I);
+	index[I] = slots.size();
+	slots.push_back(SyncPointHandle(I, this));
+	blockIndexDirty = true;
+	return true;
+}
+
+/*
+ * Call this when I should no longer be treated as a sync point.
+ * There is no need to call it before erasing I, the handle takes care of that.
+ */
+void SyncPointRegistry::invalidate(Instruction* I) {
+	auto found = index.find(I);
+	if (found == index.end())
+		return;
+
+	slots[found->second].release();
+	forget(I);
+}
+
+void SyncPointRegistry::forget(Instruction* I) {
+	index.erase(I);
+	invalidated.insert(I);
+	blockIndexDirty = true;
+}
+
+void SyncPointRegistry::SyncPointHandle::deleted() {
+	// only the Value part of the instruction is still valid here
+	Instruction* I = static_cast<Instruction*>(getValPtr());
+	setValPtr(nullptr);
+	registry->forget(I);
+}
+
+void SyncPointRegistry::clear() {
+	slots.clear();
+	index.clear();
+	invalidated.clear();
+	blockIndex.clear();
+	blockIndexDirty = true;
+}
+
+void SyncPointRegistry::indexBlocks() {
+	blockIndex.clear();
+	for (size_t idx = 0; idx < slots.size(); idx++) {
+		if (Instruction* I = (*this)[idx])
+			blockIndex[I->getParent()].push_back(I);
+	}
+	blockIndexDirty = false;
+}
+
+const SyncPointRegistry::BlockList& SyncPointRegistry::getBlockSyncPoints(BasicBlock* BB) {
+	assert(!blockIndexDirty && "sync points changed since indexBlocks()");
+	// default constructs an empty list if there are none
+	return blockIndex[BB];
+}
+
+
 bool dataflowProtection::isStoreMovePoint(StoreInst* SI) {
 	if ( 	(getClone(SI).first == SI) ||						/* Doesn't have a clone */
 			(SI->getOperand(0)->getType()->isPointerTy()) ||	/* Storing a pointer type */
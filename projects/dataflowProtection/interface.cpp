@@ -19,6 +19,14 @@
 #include "llvm/Support/CommandLine.h"
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Support/Format.h>
 
 using namespace llvm;
 
@@ -35,6 +43,8 @@ extern cl::list<std::string> cloneGlblCl;
 extern cl::list<std::string> replReturnCl;
 extern cl::list<std::string> cloneAfterCallCl;
 extern cl::list<std::string> protectedLibCl;
+extern cl::list<std::string> parityGlblCl;
+extern cl::list<std::string> rmtFnCl;
 
 extern cl::opt<std::string> configFileLocation;
 extern cl::opt<bool> SegmentFlag;
@@ -43,6 +53,13 @@ extern cl::opt<bool> noStoreDataSyncFlag;
 extern cl::opt<bool> InterleaveFlag;
 extern cl::opt<bool> noMemReplicationFlag;
 extern cl::opt<bool> verboseFlag;
+extern cl::opt<DeferredCheckLevel> deferChecksOpt;
+extern cl::opt<bool> rollbackFlag;
+extern cl::opt<bool> threadCountersFlag;
+extern cl::opt<bool> profileSyncsFlag;
+extern cl::opt<bool> ReportErrorsFlag;
+extern cl::opt<double> overheadBudgetOpt;
+extern cl::opt<std::string> profileFileLocation;
 
 extern std::string tmr_global_count_name;
 
@@ -59,6 +76,8 @@ std::list<std::string> tempCloneGlblList;
 std::list<std::string> tempReplReturnList;
 std::list<std::string> cloneAfterCallList;
 std::list<std::string> tempProtectedLibList;
+std::list<std::string> parityGlbl;
+std::list<std::string> rmtFnList;
 std::map<Function*, std::set<int> > noXmrArgList;
 // see removeAnnotations()
 std::set<ConstantExpr*> annotationExpressions;
@@ -73,6 +92,8 @@ const std::string coarseFnsName = "replicateFnCalls";
 const std::string runtimeGlblInitName = "runtimeInitGlobals";
 const std::string isrFuncListString = "isrFunctions";
 const std::string cloneAfterCallString = "cloneAfterCall";
+const std::string parityGlblName = "parityGlobals";
+const std::string rmtFnName = "rmtFns";
 
 // track functions that we should ignore invalid SOR crossings
 extern std::map<GlobalVariable*, std::set<Function*> > globalCrossMap;
@@ -115,6 +136,18 @@ void dataflowProtection::getFunctionsFromCL() {
 		clGlobalsToRuntimeInit.push_back(x);
 	}
 
+	for (auto x : parityGlblCl) {
+		if (verboseFlag)
+			errs() << "CL: protect global variable '" << x << "' with parity\n";
+		parityGlbl.push_back(x);
+	}
+
+	for (auto x : rmtFnCl) {
+		if (verboseFlag)
+			errs() << "CL: check function '" << x << "' with a trailing thread\n";
+		rmtFnList.push_back(x);
+	}
+
 	for (auto x : isrFunctionListCl) {
 		if (verboseFlag)
 			errs() << "CL: function '" << x << "' is an ISR\n";
@@ -221,6 +254,10 @@ int dataflowProtection::getFunctionsFromConfig() {
 			lptr = &clGlobalsToRuntimeInit;
 		} else if (substr == isrFuncListString) {
 			lptr = &isrFuncNameList;
+		} else if (substr == parityGlblName) {
+			lptr = &parityGlbl;
+		} else if (substr == rmtFnName) {
+			lptr = &rmtFnList;
 		} else {
 			errs() << "ERROR: unrecognized option '" << substr;
 			errs() << "' in configuration file '" << filename << "'\n\n";
@@ -241,6 +278,348 @@ int dataflowProtection::getFunctionsFromConfig() {
 }
 
 
+//----------------------------------------------------------------------------//
+// Profile-guided scope
+//----------------------------------------------------------------------------//
+/*
+ * Reads the function call counts printed by the SmallProfile pass, which are
+ *  lines of the form "functionName: count".
+ * Returns non-zero if the file can't be read.
+ */
+int dataflowProtection::getProfileCounts(std::map<std::string, uint64_t>& callCounts) {
+	std::ifstream ifs(profileFileLocation, std::ifstream::in);
+	if (!ifs.is_open()) {
+		errs() << err_string << " No profile found at '" << profileFileLocation << "'\n";
+		return -1;
+	}
+
+	std::string line;
+	while (getline(ifs, line)) {
+		size_t sep = line.rfind(':');
+		if (sep == std::string::npos) {
+			continue;
+		}
+		std::string name = line.substr(0, sep);
+		name.erase(remove(name.begin(), name.end(), ' '), name.end());
+		std::istringstream iss(line.substr(sep + 1));
+		uint64_t count;
+		if (!name.empty() && (iss >> count)) {
+			callCounts[name] = count;
+		}
+	}
+	ifs.close();
+	return 0;
+}
+
+/*
+ * Chooses which functions to protect so that the predicted run time stays inside
+ *  of -overheadBudget.  Functions the user already put in or out of scope (with
+ *  annotations, the command line or the config file) are left alone.
+ *
+ * The cost model counts dynamic instructions.  Each function is weighted by how
+ *  many times it is called (from -profileFile, or the entry count from LLVM
+ *  profile data), and each block by its frequency relative to the entry block
+ *  (which uses branch weights from profile data if there are any).  Functions
+ *  without a count get one from their callers: the caller's count times the
+ *  frequency of each block that calls it.  Calls inside of a recursive cycle
+ *  are not followed, so those are only counted once per call from outside.
+ *  Protecting
+ *  a block adds a copy of each instruction for each replica, plus the compare
+ *  and vote/branch at each sync point.  The benefit of protecting a function is
+ *  the number of dynamic instructions it covers, so functions are picked in order
+ *  of coverage per unit of overhead until the budget is used up.
+ *
+ * The plan is then checked with the same rules as verifyOptions(), and fixed the
+ *  way the user would by hand.  A protected global used the wrong way outside of
+ *  the scope is left unprotected, like with -ignoreGlbls, unless the user asked
+ *  for it to be protected, then the planned function that uses it is protected.
+ *  A planned function that uses an unprotected global the wrong way is not
+ *  protected.  Each store to a global that was left out needs a sync point, so
+ *  that is added to the cost, and functions are dropped again until it fits.
+ */
+void dataflowProtection::planProtectionBudget(Module& M, int numClones) {
+	std::map<std::string, uint64_t> callCounts;
+	if ((profileFileLocation != "") && getProfileCounts(callCounts)) {
+		exit(-1);
+	}
+
+	// instructions added at each sync point: compare and select, or compare and branch
+	const double syncCost = (numClones == 3) ? 3.0 : 2.0;
+	// the same for the other technique, to show what it would cost instead
+	const int otherClones = (numClones == 3) ? 2 : 3;
+	const double otherSyncCost = (otherClones == 3) ? 3.0 : 2.0;
+
+	struct FunctionCost {
+		uint64_t calls;
+		double base;
+		double extra;
+		double otherExtra;
+		// how many stores to each global, which need a sync if it isn't protected
+		std::map<GlobalVariable*, double> globalStores;
+	};
+	std::map<Function*, FunctionCost> costs;
+	std::vector<Function*> candidates;
+	double totalBase = 0.0;
+
+	// how often each block runs for each call to its function
+	std::map<BasicBlock*, double> blockFreqs;
+	for (auto& F : M) {
+		if (F.isDeclaration()) {
+			continue;
+		}
+		DominatorTree DT(F);
+		LoopInfo LI(DT);
+		BranchProbabilityInfo BPI(F, LI);
+		BlockFrequencyInfo BFI(F, BPI, LI);
+		double entryFreq = BFI.getEntryFreq();
+		for (auto& bb : F) {
+			blockFreqs[&bb] = BFI.getBlockFreq(&bb).getFrequency() / entryFreq;
+		}
+	}
+
+	// callers come before callees, except in recursive cycles
+	std::vector<std::vector<CallGraphNode*> > sccs;
+	CallGraph CG(M);
+	for (auto it = scc_begin(&CG); !it.isAtEnd(); ++it) {
+		sccs.push_back(*it);
+	}
+
+	std::map<Function*, double> estimated;
+	std::map<Function*, uint64_t> numCalls;
+	for (auto scc = sccs.rbegin(); scc != sccs.rend(); ++scc) {
+		std::set<Function*> inCycle;
+		for (auto node : *scc) {
+			inCycle.insert(node->getFunction());
+		}
+
+		for (auto node : *scc) {
+			Function* F = node->getFunction();
+			if (!F || F->isDeclaration()) {
+				continue;
+			}
+
+			uint64_t calls = (estimated[F] > 0.0) ? (uint64_t)(estimated[F] + 0.5) : 1;
+			auto found = callCounts.find(F->getName().str());
+			if (found != callCounts.end()) {
+				calls = found->second;
+			} else {
+				auto EC = F->getEntryCount();
+				if (EC.hasValue()) {
+					calls = EC.getCount();
+				}
+			}
+			numCalls[F] = calls;
+
+			for (auto& callRecord : *node) {
+				Function* calledF = callRecord.second->getFunction();
+				Instruction* callInst = dyn_cast_or_null<Instruction>((Value*)callRecord.first);
+				if (!calledF || !callInst || inCycle.count(calledF)) {
+					continue;
+				}
+				estimated[calledF] += calls * blockFreqs[callInst->getParent()];
+			}
+		}
+	}
+
+	for (auto& F : M) {
+		if (F.isDeclaration()) {
+			continue;
+		}
+
+		FunctionCost& cost = costs[&F];
+		cost.calls = numCalls[&F];
+		cost.base = cost.extra = cost.otherExtra = 0.0;
+		for (auto& bb : F) {
+			double freq = cost.calls * blockFreqs[&bb];
+			unsigned numInsts = 0, numCloned = 0, numSyncs = 0;
+			for (auto& I : bb) {
+				if (isa<DbgInfoIntrinsic>(I)) {
+					continue;
+				}
+				numInsts++;
+
+				if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					Function* calledF = CI->getCalledFunction();
+					if (calledF && calledF->isDeclaration() && !calledF->isIntrinsic()) {
+						numSyncs++;
+					}
+				} else if (I.isTerminator()) {
+					if ((I.getNumOperands() > 0) && !isa<BranchInst>(I)) {
+						numSyncs++;
+					} else if (BranchInst* BI = dyn_cast<BranchInst>(&I)) {
+						if (BI->isConditional()) {
+							numSyncs++;
+						}
+					}
+				} else {
+					numCloned++;
+					if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+						if (storeDataSyncFlag || noMemReplicationFlag) {
+							numSyncs++;
+						}
+						Value* ptr = SI->getPointerOperand()->stripInBoundsOffsets();
+						if (GlobalVariable* gv = dyn_cast<GlobalVariable>(ptr)) {
+							cost.globalStores[gv] += freq;
+						}
+					}
+				}
+			}
+			cost.base += freq * numInsts;
+			cost.extra += freq * (numCloned * (numClones - 1) + numSyncs * syncCost);
+			cost.otherExtra += freq * (numCloned * (otherClones - 1) + numSyncs * otherSyncCost);
+		}
+		totalBase += cost.base;
+
+		// already decided by the user
+		if ((fnsToClone.find(&F) != fnsToClone.end()) ||
+				(fnsToSkip.find(&F) != fnsToSkip.end()) || isISR(F) ||
+				isCoarseGrainedFunction(F.getName())) {
+			continue;
+		}
+		candidates.push_back(&F);
+	}
+	std::set<Function*> planned(candidates.begin(), candidates.end());
+
+	// most coverage for the overhead first
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[&costs](Function* a, Function* b) {
+			return costs[a].base * costs[b].extra > costs[b].base * costs[a].extra;
+	});
+
+	// globals the plan leaves unprotected
+	std::set<GlobalVariable*> skippedGlobals;
+	// what the protected functions add, with either technique
+	auto planCost = [&](bool other) {
+		double total = 0.0;
+		for (auto F : fnsToClone) {
+			auto found = costs.find(F);
+			if (found == costs.end()) {
+				continue;
+			}
+			total += other ? found->second.otherExtra : found->second.extra;
+			for (auto& stores : found->second.globalStores) {
+				if (skippedGlobals.find(stores.first) != skippedGlobals.end()) {
+					total += stores.second * (other ? otherSyncCost : syncCost);
+				}
+			}
+		}
+		return total;
+	};
+
+	double allowed = (overheadBudgetOpt - 1.0) * totalBase;
+	double spent = planCost(false);
+	for (auto F : candidates) {
+		if ((spent + costs[F].extra) <= allowed) {
+			spent += costs[F].extra;
+			fnsToClone.insert(F);
+		} else {
+			fnsToSkip.insert(F);
+		}
+	}
+
+	// functions moved in or out of scope because of the globals they use
+	std::set<Function*> promoted, demoted;
+	std::set<GlobalVariable*> userGlobals = globalsToClone;
+	bool consistent = false;
+	while (true) {
+		// the globals populateValuesToClone() will protect
+		for (auto& g : M.globals()) {
+			if (xMR_default && globalCanBeCloned(g)) {
+				globalsToClone.insert(&g);
+			}
+		}
+		std::set<CrossingRecordType> crossings;
+		consistent = checkGlobalScope(M, crossings);
+		globalsToClone = userGlobals;
+
+		bool changed = false;
+		for (auto& crossing : crossings) {
+			GlobalVariable* gv = std::get<0>(crossing);
+			Function* F = std::get<1>(crossing);
+			bool isPlanned = (planned.find(F) != planned.end());
+
+			if (std::get<2>(crossing)) {
+				// protected global used outside of the scope
+				if (userGlobals.find(gv) == userGlobals.end()) {
+					if (globalsToSkip.insert(gv).second) {
+						skippedGlobals.insert(gv);
+						changed = true;
+					}
+				} else if (isPlanned && (fnsToClone.find(F) == fnsToClone.end())) {
+					fnsToSkip.erase(F);
+					fnsToClone.insert(F);
+					demoted.erase(F);
+					promoted.insert(F);
+					changed = true;
+				}
+			} else if (isPlanned && (fnsToClone.find(F) != fnsToClone.end()) &&
+					(promoted.find(F) == promoted.end())) {
+				// unprotected global used the wrong way inside of the scope
+				fnsToClone.erase(F);
+				fnsToSkip.insert(F);
+				demoted.insert(F);
+				changed = true;
+			}
+		}
+		if (changed) {
+			continue;
+		}
+		if (!consistent) {
+			break;
+		}
+
+		// leaving out globals costs sync points, so it might not fit anymore
+		spent = planCost(false);
+		if (spent <= allowed) {
+			break;
+		}
+		Function* worst = nullptr;
+		for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+			if ((fnsToClone.find(*it) != fnsToClone.end()) && (promoted.find(*it) == promoted.end())) {
+				worst = *it;
+				break;
+			}
+		}
+		if (!worst) {
+			break;
+		}
+		fnsToClone.erase(worst);
+		fnsToSkip.insert(worst);
+	}
+	spent = planCost(false);
+
+	errs() << info_string << " Protection plan for an overhead budget of "
+		   << format("%.2f", (double)overheadBudgetOpt) << "x:\n";
+	for (auto F : candidates) {
+		bool protect = (fnsToClone.find(F) != fnsToClone.end());
+		FunctionCost& c = costs[F];
+		errs() << "  " << (protect ? "protect " : "skip    ") << F->getName()
+			   << " (calls: " << c.calls
+			   << ", instructions: " << format("%.0f", c.base)
+			   << ", added: " << format("%.0f", c.extra) << ")";
+		if ((promoted.find(F) != promoted.end()) || (demoted.find(F) != demoted.end())) {
+			errs() << " to keep globals in scope";
+		}
+		errs() << "\n";
+	}
+	for (auto gv : skippedGlobals) {
+		errs() << "  unprotected global " << gv->getName() << "\n";
+	}
+
+	double predicted = (totalBase > 0.0) ? (totalBase + spent) / totalBase : 1.0;
+	double otherPredicted = (totalBase > 0.0) ? (totalBase + planCost(true)) / totalBase : 1.0;
+	errs() << "  Predicted overhead: " << format("%.2f", predicted) << "x ("
+		   << format("%.2f", otherPredicted) << "x with " << ((otherClones == 3) ? "TMR" : "DWC")
+		   << " instead)\n";
+	if (!consistent) {
+		errs() << warn_string << " the plan still uses globals across the scope boundary, "
+			   << "see the errors below\n";
+	} else if (spent > allowed) {
+		errs() << warn_string << " what the user asked to protect already goes over the budget\n";
+	}
+}
+
+
 void dataflowProtection::processCommandLine(Module& M, int numClones) {
 	if (InterleaveFlag == SegmentFlag) {
 		SegmentFlag = true;
@@ -256,6 +635,25 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 		exit(-1);
 	}
 
+	if (TMR && (deferChecksOpt != DeferNone)) {
+		errs() << warn_string << " deferChecks only applies to DWC, ignoring it.\n";
+		deferChecksOpt = DeferNone;
+	}
+
+	if (TMR && rollbackFlag) {
+		errs() << warn_string << " rollback only applies to DWC, ignoring it.\n";
+		rollbackFlag = false;
+	}
+
+	if (!TMR && threadCountersFlag) {
+		errs() << warn_string << " threadCounters only applies to TMR, ignoring it.\n";
+		threadCountersFlag = false;
+	}
+
+	if (TMR && profileSyncsFlag && !ReportErrorsFlag) {
+		errs() << info_string << " profileSyncs only counts corrections with -countErrors.\n";
+	}
+
 	// Parse information from config file
 	if (getFunctionsFromConfig()) {
 		assert("Configuration file error!" && false);
@@ -265,6 +663,11 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 	// This should be able to override config file
 	getFunctionsFromCL();
 
+	if (TMR && (rmtFnList.size() > 0)) {
+		errs() << warn_string << " rmtFns only applies to DWC, ignoring it.\n";
+		rmtFnList.clear();
+	}
+
 	// convert function names to actual pointers
 	for (Function & F : M) {
 		if (std::find(isrFuncNameList.begin(), isrFuncNameList.end(), F.getName()) != isrFuncNameList.end()) {
@@ -289,38 +692,25 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 	// more useful missing function information
 	std::set<std::string> missingFuncNames;
 
-	if (skipFn.size() == 0) {
-		for (auto & fn_it : M) {
-
-			// Ignore library calls
-			if (fn_it.isDeclaration()) {
-				continue;
-			}
-
-			// Don't erase ISRs
-			if (isISR(fn_it)) {
-				continue;
-			}
-
-			if (xMR_default) {
-				if (fnsToSkip.find(&fn_it) == fnsToSkip.end()) {
-					// This should yield to the fnsToSkip list, as it
-					//  should be fully populated by now
-					fnsToClone.insert(&fn_it);
-				}
-			}
+	for (auto fcn : skipFn) {
+		Function* f = M.getFunction(StringRef(fcn));
+		if (!f) {
+			// If the name doesn't exist, stick it in a list for later
+			// This way, we can report missing ones all at once
+			missingFuncNames.insert(fcn);
+			continue;
 		}
-	} else {
-		for (auto fcn : skipFn) {
-			Function* f = M.getFunction(StringRef(fcn));
-			if (!f) {
-				// If the name doesn't exist, stick it in a list for later
-				// This way, we can report missing ones all at once
-				missingFuncNames.insert(fcn);
-				continue;
-			}
-			fnsToSkip.insert(f);
+		fnsToSkip.insert(f);
+	}
+
+	// functions checked by a trailing thread, see outlineRMTFunctions()
+	for (auto fcn : rmtFnList) {
+		Function* f = M.getFunction(StringRef(fcn));
+		if (!f) {
+			missingFuncNames.insert(fcn);
+			continue;
 		}
+		rmtFns.insert(f);
 	}
 
 	// Report missing function names from command line
@@ -357,6 +747,34 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 		exit(-1);
 	}
 
+	// the profile decides the rest of the scope, once the user's choices are all known
+	if (overheadBudgetOpt > 0.0) {
+		planProtectionBudget(M, numClones);
+	}
+
+	if (skipFn.size() == 0) {
+		for (auto & fn_it : M) {
+
+			// Ignore library calls
+			if (fn_it.isDeclaration()) {
+				continue;
+			}
+
+			// Don't erase ISRs
+			if (isISR(fn_it)) {
+				continue;
+			}
+
+			if (xMR_default) {
+				if (fnsToSkip.find(&fn_it) == fnsToSkip.end()) {
+					// This should yield to the fnsToSkip list, as it
+					//  should be fully populated by now
+					fnsToClone.insert(&fn_it);
+				}
+			}
+		}
+	}
+
 	// special case
 	ignoreGlbl.push_back(tmr_global_count_name);
 }
@@ -480,6 +898,10 @@ void dataflowProtection::processAnnotations(Module& M) {
 					} else if (anno == xMR_anno) {
 						if (verboseFlag) errs() << "Directive: clone global variable '" << gv->getName() << "'\n";
 						globalsToClone.insert(gv);
+					} else if (anno == parity_anno) {
+						if (verboseFlag) errs() << "Directive: protect global variable '" << gv->getName() << "' with parity\n";
+						globalsToClone.insert(gv);
+						parityGlobals.insert(gv);
 					} else if (anno == default_xMR) {
 						if (verboseFlag) errs() << "Directive: set xMR as default\n";
 					} else if (anno == default_no_xMR) {
@@ -0,0 +1,521 @@
+/*
+ * multithreading.cpp
+ *
+ * This file contains the redundant multithreading (RMT) mode of dataflowProtection.
+ * Instead of interleaving the copies of a function on one core, the original
+ *  runs ahead in the application's thread, and a trailing copy checks it from
+ *  a second thread.  The run-time support is in tests/COAST_rmt.c.
+ */
+
+#include "dataflowProtection.h"
+
+#include <vector>
+#include <string>
+#include <set>
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "dataflowProtection"
+
+STATISTIC(NumFnsOutlined, "Number of functions checked by a trailing thread");
+STATISTIC(NumRMTChecks, "Number of values compared by a trailing thread");
+STATISTIC(NumRMTDrains, "Number of places that wait for the trailing thread to catch up");
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+
+// names of the run-time functions in COAST_rmt.c
+static const std::string rmt_prefix = "__COAST_rmt_";
+
+
+//----------------------------------------------------------------------------//
+// Queue helpers
+//----------------------------------------------------------------------------//
+/*
+ * Everything goes through the queue as a 64-bit word, so only values which
+ *  fit in one can be exchanged.
+ */
+static bool isQueueType(Type* t) {
+	if (t->isPointerTy() || t->isFloatTy() || t->isDoubleTy())
+		return true;
+	return t->isIntegerTy() && (t->getIntegerBitWidth() <= 64);
+}
+
+static Value* toQueueWord(IRBuilder<>& builder, Value* v) {
+	Type* i64 = builder.getInt64Ty();
+	Type* t = v->getType();
+
+	if (t->isPointerTy())
+		return builder.CreatePtrToInt(v, i64);
+	if (t->isDoubleTy())
+		return builder.CreateBitCast(v, i64);
+	if (t->isFloatTy())
+		v = builder.CreateBitCast(v, builder.getInt32Ty());
+	return builder.CreateZExtOrBitCast(v, i64);
+}
+
+static Value* fromQueueWord(IRBuilder<>& builder, Value* word, Type* t) {
+	if (t->isPointerTy())
+		return builder.CreateIntToPtr(word, t);
+	if (t->isDoubleTy())
+		return builder.CreateBitCast(word, t);
+	if (t->isFloatTy())
+		return builder.CreateBitCast(builder.CreateTrunc(word, builder.getInt32Ty()), t);
+	return builder.CreateTruncOrBitCast(word, t);
+}
+
+/*
+ * Each thread has its own stack, so the two copies of a function see different
+ *  addresses for their local variables.  Finds what a pointer is based on,
+ *  and returns true if any of it is on the stack.  If only some of it is,
+ *  mixed is set too.
+ */
+static bool isStackAddress(Value* ptr, bool& mixed) {
+	std::set<Value*> seen;
+	std::vector<Value*> worklist = {ptr};
+	unsigned numStack = 0, numOther = 0;
+
+	while (!worklist.empty()) {
+		Value* v = worklist.back();
+		worklist.pop_back();
+		if (!seen.insert(v).second)
+			continue;
+
+		if (GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(v)) {
+			worklist.push_back(GEP->getPointerOperand());
+		} else if (isa<BitCastInst>(v) || isa<AddrSpaceCastInst>(v)) {
+			worklist.push_back(cast<Instruction>(v)->getOperand(0));
+		} else if (PHINode* PN = dyn_cast<PHINode>(v)) {
+			for (auto& in : PN->incoming_values())
+				worklist.push_back(in);
+		} else if (SelectInst* SI = dyn_cast<SelectInst>(v)) {
+			worklist.push_back(SI->getTrueValue());
+			worklist.push_back(SI->getFalseValue());
+		} else if (isa<AllocaInst>(v)) {
+			numStack++;
+		} else {
+			numOther++;
+		}
+	}
+
+	mixed = numStack && numOther;
+	return numStack > 0;
+}
+
+static bool isStackAddress(Value* ptr) {
+	bool mixed;
+	return ptr->getType()->isPointerTy() && isStackAddress(ptr, mixed);
+}
+
+static Function* getRMTRuntimeFunction(Module& M, std::string name, Type* retType,
+		ArrayRef<Type*> params) {
+	if (Function* existing = M.getFunction(rmt_prefix + name))
+		return existing;
+	return Function::Create(FunctionType::get(retType, params, false),
+			GlobalValue::ExternalLinkage, rmt_prefix + name, &M);
+}
+
+
+//----------------------------------------------------------------------------//
+// Outlining the trailing copy
+//----------------------------------------------------------------------------//
+/*
+ * Calls to external functions that don't touch memory (like sqrt()) are made
+ *  by both copies.  Every other call is only made by the leading copy.
+ */
+static bool isRecomputedCall(CallInst* CI) {
+	Function* calledF = CI->getCalledFunction();
+	return calledF && calledF->isDeclaration() && CI->doesNotAccessMemory();
+}
+
+/*
+ * Returns true if I is seen by both copies without going through the queue.
+ */
+static bool isIgnoredInst(Instruction* I) {
+	if (isa<DbgInfoIntrinsic>(I))
+		return true;
+	if (IntrinsicInst* II = dyn_cast<IntrinsicInst>(I)) {
+		return (II->getIntrinsicID() == Intrinsic::lifetime_start) ||
+				(II->getIntrinsicID() == Intrinsic::lifetime_end);
+	}
+	return false;
+}
+
+/*
+ * The trailing copy can only replay the leading one if everything that comes
+ *  into the function goes through the queue, so all of its memory accesses,
+ *  and the values passed to and returned from other functions, have to fit in
+ *  a queue word.
+ * Local variables aren't exchanged, so their addresses can't leave the function
+ *  or be compared, and a pointer can't be to the stack only some of the time.
+ */
+bool dataflowProtection::canRunRMT(Function& F) {
+	auto reject = [&F, this](std::string reason) {
+		errs() << warn_string << " can't check '" << F.getName() << "' with a trailing thread, "
+				<< reason << ", it will be replicated instead\n";
+		return false;
+	};
+
+	if (F.isDeclaration())
+		return reject("it is not defined in this module");
+	if (F.isVarArg() || (F.getName() == "main") || isISR(F))
+		return reject("it is variadic, main(), or an ISR");
+
+	if (!F.getReturnType()->isVoidTy() && !isQueueType(F.getReturnType()))
+		return reject("its return type is not supported");
+	for (auto& arg : F.args()) {
+		if (!isQueueType(arg.getType()))
+			return reject("the type of argument " + std::to_string(arg.getArgNo()) + " is not supported");
+	}
+
+	for (auto& bb : F) {
+		for (auto& I : bb) {
+			if (isIgnoredInst(&I))
+				continue;
+
+			if (isa<InvokeInst>(&I))
+				return reject("it uses invoke");
+			if (I.isAtomic() || isa<IndirectBrInst>(&I))
+				return reject("it has atomic instructions or indirect branches");
+
+			if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+				if (CI->isInlineAsm() || CI->isMustTailCall())
+					return reject("it has inline assembly or musttail calls");
+				if (isRecomputedCall(CI))
+					continue;
+				if (!CI->getType()->isVoidTy() && !isQueueType(CI->getType()))
+					return reject("it calls a function whose return type is not supported");
+				for (auto& arg : CI->arg_operands()) {
+					if (!isQueueType(arg->getType()) || isStackAddress(arg))
+						return reject("it passes values of unsupported types, or the address of a local variable, to other functions");
+				}
+			} else if (LoadInst* LI = dyn_cast<LoadInst>(&I)) {
+				if (LI->isVolatile() || !isQueueType(LI->getType()))
+					return reject("it has volatile loads, or loads of unsupported types");
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+				if (SI->isVolatile() || !isQueueType(SI->getValueOperand()->getType()))
+					return reject("it has volatile stores, or stores of unsupported types");
+				if (isStackAddress(SI->getValueOperand()))
+					return reject("it stores the address of a local variable");
+			} else if (ReturnInst* RI = dyn_cast<ReturnInst>(&I)) {
+				if (RI->getReturnValue() && isStackAddress(RI->getReturnValue()))
+					return reject("it returns the address of a local variable");
+			} else if (isa<PtrToIntInst>(&I) || isa<ICmpInst>(&I)) {
+				for (auto& op : I.operands()) {
+					if (isStackAddress(op))
+						return reject("it compares or converts the address of a local variable");
+				}
+			}
+
+			bool mixed = false;
+			if (isa<LoadInst>(&I) || isa<StoreInst>(&I))
+				isStackAddress(getLoadStorePointerOperand(&I), mixed);
+			if (mixed)
+				return reject("it has pointers that are only sometimes to local variables");
+		}
+	}
+	return true;
+}
+
+/*
+ * With -rmtFns, the listed functions are not replicated.  The original runs
+ *  once, and pushes its arguments and the values it loads into a queue.
+ * A trailing copy, run by a worker thread, pops these in the same order.  It
+ *  uses the loaded values instead of reading memory (which the leading copy may
+ *  have changed again by then), and doesn't store anything.
+ * The queue only carries comparisons at the sync points: stores, calls and
+ *  returns.  Everything else that has to match (load addresses and branch
+ *  conditions), along with the values at the sync point, is folded into a
+ *  signature by each copy.  At the sync point, the leading copy pushes its
+ *  signature, and the trailing copy compares it with its own.
+ * Calls are only made by the leading copy, and their results are pushed.  If
+ *  the callee (or anything it calls) is also in -rmtFns, its trailing copy is
+ *  pushed in between, and the trailing thread runs it where the call was.
+ * Local variables are the exception: each copy has its own on its own stack, so
+ *  their loads and stores are left alone on both sides.  An error in one of them
+ *  is found when the value reaches something that is compared.
+ * The leading copy runs at close to its original speed, as long as there is
+ *  another core for the trailing one.  It only has to wait before its results
+ *  become visible outside of the program, see insertRMTChecks().
+ */
+void dataflowProtection::outlineRMTFunctions(Module& M) {
+	unsigned numOutlined = 0;
+
+	for (auto F : rmtFns) {
+		if (!canRunRMT(*F))
+			continue;
+
+		Function* trailF = createTrailingFunction(M, F);
+
+		// both are outside of the sphere of replication from now on,
+		//  calls to F sync on their arguments like any other unprotected function
+		fnsToClone.erase(F);
+		fnsToSkip.insert(F);
+		fnsToSkip.insert(trailF);
+		numOutlined++;
+	}
+
+	NumFnsOutlined += numOutlined;
+	if (verboseFlag && numOutlined)
+		errs() << info_string << " Checking " << numOutlined << " functions with a trailing thread\n";
+}
+
+/*
+ * Creates the trailing copy of F, which takes no arguments, and adds the
+ *  pushes to F itself.
+ */
+Function* dataflowProtection::createTrailingFunction(Module& M, Function* F) {
+	LLVMContext& C = M.getContext();
+	Type* t_void = Type::getVoidTy(C);
+	Type* i64 = Type::getInt64Ty(C);
+
+	FunctionType* trailType = FunctionType::get(t_void, false);
+	Function* trailF = Function::Create(trailType, GlobalValue::InternalLinkage,
+			F->getName() + ".trail", &M);
+
+	Function* beginFn = getRMTRuntimeFunction(M, "begin", t_void, {PointerType::getUnqual(trailType)});
+	Function* pushFn = getRMTRuntimeFunction(M, "push", t_void, {i64});
+	Function* popFn = getRMTRuntimeFunction(M, "pop", i64, {});
+	Function* callFn = getRMTRuntimeFunction(M, "call", t_void, {});
+
+	// the arguments come from the queue
+	ValueToValueMapTy VMap;
+	BasicBlock* argBB = BasicBlock::Create(C, "entry", trailF);
+	IRBuilder<> argBuilder(argBB);
+	AllocaInst* trailSig = argBuilder.CreateAlloca(i64, nullptr, "rmtSig");
+	argBuilder.CreateStore(argBuilder.getInt64(0), trailSig);
+	for (auto& arg : F->args()) {
+		Value* word = argBuilder.CreateCall(popFn);
+		VMap[&arg] = fromQueueWord(argBuilder, word, arg.getType());
+	}
+
+	// the rest is a copy of the body
+	for (auto& bb : *F) {
+		VMap[&bb] = CloneBasicBlock(&bb, VMap, "", trailF);
+	}
+	for (auto& bb : *trailF) {
+		for (auto& I : bb) {
+			RemapInstruction(&I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+		}
+	}
+	BasicBlock* trailEntry = cast<BasicBlock>(VMap[&F->getEntryBlock()]);
+	BranchInst::Create(trailEntry, argBB);
+
+	// the debug information belongs to F
+	std::vector<Instruction*> dbgInsts;
+	for (auto& bb : *trailF) {
+		for (auto& I : bb) {
+			if (isa<DbgInfoIntrinsic>(&I))
+				dbgInsts.push_back(&I);
+			else
+				I.setDebugLoc(DebugLoc());
+		}
+	}
+	for (auto I : dbgInsts)
+		I->eraseFromParent();
+
+	// find everything that changes the queue or the signature before changing anything
+	std::vector<Instruction*> exchanges;
+	for (auto& bb : *F) {
+		for (auto& I : bb) {
+			if (isa<LoadInst>(&I) || isa<StoreInst>(&I)) {
+				// each copy has its own local variables
+				if (!isStackAddress(getLoadStorePointerOperand(&I)))
+					exchanges.push_back(&I);
+			} else if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+				if (!isIgnoredInst(CI) && !isRecomputedCall(CI))
+					exchanges.push_back(&I);
+			} else if (isa<SwitchInst>(&I) || isa<ReturnInst>(&I)) {
+				exchanges.push_back(&I);
+			} else if (BranchInst* BI = dyn_cast<BranchInst>(&I)) {
+				if (BI->isConditional())
+					exchanges.push_back(&I);
+			}
+		}
+	}
+
+	// F now writes to memory, even if it didn't before
+	F->removeFnAttr(Attribute::ReadNone);
+	F->removeFnAttr(Attribute::ReadOnly);
+	F->removeFnAttr(Attribute::ArgMemOnly);
+
+	std::vector<Instruction*>& checks = rmtChecks[trailF];
+	auto push = [pushFn](IRBuilder<>& builder, Value* v) {
+		builder.CreateCall(pushFn, {toQueueWord(builder, v)});
+	};
+	auto pop = [popFn](IRBuilder<>& builder, Type* t) {
+		return fromQueueWord(builder, builder.CreateCall(popFn), t);
+	};
+	// the signature is rotated each time, so it also depends on the order
+	auto fold = [](IRBuilder<>& builder, AllocaInst* sig, Value* v) {
+		Value* old = builder.CreateLoad(sig->getAllocatedType(), sig);
+		Value* rotated = builder.CreateOr(builder.CreateShl(old, 1), builder.CreateLShr(old, 63));
+		builder.CreateStore(builder.CreateXor(rotated, toQueueWord(builder, v)), sig);
+	};
+	auto check = [popFn, &checks](IRBuilder<>& builder, AllocaInst* sig) {
+		Value* word = builder.CreateCall(popFn);
+		Value* mine = builder.CreateLoad(sig->getAllocatedType(), sig);
+		Value* cmp = builder.CreateICmpEQ(mine, word, "rmtCheck");
+		checks.push_back(cast<Instruction>(cmp));
+	};
+
+	// the pushes and pops have to happen in the same order on both sides
+	IRBuilder<> leadBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+	AllocaInst* leadSig = leadBuilder.CreateAlloca(i64, nullptr, "rmtSig");
+	leadBuilder.CreateStore(leadBuilder.getInt64(0), leadSig);
+	leadBuilder.CreateCall(beginFn, {trailF});
+	for (auto& arg : F->args())
+		push(leadBuilder, &arg);
+
+	for (auto I : exchanges) {
+		Instruction* trailI = cast<Instruction>(VMap[I]);
+		IRBuilder<> trailBuilder(trailI);
+		leadBuilder.SetInsertPoint(I);
+
+		if (LoadInst* LI = dyn_cast<LoadInst>(I)) {
+			fold(leadBuilder, leadSig, LI->getPointerOperand());
+			leadBuilder.SetInsertPoint(LI->getNextNode());
+			push(leadBuilder, LI);
+
+			fold(trailBuilder, trailSig, cast<LoadInst>(trailI)->getPointerOperand());
+			trailI->replaceAllUsesWith(pop(trailBuilder, trailI->getType()));
+			trailI->eraseFromParent();
+		} else if (StoreInst* SI = dyn_cast<StoreInst>(I)) {
+			StoreInst* trailSI = cast<StoreInst>(trailI);
+			fold(leadBuilder, leadSig, SI->getPointerOperand());
+			fold(leadBuilder, leadSig, SI->getValueOperand());
+			push(leadBuilder, leadBuilder.CreateLoad(i64, leadSig));
+
+			fold(trailBuilder, trailSig, trailSI->getPointerOperand());
+			fold(trailBuilder, trailSig, trailSI->getValueOperand());
+			check(trailBuilder, trailSig);
+			trailSI->eraseFromParent();
+		} else if (CallInst* CI = dyn_cast<CallInst>(I)) {
+			CallInst* trailCI = cast<CallInst>(trailI);
+			if (!CI->getCalledFunction()) {
+				fold(leadBuilder, leadSig, CI->getCalledValue());
+				fold(trailBuilder, trailSig, trailCI->getCalledValue());
+			}
+			for (unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+				fold(leadBuilder, leadSig, CI->getArgOperand(i));
+				fold(trailBuilder, trailSig, trailCI->getArgOperand(i));
+			}
+			push(leadBuilder, leadBuilder.CreateLoad(i64, leadSig));
+			check(trailBuilder, trailSig);
+
+			// a zero marks the end of the call, anything before that is a trailing copy to run
+			CI->setTailCall(false);
+			leadBuilder.SetInsertPoint(CI->getNextNode());
+			push(leadBuilder, leadBuilder.getInt64(0));
+			trailBuilder.CreateCall(callFn);
+			if (!CI->getType()->isVoidTy()) {
+				push(leadBuilder, CI);
+				trailCI->replaceAllUsesWith(pop(trailBuilder, trailCI->getType()));
+			}
+			trailCI->eraseFromParent();
+		} else if (ReturnInst* RI = dyn_cast<ReturnInst>(I)) {
+			if (RI->getReturnValue()) {
+				fold(leadBuilder, leadSig, RI->getReturnValue());
+				fold(trailBuilder, trailSig, cast<ReturnInst>(trailI)->getReturnValue());
+			}
+			push(leadBuilder, leadBuilder.CreateLoad(i64, leadSig));
+
+			check(trailBuilder, trailSig);
+			ReplaceInstWithInst(trailI, ReturnInst::Create(C));
+		} else if (BranchInst* BI = dyn_cast<BranchInst>(I)) {
+			fold(leadBuilder, leadSig, BI->getCondition());
+			fold(trailBuilder, trailSig, cast<BranchInst>(trailI)->getCondition());
+		} else if (SwitchInst* SW = dyn_cast<SwitchInst>(I)) {
+			fold(leadBuilder, leadSig, SW->getCondition());
+			fold(trailBuilder, trailSig, cast<SwitchInst>(trailI)->getCondition());
+		}
+	}
+
+	// the static allocas go back into the entry block
+	MergeBlockIntoPredecessor(trailEntry);
+
+	// keep the signatures in registers
+	DominatorTree leadDT(*F);
+	PromoteMemToReg({leadSig}, leadDT);
+	DominatorTree trailDT(*trailF);
+	PromoteMemToReg({trailSig}, trailDT);
+
+	return trailF;
+}
+
+
+//----------------------------------------------------------------------------//
+// Checking and waiting
+//----------------------------------------------------------------------------//
+/*
+ * The comparisons in the trailing functions branch to the DWC error handler,
+ *  which has to be set up first.
+ * The leading thread also waits for the trailing one to catch up before anything
+ *  can leave the program: before every call to an external function (including
+ *  exit() and output), and before main() returns.
+ */
+void dataflowProtection::insertRMTChecks(Module& M) {
+	if (rmtChecks.empty())
+		return;
+
+	unsigned numChecks = 0;
+	for (auto& fnChecks : rmtChecks) {
+		BasicBlock* errBlock = errBlockMap[fnChecks.first];
+		for (auto cmp : fnChecks.second) {
+			splitBlocks(cmp, errBlock);
+			numChecks++;
+		}
+	}
+
+	std::vector<Instruction*> drainPoints;
+	for (auto& F : M) {
+		if (F.isDeclaration() || (rmtChecks.find(&F) != rmtChecks.end()))
+			continue;
+
+		for (auto& bb : F) {
+			for (auto& I : bb) {
+				if (isa<ReturnInst>(&I)) {
+					if (F.getName() == "main")
+						drainPoints.push_back(&I);
+					continue;
+				}
+
+				Function* calledF;
+				if (CallInst* CI = dyn_cast<CallInst>(&I))
+					calledF = CI->getCalledFunction();
+				else if (InvokeInst* II = dyn_cast<InvokeInst>(&I))
+					calledF = II->getCalledFunction();
+				else
+					continue;
+
+				// indirect calls and inline assembly could go anywhere
+				if (calledF && (!calledF->isDeclaration() || calledF->isIntrinsic() ||
+						calledF->getName().startswith(rmt_prefix)))
+					continue;
+				drainPoints.push_back(&I);
+			}
+		}
+	}
+
+	Function* drainFn = getRMTRuntimeFunction(M, "drain", Type::getVoidTy(M.getContext()), {});
+	for (auto I : drainPoints)
+		CallInst::Create(drainFn, "", I);
+
+	NumRMTChecks += numChecks;
+	NumRMTDrains += drainPoints.size();
+	if (verboseFlag)
+		errs() << info_string << " Added " << numChecks << " trailing thread checks, and waits for them at "
+				<< drainPoints.size() << " places\n";
+}
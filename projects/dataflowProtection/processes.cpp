@@ -0,0 +1,138 @@
+/*
+ * processes.cpp
+ *
+ * This file contains the -PLR pass, which gets a program ready to run as several
+ *  redundant processes.  The code itself is not replicated, only the library
+ *  calls that talk to the outside world are redirected to the run-time support
+ *  in tests/COAST_plr.c, which votes on them across the processes.
+ */
+
+#include "dataflowProtection.h"
+
+#include <set>
+#include <map>
+#include <list>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "dataflowProtection"
+
+STATISTIC(NumPLRCalls, "Number of library calls redirected to the process-level redundancy run-time");
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::list<std::string> skipLibCalls;
+
+// names of the run-time functions in COAST_plr.c
+static const std::string plr_prefix = "__COAST_plr_";
+
+// the library calls that COAST_plr.c has a wrapper for
+static const std::set<std::string> plrWrappedCalls = {
+	"printf", "fprintf", "puts", "putchar", "fwrite", "write",
+	"exit", "time", "clock", "getchar", "fgets", "read"
+};
+
+
+//----------------------------------------------------------------------------//
+// Process-level redundancy
+//----------------------------------------------------------------------------//
+/*
+ * The calls that -TMR and -DWC only make once (skipLibCalls, from the command
+ *  line and the configuration file) are the ones that the processes have to
+ *  agree on.  Any of them with a wrapper in the run-time are redirected to it.
+ * The replicas are started at the beginning of main(), and vote on the exit
+ *  code when it returns.
+ */
+bool dataflowProtection::runPLR(Module& M, int numReplicas) {
+	if (getFunctionsFromConfig()) {
+		errs() << warn_string << " only using the skipLibCalls from the command line\n";
+	}
+	getFunctionsFromCL();
+
+	Function* mainF = M.getFunction("main");
+	if (!mainF || mainF->isDeclaration()) {
+		errs() << err_string << " -PLR needs main() to start the replicas\n";
+		return false;
+	}
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	FunctionType* intFnType = FunctionType::get(Type::getVoidTy(C), {i32}, false);
+
+	Function* initFn = M.getFunction(plr_prefix + "init");
+	if (!initFn)
+		initFn = Function::Create(intFnType, GlobalValue::ExternalLinkage, plr_prefix + "init", &M);
+	Function* exitFn = M.getFunction(plr_prefix + "exit");
+	if (!exitFn)
+		exitFn = Function::Create(intFnType, GlobalValue::ExternalLinkage, plr_prefix + "exit", &M);
+
+	// the wrappers have the same signature as what they wrap
+	std::map<Function*, Function*> wrappers;
+	for (auto name : skipLibCalls) {
+		if (plrWrappedCalls.find(name) == plrWrappedCalls.end())
+			continue;
+		Function* libF = M.getFunction(name);
+		if (!libF || !libF->isDeclaration())
+			continue;
+
+		Function* wrapperF = M.getFunction(plr_prefix + name);
+		if (!wrapperF) {
+			wrapperF = Function::Create(libF->getFunctionType(), GlobalValue::ExternalLinkage,
+					plr_prefix + name, &M);
+		}
+		if (wrapperF->getFunctionType() != libF->getFunctionType()) {
+			errs() << warn_string << " '" << name << "' has an unexpected type, not redirecting it\n";
+			continue;
+		}
+		wrappers[libF] = wrapperF;
+	}
+
+	unsigned numRedirected = 0;
+	for (auto& F : M) {
+		for (auto& bb : F) {
+			for (auto& I : bb) {
+				CallInst* CI = dyn_cast<CallInst>(&I);
+				if (!CI || !CI->getCalledFunction())
+					continue;
+				auto found = wrappers.find(CI->getCalledFunction());
+				if (found != wrappers.end()) {
+					CI->setCalledFunction(found->second);
+					numRedirected++;
+				}
+			}
+		}
+	}
+
+	// start the replicas before anything else happens
+	Instruction* first = &*mainF->getEntryBlock().getFirstInsertionPt();
+	CallInst::Create(initFn, {ConstantInt::get(i32, numReplicas)}, "", first);
+
+	// returning from main() is the same as calling exit()
+	std::vector<ReturnInst*> returns;
+	for (auto& bb : *mainF) {
+		if (ReturnInst* RI = dyn_cast<ReturnInst>(bb.getTerminator()))
+			returns.push_back(RI);
+	}
+	for (auto RI : returns) {
+		Value* code = RI->getReturnValue();
+		if (code && code->getType()->isIntegerTy())
+			code = CastInst::CreateIntegerCast(code, i32, true, "", RI);
+		else
+			code = ConstantInt::get(i32, 0);
+		CallInst::Create(exitFn, {code}, "", RI);
+	}
+
+	NumPLRCalls += numRedirected;
+	if (verboseFlag)
+		errs() << info_string << " Redirected " << numRedirected << " library calls to the PLR run-time\n";
+	return true;
+}
@@ -0,0 +1,649 @@
+/*
+ * rollback.cpp
+ *
+ * This file contains the checkpoint and rollback recovery mode of DWC (-rollback).
+ * Every store in the protected functions first saves the old value in an undo
+ *  log.  A function with DWC checks takes a checkpoint (setjmp) when it starts,
+ *  and when a check fails, it undoes the stores made since then and runs again
+ *  from the checkpoint, instead of calling the fault handler straight away.
+ * Anything that can't be undone, like a call to a library function, commits
+ *  the log, and the function takes a new checkpoint right after it.
+ * Every checkpoint also empties the log, since nothing before it can be rolled
+ *  back any more.  Loops that write memory take one at the top of each
+ *  iteration, so the log only has to hold the stores of one iteration.
+ */
+
+#include "dataflowProtection.h"
+
+#include <set>
+#include <vector>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "dataflowProtection"
+
+STATISTIC(NumCheckpoints, "Number of checkpoints that DWC errors roll back to");
+STATISTIC(NumStoresLogged, "Number of stores that save the old value in the undo log");
+STATISTIC(NumCommits, "Number of places that commit the undo log");
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+extern cl::opt<bool> rollbackFlag;
+extern cl::opt<unsigned> rollbackLogSizeOpt;
+extern cl::opt<DeferredCheckLevel> deferChecksOpt;
+extern cl::opt<bool> loopSyncsFlag;
+
+extern std::string fault_function_name;
+
+// names of the undo log and the functions that work on it
+static const std::string rollback_prefix = "__COAST_rollback";
+// everything COAST adds to the program starts with this
+static const std::string coast_prefix = "__COAST_";
+// except for these, which print and read for the -PLR run-time
+static const std::string plr_wrapper_prefix = "__COAST_plr_";
+
+// how many times to re-execute from the same checkpoint before giving up
+#define ROLLBACK_RETRIES 3
+// big enough for the jmp_buf of any of the supported targets
+#define JMP_BUF_WORDS 64
+
+
+//----------------------------------------------------------------------------//
+// Undo log
+//----------------------------------------------------------------------------//
+/*
+ * Each entry of the log is {i8* addr, i8* sp, i64 old, i64 size}.
+ * sp is the stack pointer when the entry was made.  If the address is between
+ *  that and the stack pointer of the function rolling back, it was in the frame
+ *  of a function that has returned since, and must not be written.
+ */
+static StructType* getUndoEntryType(LLVMContext& C) {
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	return StructType::get(C, {bytePtrType, bytePtrType, i64, i64});
+}
+
+static GlobalVariable* getUndoGlobal(Module& M, std::string name, Type* t) {
+	if (GlobalVariable* existing = M.getGlobalVariable(rollback_prefix + name, true))
+		return existing;
+	return new GlobalVariable(M, t, false, GlobalValue::InternalLinkage,
+			Constant::getNullValue(t), rollback_prefix + name);
+}
+
+static GlobalVariable* getUndoLog(Module& M) {
+	ArrayType* logType = ArrayType::get(getUndoEntryType(M.getContext()), rollbackLogSizeOpt);
+	return getUndoGlobal(M, "Log", logType);
+}
+
+static GlobalVariable* getUndoTop(Module& M) {
+	return getUndoGlobal(M, "Top", Type::getInt64Ty(M.getContext()));
+}
+
+// set when the log fills up, nothing can be rolled back until the next checkpoint
+static GlobalVariable* getUndoOverflow(Module& M) {
+	return getUndoGlobal(M, "Overflow", Type::getInt8Ty(M.getContext()));
+}
+
+static Function* createUndoFunction(Module& M, std::string name, ArrayRef<Type*> params) {
+	Function* fn = Function::Create(FunctionType::get(Type::getVoidTy(M.getContext()), params, false),
+			GlobalValue::InternalLinkage, rollback_prefix + name, &M);
+	fn->addFnAttr(Attribute::NoUnwind);
+	return fn;
+}
+
+/*
+ * void __COAST_rollbackSave(i8* addr, i64 old, i64 size)
+ * Adds an entry to the log, size is 1, 2, 4 or 8 bytes.
+ */
+static Function* getUndoSaveFunction(Module& M) {
+	if (Function* existing = M.getFunction(rollback_prefix + "Save"))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i64 = Type::getInt64Ty(C);
+	StructType* entryType = getUndoEntryType(C);
+	GlobalVariable* log = getUndoLog(M);
+	GlobalVariable* top = getUndoTop(M);
+
+	Function* saveFn = createUndoFunction(M, "Save", {Type::getInt8PtrTy(C), i64, i64});
+	auto arg = saveFn->arg_begin();
+	Value* addr = &*arg++;
+	Value* old = &*arg++;
+	Value* size = &*arg++;
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", saveFn);
+	BasicBlock* saveBB = BasicBlock::Create(C, "save", saveFn);
+	BasicBlock* fullBB = BasicBlock::Create(C, "full", saveFn);
+	IRBuilder<> builder(entryBB);
+
+	Value* idx = builder.CreateLoad(i64, top);
+	builder.CreateCondBr(builder.CreateICmpULT(idx, ConstantInt::get(i64, rollbackLogSizeOpt)), saveBB, fullBB);
+
+	builder.SetInsertPoint(saveBB);
+	Value* entry = builder.CreateGEP(log->getValueType(), log, {ConstantInt::get(i64, 0), idx});
+	Value* sp = builder.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::stacksave));
+	builder.CreateStore(addr, builder.CreateStructGEP(entryType, entry, 0));
+	builder.CreateStore(sp, builder.CreateStructGEP(entryType, entry, 1));
+	builder.CreateStore(old, builder.CreateStructGEP(entryType, entry, 2));
+	builder.CreateStore(size, builder.CreateStructGEP(entryType, entry, 3));
+	builder.CreateStore(builder.CreateAdd(idx, ConstantInt::get(i64, 1)), top);
+	builder.CreateRetVoid();
+
+	builder.SetInsertPoint(fullBB);
+	builder.CreateStore(builder.getInt8(1), getUndoOverflow(M));
+	builder.CreateRetVoid();
+
+	return saveFn;
+}
+
+/*
+ * void __COAST_rollbackSaveRange(i8* addr, i64 len)
+ * For writes that don't fit in one entry, saves each byte separately.
+ */
+static Function* getUndoSaveRangeFunction(Module& M) {
+	if (Function* existing = M.getFunction(rollback_prefix + "SaveRange"))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i64 = Type::getInt64Ty(C);
+	IntegerType* i8 = Type::getInt8Ty(C);
+	Function* saveFn = getUndoSaveFunction(M);
+
+	Function* rangeFn = createUndoFunction(M, "SaveRange", {Type::getInt8PtrTy(C), i64});
+	auto arg = rangeFn->arg_begin();
+	Value* addr = &*arg++;
+	Value* len = &*arg++;
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", rangeFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", rangeFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", rangeFn);
+	IRBuilder<> builder(entryBB);
+	builder.CreateCondBr(builder.CreateICmpEQ(len, ConstantInt::get(i64, 0)), exitBB, loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(i64, 2, "i");
+	idx->addIncoming(ConstantInt::get(i64, 0), entryBB);
+	Value* bytePtr = builder.CreateGEP(i8, addr, idx);
+	Value* old = builder.CreateZExt(builder.CreateLoad(i8, bytePtr), i64);
+	builder.CreateCall(saveFn, {bytePtr, old, ConstantInt::get(i64, 1)});
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(i64, 1));
+	idx->addIncoming(nextIdx, loopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, len), loopBB, exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	builder.CreateRetVoid();
+
+	return rangeFn;
+}
+
+/*
+ * void __COAST_rollbackRestore(i8* sp)
+ * Writes back the old values, newest first, until the log is empty.
+ * sp is the stack pointer of the function that is rolling back.
+ */
+static Function* getUndoRestoreFunction(Module& M) {
+	if (Function* existing = M.getFunction(rollback_prefix + "Restore"))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i64 = Type::getInt64Ty(C);
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	Type* intPtrType = M.getDataLayout().getIntPtrType(C);
+	StructType* entryType = getUndoEntryType(C);
+	GlobalVariable* log = getUndoLog(M);
+	GlobalVariable* top = getUndoTop(M);
+
+	Function* restoreFn = createUndoFunction(M, "Restore", {bytePtrType});
+	Value* frameSP = &*restoreFn->arg_begin();
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", restoreFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", restoreFn);
+	BasicBlock* entryLiveBB = BasicBlock::Create(C, "entry.live", restoreFn);
+	BasicBlock* doneBB = BasicBlock::Create(C, "done", restoreFn);
+	IRBuilder<> builder(entryBB);
+	Value* frameAddr = builder.CreatePtrToInt(frameSP, intPtrType);
+	builder.CreateBr(loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	Value* idx = builder.CreateLoad(i64, top);
+	BasicBlock* popBB = BasicBlock::Create(C, "pop", restoreFn, entryLiveBB);
+	builder.CreateCondBr(builder.CreateICmpNE(idx, ConstantInt::get(i64, 0)), popBB, doneBB);
+
+	builder.SetInsertPoint(popBB);
+	Value* newIdx = builder.CreateSub(idx, ConstantInt::get(i64, 1));
+	builder.CreateStore(newIdx, top);
+	Value* entry = builder.CreateGEP(log->getValueType(), log, {ConstantInt::get(i64, 0), newIdx});
+	Value* addr = builder.CreateLoad(bytePtrType, builder.CreateStructGEP(entryType, entry, 0));
+	Value* entrySP = builder.CreateLoad(bytePtrType, builder.CreateStructGEP(entryType, entry, 1));
+	Value* old = builder.CreateLoad(i64, builder.CreateStructGEP(entryType, entry, 2));
+	Value* size = builder.CreateLoad(i64, builder.CreateStructGEP(entryType, entry, 3));
+	Value* addrInt = builder.CreatePtrToInt(addr, intPtrType);
+	Value* deadFrame = builder.CreateAnd(
+			builder.CreateICmpUGE(addrInt, builder.CreatePtrToInt(entrySP, intPtrType)),
+			builder.CreateICmpULT(addrInt, frameAddr));
+	builder.CreateCondBr(deadFrame, loopBB, entryLiveBB);
+
+	// write back as many bytes as were saved
+	builder.SetInsertPoint(entryLiveBB);
+	SwitchInst* sw = builder.CreateSwitch(size, nullptr, 3);
+	BasicBlock* defaultBB = nullptr;
+	for (unsigned bytes : {1, 2, 4, 8}) {
+		BasicBlock* storeBB = BasicBlock::Create(C, "store" + std::to_string(bytes), restoreFn, doneBB);
+		IntegerType* t = IntegerType::get(C, bytes * 8);
+		IRBuilder<> storeBuilder(storeBB);
+		storeBuilder.CreateStore(storeBuilder.CreateTrunc(old, t),
+				storeBuilder.CreateBitCast(addr, PointerType::getUnqual(t)));
+		storeBuilder.CreateBr(loopBB);
+		if (bytes == 1)
+			defaultBB = storeBB;
+		else
+			sw->addCase(ConstantInt::get(i64, bytes), storeBB);
+	}
+	sw->setDefaultDest(defaultBB);
+
+	builder.SetInsertPoint(doneBB);
+	builder.CreateRetVoid();
+
+	return restoreFn;
+}
+
+/*
+ * void __COAST_rollbackCommit()
+ * Whatever was logged so far can't be rolled back any more.
+ * Called at every checkpoint.
+ */
+static Function* getUndoCommitFunction(Module& M) {
+	if (Function* existing = M.getFunction(rollback_prefix + "Commit"))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	Function* commitFn = createUndoFunction(M, "Commit", {});
+	IRBuilder<> builder(BasicBlock::Create(C, "entry", commitFn));
+	builder.CreateStore(builder.getInt64(0), getUndoTop(M));
+	builder.CreateStore(builder.getInt8(0), getUndoOverflow(M));
+	builder.CreateRetVoid();
+
+	return commitFn;
+}
+
+/*
+ * Looks for int setjmp(i8*) or void longjmp(i8*, i32), or declares them.
+ * If the program already declared one with a different pointer type, that's
+ *  fine, the buffer is cast to it.  Returns nullptr if it looks like something else.
+ */
+static Function* getJmpFunction(Module& M, std::string name, Type* retType, ArrayRef<Type*> params) {
+	Function* fn = M.getFunction(name);
+	if (!fn) {
+		fn = Function::Create(FunctionType::get(retType, params, false),
+				GlobalValue::ExternalLinkage, name, &M);
+	}
+
+	FunctionType* fnType = fn->getFunctionType();
+	if ((fnType->getReturnType() != retType) || (fnType->getNumParams() != params.size()))
+		return nullptr;
+	if (!fnType->getParamType(0)->isPointerTy())
+		return nullptr;
+	for (unsigned i = 1; i < params.size(); i++) {
+		if (fnType->getParamType(i) != params[i])
+			return nullptr;
+	}
+	return fn;
+}
+
+
+//----------------------------------------------------------------------------//
+// Commit points
+//----------------------------------------------------------------------------//
+/*
+ * A call commits the log if the callee can have an effect that isn't logged,
+ *  which is anything that isn't one of the protected functions, or if the callee
+ *  takes a checkpoint, which empties the log.
+ * Calls to memcpy and friends are logged like stores instead, and so are the
+ *  stores in the helpers that COAST adds (see logHelperStores()).  The run-time
+ *  libraries only change their own state, except for the -PLR wrappers.
+ */
+bool dataflowProtection::isRollbackCommit(Instruction* I, std::set<Function*>& commitFns) {
+	if (StoreInst* SI = dyn_cast<StoreInst>(I))
+		return SI->isVolatile();
+	if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(I))
+		return MI->isVolatile();
+	if (isa<IntrinsicInst>(I))
+		return false;
+
+	Function* callee;
+	if (CallInst* CI = dyn_cast<CallInst>(I)) {
+		if (CI->isInlineAsm())
+			return true;
+		callee = CI->getCalledFunction();
+	} else if (InvokeInst* II = dyn_cast<InvokeInst>(I)) {
+		callee = II->getCalledFunction();
+	} else {
+		return false;
+	}
+
+	if (!callee)
+		return true;
+	if (callee->getName().startswith(coast_prefix) && !callee->getName().startswith(plr_wrapper_prefix))
+		return false;
+	if (callee->getName() == fault_function_name)
+		return false;
+	if (fnsToClone.find(callee) == fnsToClone.end())
+		return true;
+	return commitFns.find(callee) != commitFns.end();
+}
+
+/*
+ * A protected function commits if it has a commit point, so calls to it are
+ *  commit points too.  Keep going until nothing changes.
+ * commitFns starts out with the functions that take a checkpoint.
+ */
+void dataflowProtection::findRollbackCommitFunctions(std::set<Function*>& commitFns) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto F : fnsToClone) {
+			if (commitFns.find(F) != commitFns.end())
+				continue;
+			for (auto& bb : *F) {
+				for (auto& I : bb) {
+					if (isRollbackCommit(&I, commitFns)) {
+						commitFns.insert(F);
+						changed = true;
+						break;
+					}
+				}
+				if (commitFns.find(F) != commitFns.end())
+					break;
+			}
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Checkpoints and rollback
+//----------------------------------------------------------------------------//
+/*
+ * Saves the old value at the address being stored to.
+ * Anything that isn't 1, 2, 4 or 8 bytes, or may not be aligned, is saved one
+ *  byte at a time.
+ */
+static void logStore(Module& M, StoreInst* SI) {
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	IntegerType* i64 = Type::getInt64Ty(C);
+	Type* t = SI->getValueOperand()->getType();
+	uint64_t size = DL.getTypeStoreSize(t);
+
+	bool isWord = (size == 1) || (size == 2) || (size == 4) || (size == 8);
+	isWord &= t->isIntegerTy() || t->isPointerTy() || t->isFloatingPointTy() ||
+			(t->isVectorTy() && !t->getScalarType()->isPointerTy());
+	isWord &= (SI->getAlignment() == 0) || (SI->getAlignment() >= DL.getABITypeAlignment(t));
+
+	IRBuilder<> builder(SI);
+	Value* ptr = SI->getPointerOperand();
+	Value* addr = builder.CreateBitCast(ptr, Type::getInt8PtrTy(C));
+	if (!isWord) {
+		builder.CreateCall(getUndoSaveRangeFunction(M), {addr, ConstantInt::get(i64, size)});
+		return;
+	}
+
+	Value* old = builder.CreateLoad(t, ptr, "undoOld");
+	if (t->isPointerTy())
+		old = builder.CreatePtrToInt(old, i64);
+	else if (!t->isIntegerTy())
+		old = builder.CreateBitCast(old, IntegerType::get(C, DL.getTypeSizeInBits(t)));
+	old = builder.CreateZExtOrBitCast(old, i64);
+	builder.CreateCall(getUndoSaveFunction(M), {addr, old, ConstantInt::get(i64, size)});
+}
+
+/*
+ * The helpers that COAST adds, like the fused memcpy loops and the parity
+ *  updates, are called from the protected functions but aren't cloned, so
+ *  their stores are logged here.
+ */
+static unsigned logHelperStores(Module& M, std::set<Function*>& callers) {
+	std::set<Function*> helpers;
+	for (auto F : callers) {
+		for (auto& bb : *F) {
+			for (auto& I : bb) {
+				CallInst* CI = dyn_cast<CallInst>(&I);
+				Function* callee = CI ? CI->getCalledFunction() : nullptr;
+				if (callee && !callee->isDeclaration() && callee->getName().startswith(coast_prefix)
+						&& !callee->getName().startswith(rollback_prefix))
+					helpers.insert(callee);
+			}
+		}
+	}
+
+	unsigned numLogged = 0;
+	for (auto F : helpers) {
+		std::vector<StoreInst*> stores;
+		for (auto& bb : *F) {
+			for (auto& I : bb) {
+				if (StoreInst* SI = dyn_cast<StoreInst>(&I))
+					stores.push_back(SI);
+			}
+		}
+		for (auto SI : stores) {
+			logStore(M, SI);
+			numLogged++;
+		}
+	}
+	return numLogged;
+}
+
+/*
+ * A checkpoint empties the log, then calls setjmp(), which returns again with
+ *  the number of tries so far when a check fails.
+ * The count is changed after the setjmp(), so it has to be volatile to still be
+ *  right after a longjmp().
+ */
+static void takeCheckpoint(Module& M, IRBuilder<>& builder, Function* setjmpFn,
+		Value* jmpBufArg, AllocaInst* triesVar) {
+	builder.CreateCall(getUndoCommitFunction(M));
+	builder.CreateStore(builder.CreateCall(setjmpFn, {jmpBufArg}), triesVar, true);
+}
+
+/*
+ * With -rollback, DWC errors go back to the last checkpoint of the function
+ *  they were found in, after undoing everything written since then.
+ * A checkpoint is a setjmp(), so the SSA values don't need to be saved, and
+ *  the memory is brought back by the undo log.
+ * There is one when the function starts, one after each commit point, and one
+ *  at the top of each loop that writes memory.  The loop ones are left out if
+ *  checks are moved past the end of the loop (-deferChecks=function or
+ *  -loopSyncs), since going back to the last iteration wouldn't help.
+ * The phi nodes at the top of these loops are changed again at the end of each
+ *  iteration, which a longjmp() doesn't undo, so they are moved to the stack,
+ *  where the log takes care of them.
+ * Runs after the clones are moved, so every store and error
+ *  branch is already where it ends up.
+ */
+void dataflowProtection::insertRollback(Module& M) {
+	if (!rollbackFlag)
+		return;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+
+	// on a hosted system, setjmp() also saves the signal mask, which is a system call
+	Triple triple(M.getTargetTriple());
+	std::string jmpPrefix = (triple.isOSLinux() || triple.isOSDarwin() || triple.isOSFreeBSD()) ? "_" : "";
+	Function* setjmpFn = getJmpFunction(M, jmpPrefix + "setjmp", i32, {bytePtrType});
+	Function* longjmpFn = getJmpFunction(M, jmpPrefix + "longjmp", Type::getVoidTy(C), {bytePtrType, i32});
+	if (!setjmpFn || !longjmpFn) {
+		errs() << warn_string << " setjmp() or longjmp() has an unexpected type, -rollback is disabled\n";
+		return;
+	}
+	setjmpFn->addFnAttr(Attribute::ReturnsTwice);
+	longjmpFn->addFnAttr(Attribute::NoReturn);
+
+	// only worth a checkpoint if something can find an error
+	std::set<Function*> checkpointFns;
+	for (auto F : fnsToClone) {
+		BasicBlock* errBlock = errBlockMap[F];
+		if (!F->isDeclaration() && !isISR(*F) && errBlock && !pred_empty(errBlock))
+			checkpointFns.insert(F);
+	}
+
+	// calls to functions that take a checkpoint are commit points too
+	std::set<Function*> commitFns = checkpointFns;
+	findRollbackCommitFunctions(commitFns);
+
+	unsigned numCheckpoints = 0, numCommits = 0;
+	unsigned numLogged = logHelperStores(M, fnsToClone);
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration() || isISR(*F))
+			continue;
+
+		// find everything first, since the instrumentation adds more stores
+		std::vector<StoreInst*> stores;
+		std::vector<MemIntrinsic*> memWrites;
+		std::vector<Instruction*> commits;
+		bool canCheckpoint = (checkpointFns.find(F) != checkpointFns.end());
+		for (auto& bb : *F) {
+			for (auto& I : bb) {
+				if (isRollbackCommit(&I, commitFns)) {
+					// there's no single place after an invoke to take a new checkpoint
+					if (isa<InvokeInst>(&I))
+						canCheckpoint = false;
+					else
+						commits.push_back(&I);
+				} else if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+					stores.push_back(SI);
+				} else if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&I)) {
+					memWrites.push_back(MI);
+				}
+			}
+		}
+
+		std::vector<BasicBlock*> loopHeaders;
+		if (canCheckpoint) {
+			DominatorTree DT(*F);
+			LoopInfo LI(DT);
+			for (auto L : LI.getLoopsInPreorder()) {
+				bool writes = false;
+				for (auto bb : L->blocks()) {
+					for (auto& I : *bb)
+						writes |= I.mayWriteToMemory();
+				}
+				if (writes && !L->getHeader()->isEHPad())
+					loopHeaders.push_back(L->getHeader());
+			}
+
+			for (auto header : loopHeaders) {
+				std::vector<PHINode*> phis;
+				for (auto& phi : header->phis())
+					phis.push_back(&phi);
+				for (auto phi : phis) {
+					AllocaInst* slot = DemotePHIToStack(phi);
+					for (auto user : slot->users()) {
+						if (StoreInst* SI = dyn_cast<StoreInst>(user))
+							stores.push_back(SI);
+					}
+				}
+			}
+			if ( (deferChecksOpt == DeferFunction) || loopSyncsFlag )
+				loopHeaders.clear();
+		}
+
+		for (auto SI : stores) {
+			logStore(M, SI);
+			numLogged++;
+		}
+		for (auto MI : memWrites) {
+			IRBuilder<> builder(MI);
+			builder.CreateCall(getUndoSaveRangeFunction(M),
+					{MI->getRawDest(), builder.CreateZExtOrTrunc(MI->getLength(), i64)});
+			numLogged++;
+		}
+
+		AllocaInst* triesVar = nullptr;
+		Value* jmpBufArg = nullptr;
+		if (canCheckpoint) {
+			BasicBlock& entryBB = F->getEntryBlock();
+			BasicBlock::iterator firstSpot = entryBB.begin();
+			while (isa<AllocaInst>(&*firstSpot))
+				firstSpot++;
+
+			IRBuilder<> builder(&entryBB, firstSpot);
+			AllocaInst* jmpBuf = builder.CreateAlloca(ArrayType::get(i64, JMP_BUF_WORDS), nullptr, "rollbackBuf");
+			triesVar = builder.CreateAlloca(i32, nullptr, "rollbackTries");
+			jmpBufArg = builder.CreateBitCast(jmpBuf, setjmpFn->getFunctionType()->getParamType(0));
+			Value* longjmpBufArg = builder.CreateBitCast(jmpBuf, longjmpFn->getFunctionType()->getParamType(0));
+			takeCheckpoint(M, builder, setjmpFn, jmpBufArg, triesVar);
+			numCheckpoints++;
+
+			/*
+			 * The error block decides whether to roll back, or give up and call
+			 *  the fault handler like before.
+			 */
+			BasicBlock* errBlock = errBlockMap[F];
+			Instruction* faultCall = &errBlock->front();
+			BasicBlock* faultBB = errBlock->splitBasicBlock(faultCall->getIterator(),
+					"rollbackFailed." + F->getName());
+			errBlock->getTerminator()->eraseFromParent();
+			BasicBlock* rollbackBB = BasicBlock::Create(C, "rollback." + F->getName(), F, faultBB);
+
+			builder.SetInsertPoint(errBlock);
+			builder.SetCurrentDebugLocation(faultCall->getDebugLoc());
+			LoadInst* tries = builder.CreateLoad(i32, triesVar);
+			tries->setVolatile(true);
+			Value* overflow = builder.CreateLoad(Type::getInt8Ty(C), getUndoOverflow(M));
+			Value* canRetry = builder.CreateAnd(
+					builder.CreateICmpULT(tries, ConstantInt::get(i32, ROLLBACK_RETRIES)),
+					builder.CreateICmpEQ(overflow, builder.getInt8(0)));
+			builder.CreateCondBr(canRetry, rollbackBB, faultBB);
+
+			builder.SetInsertPoint(rollbackBB);
+			Value* sp = builder.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::stacksave));
+			builder.CreateCall(getUndoRestoreFunction(M), {sp});
+			builder.CreateCall(longjmpFn, {longjmpBufArg, builder.CreateAdd(tries, ConstantInt::get(i32, 1))});
+			builder.CreateUnreachable();
+
+			for (auto header : loopHeaders) {
+				IRBuilder<> loopBuilder(&*header->getFirstInsertionPt());
+				takeCheckpoint(M, loopBuilder, setjmpFn, jmpBufArg, triesVar);
+				numCheckpoints++;
+			}
+		}
+
+		// the log starts over after each commit, and so does the checkpoint
+		for (auto I : commits) {
+			IRBuilder<> builder(I->getNextNode());
+			if (canCheckpoint) {
+				takeCheckpoint(M, builder, setjmpFn, jmpBufArg, triesVar);
+				numCheckpoints++;
+			} else {
+				builder.CreateCall(getUndoCommitFunction(M));
+			}
+			numCommits++;
+		}
+	}
+
+	NumCheckpoints += numCheckpoints;
+	NumStoresLogged += numLogged;
+	NumCommits += numCommits;
+	if (verboseFlag) {
+		errs() << info_string << " Inserted " << numCheckpoints << " checkpoints, logging "
+				<< numLogged << " stores\n";
+	}
+}
@@ -9,11 +9,36 @@
 #include "llvm/Support/CommandLine.h"
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/CFG.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/ADT/Statistic.h>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "dataflowProtection"
+
+STATISTIC(NumStoreSyncs, "Number of store sync points");
+STATISTIC(NumGEPSyncs, "Number of GEP sync points");
+STATISTIC(NumCallSyncs, "Number of call sync points");
+STATISTIC(NumTerminatorSyncs, "Number of terminator sync points");
+STATISTIC(NumVoters, "Number of TMR voters inserted");
+STATISTIC(NumBlocksSplit, "Number of basic blocks split for sync logic");
+STATISTIC(NumErrorBlocks, "Number of error handling blocks created");
+STATISTIC(NumChecksCoalesced, "Number of DWC checks merged into an earlier one");
+STATISTIC(NumLoopSyncsHoisted, "Number of loop-invariant syncs moved to a loop preheader");
+STATISTIC(NumLoopSyncsSunk, "Number of induction variable syncs moved to a loop exit");
+STATISTIC(NumRedundantSyncs, "Number of syncs skipped because an earlier sync covers them");
+STATISTIC(NumParityLoads, "Number of loads from parity protected globals that are checked");
+STATISTIC(NumParityStores, "Number of stores to parity protected globals that update the parity");
+STATISTIC(NumMemOpsFused, "Number of replicated memcpy and memset calls combined into one loop");
+
 
 // Command line options
 extern cl::opt<bool> OriginalReportErrorsFlag;
@@ -27,6 +52,14 @@ extern cl::opt<bool> verboseFlag;
 extern cl::opt<bool> noMainFlag;
 extern cl::opt<bool> countSyncsFlag;
 extern cl::opt<bool> protectStackFlag;
+extern cl::opt<bool> bitwiseVoteFlag;
+extern cl::opt<DeferredCheckLevel> deferChecksOpt;
+extern cl::opt<bool> coalesceChecksFlag;
+extern cl::opt<bool> loopSyncsFlag;
+extern cl::opt<bool> syncElimFlag;
+extern cl::opt<MemOpFusion> fuseMemOpsOpt;
+extern cl::opt<bool> threadCountersFlag;
+extern cl::opt<bool> profileSyncsFlag;
 
 // another set of sync points from boundary crossings
 // see verifyOptions()
@@ -42,6 +75,7 @@ std::string gep_cmp_name = "gcmp";
 std::string call_cmp_name = "ccmp";
 std::string store_cmp_name = "scmp";
 std::string terminator_cmp_name = "tcmp";
+std::string loop_cmp_name = "lcmp";
 
 // dynamically count the number of times we synchronize
 std::string dynCountName = "__SYNC_COUNT";
@@ -87,6 +121,60 @@ CmpInst::Predicate getComparisonPredicate(Type* opType) {
 	}
 }
 
+/*
+ * Comparing two vectors gives a vector of i1, which can't be branched on.
+ * This reduces it to a single i1 by packing the lanes into an integer with one
+ *  bit per lane (<N x i1> -> iN), which works for any vector width or element type.
+ * If allLanes is set, the result is true only if every lane is true (for "equal"
+ *  comparisons), otherwise it is true if any lane is true (for "not equal").
+ * The new instructions are inserted immediately after vecCmp.
+ */
+CmpInst* reduceVectorCompare(Instruction* vecCmp, bool allLanes, const Twine& name) {
+	assert(vecCmp->getType()->isVectorTy() && "reducing a vector comparison");
+
+	unsigned nLanes = vecCmp->getType()->getVectorNumElements();
+	IntegerType* laneBitsType = IntegerType::get(vecCmp->getContext(), nLanes);
+	BitCastInst* laneBits = new BitCastInst(vecCmp, laneBitsType, "laneBits");
+	laneBits->insertAfter(vecCmp);
+
+	CmpInst* reduced;
+	if (allLanes) {
+		reduced = CmpInst::Create(intCmpType, intCmpEqual, laneBits,
+				Constant::getAllOnesValue(laneBitsType), name);
+	} else {
+		reduced = CmpInst::Create(intCmpType, intCmpNotEqual, laneBits,
+				Constant::getNullValue(laneBitsType), name);
+	}
+	reduced->insertAfter(laneBits);
+	return reduced;
+}
+
+/*
+ * Returns true if v is a PHI node in the loop header that is stepped by a constant
+ *  each time around the loop, or is that step.
+ */
+bool isSimpleInduction(Loop* L, Value* v) {
+	PHINode* phi = dyn_cast<PHINode>(v);
+	if (!phi) {
+		if (BinaryOperator* step = dyn_cast<BinaryOperator>(v)) {
+			phi = dyn_cast<PHINode>(step->getOperand(0));
+		}
+	}
+	BasicBlock* latch = L->getLoopLatch();
+	if (!phi || !latch || (phi->getParent() != L->getHeader()) || (phi->getBasicBlockIndex(latch) < 0)) {
+		return false;
+	}
+
+	BinaryOperator* next = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(latch));
+	if (!next || (next->getOperand(0) != phi) || !isa<ConstantInt>(next->getOperand(1))) {
+		return false;
+	}
+	if ((next->getOpcode() != Instruction::Add) && (next->getOpcode() != Instruction::Sub)) {
+		return false;
+	}
+	return (v == phi) || (v == next);
+}
+
 
 //----------------------------------------------------------------------------//
 // Obtain synchronization points
@@ -151,7 +239,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 					if (debugFlag)
 						PRINT_VALUE(&I);
 					#endif
-					syncPoints.push_back(&I);
+					syncPoints.insert(&I);
 				}
 
 				// Sync at external function calls - they're only declared, not defined
@@ -185,7 +273,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 
 					// sync before function declarations and calls to external functions
 					if (calledF->hasExternalLinkage() && calledF->isDeclaration()) {
-						syncPoints.push_back(&I);
+						syncPoints.insert(&I);
 //						errs() << "Adding " << CI->getCalledFunction()->getName() << " to syncpoints\n";
 					}
 					#ifdef DBG_POP_SYNC_PTS
@@ -215,7 +303,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 					}
 					// Otherwise, go ahead and add it to the list of sync-points
 					else {
-						syncPoints.push_back(&I);
+						syncPoints.insert(&I);
 						#ifdef DBG_POP_SYNC_PTS
 						if (debugFlag)
 							PRINT_VALUE(&I);
@@ -230,7 +318,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 						if (debugFlag)
 							PRINT_VALUE(&I);
 						#endif
-						syncPoints.push_back(&I);
+						syncPoints.insert(&I);
 					}
 				}
 
@@ -254,7 +342,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 	// add the global stores found earlier (verifyOptions())
 	for (auto si : syncGlobalStores) {
 //		errs() << "sync global store: " << *si << "\n";
-		syncPoints.push_back(si);
+		syncPoints.insert(si);
 	}
 }
 
@@ -263,7 +351,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 // Insert synchronization logic
 //----------------------------------------------------------------------------//
 void dataflowProtection::processSyncPoints(Module & M, int numClones) {
-	if (syncPoints.size() == 0)
+	if (syncPoints.empty())
 		return;
 
 	GlobalVariable* TMRErrorDetected = M.getGlobalVariable(tmr_global_count_name);
@@ -293,42 +381,77 @@ void dataflowProtection::processSyncPoints(Module & M, int numClones) {
 	// make sure to skip this - I think this check is too late
 	globalsToSkip.insert(TMRErrorDetected);
 
-	// Some of the syncpoints may be invalidated during this next process, but we can't remove them
-	//  from this list we're iterating over.  Make a list to delete them later.
-	std::vector<Instruction*> deleteItLater;
+	// the site numbers have to be handed out before any sync logic exists
+	numberSyncSites(M);
+
+	// move syncs out of loops while the loop info is still good
+	if (loopSyncsFlag) {
+		for (auto F : fnsToClone) {
+			placeLoopSyncs(F, TMRErrorDetected);
+		}
+	}
 
-	for (auto I : syncPoints) {
+	// Some of the syncpoints may be invalidated during this next process.  The registry keeps
+	//  the remaining slots where they are, so those are skipped over below.
+	// Sync points added along the way already have their sync logic, so only go up
+	//  to the ones that exist right now.
+	size_t numSyncPoints = syncPoints.size();
+	for (size_t idx = 0; idx < numSyncPoints; idx++) {
+		Instruction* I = syncPoints[idx];
+		currentSyncSite = -1;
+		if (!I)
+			continue;
+		// already synced somewhere else
+		if (movedLoopSyncs.find(I) != movedLoopSyncs.end())
+			continue;
 
-		assert(I && "How did a null pointer get into syncpoints?");
+		// the sync logic goes in front of the sync point, so if anything was added
+		//  there, it wasn't skipped (e.g. by -syncElim)
+		BasicBlock* syncBB = I->getParent();
+		Instruction* beforeSync = I->getPrevNode();
+		selectSyncSite(I);
 
 		if (StoreInst* currStoreInst = dyn_cast<StoreInst>(I)) {
 			/* Sync here if it's a special global store across SoR */
 			if (syncGlobalStores.find(currStoreInst) != syncGlobalStores.end()) {
+				NumStoreSyncs++;
 				syncStoreInst(currStoreInst, TMRErrorDetected, true);
+				if ( (I->getParent() != syncBB) || (I->getPrevNode() != beforeSync) )
+					countSyncSite(currStoreInst);
 //				errs() << *currStoreInst << "\n";
 
-				/* If it is a special store, then also can remove the clones of the StoreInst */
+				/* If it is a special store, then also can remove the clones of the StoreInst,
+				 * unless they store to the copies of a replicated address (like a local variable),
+				 * which would then never be written */
 				ValuePair clones = getClone(currStoreInst);
-				if (clones.first != currStoreInst) {
+				if ( (clones.first != currStoreInst) && !isCloned(currStoreInst->getPointerOperand()) ) {
 					Instruction* firstClone = dyn_cast<Instruction>(clones.first);
 					firstClone->eraseFromParent();
 					if (TMR) {
 						Instruction* secondClone = dyn_cast<Instruction>(clones.second);
 						secondClone->eraseFromParent();
 					}
-					/* Now we have to clean up the map to avoid stale pointers */
-					cloneMap.erase(currStoreInst);
+					/* The clone registry drops the entry once the clones are erased */
 				}
 			}
 			/* Sync here if the flag is set */
 			else if (!noStoreDataSyncFlag) {
+				NumStoreSyncs++;
 				syncStoreInst(currStoreInst, TMRErrorDetected);
+				if ( (I->getParent() != syncBB) || (I->getPrevNode() != beforeSync) )
+					countSyncSite(currStoreInst);
 			}
 		} else if (CallInst* currCallInst = dyn_cast<CallInst>(I)) {
+			NumCallSyncs++;
 			processCallSync(currCallInst, TMRErrorDetected);
+			if ( (I->getParent() != syncBB) || (I->getPrevNode() != beforeSync) )
+				countSyncSite(currCallInst);
 
 		} else if (TerminatorInst* currTerminator = dyn_cast<TerminatorInst>(I)) { // is a terminator
+			NumTerminatorSyncs++;
 			syncTerminator(currTerminator, TMRErrorDetected);
+			if ( (I->getParent() != syncBB) || (I->getPrevNode() != beforeSync) )
+				countSyncSite(currTerminator);
 
 		} else if (GetElementPtrInst* currGEP = dyn_cast<GetElementPtrInst>(I)) {
 
@@ -367,8 +490,11 @@ void dataflowProtection::processSyncPoints(Module & M, int numClones) {
 			}
 
 			// else there is noMemReplication
+			NumGEPSyncs++;
 			if (syncGEP(currGEP, TMRErrorDetected)) {
-				deleteItLater.push_back(I);
+				syncPoints.invalidate(I);
+			} else if ( (I->getParent() != syncBB) || (I->getPrevNode() != beforeSync) ) {
+				countSyncSite(currGEP);
 			}
 		} else {
 			assert(isa<Instruction>(I) && "non-instruction value in syncpoints");
@@ -388,18 +514,40 @@ void dataflowProtection::processSyncPoints(Module & M, int numClones) {
 		}
 
 	}
+	currentSyncSite = -1;
 
-	// delete the now-invalid pointers
-	for (auto it : deleteItLater) {
-		syncPoints.erase(std::find(syncPoints.begin(), syncPoints.end(), it));
-	}
+	movedLoopSyncs.clear();
+	verifiedValues.clear();
 
 	// we found some new ones while doing stuff above
 	// these will be used for moving sync instructions around
 	for (auto ns : newSyncPoints) {
-		syncPoints.push_back(ns);
+		syncPoints.insert(ns);
+	}
+
+	// DWC comparisons that weren't checked right away
+	for (auto& fnChecks : deferredDWCChecks) {
+		insertDeferredDWCChecks(fnChecks.first);
+	}
+	deferredDWCChecks.clear();
+
+	// later passes over the code don't keep the analyses up to date
+	clearAnalysisCache();
+
+	// merge the chains of checks left behind by splitBlocks()
+	if (!TMR && coalesceChecksFlag) {
+		for (auto& fnErr : errBlockMap) {
+			coalesceSyncChecks(fnErr.first);
+		}
 	}
 
+	// with -threadCounters, the program gets the totals from the run-time instead
+	redirectCounterAccesses(M, TMRErrorDetected);
+	redirectCounterAccesses(M, dynamicSyncCount);
+
+	// side table and dump routine for -profileSyncs
+	emitSyncProfile(M);
+
 	// remove the TMR counter if it wasn't used
 	if (!TMR && TMRErrorDetected->getNumUses() < 1)
 		TMRErrorDetected->eraseFromParent();
@@ -431,6 +579,36 @@ bool dataflowProtection::syncGEP(GetElementPtrInst* currGEP, GlobalVariable* TMR
 	Value* clone1 = getClone(orig).first;
 	assert(clone1 && "Cloned value exists");
 
+	// an earlier sync already covers this offset
+	if (Instruction* prevSync = getDominatingSync(orig, currGEP)) {
+		startOfSyncLogic[currGEP] = currGEP;
+		if (TMR) {
+			GetElementPtrInst* currGEPClone1 = dyn_cast<GetElementPtrInst>(getClone(currGEP).first);
+			GetElementPtrInst* currGEPClone2 = dyn_cast<GetElementPtrInst>(getClone(currGEP).second);
+
+			currGEP->setOperand(currGEP->getNumOperands()-1,prevSync);
+			currGEPClone1->setOperand(currGEPClone1->getNumOperands()-1,prevSync);
+			currGEPClone2->setOperand(currGEPClone2->getNumOperands()-1,prevSync);
+		}
+		return false;
+	}
+
+	if (TMR && bitwiseVoteFlag) {
+		Instruction* vote = insertBitwiseVoter(orig, clone1, getClone(orig).second, currGEP, TMRErrorDetected, syncInsts);
+		if (vote) {
+			startOfSyncLogic[currGEP] = syncInsts.front();
+			recordSync(orig, vote);
+
+			GetElementPtrInst* currGEPClone1 = dyn_cast<GetElementPtrInst>(getClone(currGEP).first);
+			GetElementPtrInst* currGEPClone2 = dyn_cast<GetElementPtrInst>(getClone(currGEP).second);
+
+			currGEP->setOperand(currGEP->getNumOperands()-1,vote);
+			currGEPClone1->setOperand(currGEPClone1->getNumOperands()-1,vote);
+			currGEPClone2->setOperand(currGEPClone2->getNumOperands()-1,vote);
+			return false;
+		}
+	}
+
 	// get the correct comparison type for this instruction
 	Type* opType = orig->getType();
 	Instruction::OtherOps cmp_op = getComparisonType(opType);
@@ -446,6 +624,7 @@ bool dataflowProtection::syncGEP(GetElementPtrInst* currGEP, GlobalVariable* TMR
 		Value* clone2 = getClone(orig).second;
 		assert(clone2 && "Clone exists when syncing at store");
 		SelectInst* sel = SelectInst::Create(cmp,orig,clone2,tmr_vote_inst_name,currGEP);
+		NumVoters++;
 
 		syncInsts.push_back(cmp);
 		syncInsts.push_back(sel);
@@ -456,6 +635,7 @@ bool dataflowProtection::syncGEP(GetElementPtrInst* currGEP, GlobalVariable* TMR
 		currGEP->setOperand(currGEP->getNumOperands()-1,sel);
 		currGEPClone1->setOperand(currGEPClone1->getNumOperands()-1,sel);
 		currGEPClone2->setOperand(currGEPClone2->getNumOperands()-1,sel);
+		recordSync(orig, sel);
 
 		// Too many cases to account for this, so assertion is removed for now
 //		if(!isa<PHINode>(orig)){
@@ -463,9 +643,12 @@ bool dataflowProtection::syncGEP(GetElementPtrInst* currGEP, GlobalVariable* TMR
 //		}
 
 		insertTMRCorrectionCount(cmp, TMRErrorDetected);
+	} else if (deferChecksOpt != DeferNone) {
+		deferDWCCheck(cmp);
+		recordSync(orig, cmp);
 	} else {		// DWC
 		Function* currFn = currGEP->getParent()->getParent();
-		splitBlocks(cmp, errBlockMap[currFn]);
+		recordSync(orig, splitBlocks(cmp, errBlockMap[currFn]));
 		// fix invalidated pointer - see note in processCallSync()
 		startOfSyncLogic[currGEP] = currGEP;
 	}
@@ -504,34 +687,60 @@ void dataflowProtection::syncStoreInst(StoreInst* currStoreInst, GlobalVariable*
 		return;
 	}
 
-	// get the correct comparison type for this instruction
-	Type* opType = currStoreInst->getOperand(0)->getType();
-	Instruction::OtherOps cmp_op = getComparisonType(opType);
-	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+	// an earlier sync already covers this value
+	if (Instruction* prevSync = getDominatingSync(orig, currStoreInst)) {
+		startOfSyncLogic[currStoreInst] = currStoreInst;
+		if (TMR) {
+			currStoreInst->setOperand(0, prevSync);
+			dyn_cast<StoreInst>(getClone(currStoreInst).first)->setOperand(0, prevSync);
+			dyn_cast<StoreInst>(getClone(currStoreInst).second)->setOperand(0, prevSync);
+		}
+		return;
+	}
 
-	Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, orig, clone1, store_cmp_name, currStoreInst);
-	cmp->removeFromParent();
-	cmp->insertBefore(currStoreInst);
+	// the bitwise voter doesn't need a comparison at all
+	Instruction* sel = nullptr;
+	if (TMR && bitwiseVoteFlag) {
+		sel = insertBitwiseVoter(orig, clone1, getClone(orig).second, currStoreInst, TMRErrorDetected, syncInsts);
+	}
+
+	Instruction* cmp = nullptr;
+	if (sel) {
+		startOfSyncLogic[currStoreInst] = syncInsts.front();
+	} else {
+		// get the correct comparison type for this instruction
+		Type* opType = currStoreInst->getOperand(0)->getType();
+		Instruction::OtherOps cmp_op = getComparisonType(opType);
+		CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+
+		cmp = CmpInst::Create(cmp_op, cmp_eq, orig, clone1, store_cmp_name, currStoreInst);
+		cmp->removeFromParent();
+		cmp->insertBefore(currStoreInst);
 
-	syncInsts.push_back(cmp);
-	startOfSyncLogic[currStoreInst] = cmp;
+		syncInsts.push_back(cmp);
+		startOfSyncLogic[currStoreInst] = cmp;
+	}
 
 	if (TMR) {
-		Value* clone2 = getClone(orig).second;
-		assert(clone2 && "Clone exists when syncing at store");
-		SelectInst* sel = SelectInst::Create(cmp,orig,clone2,tmr_vote_inst_name,currStoreInst);
-		syncInsts.push_back(sel);
+		if (!sel) {
+			Value* clone2 = getClone(orig).second;
+			assert(clone2 && "Clone exists when syncing at store");
+			sel = SelectInst::Create(cmp,orig,clone2,tmr_vote_inst_name,currStoreInst);
+			NumVoters++;
+			syncInsts.push_back(sel);
+		}
 
 		assert(getClone(currStoreInst).first && "Store instruction has a clone");
 
 		currStoreInst->setOperand(0, sel);
 		dyn_cast<StoreInst>(getClone(currStoreInst).first)->setOperand(0, sel);
 		dyn_cast<StoreInst>(getClone(currStoreInst).second)->setOperand(0, sel);
+		recordSync(orig, sel);
 
 		// Make sure that the voted value is propagated downstream
 		if (orig->getNumUses() != 2) {
 			if (Instruction* origInst = dyn_cast<Instruction>(orig)) {
-				DominatorTree DT = DominatorTree(*origInst->getParent()->getParent());
+				DominatorTree& DT = *getDomTree(origInst->getParent()->getParent());
 				for (auto u : origInst->users()) {
 					// Find any and all instructions that were not updated
 					if (std::find(syncInsts.begin() ,syncInsts.end(), u) == syncInsts.end()) {
@@ -551,10 +760,15 @@ void dataflowProtection::syncStoreInst(StoreInst* currStoreInst, GlobalVariable*
 			}
 		}
 
-		insertTMRCorrectionCount(cmp, TMRErrorDetected);
+		if (cmp) {
+			insertTMRCorrectionCount(cmp, TMRErrorDetected);
+		}
+	} else if (deferChecksOpt != DeferNone) {
+		deferDWCCheck(cmp);
+		recordSync(orig, cmp);
 	} else {		// DWC
 		Function* currFn = currStoreInst->getParent()->getParent();
-		splitBlocks(cmp, errBlockMap[currFn]);
+		recordSync(orig, splitBlocks(cmp, errBlockMap[currFn]));
 		// fix invalidated pointer - see note in processCallSync()
 		startOfSyncLogic[currStoreInst] = currStoreInst;
 	}
@@ -593,6 +807,8 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 
 	// We now have a list of (an unknown number of) operands, insert comparisons for all of them
 	std::deque<Value*> cmpInstList;
+	// the operands that are checked by the one branch at the end (DWC)
+	std::vector<Value*> checkedOperands;
 	std::vector<Instruction*> syncHelperList;
 	BasicBlock* currBB = currCallInst->getParent();
 	syncHelperMap[currBB] = syncHelperList;
@@ -606,6 +822,16 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		}
 		ValuePair clones = getClone(orig);
 
+		// an earlier sync already covers this operand
+		if (Instruction* prevSync = getDominatingSync(orig, currCallInst)) {
+			if (TMR) {
+				currCallInst->replaceUsesOfWith(orig, prevSync);
+				dyn_cast<CallInst>(getClone(currCallInst).first)->replaceUsesOfWith(clones.first, prevSync);
+				dyn_cast<CallInst>(getClone(currCallInst).second)->replaceUsesOfWith(clones.second, prevSync);
+			}
+			continue;
+		}
+
 		Type* opType = orig->getType();
 		// also need to skip syncing on array types
 		if (opType->isArrayTy()) {
@@ -628,23 +854,38 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 			PRINT_VALUE(orig);
 			assert(!orig->getType()->isArrayTy() && "array type not allowed here");
 		}
-		Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, orig, clones.first, call_cmp_name, currCallInst);
-		cmp->removeFromParent();
-		cmp->insertBefore(currCallInst);
+
+		// everything inserted to sync this operand
+		std::vector<Instruction*> voterInsts;
+		Instruction* sel = nullptr;
+		if (TMR && bitwiseVoteFlag) {
+			sel = insertBitwiseVoter(orig, clones.first, clones.second, currCallInst, TMRErrorDetected, voterInsts);
+		}
+
+		Instruction* cmp = nullptr;
+		if (!sel) {
+			cmp = CmpInst::Create(cmp_op, cmp_eq, orig, clones.first, call_cmp_name, currCallInst);
+			cmp->removeFromParent();
+			cmp->insertBefore(currCallInst);
+			voterInsts.push_back(cmp);
+		}
 		if (firstIteration) {
-			startOfSyncLogic[currCallInst] = cmp;
+			startOfSyncLogic[currCallInst] = voterInsts.front();
 			firstIteration = false;
 		}
 
-		syncInsts.push_back(cmp);
-
 		if (TMR) {
-			SelectInst* sel = SelectInst::Create(cmp, orig, clones.second, tmr_vote_inst_name, currCallInst);
-			syncInsts.push_back(sel);
+			if (!sel) {
+				sel = SelectInst::Create(cmp, orig, clones.second, tmr_vote_inst_name, currCallInst);
+				NumVoters++;
+				voterInsts.push_back(sel);
+			}
+			syncInsts.insert(syncInsts.end(), voterInsts.begin(), voterInsts.end());
 
 			currCallInst->replaceUsesOfWith(orig, sel);
 			dyn_cast<CallInst>(getClone(currCallInst).first)->replaceUsesOfWith(clones.first, sel);
 			dyn_cast<CallInst>(getClone(currCallInst).second)->replaceUsesOfWith(clones.second, sel);
+			recordSync(orig, sel);
 
 			/*
 			 * If something fails this check for useCount, it means that it is used after the call synchronization
@@ -654,9 +895,16 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 			 *  and it hasn't been alloca'd; then every reference is to the original argument.
 			 */
 			int useCount = orig->getNumUses();
-			if (useCount != 2) {
+			// how many of those uses belong to the voter itself
+			int voterUses = 0;
+			for (auto uu : orig->users()) {
+				if (std::find(voterInsts.begin(), voterInsts.end(), uu) != voterInsts.end()) {
+					voterUses++;
+				}
+			}
+			if (useCount != voterUses) {
 				if (Instruction* origInst = dyn_cast<Instruction>(orig)) {
-					DominatorTree DT = DominatorTree(*origInst->getParent()->getParent());
+					DominatorTree& DT = *getDomTree(origInst->getParent()->getParent());
 					std::vector<Instruction*> uses;
 					for (auto uu : orig->users()) {
 						uses.push_back(dyn_cast<Instruction>(uu));
@@ -685,19 +933,33 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 				}
 			}
 
-			// if it's not an argument, then we can assert that there can only be 2 uses
+			// if it's not an argument, then we can assert that it is only used by the voter
 			if (std::find(argVals.begin(), argVals.end(), orig) == argVals.end()) {
-				if (useCount != 2) {
+				if (useCount != voterUses) {
 					errs() << *currCallInst << "\n";
 					errs() << *orig << "\n";
 				}
-				assert(useCount==2 && "Instruction only used in call sync");
+				assert(useCount==voterUses && "Instruction only used in call sync");
 				// TODO: examine what could cause this to fail
 			}
-			insertTMRCorrectionCount(cmp, TMRErrorDetected);
+			if (cmp) {
+				insertTMRCorrectionCount(cmp, TMRErrorDetected);
+			}
+		} else if (deferChecksOpt != DeferNone) {
+			// each operand is folded in on its own
+			deferDWCCheck(cmp);
+			recordSync(orig, cmp);
 		} else {		// DWC
-			cmpInstList.push_back(cmp);
+			checkedOperands.push_back(orig);
 			syncHelperMap[currBB].push_back(cmp);
+			// vector operands have to be reduced before they can be combined with the others
+			if (cmp->getType()->isVectorTy()) {
+				CmpInst* reduced = reduceVectorCompare(cmp, true, "simdSync");
+				syncHelperMap[currBB].push_back(cast<Instruction>(reduced->getOperand(0)));
+				syncHelperMap[currBB].push_back(reduced);
+				cmp = reduced;
+			}
+			cmpInstList.push_back(cmp);
 		}
 	}
 
@@ -707,11 +969,12 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		}
 
 		// Reduce the comparisons to a single instruction
+		// they are all "equal" compares, so every one of them has to be true
 		while (cmpInstList.size() > 1) {
 			Value* cmp0 = cmpInstList[0];
 			Value* cmp1 = cmpInstList[1];
 
-			Instruction* cmpInst = BinaryOperator::Create(Instruction::Or, cmp0, cmp1, "or", currCallInst);
+			Instruction* cmpInst = BinaryOperator::Create(Instruction::And, cmp0, cmp1, "and", currCallInst);
 			cmpInstList.push_back(cmpInst);
 			syncHelperMap[currBB].push_back(cmpInst);
 
@@ -723,7 +986,10 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		Instruction* reducedCompare = dyn_cast<Instruction>(tmpCmp);
 		assert(	reducedCompare && "Call sync compare reduced to a single instruction");
 		syncHelperMap[currBB].pop_back();
-		splitBlocks(reducedCompare,	errBlockMap[currCallInst->getParent()->getParent()]);
+		Instruction* check = splitBlocks(reducedCompare, errBlockMap[currCallInst->getParent()->getParent()]);
+		for (auto orig : checkedOperands) {
+			recordSync(orig, check);
+		}
 		/*
 		 * NOTE:
 		 * splitting the blocks invalidates the previously set value in the map
@@ -823,8 +1089,8 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			Value* op0 = currTerminator->getOperand(0);
 			// TODO: will there ever be more than one operand to worry about?
 			// Yes, perhaps nested struct types. Hmm...
-			Value* op1 = cloneMap[op0].first;
-			Value* op2 = cloneMap[op0].second;
+			Value* op1 = cloneRegistry.getReplica(op0, 0);
+			Value* op2 = cloneRegistry.getReplica(op0, 1);
 //			errs() << *op << "\n" << *op2 << "\n" << *op3 << "\n";
 			unsigned arr[] = {0};
 
@@ -880,6 +1146,7 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 				}
 				Instruction* eCmp = CmpInst::Create(cmp_op, cmp_eq, extract0, extract1, cmpName);
 				eSel[i] = SelectInst::Create(eCmp, extract0, extract2, selName);
+				NumVoters++;
 
 				// debug
 //				errs() << *extract0 << "\n" << *extract1 << "\n" << *extract2 << "\n";
@@ -931,13 +1198,34 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 		}
 		assert(cmp_op && "return type not supported!");
 
+		// an earlier vote on this value can be used again
+		if (Instruction* prevVote = getDominatingSync(op, currTerminator)) {
+			startOfSyncLogic[currTerminator] = currTerminator;
+			currTerminator->replaceUsesOfWith(op, prevVote);
+			return;
+		}
+
+		// no need to split the block when voting bitwise
+		if (bitwiseVoteFlag) {
+			std::vector<Instruction*> voterInsts;
+			Instruction* vote = insertBitwiseVoter(op, clone1, clone2, currTerminator, TMRErrorDetected, voterInsts);
+			if (vote) {
+				startOfSyncLogic[currTerminator] = voterInsts.front();
+				currTerminator->replaceUsesOfWith(op, vote);
+				recordSync(op, vote);
+				return;
+			}
+		}
+
 		Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, op, clone1, terminator_cmp_name, currTerminator);
 
 		startOfSyncLogic[currTerminator] = cmp;
 
 		SelectInst* sel = SelectInst::Create(cmp, op, clone2, tmr_vote_inst_name, currTerminator);
+		NumVoters++;
 
 		currTerminator->replaceUsesOfWith(op, sel);
+		recordSync(op, sel);
 
 		// Too many cases to account for each possibility, this is removed
 		// assert(numUses == 2 && "Instruction only used in terminator synchronization");
@@ -983,7 +1271,7 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			uint64_t nTypes = sType->getStructNumElements();
 			// load each of the inner values and get their types
 			Value* op0 = currTerminator->getOperand(0);
-			Value* op1 = cloneMap[op0].first;
+			Value* op1 = cloneRegistry.getReplica(op0, 0);
 
 			// we'll need these later
 			unsigned arr[] = {0};
@@ -1033,15 +1321,21 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 					firstTime = 0;
 					syncPointLater = extract0;
 				}
-				eCmp.push_back(CmpInst::Create(cmp_op, cmp_eq, extract0, extract1, cmpName));
+				CmpInst* elementCmp = CmpInst::Create(cmp_op, cmp_eq, extract0, extract1, cmpName);
 
 				// debug
-//				errs() << *extract0 << "\n" << *extract1 << "\n" << *eCmp[i] << "\n";
+//				errs() << *extract0 << "\n" << *extract1 << "\n" << *elementCmp << "\n";
 
 				// insert the instructions into the basic block
 				extract0->insertBefore(currTerminator);
 				extract1->insertAfter(extract0);
-				eCmp.back()->insertAfter(extract1);
+				elementCmp->insertAfter(extract1);
+
+				// vector elements are reduced so they can be OR'd with the rest
+				if (elementCmp->getType()->isVectorTy()) {
+					elementCmp = reduceVectorCompare(elementCmp, false, cmpName + ".reduce");
+				}
+				eCmp.push_back(elementCmp);
 			}
 
 			// this doesn't help with the below anymore, but still a good check
@@ -1079,7 +1373,13 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			} else {
 				// nothing compared because they're all pointers
 				// so there's no synchronization necessary (?)
-				syncPoints.push_back(currTerminator);
+				syncPoints.insert(currTerminator);
+				return;
+			}
+
+			if (deferChecksOpt != DeferNone) {
+				deferDWCCheck(cmpInst);
+				startOfSyncLogic[currTerminator] = syncPointLater;
 				return;
 			}
 
@@ -1094,7 +1394,7 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			 *   any special information about synclogic
 			 */
 			Instruction* newTerm = lookAtLater->getParent()->getTerminator();
-			syncPoints.push_back(newTerm);
+			syncPoints.insert(newTerm);
 			startOfSyncLogic[newTerm] = syncPointLater;
 			return;
 
@@ -1104,11 +1404,24 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			assert(false && "Return type not supported!\n");
 		}
 
-		Instruction *cmpInst = CmpInst::Create(cmp_op,cmp_eq, currTerminator->getOperand(0),
-				clone, "tmp",currTerminator);
+		// already checked on the way here
+		Value* op = currTerminator->getOperand(0);
+		if (getDominatingSync(op, currTerminator)) {
+			startOfSyncLogic[currTerminator] = currTerminator;
+			return;
+		}
+
+		Instruction *cmpInst = CmpInst::Create(cmp_op,cmp_eq, op, clone, "tmp",currTerminator);
+
+		if (deferChecksOpt != DeferNone) {
+			deferDWCCheck(cmpInst);
+			startOfSyncLogic[currTerminator] = cmpInst;
+			recordSync(op, cmpInst);
+			return;
+		}
 
 		Function* currFn = currTerminator->getParent()->getParent();
-		splitBlocks(cmpInst, errBlockMap[currFn]);
+		recordSync(op, splitBlocks(cmpInst, errBlockMap[currFn]));
 	}
 }
 
@@ -1126,6 +1439,7 @@ Instruction* dataflowProtection::splitBlocks(Instruction* I, BasicBlock* errBloc
 	BasicBlock* originalBlock = I->getParent();
 	const Twine& name = originalBlock->getParent()->getName() + ".cont";
 	BasicBlock* newBlock = originalBlock->splitBasicBlock(I, name);
+	NumBlocksSplit++;
 
 	// The compare instruction is copied to the new basicBlock by calling split, so we remove it
 	I->eraseFromParent();
@@ -1134,46 +1448,25 @@ Instruction* dataflowProtection::splitBlocks(Instruction* I, BasicBlock* errBloc
 	originalBlock->getTerminator()->eraseFromParent();
 	// create conditional branch
 	// there are some times it will try to branch on a vector value.
-	// Instead need to insert additional compare logic. Only necessary with DWC.
-	if (!newCmpInst->getType()->isIntegerTy(1) && !TMR) {
+	// Instead need to insert additional compare logic.
+	if (newCmpInst->getType()->isVectorTy()) {
 		// it is possible that the value being compared is a vector type instead of a basic type
 
-		// need to sign extend the boolean vector
-		int numElements = newCmpInst->getType()->getVectorNumElements();
-		Type* newVecType = VectorType::get(IntegerType::getInt16Ty(originalBlock->getContext()), numElements);
-
-		SExtInst* signExt = new SExtInst(dyn_cast<Value>(newCmpInst), newVecType);
-		signExt->setName("syncExt");
-		signExt->insertAfter(newCmpInst);
-
-		// what size should the new type be? 16 bits * the number of elements
-		// TODO: why 16 bits?
-		int vecSize = numElements * 16;
-		// get something to compare against
-		IntegerType* intType = IntegerType::get(originalBlock->getContext(), vecSize);
-		Constant* newIntVec = Constant::getAllOnesValue(intType);
-
-		// bitcast the vector to a scalar value
-		BitCastInst* vecToScalar = new BitCastInst(signExt, intType);
-		vecToScalar->setName("b_cast");
-		vecToScalar->insertAfter(signExt);
+		// all of the lanes have to match
+		CmpInst* nextCmpInst = reduceVectorCompare(newCmpInst, true, "simdSync");
+		Instruction* vecToScalar = cast<Instruction>(nextCmpInst->getOperand(0));
 
 #ifdef DEBUG_SIMD_SYNCING
-		errs() << "SExt: " << *signExt << "\n";
 		errs() << "Bcast: " << *vecToScalar << "\n";
+		errs() << "Cmp: " << *nextCmpInst << "\n";
 #endif
 
-		// create one more compare instruction
-		CmpInst* nextCmpInst = CmpInst::Create(intCmpType, intCmpEqual, vecToScalar, newIntVec);
-		nextCmpInst->setName("simdSync");
-		nextCmpInst->insertAfter(vecToScalar);
-
 		// create terminator
 		BranchInst* newTerm;
 		newTerm = BranchInst::Create(newBlock, errBlock, nextCmpInst, originalBlock);
 		startOfSyncLogic[newTerm] = newCmpInst;
 		// this map will help with moving things later if the code is segmented
-		simdMap[newCmpInst] = std::make_tuple(signExt, vecToScalar, nextCmpInst);
+		simdMap[newCmpInst] = std::make_pair(vecToScalar, nextCmpInst);
 
 	} else {
 		BranchInst* newTerm;
@@ -1181,6 +1474,10 @@ Instruction* dataflowProtection::splitBlocks(Instruction* I, BasicBlock* errBloc
 		startOfSyncLogic[newTerm] = newCmpInst;
 	}
 
+	// keep the cached dominator tree (if any) in step with the new edges
+	updateDomTreeAfterSplit(originalBlock, newBlock);
+	updateDomTreeAfterNewEdge(originalBlock, errBlock);
+
 	// if the original block is already in the map, replace the entry with
 	//  the new block
 	if (syncCheckMap.find(originalBlock) != syncCheckMap.end()) {
@@ -1193,131 +1490,840 @@ Instruction* dataflowProtection::splitBlocks(Instruction* I, BasicBlock* errBloc
 
 
 //----------------------------------------------------------------------------//
-// DWC error handling function/blocks
+// Loop-aware sync placement
 //----------------------------------------------------------------------------//
-void dataflowProtection::insertErrorFunction(Module &M, int numClones) {
-	Type* t_void = Type::getVoidTy(M.getContext());
-	/*
-	 * There are 3 scenarios for inserting an error function:
-	 * 1) it already exists, defined by application programmer
-	 * 2) it does not exist, but -noMain flag is passed
-	 * 3) it does not exist
-	 */
-
-	// Will be created if either 1) DWC or 2) Stack Protection
-	Constant* c;
-	if ( (numClones == 2) || (protectStackFlag) ) {
-		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
-	} else {
-		return;
-	}
-
-	Function* errFn = dyn_cast<Function>(c);
-	assert(errFn && "Fault detection function is non-void");
-	// TODO: not sure if adding this attribute is necessary, but check some aggressive optimizations
-	errFn->addFnAttr(Attribute::get(M.getContext(), "noinline"));
-
-	/*
-	 * Scenario 1:
-	 * The user has declared their own error handler, use that.
-	 */
-	if ( errFn->getBasicBlockList().size() != 0) {
-		if (verboseFlag) errs() << info_string << " Found existing DWC error handler function\n";
+/*
+ * Every terminator is a sync point, so a branch inside of a loop has its condition
+ *  voted on (or checked) every time around the loop.  With -loopSyncs, some of these
+ *  are done somewhere else instead:
+ *  - If the condition doesn't change inside the loop, it is synced once in the
+ *    preheader of the outermost loop where that is true.  For TMR, the branch then
+ *    uses the voted value.
+ *  - For DWC, if the loop only exits from one place, and the branch there compares
+ *    an induction variable against a loop-invariant bound, the branch to the error
+ *    block is moved to the loop exit instead.  The copies of the exit condition are
+ *    still compared every time around the loop, but the results are AND'd into a
+ *    running value instead of being branched on.  At the exit, that value is checked
+ *    along with the copies of the induction variable and bound, and the exit
+ *    condition must agree with the loop having left.  So a fault in the counter, the
+ *    compare, or a branch that leaves the loop early is still detected, just later.
+ *    A branch that stays in the loop when it shouldn't is not, which is no different
+ *    from checking the condition every time.
+ *    TMR still votes every time, because it can't fix the control flow later.
+ * This has to happen before any blocks are split, while the loop info is accurate.
+ */
+//#define DEBUG_LOOP_SYNCS
+void dataflowProtection::placeLoopSyncs(Function* F, GlobalVariable* TMRErrorDetected) {
+	if (F->isDeclaration() || (F->getName() == fault_function_name)) {
 		return;
 	}
 
-	/*
-	 * Scenario 2:
-	 * Error handler will be added later.
-	 * We are to mark the function as "extern" and return.
-	 */
-	if (noMainFlag) {
-		errFn->setLinkage(GlobalValue::LinkageTypes::ExternalLinkage);
+	LoopInfo LI(*getDomTree(F));
+	if (LI.empty()) {
 		return;
 	}
 
-	/*
-	 * Scenario 3:
-	 * Error handler does not exist, so we need to create one.
-	 * Change the fault detection block name so it's unique to this module,
-	 *  in case someone tries to link this against another object file later.
-	 * Randomize the name, that way the output code can be included in a library file.
-	 */
-
-	// First, remove the function we created already
-	errFn->removeFromParent();
-
-	// Then, name the new one. Have to change global name because is used elsewhere
-	std::string random_suffix = getRandomString(12);
-	fault_function_name += random_suffix;
-	c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
-	errFn = dyn_cast<Function>(c);
+	// the loop doesn't change the value or any of its copies
+	auto isInvariant = [this](Loop* L, Value* v) {
+		return L->isLoopInvariant(v) && L->isLoopInvariant(getClone(v).first)
+				&& (!TMR || L->isLoopInvariant(getClone(v).second));
+	};
+
+	// sync point, and the preheader terminator to sync before instead
+	std::vector<std::pair<Instruction*, Instruction*> > hoisted;
+	// sync point, and the loop exit to check at instead
+	std::vector<std::pair<Instruction*, BasicBlock*> > sunk;
+
+	for (auto& bb : *F) {
+		Loop* L = LI.getLoopFor(&bb);
+		Instruction* term = bb.getTerminator();
+		if (!L || !isSyncPoint(term)) {
+			continue;
+		}
 
-	// reference to "abort" call
-	Constant* abortC = M.getOrInsertFunction("abort", t_void, NULL);
-	Function* abortF = dyn_cast<Function>(abortC);
-	assert(abortF && "Abort function detected");
-	// TODO: on what platform would an "abort" function not exist?
-	// in this case, the application programmer would have to provide their own error function
+		Value* cond = nullptr;
+		if (BranchInst* BI = dyn_cast<BranchInst>(term)) {
+			if (BI->isConditional()) {
+				cond = BI->getCondition();
+			}
+		} else if (SwitchInst* SI = dyn_cast<SwitchInst>(term)) {
+			cond = SI->getCondition();
+		}
+		if (!cond || !cond->getType()->isIntegerTy() || !isCloned(cond)) {
+			continue;
+		}
 
-	// Create a basic block that calls abort
-	BasicBlock* bb = BasicBlock::Create(M.getContext(), Twine("entry"), errFn, NULL);
-	CallInst* new_abort = CallInst::Create(abortF, "", bb);
-	UnreachableInst* term = new UnreachableInst(M.getContext(), bb);
-}
+		Loop* hoistTo = nullptr;
+		for (Loop* outer = L; outer && isInvariant(outer, cond); outer = outer->getParentLoop()) {
+			if (outer->getLoopPreheader()) {
+				hoistTo = outer;
+			}
+		}
+		if (hoistTo) {
+			hoisted.push_back(std::make_pair(term, hoistTo->getLoopPreheader()->getTerminator()));
+			continue;
+		}
 
+		if (TMR) {
+			continue;
+		}
 
-void dataflowProtection::createErrorBlocks(Module &M, int numClones) {
-	Type* t_void = Type::getVoidTy(M.getContext());
+		// only relational compares, so a bad copy can't make the loop run (almost) forever
+		ICmpInst* cmp = dyn_cast<ICmpInst>(cond);
+		BasicBlock* exitBB = L->getExitBlock();
+		if (!cmp || !cmp->isRelational() || (L->getExitingBlock() != &bb) || !exitBB ||
+				(exitBB->getSinglePredecessor() != &bb) || exitBB->isEHPad()) {
+			continue;
+		}
+		// the running check has to be available at the back edge
+		BasicBlock* latch = L->getLoopLatch();
+		if (!latch || !getDomTree(F)->dominates(&bb, latch)) {
+			continue;
+		}
+		Value* iv = cmp->getOperand(0);
+		Value* bound = cmp->getOperand(1);
+		if (!L->isLoopInvariant(bound)) {
+			std::swap(iv, bound);
+		}
+		if (L->isLoopInvariant(bound) && isSimpleInduction(L, iv)) {
+			sunk.push_back(std::make_pair(term, exitBB));
+		}
+	}
 
-	// Create an error handler block for each function - they can't share one
-	// Will be created if either 1) DWC or 2) Stack Protection
-	Constant* c;
-	if ( (numClones == 2) || (protectStackFlag) ) {
-		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
-	} else {
-		return;
+	// The running checks go in before any blocks are split, because one loop's exit
+	//  can be the latch of another.
+	LLVMContext& C = F->getContext();
+	std::map<Instruction*, Instruction*> runningChecks;
+	for (auto s : sunk) {
+		Instruction* term = s.first;
+		CmpInst* cmp = cast<CmpInst>(cast<BranchInst>(term)->getCondition());
+		Loop* L = LI.getLoopFor(term->getParent());
+		BasicBlock* header = L->getHeader();
+		BasicBlock* latch = L->getLoopLatch();
+
+		PHINode* phi = PHINode::Create(Type::getInt1Ty(C), 2, "loopCheck", &header->front());
+		Instruction* match = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_EQ,
+				cmp, getClone(cmp).first, loop_cmp_name, term);
+		Instruction* running = BinaryOperator::Create(Instruction::And, phi, match, "loopCheck", term);
+		for (BasicBlock* pred : predecessors(header)) {
+			phi->addIncoming((pred == latch) ? (Value*)running : ConstantInt::getTrue(C), pred);
+		}
+		runningChecks[term] = running;
+		// the clones are moved in front of this when the code is segmented
+		startOfSyncLogic[term] = match;
 	}
 
-	Function* errFn = dyn_cast<Function>(c);
-	assert(errFn && "error function exists");
+	// the same condition can be used by more than one loop branch
+	std::map<std::pair<Value*, Instruction*>, Value*> syncedValues;
+	for (auto h : hoisted) {
+		Instruction* term = h.first;
+		Instruction* preTerm = h.second;
+		Value* cond = term->getOperand(0);
 
-	// TODO: should this iterate over fnsToClone instead?
-	for (auto & F : M) {
-		if (F.getBasicBlockList().size() == 0)
-			continue;
+#ifdef DEBUG_LOOP_SYNCS
+		errs() << "Syncing " << *cond << " in '" << preTerm->getParent()->getName() << "'\n";
+#endif
 
-		if (isISR(F))
-			continue;
+		auto key = std::make_pair(cond, preTerm);
+		if (syncedValues.find(key) == syncedValues.end()) {
+			std::vector<Instruction*> syncInsts;
+			selectSyncSite(term);
+			if (currentSyncSite >= 0)
+				syncSites[currentSyncSite].kind = "hoisted-terminator";
+			syncedValues[key] = syncLoopValue(cond, preTerm, TMRErrorDetected, syncInsts);
+			countSyncSite(preTerm);
+			currentSyncSite = -1;
+
+			// the preheader terminator is a sync point too, which keeps the clones before this
+			if (startOfSyncLogic.find(preTerm) == startOfSyncLogic.end()) {
+				startOfSyncLogic[preTerm] = syncInsts.empty() ? preTerm : syncInsts.front();
+			}
+			movedLoopSyncs.insert(preTerm);
+		}
+		if (TMR) {
+			term->replaceUsesOfWith(cond, syncedValues[key]);
+		}
+		startOfSyncLogic[term] = term;
+		movedLoopSyncs.insert(term);
+		NumLoopSyncsHoisted++;
+	}
 
-		BasicBlock* originalBlock = &(F.back());
-		BasicBlock* errBlock = BasicBlock::Create(originalBlock->getContext(),
-				"errorHandler." + Twine(originalBlock->getParent()->getName()),
-				originalBlock->getParent(), originalBlock);
-		errBlock->moveAfter(originalBlock);
+	for (auto s : sunk) {
+		Instruction* term = s.first;
+		BasicBlock* exitBB = s.second;
+		CmpInst* cmp = cast<CmpInst>(cast<BranchInst>(term)->getCondition());
 
-		CallInst* dwcFailCall;
-		dwcFailCall = CallInst::Create(errFn, "", errBlock);
-		UnreachableInst* term = new UnreachableInst(errBlock->getContext(),
-				errBlock);
+#ifdef DEBUG_LOOP_SYNCS
+		errs() << "Checking " << *cmp << " in '" << exitBB->getName() << "'\n";
+#endif
 
-		// have to give the call some debug info, or compilation issues
-		Instruction* lastInst = originalBlock->getTerminator();
-//		while (lastInst->is)
-		if (lastInst->getDebugLoc()) {
-			dwcFailCall->setDebugLoc(lastInst->getDebugLoc());
-//			errs() << *dwcFailCall << "\n";
+		selectSyncSite(term);
+		if (currentSyncSite >= 0)
+			syncSites[currentSyncSite].kind = "sunk-terminator";
+		// always checked, so it can be counted before the check
+		countSyncSite(&*exitBB->getFirstInsertionPt());
+
+		// every compare matched, and the last one really said to leave
+		Instruction* insertPt = &*exitBB->getFirstInsertionPt();
+		bool exitOnTrue = (cast<BranchInst>(term)->getSuccessor(0) == exitBB);
+		Instruction* tookExit = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_EQ,
+				cmp, ConstantInt::get(Type::getInt1Ty(C), exitOnTrue), loop_cmp_name, insertPt);
+		Instruction* allMatch = BinaryOperator::Create(Instruction::And, runningChecks[term], tookExit,
+				"loopCheck", insertPt);
+		if (deferChecksOpt != DeferNone) {
+			deferDWCCheck(allMatch);
 		} else {
-//			errs() << *lastInst << "\n";
-			;
+			splitBlocks(allMatch, errBlockMap[F]);
 		}
 
-		errBlockMap[&F] = errBlock;
+		for (auto& op : cmp->operands()) {
+			if (isCloned(op)) {
+				std::vector<Instruction*> syncInsts;
+				syncLoopValue(op, &*exitBB->getFirstInsertionPt(), TMRErrorDetected, syncInsts);
+			}
+		}
+		currentSyncSite = -1;
+		movedLoopSyncs.insert(term);
+		NumLoopSyncsSunk++;
 	}
 }
 
+/*
+ * Syncs v and its copies right before insertBefore, and returns the value to use
+ *  from now on: the voted value for TMR, or v itself for DWC.
+ * syncInsts gets any new instructions that stay in front of insertBefore.
+ */
+Value* dataflowProtection::syncLoopValue(Value* v, Instruction* insertBefore, GlobalVariable* TMRErrorDetected,
+		std::vector<Instruction*>& syncInsts)
+{
+	Value* clone1 = getClone(v).first;
+	Type* opType = v->getType();
+	Instruction::OtherOps cmp_op = getComparisonType(opType);
+	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
 
-//----------------------------------------------------------------------------//
+	if (TMR) {
+		Value* clone2 = getClone(v).second;
+		if (bitwiseVoteFlag) {
+			Instruction* vote = insertBitwiseVoter(v, clone1, clone2, insertBefore, TMRErrorDetected, syncInsts);
+			if (vote) {
+				recordSync(v, vote);
+				return vote;
+			}
+		}
+
+		Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, v, clone1, loop_cmp_name, insertBefore);
+		SelectInst* sel = SelectInst::Create(cmp, v, clone2, tmr_vote_inst_name, insertBefore);
+		NumVoters++;
+		syncInsts.push_back(cmp);
+		syncInsts.push_back(sel);
+
+		// this block ends with a sync point, so the new terminator has to be one too
+		insertTMRCorrectionCount(cmp, TMRErrorDetected, true);
+		recordSync(v, sel);
+		return sel;
+	}
+
+	Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, v, clone1, loop_cmp_name, insertBefore);
+	if (deferChecksOpt != DeferNone) {
+		deferDWCCheck(cmp);
+		syncInsts.push_back(cmp);
+		recordSync(v, cmp);
+	} else {
+		// the check ends up in a different block than insertBefore
+		recordSync(v, splitBlocks(cmp, errBlockMap[insertBefore->getParent()->getParent()]));
+	}
+	return v;
+}
+
+
+//----------------------------------------------------------------------------//
+// Redundant sync elimination
+//----------------------------------------------------------------------------//
+/*
+ * The same value is often synced more than once, such as when it is used as a GEP
+ *  offset, then passed to a call, then stored.  The copies are SSA values, so once
+ *  they have been checked (DWC) or voted on (TMR), they are still the same anywhere
+ *  that sync dominates.  Those later syncs can be skipped; TMR uses the earlier
+ *  voted value instead.
+ * Everything recorded here is only good until the end of processSyncPoints().
+ */
+void dataflowProtection::recordSync(Value* orig, Instruction* syncInst) {
+	if (!syncElimFlag || !syncInst) {
+		return;
+	}
+	verifiedValues[orig].push_back(syncInst);
+}
+
+/*
+ * Returns the check (DWC) or voted value (TMR) of an earlier sync on orig which
+ *  dominates I, or nullptr if there isn't one.
+ */
+Instruction* dataflowProtection::getDominatingSync(Value* orig, Instruction* I) {
+	auto found = verifiedValues.find(orig);
+	if (found == verifiedValues.end()) {
+		return nullptr;
+	}
+
+	DominatorTree* DT = getDomTree(I->getParent()->getParent());
+	for (auto syncInst : found->second) {
+		if ((syncInst->getParent()->getParent() == I->getParent()->getParent())
+				&& DT->dominates(syncInst, I)) {
+			NumRedundantSyncs++;
+			return syncInst;
+		}
+	}
+	return nullptr;
+}
+
+
+//----------------------------------------------------------------------------//
+// Deferred DWC checks
+//----------------------------------------------------------------------------//
+/*
+ * Normally DWC branches to the error block at every sync point.  With -deferChecks,
+ *  the comparisons are instead AND'd together into a running value, which is only
+ *  branched on at a few places.  This trades fewer branches for a longer delay
+ *  between an error happening and it being detected.
+ * cmpInst must be true if the copies match.
+ */
+void dataflowProtection::deferDWCCheck(Instruction* cmpInst) {
+	if (cmpInst->getType()->isVectorTy()) {
+		cmpInst = reduceVectorCompare(cmpInst, true, "simdSync");
+	}
+	assert(cmpInst->getType()->isIntegerTy(1) && "deferring a boolean comparison");
+	deferredDWCChecks[cmpInst->getFunction()].push_back(cmpInst);
+}
+
+/*
+ * Builds the running check for F and branches on it at each check point.
+ * Check points are:
+ *   - returns (and resumes), so errors never leave the function
+ *   - calls to functions which aren't protected, because those have side
+ *     effects we can't take back
+ *   - volatile stores, for the same reason
+ *   - loop latches, if -deferChecks=loop
+ */
+void dataflowProtection::insertDeferredDWCChecks(Function* F) {
+	std::vector<Instruction*>& deferred = deferredDWCChecks[F];
+	if (deferred.empty()) {
+		return;
+	}
+	BasicBlock* errBlock = errBlockMap[F];
+	assert(errBlock && "function has an error block");
+
+	SmallPtrSet<Instruction*, 32> deferredSet(deferred.begin(), deferred.end());
+
+	// need the loops before the CFG changes
+	SmallPtrSet<Instruction*, 8> latchTerminators;
+	if (deferChecksOpt == DeferLoop) {
+		LoopInfo LI(*getDomTree(F));
+		for (Loop* L : LI.getLoopsInPreorder()) {
+			SmallVector<BasicBlock*, 4> latches;
+			L->getLoopLatches(latches);
+			for (BasicBlock* latch : latches) {
+				latchTerminators.insert(latch->getTerminator());
+			}
+		}
+	}
+
+	LLVMContext& C = F->getContext();
+	Constant* allMatchInit = ConstantInt::getTrue(C);
+
+	// The running value is built one block at a time.  The first AND in each block
+	//  is given the value coming into the block after all of the blocks are done,
+	//  which is when SSAUpdater can create any PHI nodes that are needed.
+	SSAUpdater SSA;
+	SSA.Initialize(Type::getInt1Ty(C), "dwcCheck");
+	std::vector<std::pair<BasicBlock*, Instruction*> > firstInBlock;
+	// check point, and the running value there (nullptr for whatever comes into the block)
+	std::vector<std::pair<Instruction*, Value*> > checkPoints;
+
+	for (auto& bb : *F) {
+		if (&bb == errBlock) {
+			continue;
+		}
+
+		// the instructions are collected first because new ones are inserted along the way
+		std::vector<Instruction*> insts;
+		for (auto& I : bb) {
+			insts.push_back(&I);
+		}
+
+		Instruction* allMatch = nullptr;
+		// don't branch on the same value twice in a row
+		Value* lastChecked = allMatchInit;
+		bool checkedLiveIn = false;
+		for (auto I : insts) {
+			if (deferredSet.count(I)) {
+				Value* prev = allMatch ? (Value*)allMatch : (Value*)UndefValue::get(I->getType());
+				Instruction* newAllMatch = BinaryOperator::Create(Instruction::And, prev, I, "dwcCheck");
+				newAllMatch->insertAfter(I);
+				if (!allMatch) {
+					firstInBlock.push_back(std::make_pair(&bb, newAllMatch));
+				}
+				allMatch = newAllMatch;
+				continue;
+			}
+
+			bool isCheckPoint = false;
+			if (isa<ReturnInst>(I) || isa<ResumeInst>(I)) {
+				isCheckPoint = true;
+			} else if (latchTerminators.count(I)) {
+				isCheckPoint = true;
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(I)) {
+				isCheckPoint = SI->isVolatile();
+			} else if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+				Function* calledF;
+				if (CallInst* CI = dyn_cast<CallInst>(I)) {
+					calledF = CI->getCalledFunction();
+				} else {
+					calledF = cast<InvokeInst>(I)->getCalledFunction();
+				}
+				// indirect calls could go anywhere
+				if (!calledF) {
+					isCheckPoint = true;
+				} else if (!calledF->isIntrinsic()) {
+					isCheckPoint = (fnsToClone.find(calledF) == fnsToClone.end());
+				}
+			}
+			if (!isCheckPoint) {
+				continue;
+			}
+
+			if (allMatch) {
+				if (allMatch != lastChecked) {
+					checkPoints.push_back(std::make_pair(I, allMatch));
+					lastChecked = allMatch;
+				}
+			} else if (!checkedLiveIn) {
+				checkPoints.push_back(std::make_pair(I, nullptr));
+				checkedLiveIn = true;
+			}
+		}
+
+		if (allMatch) {
+			SSA.AddAvailableValue(&bb, allMatch);
+		}
+	}
+
+	// nothing can have gone wrong before the function starts
+	BasicBlock* entry = &F->getEntryBlock();
+	if (!SSA.HasValueForBlock(entry)) {
+		SSA.AddAvailableValue(entry, allMatchInit);
+	}
+	for (auto& first : firstInBlock) {
+		BasicBlock* bb = first.first;
+		Value* liveIn = (bb == entry) ? allMatchInit : SSA.GetValueInMiddleOfBlock(bb);
+		first.second->setOperand(0, liveIn);
+	}
+	for (auto& check : checkPoints) {
+		if (!check.second) {
+			BasicBlock* bb = check.first->getParent();
+			check.second = (bb == entry) ? allMatchInit : SSA.GetValueInMiddleOfBlock(bb);
+		}
+	}
+
+	// now it's safe to change the CFG
+	for (auto& check : checkPoints) {
+		// constant if nothing has been compared yet, or if the block is unreachable
+		if (isa<Constant>(check.second)) {
+			continue;
+		}
+		insertDeferredDWCCheck(check.first, check.second, errBlock);
+	}
+}
+
+/*
+ * Splits the block right before checkPoint, and goes to errBlock if allMatch is false.
+ */
+void dataflowProtection::insertDeferredDWCCheck(Instruction* checkPoint, Value* allMatch, BasicBlock* errBlock) {
+	BasicBlock* originalBlock = checkPoint->getParent();
+	BasicBlock* newBlock = originalBlock->splitBasicBlock(checkPoint,
+			originalBlock->getParent()->getName() + ".cont");
+	NumBlocksSplit++;
+
+	// replace the unconditional branch that splitting the block added
+	originalBlock->getTerminator()->eraseFromParent();
+	BranchInst* newTerm = BranchInst::Create(newBlock, errBlock, allMatch, originalBlock);
+
+	updateDomTreeAfterSplit(originalBlock, newBlock);
+	updateDomTreeAfterNewEdge(originalBlock, errBlock);
+
+	// If checkPoint was a sync point, its comparisons were left behind in originalBlock.
+	// The new branch takes over as the sync point there, so the clones are still moved
+	//  in front of the comparisons when segmenting.
+	auto start = startOfSyncLogic.find(checkPoint);
+	if (isSyncPoint(checkPoint) && (start != startOfSyncLogic.end())
+			&& (start->second->getParent() == originalBlock)) {
+		syncPoints.insert(newTerm);
+		startOfSyncLogic[newTerm] = start->second;
+		startOfSyncLogic[checkPoint] = checkPoint;
+	}
+
+	// anything that was recorded about the end of the block has moved
+	auto found = syncCheckMap.find(originalBlock);
+	if (found != syncCheckMap.end()) {
+		syncCheckMap[newBlock] = found->second;
+		syncCheckMap.erase(found);
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Coalescing sync checks
+//----------------------------------------------------------------------------//
+/*
+ * Splitting the block at every DWC sync point leaves behind chains of ".cont" blocks,
+ *  each one ending with a branch to the error block.  If the check at the end of the
+ *  next block in the chain only depends on values that already exist in the current
+ *  block, it can be done early instead, AND'd with the current check.  Then the two
+ *  blocks only need one branch, and they can be merged back together.
+ * Checks are only moved earlier, never later, so no side effect can happen before
+ *  the check that protects it.
+ */
+//#define DEBUG_COALESCE_CHECKS
+void dataflowProtection::coalesceSyncChecks(Function* F) {
+	BasicBlock* errBlock = errBlockMap[F];
+	if (!errBlock) {
+		return;
+	}
+
+	// returns the branch if bb ends with a DWC check
+	auto getCheck = [errBlock](BasicBlock* bb) -> BranchInst* {
+		BranchInst* br = dyn_cast<BranchInst>(bb->getTerminator());
+		if (br && br->isConditional() && (br->getSuccessor(1) == errBlock)) {
+			return br;
+		}
+		return nullptr;
+	};
+
+	for (auto& bb : *F) {
+		BranchInst* check = getCheck(&bb);
+		if (!check) {
+			continue;
+		}
+
+		while (true) {
+			BasicBlock* next = check->getSuccessor(0);
+			if ((next == &bb) || (next->getSinglePredecessor() != &bb)) {
+				break;
+			}
+			BranchInst* nextCheck = getCheck(next);
+			if (!nextCheck) {
+				break;
+			}
+			std::vector<Instruction*> checkLogic;
+			if (!collectCheckLogic(nextCheck, checkLogic)) {
+				break;
+			}
+
+#ifdef DEBUG_COALESCE_CHECKS
+			errs() << "Merging the check in '" << next->getName() << "' into '" << bb.getName() << "'\n";
+#endif
+
+			// do the next check here instead
+			for (auto I : checkLogic) {
+				I->moveBefore(check);
+			}
+			Instruction* allMatch = BinaryOperator::Create(Instruction::And,
+					check->getCondition(), nextCheck->getCondition(), "syncCheck.merged", check);
+
+			// Everything the two checks need is now moved in front of the merged check when
+			//  segmenting, in the same order it is in now.
+			std::vector<Instruction*>& helpers = syncHelperMap[&bb];
+			auto oldCheck = syncCheckMap.find(&bb);
+			if (oldCheck != syncCheckMap.end()) {
+				helpers.push_back(oldCheck->second);
+				auto simd = simdMap.find(oldCheck->second);
+				if (simd != simdMap.end()) {
+					helpers.push_back(simd->second.first);
+					helpers.push_back(simd->second.second);
+				}
+			}
+			helpers.insert(helpers.end(), checkLogic.begin(), checkLogic.end());
+			syncCheckMap[&bb] = allMatch;
+			syncCheckMap.erase(next);
+			syncHelperMap.erase(next);
+
+			check->setCondition(allMatch);
+			BasicBlock* after = nextCheck->getSuccessor(0);
+			startOfSyncLogic.erase(nextCheck);
+			nextCheck->eraseFromParent();
+			BranchInst::Create(after, next);
+			NumChecksCoalesced++;
+
+			// now next and after can be the same block
+			if ((after == next) || (after->getSinglePredecessor() != next) ||
+					isa<PHINode>(after->front()) || after->isEHPad() || after->hasAddressTaken()) {
+				break;
+			}
+			next->getTerminator()->eraseFromParent();
+			next->getInstList().splice(next->end(), after->getInstList());
+			after->replaceAllUsesWith(next);
+
+			auto afterCheck = syncCheckMap.find(after);
+			if (afterCheck != syncCheckMap.end()) {
+				syncCheckMap[next] = afterCheck->second;
+				syncCheckMap.erase(afterCheck);
+			}
+			auto afterHelpers = syncHelperMap.find(after);
+			if (afterHelpers != syncHelperMap.end()) {
+				syncHelperMap[next] = afterHelpers->second;
+				syncHelperMap.erase(afterHelpers);
+			}
+			after->eraseFromParent();
+		}
+	}
+}
+
+/*
+ * Gets the instructions in the same block as check that its condition depends on,
+ *  in the order they appear in the block.
+ * Returns false if any of them can't be safely moved to the previous block: only
+ *  comparisons and other side effect free sync logic can be moved, not the
+ *  values being synchronized on or their clones.
+ */
+bool dataflowProtection::collectCheckLogic(BranchInst* check, std::vector<Instruction*>& checkLogic) {
+	BasicBlock* bb = check->getParent();
+	SmallPtrSet<Instruction*, 16> needed;
+	std::vector<Instruction*> worklist;
+
+	if (Instruction* cond = dyn_cast<Instruction>(check->getCondition())) {
+		worklist.push_back(cond);
+	}
+	while (!worklist.empty()) {
+		Instruction* I = worklist.back();
+		worklist.pop_back();
+		if ((I->getParent() != bb) || needed.count(I)) {
+			continue;
+		}
+
+		if (isa<PHINode>(I) || !isSafeToSpeculativelyExecute(I) || isSyncPoint(I) ||
+				isCloned(I) || cloneRegistry.getOriginal(I)) {
+			return false;
+		}
+		needed.insert(I);
+
+		for (auto& op : I->operands()) {
+			if (Instruction* opInst = dyn_cast<Instruction>(op)) {
+				worklist.push_back(opInst);
+			}
+		}
+	}
+
+	for (auto& I : *bb) {
+		if (needed.count(&I)) {
+			checkLogic.push_back(&I);
+		}
+	}
+	return true;
+}
+
+
+//----------------------------------------------------------------------------//
+// Cached analyses
+//----------------------------------------------------------------------------//
+/*
+ * Building a DominatorTree walks the whole function, so constructing a new one
+ *  at every sync point made processSyncPoints() quadratic in the function size.
+ * Instead the tree is built the first time it is needed for a function, and the
+ *  routines which split blocks patch it up as they go.
+ * Define this to check the incremental updates against a fresh tree.
+ */
+// #define DEBUG_DOM_TREE_CACHE
+DominatorTree* dataflowProtection::getDomTree(Function* F) {
+	auto found = domTreeCache.find(F);
+	if (found != domTreeCache.end()) {
+#ifdef DEBUG_DOM_TREE_CACHE
+		assert(found->second->verify() && "cached dominator tree is out of date");
+#endif
+		return found->second.get();
+	}
+
+	DominatorTree* DT = new DominatorTree(*F);
+	domTreeCache[F] = std::unique_ptr<DominatorTree>(DT);
+	return DT;
+}
+
+/*
+ * newBB was split off the bottom of oldBB, so it takes over all of the
+ *  blocks that oldBB used to immediately dominate.
+ */
+void dataflowProtection::updateDomTreeAfterSplit(BasicBlock* oldBB, BasicBlock* newBB) {
+	auto found = domTreeCache.find(oldBB->getParent());
+	if (found == domTreeCache.end())
+		return;
+
+	DominatorTree* DT = found->second.get();
+	DomTreeNode* oldNode = DT->getNode(oldBB);
+	// nothing to do for unreachable code
+	if (!oldNode)
+		return;
+
+	std::vector<DomTreeNode*> children(oldNode->begin(), oldNode->end());
+	DomTreeNode* newNode = DT->addNewBlock(newBB, oldBB);
+	for (auto child : children) {
+		DT->changeImmediateDominator(child, newNode);
+	}
+}
+
+/*
+ * newBB is only reachable through idomBB, such as the TMR error counting blocks.
+ */
+void dataflowProtection::updateDomTreeAfterNewBlock(BasicBlock* newBB, BasicBlock* idomBB) {
+	auto found = domTreeCache.find(newBB->getParent());
+	if (found == domTreeCache.end())
+		return;
+
+	DominatorTree* DT = found->second.get();
+	if (DT->getNode(idomBB))
+		DT->addNewBlock(newBB, idomBB);
+}
+
+/*
+ * A branch from fromBB to toBB was added, where toBB may already have other
+ *  predecessors (or may have been unreachable, like the DWC error blocks).
+ */
+void dataflowProtection::updateDomTreeAfterNewEdge(BasicBlock* fromBB, BasicBlock* toBB) {
+	auto found = domTreeCache.find(fromBB->getParent());
+	if (found == domTreeCache.end())
+		return;
+
+	found->second->insertEdge(fromBB, toBB);
+}
+
+void dataflowProtection::clearAnalysisCache() {
+	domTreeCache.clear();
+}
+
+
+//----------------------------------------------------------------------------//
+// DWC error handling function/blocks
+//----------------------------------------------------------------------------//
+void dataflowProtection::insertErrorFunction(Module &M, int numClones) {
+	Type* t_void = Type::getVoidTy(M.getContext());
+	/*
+	 * There are 3 scenarios for inserting an error function:
+	 * 1) it already exists, defined by application programmer
+	 * 2) it does not exist, but -noMain flag is passed
+	 * 3) it does not exist
+	 */
+
+	// Will be created if either 1) DWC or 2) Stack Protection
+	Constant* c;
+	if ( (numClones == 2) || (protectStackFlag) ) {
+		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
+	} else {
+		return;
+	}
+
+	Function* errFn = dyn_cast<Function>(c);
+	assert(errFn && "Fault detection function is non-void");
+	// TODO: not sure if adding this attribute is necessary, but check some aggressive optimizations
+	errFn->addFnAttr(Attribute::get(M.getContext(), "noinline"));
+
+	/*
+	 * Scenario 1:
+	 * The user has declared their own error handler, use that.
+	 */
+	if ( errFn->getBasicBlockList().size() != 0) {
+		if (verboseFlag) errs() << info_string << " Found existing DWC error handler function\n";
+		return;
+	}
+
+	/*
+	 * Scenario 2:
+	 * Error handler will be added later.
+	 * We are to mark the function as "extern" and return.
+	 */
+	if (noMainFlag) {
+		errFn->setLinkage(GlobalValue::LinkageTypes::ExternalLinkage);
+		return;
+	}
+
+	/*
+	 * Scenario 3:
+	 * Error handler does not exist, so we need to create one.
+	 * Change the fault detection block name so it's unique to this module,
+	 *  in case someone tries to link this against another object file later.
+	 * Randomize the name, that way the output code can be included in a library file.
+	 */
+
+	// First, remove the function we created already
+	errFn->removeFromParent();
+
+	// Then, name the new one. Have to change global name because is used elsewhere
+	std::string random_suffix = getRandomString(12);
+	fault_function_name += random_suffix;
+	c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
+	errFn = dyn_cast<Function>(c);
+
+	// reference to "abort" call
+	Constant* abortC = M.getOrInsertFunction("abort", t_void, NULL);
+	Function* abortF = dyn_cast<Function>(abortC);
+	assert(abortF && "Abort function detected");
+	// TODO: on what platform would an "abort" function not exist?
+	// in this case, the application programmer would have to provide their own error function
+
+	// Create a basic block that calls abort
+	BasicBlock* bb = BasicBlock::Create(M.getContext(), Twine("entry"), errFn, NULL);
+	CallInst* new_abort = CallInst::Create(abortF, "", bb);
+	UnreachableInst* term = new UnreachableInst(M.getContext(), bb);
+}
+
+
+void dataflowProtection::createErrorBlocks(Module &M, int numClones) {
+	Type* t_void = Type::getVoidTy(M.getContext());
+
+	// Create an error handler block for each function - they can't share one
+	// Will be created if either 1) DWC or 2) Stack Protection
+	Constant* c;
+	if ( (numClones == 2) || (protectStackFlag) ) {
+		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
+	} else {
+		return;
+	}
+
+	Function* errFn = dyn_cast<Function>(c);
+	assert(errFn && "error function exists");
+
+	// TODO: should this iterate over fnsToClone instead?
+	for (auto & F : M) {
+		if (F.getBasicBlockList().size() == 0)
+			continue;
+
+		if (isISR(F))
+			continue;
+
+		BasicBlock* originalBlock = &(F.back());
+		BasicBlock* errBlock = BasicBlock::Create(originalBlock->getContext(),
+				"errorHandler." + Twine(originalBlock->getParent()->getName()),
+				originalBlock->getParent(), originalBlock);
+		errBlock->moveAfter(originalBlock);
+		NumErrorBlocks++;
+
+		CallInst* dwcFailCall;
+		dwcFailCall = CallInst::Create(errFn, "", errBlock);
+		UnreachableInst* term = new UnreachableInst(errBlock->getContext(),
+				errBlock);
+
+		// have to give the call some debug info, or compilation issues
+		Instruction* lastInst = originalBlock->getTerminator();
+//		while (lastInst->is)
+		if (lastInst->getDebugLoc()) {
+			dwcFailCall->setDebugLoc(lastInst->getDebugLoc());
+//			errs() << *dwcFailCall << "\n";
+		} else {
+//			errs() << *lastInst << "\n";
+			;
+		}
+
+		errBlockMap[&F] = errBlock;
+	}
+}
+
+
+//----------------------------------------------------------------------------//
 // TMR error detection
 //----------------------------------------------------------------------------//
 void dataflowProtection::insertTMRDetectionFlag(Instruction* cmpInst, GlobalVariable* TMRErrorDetected) {
@@ -1325,208 +2331,1391 @@ void dataflowProtection::insertTMRDetectionFlag(Instruction* cmpInst, GlobalVari
 		return;
 	}
 
-	Instruction* nextInst = cmpInst->getNextNode();
-	Value* orig = dyn_cast<Value>(cmpInst->getOperand(0));
-	assert(orig && "Original operand exists");
+	Instruction* nextInst = cmpInst->getNextNode();
+	Value* orig = dyn_cast<Value>(cmpInst->getOperand(0));
+	assert(orig && "Original operand exists");
+
+	Value* clone1 = getClone(orig).first;
+	Value* clone2 = getClone(orig).second;
+
+	// get the correct comparison type for this instruction
+	Type* opType = orig->getType();
+	Instruction::OtherOps cmp_op = getComparisonType(opType);
+	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+
+	// Insert additional OR operations
+	Instruction* cmpInst2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", nextInst);
+	Instruction* andCmps = BinaryOperator::CreateAnd(cmpInst, cmpInst2, "cmpReduction", nextInst);
+	if (andCmps->getType()->isVectorTy()) {
+		andCmps = reduceVectorCompare(andCmps, true, "cmpReduction");
+	}
+
+	// Insert a load, or after the sel inst
+	insertCounterAdd(TMRErrorDetected, andCmps, nextInst);
+}
+
+
+//#define DEBUG_INSERT_TMR_COUNT
+void dataflowProtection::insertTMRCorrectionCount(Instruction* cmpInst, GlobalVariable* TMRErrorDetected, bool updateSyncPoint) {
+	assert(cmpInst && "valid compare instruction");
+	assert(TMRErrorDetected && "valid TMR count global");
+
+	if (OriginalReportErrorsFlag) {
+		insertTMRDetectionFlag(cmpInst, TMRErrorDetected);
+		return;
+	} else if (!ReportErrorsFlag) {
+		return;
+	}
+
+#ifdef DEBUG_INSERT_TMR_COUNT
+	int flag = 0;
+	if (cmpInst->getParent()->getName() == "if.then.i3" &&
+			cmpInst->getParent()->getParent()->getName() == "uxQueueSpacesAvailable")
+	{
+		flag = 1;
+		errs() << "Inserting TMR correction counters into BB:\n";
+		errs() << *cmpInst->getParent() << "\n";
+	}
+#endif
+
+	Instruction* nextInst = cmpInst->getNextNode();
+	// value being synchronized on
+	Value* orig = dyn_cast<Value>(cmpInst->getOperand(0));
+	assert(orig && "Original operand exists");
+
+	Value* clone1 = getClone(orig).first;
+	Value* clone2 = getClone(orig).second;
+
+	// get the correct comparison type for this instruction
+	Type* opType = orig->getType();
+	Instruction::OtherOps cmp_op = getComparisonType(opType);
+	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+
+	// Insert additional OR operations
+	// compare the original with the 2nd clone
+	Instruction* cmpInst2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", nextInst);
+
+	/* Trying to add support to detecting errors in vector types */
+	if (cmpInst->getType()->isVectorTy()) {
+		insertVectorTMRCorrectionCount(cmpInst, cmpInst2, TMRErrorDetected);
+		return;
+	}
+
+	// AND the two compares together to see if either compare failed
+	BinaryOperator* andCmps = BinaryOperator::CreateAnd(cmpInst, cmpInst2, "cmpReduction", nextInst);
+
+	if (!andCmps->getType()->isIntegerTy(1)) {
+		errs() << "TMR detector can't branch on " << *(andCmps->getType()) << "\n";
+		errs() << *andCmps << "\n";
+		errs() << *andCmps->getParent() << "\n";
+		assert(false);
+	}
+
+	BasicBlock* originalBlock = cmpInst->getParent();
+	// create a new basic block to increment the counter, if there was an error
+	BasicBlock* errBlock = BasicBlock::Create(originalBlock->getContext(),
+			"errorHandler." + Twine(originalBlock->getParent()->getName()),
+			originalBlock->getParent(), originalBlock);
+	NumErrorBlocks++;
+
+	Constant* one = ConstantInt::get(Type::getInt32Ty(errBlock->getContext()), 1, false);
+	if (countSyncsFlag) {
+		/*
+		 * Increment global sync counter
+		 */
+		insertCounterAdd(dynamicSyncCount, one, cmpInst);
+	}
+
+	// Split blocks, deal with terminators
+	const Twine& name = originalBlock->getParent()->getName() + ".cont";
+	// the "vote" instruction is the first one in the new BB
+	BasicBlock* originalBlockContinued = originalBlock->splitBasicBlock(nextInst, name);
+	NumBlocksSplit++;
+
+	// splitting blocks adds an unconditional branch to the new BB; remove it
+	originalBlock->getTerminator()->eraseFromParent();
+	BranchInst* condGoToErrBlock = BranchInst::Create(originalBlockContinued, errBlock, andCmps, originalBlock);
+
+	// add a branch instruction to the error block to unconditionally go to the continue block
+	BranchInst* returnToBB = BranchInst::Create(originalBlockContinued, errBlock);
+	errBlock->moveAfter(originalBlock);
+
+	// Populate new block -- load global counter, increment, store
+	insertCounterAdd(TMRErrorDetected, one, returnToBB);
+
+	// originalBlock still dominates both of the new blocks
+	updateDomTreeAfterSplit(originalBlock, originalBlockContinued);
+	updateDomTreeAfterNewBlock(errBlock, originalBlock);
+
+	// if terminator for originalBlock was a sync point, be sure to mark the new terminator as such as well
+	if (updateSyncPoint) {
+		newSyncPoints.push_back(condGoToErrBlock);
+	}
+
+#ifdef DEBUG_INSERT_TMR_COUNT
+	if (flag) {
+		flag = 0;
+	}
+#endif
+
+	// Update how to divide up blocks
+	std::vector<Instruction*> syncHelperList;
+	syncHelperMap[originalBlock] = syncHelperList;
+	syncHelperMap[originalBlock].push_back(cmpInst);
+	syncHelperMap[originalBlock].push_back(cmpInst2);
+	syncHelperMap[originalBlock].push_back(andCmps);
+	syncCheckMap[originalBlock] = condGoToErrBlock;
+	startOfSyncLogic[condGoToErrBlock] = cmpInst;
+}
+
+
+/*
+ * Vector version of the TMR correction counter.  Every lane that doesn't agree
+ *  adds one to the error count, so no branching is needed.
+ * Invalidates cmpInst2.
+ */
+void dataflowProtection::insertVectorTMRCorrectionCount(Instruction* cmpInst, Instruction* cmpInst2, GlobalVariable* TMRErrorDetected) {
+	// change the comparisons to be NotEqual so we can add the results for a total error count
+	Instruction::OtherOps cmp_op;
+	CmpInst::Predicate cmp_neq;
+	Type* vType = cmpInst->getOperand(0)->getType();
+	if (vType->isIntOrIntVectorTy() || vType->isPtrOrPtrVectorTy()) {
+		// integer or pointer type
+		cmp_op = intCmpType;
+		cmp_neq = intCmpNotEqual;
+	} else if (vType->isFPOrFPVectorTy()) {
+		// floating point type
+		cmp_op = fpCmpType;
+		cmp_neq = fpCmpNotEqual;
+		// see the note in syncTerminator() about comparison predicate types
+	} else {
+		assert(false && "unsupported vector type");
+	}
+	CmpInst* newCmpInst = CmpInst::Create(cmp_op, cmp_neq, \
+			cmpInst->getOperand(0), cmpInst->getOperand(1), "ncmp");
+	newCmpInst->insertAfter(cmpInst);
+	CmpInst* newCmpInst2 = CmpInst::Create(cmp_op, cmp_neq, \
+			cmpInst2->getOperand(0), cmpInst2->getOperand(1), "ncmp");
+	newCmpInst2->insertAfter(cmpInst2);
+	cmpInst2->replaceAllUsesWith(newCmpInst2);
+	cmpInst2->eraseFromParent();
+
+	// need to OR the two cmp's first
+	BinaryOperator* cmpOr = BinaryOperator::Create(Instruction::BinaryOps::Or, \
+			newCmpInst, newCmpInst2, "reduceOr");
+	cmpOr->insertAfter(newCmpInst2);
+
+	// pack the lanes into an integer with one bit per lane, then count the bits
+	// this works for any vector width, and doesn't rely on the target
+	//  supporting the vector reduction intrinsics
+	BasicBlock* thisBlock = newCmpInst->getParent();
+	unsigned nLanes = cmpOr->getType()->getVectorNumElements();
+	IntegerType* laneBitsType = IntegerType::get(thisBlock->getContext(), nLanes);
+	BitCastInst* laneBits = new BitCastInst(cmpOr, laneBitsType, "laneBits");
+	laneBits->insertAfter(cmpOr);
+
+	Function* ctpop = Intrinsic::getDeclaration(thisBlock->getModule(), Intrinsic::ctpop, laneBitsType);
+	CallInst* laneErrors = CallInst::Create(ctpop, {laneBits}, "laneErrors");
+	laneErrors->insertAfter(laneBits);
+
+	// add this to the global
+	// if there were no errors, then it's just adding 0
+	insertCounterAdd(TMRErrorDetected, laneErrors, laneErrors->getNextNode());
+
+	return;
+}
+
+
+//----------------------------------------------------------------------------//
+// Sync profiling
+//----------------------------------------------------------------------------//
+/*
+ * With -profileSyncs, every sync point gets a site number and two 64-bit counters
+ *  in __COAST_syncProfile: how many times its sync logic ran, and how many errors
+ *  the voters there corrected (TMR with -countErrors).  Sites are numbered in
+ *  module order before any sync logic is added, so the same code always gets
+ *  the same numbers.
+ * __COAST_syncSites says where each site is, and __COAST_dumpSyncProfile() prints
+ *  the sites that ran as CSV.  It is called at exit if main() is in this module.
+ * Like __SYNC_COUNT, the counters are plain increments, so they can lose counts
+ *  when several threads go through the same site at the same time.
+ */
+// where each count is in the pair for a site, must match the dump routine
+#define SYNC_SITE_EXECUTIONS 0
+#define SYNC_SITE_CORRECTIONS 1
+
+static const std::string sync_profile_name = "__COAST_syncProfile";
+static const std::string sync_sites_name = "__COAST_syncSites";
+static const std::string sync_dump_name = "__COAST_dumpSyncProfile";
+
+void dataflowProtection::numberSyncSites(Module& M) {
+	syncSites.clear();
+	syncSiteIds.clear();
+	syncSiteCounts = nullptr;
+	if (!profileSyncsFlag)
+		return;
+
+	for (auto& F : M) {
+		unsigned bbNum = 0;
+		for (auto& bb : F) {
+			std::string block = bb.hasName() ? bb.getName().str() : "bb" + std::to_string(bbNum);
+			bbNum++;
+
+			for (auto& I : bb) {
+				if (!isSyncPoint(&I))
+					continue;
+
+				SyncSite site;
+				site.function = F.getName().str();
+				site.block = block;
+				if (isa<StoreInst>(&I))
+					site.kind = "store";
+				else if (isa<CallInst>(&I))
+					site.kind = "call";
+				else if (I.isTerminator())
+					site.kind = "terminator";
+				else
+					site.kind = "gep";
+				site.file = "?";
+				site.line = site.col = 0;
+				if (const DebugLoc& DL = I.getDebugLoc()) {
+					site.file = DL->getFilename().str();
+					site.line = DL.getLine();
+					site.col = DL.getCol();
+				}
+
+				syncSiteIds[&I] = syncSites.size();
+				syncSites.push_back(site);
+			}
+		}
+	}
+	if (syncSites.empty())
+		return;
+
+	ArrayType* countsType = ArrayType::get(Type::getInt64Ty(M.getContext()), 2 * syncSites.size());
+	syncSiteCounts = new GlobalVariable(M, countsType, false, GlobalValue::InternalLinkage,
+			ConstantAggregateZero::get(countsType), sync_profile_name);
+	globalsToSkip.insert(syncSiteCounts);
+
+	if (verboseFlag)
+		errs() << info_string << " Profiling " << syncSites.size() << " sync sites\n";
+}
+
+/*
+ * Until the next one, errors counted by insertCounterAdd() go to the site of
+ *  syncPoint.
+ */
+void dataflowProtection::selectSyncSite(Instruction* syncPoint) {
+	currentSyncSite = -1;
+	if (!syncSiteCounts)
+		return;
+	auto found = syncSiteIds.find(syncPoint);
+	if (found != syncSiteIds.end())
+		currentSyncSite = found->second;
+}
+
+/*
+ * Counts one execution of the sync logic for the current site, before insertBefore.
+ * Only called once the sync logic is there, since it can still be left out.
+ */
+void dataflowProtection::countSyncSite(Instruction* insertBefore) {
+	if (!syncSiteCounts || (currentSyncSite < 0))
+		return;
+
+	IRBuilder<> builder(insertBefore);
+	Type* countType = builder.getInt64Ty();
+	Value* countPtr = builder.CreateConstInBoundsGEP2_64(syncSiteCounts->getValueType(), syncSiteCounts,
+			0, 2 * currentSyncSite + SYNC_SITE_EXECUTIONS);
+	LoadInst* LI = builder.CreateLoad(countType, countPtr, "siteSyncLoad");
+	builder.CreateStore(builder.CreateAdd(LI, builder.getInt64(1), "siteSyncAdd"), countPtr);
+}
+
+/*
+ * Adds the table of sites, and void __COAST_dumpSyncProfile(void), which prints
+ *  site,function,block,kind,location,syncs,corrections
+ *  for every site that ran at least once.
+ */
+void dataflowProtection::emitSyncProfile(Module& M) {
+	if (!syncSiteCounts)
+		return;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	PointerType* strType = Type::getInt8PtrTy(C);
+	StructType* siteType = StructType::get(C, {strType, strType, strType, strType, i32, i32});
+
+	// the same names show up many times
+	std::map<std::string, Constant*> strings;
+	auto getString = [&](const std::string& str) -> Constant* {
+		auto found = strings.find(str);
+		if (found != strings.end())
+			return found->second;
+		Constant* data = ConstantDataArray::getString(C, str);
+		GlobalVariable* strGlobal = new GlobalVariable(M, data->getType(), true,
+				GlobalValue::PrivateLinkage, data, sync_sites_name + ".str");
+		strGlobal->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+		Constant* strPtr = ConstantExpr::getBitCast(strGlobal, strType);
+		strings[str] = strPtr;
+		return strPtr;
+	};
+
+	std::vector<Constant*> rows;
+	for (auto& site : syncSites) {
+		rows.push_back(ConstantStruct::get(siteType, {getString(site.function), getString(site.block),
+				getString(site.kind), getString(site.file),
+				ConstantInt::get(i32, site.line), ConstantInt::get(i32, site.col)}));
+	}
+	ArrayType* tableType = ArrayType::get(siteType, rows.size());
+	GlobalVariable* table = new GlobalVariable(M, tableType, true, GlobalValue::InternalLinkage,
+			ConstantArray::get(tableType, rows), sync_sites_name);
+
+	FunctionType* dumpType = FunctionType::get(Type::getVoidTy(C), false);
+	Function* dumpFn = M.getFunction(sync_dump_name);
+	if (!dumpFn) {
+		dumpFn = Function::Create(dumpType, GlobalValue::ExternalLinkage, sync_dump_name, &M);
+	} else if (!dumpFn->isDeclaration() || (dumpFn->getFunctionType() != dumpType)) {
+		errs() << warn_string << " '" << sync_dump_name << "' already exists, not adding the sync profile dump\n";
+		return;
+	}
+	Function* printfFn = M.getFunction("printf");
+	if (!printfFn) {
+		printfFn = Function::Create(FunctionType::get(i32, {strType}, true),
+				GlobalValue::ExternalLinkage, "printf", &M);
+	} else if (!printfFn->isVarArg() || (printfFn->arg_size() != 1) ||
+			(printfFn->getFunctionType()->getParamType(0) != strType)) {
+		errs() << warn_string << " 'printf' has an unexpected type, not adding the sync profile dump\n";
+		return;
+	}
+	dumpFn->addFnAttr(Attribute::NoUnwind);
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", dumpFn);
+	BasicBlock* siteBB = BasicBlock::Create(C, "site", dumpFn);
+	BasicBlock* printBB = BasicBlock::Create(C, "print", dumpFn);
+	BasicBlock* nextBB = BasicBlock::Create(C, "next", dumpFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", dumpFn);
+	IRBuilder<> builder(entryBB);
+	builder.CreateCall(printfFn, {getString("site,function,block,kind,location,syncs,corrections\n")});
+	builder.CreateBr(siteBB);
+
+	// skip the sites that never ran
+	builder.SetInsertPoint(siteBB);
+	PHINode* idx = builder.CreatePHI(i32, 2, "idx");
+	idx->addIncoming(builder.getInt32(0), entryBB);
+	Value* countIdx = builder.CreateMul(idx, builder.getInt32(2));
+	Type* countsType = syncSiteCounts->getValueType();
+	Value* syncs = builder.CreateLoad(i64, builder.CreateInBoundsGEP(countsType, syncSiteCounts,
+			{builder.getInt32(0), builder.CreateAdd(countIdx, builder.getInt32(SYNC_SITE_EXECUTIONS))}), "syncs");
+	Value* corrections = builder.CreateLoad(i64, builder.CreateInBoundsGEP(countsType, syncSiteCounts,
+			{builder.getInt32(0), builder.CreateAdd(countIdx, builder.getInt32(SYNC_SITE_CORRECTIONS))}), "corrections");
+	builder.CreateCondBr(builder.CreateICmpNE(syncs, builder.getInt64(0)), printBB, nextBB);
+
+	builder.SetInsertPoint(printBB);
+	Value* row = builder.CreateInBoundsGEP(tableType, table, {builder.getInt32(0), idx});
+	std::vector<Value*> printArgs = {getString("%u,%s,%s,%s,%s:%u:%u,%llu,%llu\n"), idx};
+	for (unsigned field = 0; field < siteType->getNumElements(); field++) {
+		printArgs.push_back(builder.CreateLoad(siteType->getElementType(field),
+				builder.CreateStructGEP(siteType, row, field)));
+	}
+	printArgs.push_back(syncs);
+	printArgs.push_back(corrections);
+	builder.CreateCall(printfFn, printArgs);
+	builder.CreateBr(nextBB);
+
+	builder.SetInsertPoint(nextBB);
+	Value* nextIdx = builder.CreateAdd(idx, builder.getInt32(1));
+	idx->addIncoming(nextIdx, nextBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, builder.getInt32(syncSites.size())), siteBB, exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	builder.CreateRetVoid();
+
+	// print it when the program is done
+	Function* mainF = M.getFunction("main");
+	if (noMainFlag || !mainF || mainF->isDeclaration())
+		return;
+	FunctionType* atexitType = FunctionType::get(i32, {PointerType::getUnqual(dumpType)}, false);
+	Function* atexitFn = M.getFunction("atexit");
+	if (!atexitFn)
+		atexitFn = Function::Create(atexitType, GlobalValue::ExternalLinkage, "atexit", &M);
+	if (atexitFn->getFunctionType() != atexitType) {
+		errs() << warn_string << " 'atexit' has an unexpected type, call " << sync_dump_name << "() to see the profile\n";
+		return;
+	}
+	CallInst::Create(atexitFn, {dumpFn}, "", &*mainF->getEntryBlock().getFirstInsertionPt());
+}
+
+
+//----------------------------------------------------------------------------//
+// Per-thread counters
+//----------------------------------------------------------------------------//
+/*
+ * TMR_ERROR_CNT and __SYNC_COUNT are plain globals, so with more than one thread
+ *  the increments race, and every core keeps writing the same cache line.
+ * With -threadCounters, each thread adds to its own 64-bit counters instead,
+ *  which are in a cache line of their own.  tests/COAST_counters.c hands them
+ *  out, and adds them up when the program reads one of the globals.
+ */
+// where each counter is in the block of a thread, must match COAST_counters.c
+#define THREAD_COUNTER_ERRORS 0
+#define THREAD_COUNTER_SYNCS 1
+
+static const std::string counters_prefix = "__COAST_counters_";
+static const std::string thread_counters_name = "__COAST_threadCounters";
+
+static Function* getCountersRuntimeFunction(Module& M, std::string name, Type* retType,
+		ArrayRef<Type*> params) {
+	if (Function* existing = M.getFunction(counters_prefix + name))
+		return existing;
+	return Function::Create(FunctionType::get(retType, params, false),
+			GlobalValue::ExternalLinkage, counters_prefix + name, &M);
+}
+
+/*
+ * i64* __COAST_threadCounters()
+ * The counters of the calling thread, which get registered the first time.
+ * The calls are inlined by inlineThreadCounters().
+ */
+static Function* getThreadCountersFunction(Module& M) {
+	if (Function* existing = M.getFunction(thread_counters_name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	PointerType* slotType = Type::getInt64PtrTy(C);
+
+	// defined in the run-time as "__thread uint64_t* __COAST_counters_mine"
+	GlobalVariable* mine = M.getGlobalVariable(counters_prefix + "mine");
+	if (!mine) {
+		mine = new GlobalVariable(M, slotType, false, GlobalValue::ExternalLinkage,
+				nullptr, counters_prefix + "mine", nullptr, GlobalValue::GeneralDynamicTLSModel);
+	}
+	Function* registerFn = getCountersRuntimeFunction(M, "register", slotType, {});
+
+	Function* slotFn = Function::Create(FunctionType::get(slotType, false),
+			GlobalValue::InternalLinkage, thread_counters_name, &M);
+	slotFn->addFnAttr(Attribute::NoUnwind);
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", slotFn);
+	BasicBlock* registerBB = BasicBlock::Create(C, "register", slotFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", slotFn);
+	IRBuilder<> builder(entryBB);
+	Value* slot = builder.CreateLoad(slotType, mine);
+	builder.CreateCondBr(builder.CreateIsNull(slot), registerBB, exitBB);
+
+	builder.SetInsertPoint(registerBB);
+	Value* newSlot = builder.CreateCall(registerFn);
+	builder.CreateBr(exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	PHINode* result = builder.CreatePHI(slotType, 2, "slot");
+	result->addIncoming(slot, entryBB);
+	result->addIncoming(newSlot, registerBB);
+	builder.CreateRet(result);
+
+	return slotFn;
+}
+
+/*
+ * Nothing runs the inliner after COAST, so each counter update would have to
+ *  call __COAST_threadCounters().  Inlining splits the blocks, which would get
+ *  in the way of keeping track of the sync logic, so it is done once nothing
+ *  else moves it around.
+ */
+void dataflowProtection::inlineThreadCounters(Module& M) {
+	Function* slotFn = M.getFunction(thread_counters_name);
+	if (!slotFn)
+		return;
+
+	std::vector<CallInst*> calls;
+	for (auto U : slotFn->users()) {
+		if (CallInst* CI = dyn_cast<CallInst>(U))
+			calls.push_back(CI);
+	}
+	for (auto CI : calls) {
+		InlineFunctionInfo IFI;
+		InlineFunction(CI, IFI);
+	}
+
+	if (slotFn->use_empty())
+		slotFn->eraseFromParent();
+}
+
+/*
+ * Adds amount to counter (TMR_ERROR_CNT or __SYNC_COUNT) before insertBefore.
+ * Returns the new instructions, so they can be kept with the rest of the sync logic.
+ */
+std::vector<Instruction*> dataflowProtection::insertCounterAdd(GlobalVariable* counter,
+		Value* amount, Instruction* insertBefore) {
+	std::vector<Instruction*> inserted;
+	bool isSyncCount = (counter == dynamicSyncCount);
+	IRBuilder<> builder(insertBefore);
+
+	Type* countType = counter->getValueType();
+	Value* countPtr = counter;
+	if (threadCountersFlag) {
+		countType = builder.getInt64Ty();
+		CallInst* slot = builder.CreateCall(getThreadCountersFunction(*insertBefore->getModule()));
+		countPtr = builder.CreateConstInBoundsGEP1_32(countType, slot,
+				isSyncCount ? THREAD_COUNTER_SYNCS : THREAD_COUNTER_ERRORS);
+		inserted.push_back(slot);
+		inserted.push_back(cast<Instruction>(countPtr));
+	}
+
+	Value* addend = amount;
+	if (amount->getType() != countType) {
+		addend = builder.CreateZExtOrTrunc(amount, countType, "extendedCmp");
+		if (Instruction* castInst = dyn_cast<Instruction>(addend))
+			inserted.push_back(castInst);
+	}
+
+	LoadInst* LI = builder.CreateLoad(countType, countPtr, isSyncCount ? "ldSyncCnt" : "errFlagLoad");
+	Value* BI = builder.CreateAdd(LI, addend, isSyncCount ? "incSyncCnt" : "errFlagAdd");
+	StoreInst* SI = builder.CreateStore(BI, countPtr);
+	inserted.push_back(LI);
+	if (Instruction* addInst = dyn_cast<Instruction>(BI))
+		inserted.push_back(addInst);
+	inserted.push_back(SI);
+
+	// with -profileSyncs, the errors are also counted for the sync point they were found at
+	if (!isSyncCount && syncSiteCounts && (currentSyncSite >= 0) && !OriginalReportErrorsFlag) {
+		Type* siteCountType = builder.getInt64Ty();
+		Value* sitePtr = builder.CreateConstInBoundsGEP2_64(syncSiteCounts->getValueType(), syncSiteCounts,
+				0, 2 * currentSyncSite + SYNC_SITE_CORRECTIONS);
+		Value* siteAddend = builder.CreateZExtOrTrunc(amount, siteCountType, "siteErrors");
+		LoadInst* siteLoad = builder.CreateLoad(siteCountType, sitePtr, "siteErrLoad");
+		Value* siteAdd = builder.CreateAdd(siteLoad, siteAddend, "siteErrAdd");
+		StoreInst* siteStore = builder.CreateStore(siteAdd, sitePtr);
+		for (Value* v : {sitePtr, siteAddend}) {
+			if (Instruction* siteInst = dyn_cast<Instruction>(v))
+				inserted.push_back(siteInst);
+		}
+		inserted.push_back(siteLoad);
+		if (Instruction* addInst = dyn_cast<Instruction>(siteAdd))
+			inserted.push_back(addInst);
+		inserted.push_back(siteStore);
+	}
+
+	return inserted;
+}
+
+/*
+ * The program reads and writes TMR_ERROR_CNT and __SYNC_COUNT directly, so with
+ *  -threadCounters those accesses are changed to add up, or reset, the counters
+ *  of all of the threads.  The copies of a load all get the same total, so
+ *  they can't disagree because another thread counted something in between.
+ */
+void dataflowProtection::redirectCounterAccesses(Module& M, GlobalVariable* counter) {
+	if (!threadCountersFlag || !counter)
+		return;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32 = Type::getInt32Ty(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	Function* totalFn = getCountersRuntimeFunction(M, "total", i64, {i32});
+	Function* setFn = getCountersRuntimeFunction(M, "set", Type::getVoidTy(C), {i32, i64});
+	Constant* which = ConstantInt::get(i32,
+			(counter == dynamicSyncCount) ? THREAD_COUNTER_SYNCS : THREAD_COUNTER_ERRORS);
+
+	std::vector<LoadInst*> loads;
+	std::vector<StoreInst*> stores;
+	for (User* u : counter->users()) {
+		if (LoadInst* LI = dyn_cast<LoadInst>(u)) {
+			loads.push_back(LI);
+		} else if (StoreInst* SI = dyn_cast<StoreInst>(u)) {
+			if (SI->getPointerOperand() == counter)
+				stores.push_back(SI);
+		}
+	}
+
+	// look up the originals now, replacing them changes what the clones map to
+	std::map<LoadInst*, LoadInst*> cloneOrigs;
+	for (auto LI : loads) {
+		if (LoadInst* orig = dyn_cast_or_null<LoadInst>(getCloneOrig(LI)))
+			cloneOrigs[LI] = orig;
+	}
 
-	Value* clone1 = getClone(orig).first;
-	Value* clone2 = getClone(orig).second;
+	// originals first, so the copies can use the same value
+	std::map<LoadInst*, Value*> totals;
+	for (auto LI : loads) {
+		if (getCloneOrig(LI) || !LI->getType()->isIntegerTy())
+			continue;
+		IRBuilder<> builder(LI);
+		Value* total = builder.CreateZExtOrTrunc(builder.CreateCall(totalFn, {which}), LI->getType());
+		LI->replaceAllUsesWith(total);
+		totals[LI] = total;
+	}
+	for (auto& clone : cloneOrigs) {
+		if (totals.find(clone.second) != totals.end()) {
+			clone.first->replaceAllUsesWith(totals[clone.second]);
+			clone.first->eraseFromParent();
+		}
+	}
+	// otherwise the global looks unused, and removeUnusedGlobals() erases it under them
+	for (auto& total : totals) {
+		total.first->eraseFromParent();
+	}
 
-	// get the correct comparison type for this instruction
-	Type* opType = orig->getType();
-	Instruction::OtherOps cmp_op = getComparisonType(opType);
-	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+	// the old global is still written, in case the program looks at it some other way
+	for (auto SI : stores) {
+		if (getCloneOrig(SI) || !SI->getValueOperand()->getType()->isIntegerTy())
+			continue;
+		IRBuilder<> builder(SI);
+		builder.CreateCall(setFn, {which, builder.CreateZExtOrTrunc(SI->getValueOperand(), i64)});
+	}
+}
 
-	// Insert additional OR operations
-	Instruction* cmpInst2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", nextInst);
-	BinaryOperator* andCmps = BinaryOperator::CreateAnd(cmpInst, cmpInst2, "cmpReduction", nextInst);
 
-	// Insert a load, or after the sel inst
-	LoadInst* LI = new LoadInst(TMRErrorDetected, "errFlagLoad", nextInst);
-	CastInst* castedCmp = CastInst::CreateZExtOrBitCast(andCmps, LI->getType(), "extendedCmp", LI);
+//----------------------------------------------------------------------------//
+// Bitwise voting
+//----------------------------------------------------------------------------//
+/*
+ * Get the integer (or integer vector) type the same width as opType, which is
+ *  what the bitwise voter operates on.  Returns nullptr for types that can't
+ *  be voted on bit by bit, like pointers and aggregates.
+ */
+static Type* getBitwiseVoteType(Type* opType) {
+	if (opType->isIntOrIntVectorTy()) {
+		return opType;
+	} else if (!opType->isFPOrFPVectorTy()) {
+		return nullptr;
+	}
 
-	BinaryOperator* BI = BinaryOperator::CreateAdd(LI, castedCmp, "errFlagCmp", nextInst);
-	StoreInst* SI = new StoreInst(BI, TMRErrorDetected, nextInst);
+	Type* intType = Type::getIntNTy(opType->getContext(), opType->getScalarSizeInBits());
+	if (opType->isVectorTy()) {
+		return VectorType::get(intType, opType->getVectorNumElements());
+	}
+	return intType;
 }
 
+/*
+ * Inserts a straight-line majority voter before insertBefore:
+ *   vote = (a & b) | (a & c) | (b & c)
+ * Floating point values are bitcast to integers of the same width first, so
+ *  NaNs are voted on like any other bit pattern.  If errors are being counted,
+ *  the counter is incremented by the (zero-extended) result of checking if
+ *  any of the copies differ, or for vectors by the number of lanes that differ,
+ *  so no new basic blocks are needed.  With -reportErrors, the flag is updated
+ *  the same way as for the compare and select voter.
+ * All of the inserted instructions are added to voterInsts, in order.
+ * Returns the voted value, or nullptr if the type isn't supported, in which
+ *  case nothing is inserted and the caller should use compare and select.
+ */
+Instruction* dataflowProtection::insertBitwiseVoter(Value* orig, Value* clone1, Value* clone2,
+		Instruction* insertBefore, GlobalVariable* TMRErrorDetected, std::vector<Instruction*>& voterInsts) {
+	Type* opType = orig->getType();
+	Type* voteType = getBitwiseVoteType(opType);
+	if (!voteType) {
+		return nullptr;
+	}
 
-//#define DEBUG_INSERT_TMR_COUNT
-void dataflowProtection::insertTMRCorrectionCount(Instruction* cmpInst, GlobalVariable* TMRErrorDetected, bool updateSyncPoint) {
-	assert(cmpInst && "valid compare instruction");
-	assert(TMRErrorDetected && "valid TMR count global");
+	Value* a = orig;
+	Value* b = clone1;
+	Value* c = clone2;
+	if (voteType != opType) {
+		Instruction* castA = new BitCastInst(orig, voteType, "voteCast", insertBefore);
+		Instruction* castB = new BitCastInst(clone1, voteType, "voteCast", insertBefore);
+		Instruction* castC = new BitCastInst(clone2, voteType, "voteCast", insertBefore);
+		voterInsts.push_back(castA);
+		voterInsts.push_back(castB);
+		voterInsts.push_back(castC);
+		a = castA;	b = castB;	c = castC;
+	}
+
+	// explicitly create the instructions so nothing is constant folded away
+	Instruction* ab = BinaryOperator::Create(Instruction::And, a, b, "voteAB", insertBefore);
+	Instruction* ac = BinaryOperator::Create(Instruction::And, a, c, "voteAC", insertBefore);
+	Instruction* bc = BinaryOperator::Create(Instruction::And, b, c, "voteBC", insertBefore);
+	Instruction* abac = BinaryOperator::Create(Instruction::Or, ab, ac, "voteOr", insertBefore);
+	Instruction* vote = BinaryOperator::Create(Instruction::Or, abac, bc, tmr_vote_inst_name, insertBefore);
+	voterInsts.push_back(ab);
+	voterInsts.push_back(ac);
+	voterInsts.push_back(bc);
+	voterInsts.push_back(abac);
+	voterInsts.push_back(vote);
+
+	if (voteType != opType) {
+		vote = new BitCastInst(vote, opType, tmr_vote_inst_name, insertBefore);
+		voterInsts.push_back(vote);
+	}
+	NumVoters++;
+
+	if (!ReportErrorsFlag && !OriginalReportErrorsFlag) {
+		return vote;
+	}
 
+	// -reportErrors only sets the flag, same as insertTMRDetectionFlag()
 	if (OriginalReportErrorsFlag) {
-		insertTMRDetectionFlag(cmpInst, TMRErrorDetected);
-		return;
-	} else if (!ReportErrorsFlag) {
-		return;
+		Instruction::OtherOps cmp_op = getComparisonType(opType);
+		CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+		Instruction* cmp1 = CmpInst::Create(cmp_op, cmp_eq, orig, clone1, "cmp", insertBefore);
+		Instruction* cmp2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", insertBefore);
+		Instruction* andCmps = BinaryOperator::CreateAnd(cmp1, cmp2, "cmpReduction", insertBefore);
+		voterInsts.push_back(cmp1);
+		voterInsts.push_back(cmp2);
+		voterInsts.push_back(andCmps);
+		if (andCmps->getType()->isVectorTy()) {
+			Instruction* reduced = reduceVectorCompare(andCmps, true, "cmpReduction");
+			voterInsts.push_back(andCmps->getNextNode());
+			voterInsts.push_back(reduced);
+			andCmps = reduced;
+		}
+		std::vector<Instruction*> flagInsts = insertCounterAdd(TMRErrorDetected, andCmps, insertBefore);
+		voterInsts.insert(voterInsts.end(), flagInsts.begin(), flagInsts.end());
+		return vote;
 	}
 
-#ifdef DEBUG_INSERT_TMR_COUNT
-	int flag = 0;
-	if (cmpInst->getParent()->getName() == "if.then.i3" &&
-			cmpInst->getParent()->getParent()->getName() == "uxQueueSpacesAvailable")
-	{
-		flag = 1;
-		errs() << "Inserting TMR correction counters into BB:\n";
-		errs() << *cmpInst->getParent() << "\n";
+	if (countSyncsFlag) {
+		Constant* one = ConstantInt::get(Type::getInt32Ty(opType->getContext()), 1, false);
+		std::vector<Instruction*> countInsts = insertCounterAdd(dynamicSyncCount, one, insertBefore);
+		voterInsts.insert(voterInsts.end(), countInsts.begin(), countInsts.end());
 	}
-#endif
 
-	Instruction* nextInst = cmpInst->getNextNode();
-	// value being synchronized on
-	Value* orig = dyn_cast<Value>(cmpInst->getOperand(0));
-	assert(orig && "Original operand exists");
+	// any bit set here means one of the copies disagreed
+	Instruction* xab = BinaryOperator::Create(Instruction::Xor, a, b, "voteDiff", insertBefore);
+	Instruction* xac = BinaryOperator::Create(Instruction::Xor, a, c, "voteDiff", insertBefore);
+	Instruction* diff = BinaryOperator::Create(Instruction::Or, xab, xac, "voteDiffOr", insertBefore);
+	voterInsts.push_back(xab);
+	voterInsts.push_back(xac);
+	voterInsts.push_back(diff);
+
+	Constant* zero = Constant::getNullValue(voteType);
+	Instruction* mismatch = CmpInst::Create(intCmpType, intCmpNotEqual, diff, zero, "voteMismatch", insertBefore);
+	voterInsts.push_back(mismatch);
+
+	// vectors count one error for each lane that doesn't agree,
+	//  same as insertVectorTMRCorrectionCount()
+	if (voteType->isVectorTy()) {
+		IntegerType* laneBitsType = IntegerType::get(opType->getContext(), voteType->getVectorNumElements());
+		Instruction* laneBits = new BitCastInst(mismatch, laneBitsType, "laneBits", insertBefore);
+		Function* ctpop = Intrinsic::getDeclaration(insertBefore->getModule(), Intrinsic::ctpop, laneBitsType);
+		mismatch = CallInst::Create(ctpop, {laneBits}, "laneErrors", insertBefore);
+		voterInsts.push_back(laneBits);
+		voterInsts.push_back(mismatch);
+	}
 
-	Value* clone1 = getClone(orig).first;
-	Value* clone2 = getClone(orig).second;
+	std::vector<Instruction*> countInsts = insertCounterAdd(TMRErrorDetected, mismatch, insertBefore);
+	voterInsts.insert(voterInsts.end(), countInsts.begin(), countInsts.end());
 
-	// get the correct comparison type for this instruction
-	Type* opType = orig->getType();
-	Instruction::OtherOps cmp_op = getComparisonType(opType);
-	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+	return vote;
+}
 
-	// Insert additional OR operations
-	// compare the original with the 2nd clone
-	Instruction* cmpInst2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", nextInst);
 
-	/* Trying to add support to detecting errors in vector types */
-	if (cmpInst->getType()->isVectorTy()) {
-		insertVectorTMRCorrectionCount(cmpInst, cmpInst2, TMRErrorDetected);
+//----------------------------------------------------------------------------//
+// Fused memory intrinsics
+//----------------------------------------------------------------------------//
+/*
+ * When memory is replicated, each memcpy or memset is cloned along with it,
+ *  so the same amount of data is streamed through the cache two or three times.
+ * With -fuseMemOps=check, the copies of each call are replaced with one call
+ *  to a loop which votes on the sources (TMR) and writes the result to every
+ *  destination, or compares them (DWC) and goes to the error handler if they
+ *  don't match.  A source that isn't replicated is only read once.
+ * The loop is written plainly so the vectorizer can pick it up.
+ */
+void dataflowProtection::fuseMemIntrinsics(Module& M) {
+	if (fuseMemOpsOpt == FuseNone || noMemReplicationFlag)
 		return;
+
+	// find them all first, since fusing erases them
+	std::vector<CallInst*> memCalls;
+	for (auto F : fnsToClone) {
+		for (auto& bb : *F) {
+			for (auto& I : bb) {
+				if ((isa<MemCpyInst>(&I) || isa<MemSetInst>(&I)) && cloneRegistry.contains(&I))
+					memCalls.push_back(cast<CallInst>(&I));
+			}
+		}
 	}
 
-	// AND the two compares together to see if either compare failed
-	BinaryOperator* andCmps = BinaryOperator::CreateAnd(cmpInst, cmpInst2, "cmpReduction", nextInst);
+	unsigned numFused = 0;
+	for (auto CI : memCalls) {
+		if (fuseMemIntrinsic(M, CI))
+			numFused++;
+	}
 
-	if (!andCmps->getType()->isIntegerTy(1)) {
-		errs() << "TMR detector can't branch on " << *(andCmps->getType()) << ".  Disable vectorization? (-fno-vectorize) \n";
-		errs() << *andCmps << "\n";
-		errs() << *andCmps->getParent() << "\n";
-		assert(false);
+	NumMemOpsFused += numFused;
+	if (verboseFlag)
+		errs() << info_string << " Fused " << numFused << " replicated memcpy/memset calls\n";
+}
+
+/*
+ * Replaces origCall and its copies with a single call to a fused loop.
+ * Returns false if they can't be combined, in which case nothing is changed.
+ */
+bool dataflowProtection::fuseMemIntrinsic(Module& M, CallInst* origCall) {
+	MemIntrinsic* orig = cast<MemIntrinsic>(origCall);
+	bool isSet = isa<MemSetInst>(orig);
+
+	std::vector<MemIntrinsic*> calls = {orig};
+	for (unsigned n = 0; n < cloneRegistry.getNumReplicas(orig); n++) {
+		MemIntrinsic* copy = dyn_cast_or_null<MemIntrinsic>(cloneRegistry.getReplica(orig, n));
+		if (!copy || copy->getIntrinsicID() != orig->getIntrinsicID())
+			return false;
+		calls.push_back(copy);
 	}
 
-	BasicBlock* originalBlock = cmpInst->getParent();
-	// create a new basic block to increment the counter, if there was an error
-	BasicBlock* errBlock = BasicBlock::Create(originalBlock->getContext(),
-			"errorHandler." + Twine(originalBlock->getParent()->getName()),
-			originalBlock->getParent(), originalBlock);
+	// they must all be the same size, and be to different places, for the order not to matter
+	Type* bytePtrType = Type::getInt8PtrTy(M.getContext());
+	std::set<Value*> dests;
+	for (auto call : calls) {
+		if (call->isVolatile() || call->getLength() != orig->getLength())
+			return false;
+		if (call->getRawDest()->getType() != bytePtrType)
+			return false;
+		if (!isSet && cast<MemTransferInst>(call)->getRawSource()->getType() != bytePtrType)
+			return false;
+		dests.insert(call->getRawDest());
+	}
+	if (dests.size() != calls.size())
+		return false;
 
-	if (countSyncsFlag) {
-		/*
-		 * Increment global sync counter
-		 */
-		// Populate new block -- load global counter, increment, store
-		LoadInst* loadSyncCounter = new LoadInst(dynamicSyncCount, "ldSyncCnt", cmpInst);
-		Constant* one = ConstantInt::get(loadSyncCounter->getType(), 1, false);
-		BinaryOperator* incSyncCounter = BinaryOperator::CreateAdd(
-										loadSyncCounter, one, "incSyncCnt", cmpInst);
-		StoreInst* SI = new StoreInst(incSyncCounter, dynamicSyncCount, cmpInst);
+	std::vector<Value*> srcs;
+	for (auto call : calls) {
+		if (isSet)
+			srcs.push_back(cast<MemSetInst>(call)->getValue());
+		else
+			srcs.push_back(cast<MemTransferInst>(call)->getRawSource());
+	}
+	// copying from something that isn't replicated only needs to be read once
+	bool sameSrc = std::all_of(srcs.begin(), srcs.end(), [&](Value* v) { return v == srcs[0]; });
+	if (sameSrc)
+		srcs.resize(1);
+
+	Function* F = orig->getFunction();
+	bool check = !sameSrc;
+	if (check && !TMR && !errBlockMap[F])
+		check = false;
+
+	// widest element that evenly divides the length, and that all of the pointers are aligned to
+	unsigned width = 8;
+	ConstantInt* constLen = dyn_cast<ConstantInt>(orig->getLength());
+	if (!constLen) {
+		width = 1;
+	}
+	for (auto call : calls) {
+		unsigned align = call->getDestAlignment();
+		if (!isSet)
+			align = std::min(align, cast<MemTransferInst>(call)->getSourceAlignment());
+		while (width > 1 && (width > align || constLen->getZExtValue() % width != 0))
+			width /= 2;
 	}
 
-	// Populate new block -- load global counter, increment, store
-	LoadInst* LI = new LoadInst(TMRErrorDetected, "errFlagLoad", errBlock);
-	Constant* one = ConstantInt::get(LI->getType(), 1, false);
-	BinaryOperator* BI = BinaryOperator::CreateAdd(LI, one, "errFlagAdd", errBlock);
-	StoreInst* SI = new StoreInst(BI, TMRErrorDetected, errBlock);
+	IRBuilder<> builder(orig);
+	Instruction* dwcCheck = nullptr;
+	// the value being set is only one byte, so it can be checked right here
+	if (isSet && check) {
+		if (TMR) {
+			Value* vote = builder.CreateOr(builder.CreateOr(
+					builder.CreateAnd(srcs[0], srcs[1]), builder.CreateAnd(srcs[0], srcs[2])),
+					builder.CreateAnd(srcs[1], srcs[2]), tmr_vote_inst_name);
+			srcs = {vote};
+			NumVoters++;
+		} else {
+			dwcCheck = cast<Instruction>(builder.CreateICmpEQ(srcs[0], srcs[1], call_cmp_name));
+			srcs.resize(1);
+		}
+		check = false;
+	}
 
-	// Split blocks, deal with terminators
-	const Twine& name = originalBlock->getParent()->getName() + ".cont";
-	// the "vote" instruction is the first one in the new BB
-	BasicBlock* originalBlockContinued = originalBlock->splitBasicBlock(nextInst, name);
+	std::vector<Value*> args;
+	for (auto call : calls)
+		args.push_back(call->getRawDest());
+	args.insert(args.end(), srcs.begin(), srcs.end());
+	args.push_back(orig->getLength());
+
+	Function* fusedFn = getFusedMemFunction(M, isSet, calls.size(), srcs.size(), width,
+			check, orig->getLength()->getType());
+	CallInst* fusedCall = builder.CreateCall(fusedFn, args);
+	if (check && !TMR)
+		dwcCheck = fusedCall;
+
+	// the arguments may have been synchronized already, and that logic still has to come after the clones
+	auto start = startOfSyncLogic.find(orig);
+	if (isSyncPoint(orig) && (start != startOfSyncLogic.end())) {
+		syncPoints.insert(fusedCall);
+		startOfSyncLogic[fusedCall] = (start->second == orig) ? fusedCall : start->second;
+		startOfSyncLogic.erase(start);
+	}
 
-	// splitting blocks adds an unconditional branch to the new BB; remove it
-	originalBlock->getTerminator()->eraseFromParent();
-	BranchInst* condGoToErrBlock = BranchInst::Create(originalBlockContinued, errBlock, andCmps, originalBlock);
+	// the copies go first, since erasing the original drops its registry entry
+	for (unsigned n = 1; n < calls.size(); n++)
+		calls[n]->eraseFromParent();
+	orig->eraseFromParent();
 
-	// add a branch instruction to the error block to unconditionally go to the continue block
-	BranchInst* returnToBB = BranchInst::Create(originalBlockContinued, errBlock);
-	errBlock->moveAfter(originalBlock);
+	if (dwcCheck)
+		splitBlocks(dwcCheck, errBlockMap[F]);
+	return true;
+}
 
-	// if terminator for originalBlock was a sync point, be sure to mark the new terminator as such as well
-	if (updateSyncPoint) {
-		newSyncPoints.push_back(condGoToErrBlock);
+/*
+ * Gets (or creates) the loop that does the work of a fused call, one for each
+ *  combination of arguments.  The parameters are the destinations, then the
+ *  sources (or byte values for memset), then the length in bytes.
+ * Each iteration moves one integer of the given width, so the length has to be
+ *  a multiple of it.  The DWC check version returns true if the sources matched.
+ */
+Function* dataflowProtection::getFusedMemFunction(Module& M, bool isSet, unsigned numDests,
+		unsigned numSrcs, unsigned width, bool check, Type* lenType) {
+	std::string name = std::string("__COAST_") + (isSet ? "memset" : "memcpy")
+			+ std::to_string(numDests) + "_" + std::to_string(numSrcs)
+			+ "_w" + std::to_string(width) + "_i" + std::to_string(lenType->getIntegerBitWidth())
+			+ (check ? "_check" : "");
+	if (Function* existing = M.getFunction(name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* elemType = IntegerType::get(C, width * 8);
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	bool voting = check && (numSrcs == 3);
+	bool comparing = check && (numSrcs == 2);
+
+	std::vector<Type*> params(numDests, bytePtrType);
+	params.insert(params.end(), numSrcs, isSet ? Type::getInt8Ty(C) : bytePtrType);
+	params.push_back(lenType);
+	Type* retType = comparing ? Type::getInt1Ty(C) : Type::getVoidTy(C);
+	Function* fusedFn = Function::Create(FunctionType::get(retType, params, false),
+			GlobalValue::InternalLinkage, name, &M);
+	fusedFn->addFnAttr(Attribute::NoUnwind);
+
+	std::vector<Value*> args;
+	for (auto& arg : fusedFn->args())
+		args.push_back(&arg);
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", fusedFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", fusedFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", fusedFn);
+	IRBuilder<> builder(entryBB);
+
+	Value* count = builder.CreateUDiv(args.back(), ConstantInt::get(lenType, width), "count");
+	std::vector<Value*> dests;
+	for (unsigned n = 0; n < numDests; n++)
+		dests.push_back(builder.CreateBitCast(args[n], elemType->getPointerTo()));
+	std::vector<Value*> srcs;
+	for (unsigned n = 0; n < numSrcs; n++) {
+		Value* src = args[numDests + n];
+		if (isSet) {
+			// repeat the byte across the whole element
+			APInt ones = APInt::getSplat(width * 8, APInt(8, 1));
+			src = builder.CreateMul(builder.CreateZExt(src, elemType), ConstantInt::get(elemType, ones));
+		} else {
+			src = builder.CreateBitCast(src, elemType->getPointerTo());
+		}
+		srcs.push_back(src);
+	}
+	Constant* zero = ConstantInt::get(elemType, 0);
+	builder.CreateCondBr(builder.CreateICmpEQ(count, ConstantInt::get(lenType, 0)), exitBB, loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(lenType, 2, "i");
+	idx->addIncoming(ConstantInt::get(lenType, 0), entryBB);
+	PHINode* diff = nullptr;
+	if (comparing) {
+		diff = builder.CreatePHI(elemType, 2, "diff");
+		diff->addIncoming(zero, entryBB);
 	}
 
-#ifdef DEBUG_INSERT_TMR_COUNT
-	if (flag) {
-		flag = 0;
+	std::vector<Value*> values;
+	for (auto src : srcs) {
+		if (isSet)
+			values.push_back(src);
+		else
+			values.push_back(builder.CreateLoad(elemType, builder.CreateGEP(elemType, src, idx)));
+	}
+	Value* nextDiff = nullptr;
+	if (voting) {
+		// same as insertBitwiseVoter()
+		Value* vote = builder.CreateOr(builder.CreateOr(
+				builder.CreateAnd(values[0], values[1]), builder.CreateAnd(values[0], values[2])),
+				builder.CreateAnd(values[1], values[2]), tmr_vote_inst_name);
+		values = {vote};
+	} else if (comparing) {
+		nextDiff = builder.CreateOr(diff, builder.CreateXor(values[0], values[1]));
+	}
+	for (unsigned n = 0; n < numDests; n++) {
+		Value* v = (values.size() == 1) ? values[0] : values[n];
+		builder.CreateStore(v, builder.CreateGEP(elemType, dests[n], idx));
 	}
-#endif
 
-	// Update how to divide up blocks
-	std::vector<Instruction*> syncHelperList;
-	syncHelperMap[originalBlock] = syncHelperList;
-	syncHelperMap[originalBlock].push_back(cmpInst);
-	syncHelperMap[originalBlock].push_back(cmpInst2);
-	syncHelperMap[originalBlock].push_back(andCmps);
-	syncCheckMap[originalBlock] = condGoToErrBlock;
-	startOfSyncLogic[condGoToErrBlock] = cmpInst;
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(lenType, 1));
+	idx->addIncoming(nextIdx, loopBB);
+	if (comparing)
+		diff->addIncoming(nextDiff, loopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, count), loopBB, exitBB);
+
+	builder.SetInsertPoint(exitBB);
+	if (comparing) {
+		PHINode* allDiff = builder.CreatePHI(elemType, 2, "diff");
+		allDiff->addIncoming(zero, entryBB);
+		allDiff->addIncoming(nextDiff, loopBB);
+		builder.CreateRet(builder.CreateICmpEQ(allDiff, zero));
+	} else {
+		builder.CreateRetVoid();
+	}
+
+	return fusedFn;
 }
 
 
-// invalidates the first two arguments
-void dataflowProtection::insertVectorTMRCorrectionCount(Instruction* cmpInst, Instruction* cmpInst2, GlobalVariable* TMRErrorDetected) {
-	// don't support pointers (yet)
-	if (cmpInst->getType()->isPtrOrPtrVectorTy()) {
-		assert(false && "not supporting TMR detector with vectors of pointers");
+//----------------------------------------------------------------------------//
+// Parity protected globals
+//----------------------------------------------------------------------------//
+/*
+ * Large arrays can be kept as a single copy, protected by one parity byte for
+ *  every PARITY_BLOCK_SIZE bytes, instead of being replicated.
+ *  These are chosen with -parityGlobals or the __xMR_PARITY annotation.
+ * The parity byte is the XOR of all of the bytes in its block, which doesn't
+ *  depend on the byte order of the target.
+ * Each store first loads the old value, and then XORs the difference between
+ *  the old and new values into the parity of the block.
+ * Each load first recomputes the parity of its block.  If it doesn't match,
+ *      void FAULT_DETECTED_PARITY(void* block)
+ *  is called, which can repair the block (for example from a copy that is
+ *  scrubbed in the background).  The parity is checked again when it returns,
+ *  and abort() is called if it still doesn't match.  If the application
+ *  doesn't define it, it calls abort().
+ */
+
+#define PARITY_BLOCK_SIZE 16
+
+std::string parity_fault_function_name = "FAULT_DETECTED_PARITY";
+
+// XOR of all of the bytes of an integer of up to 64 bits
+static uint8_t foldToByte(uint64_t v) {
+	v ^= v >> 32;
+	v ^= v >> 16;
+	v ^= v >> 8;
+	return (uint8_t)v;
+}
+
+static Value* foldToByte(IRBuilder<>& builder, Value* v) {
+	v = builder.CreateZExtOrTrunc(v, builder.getInt64Ty());
+	v = builder.CreateXor(v, builder.CreateLShr(v, 32));
+	v = builder.CreateXor(v, builder.CreateLShr(v, 16));
+	v = builder.CreateXor(v, builder.CreateLShr(v, 8));
+	return builder.CreateTrunc(v, builder.getInt8Ty());
+}
+
+/*
+ * XORs the bytes of the initializer into the parity of each block.
+ * Returns false for anything that can't be done at compile time, like pointers,
+ *  or values that aren't all in the same block.
+ */
+static bool foldInitializerParity(const DataLayout& DL, Constant* init, uint64_t offset,
+		std::vector<uint8_t>& parity) {
+	Type* t = init->getType();
+	if (isa<ConstantAggregateZero>(init) || isa<UndefValue>(init)) {
+		return true;
 	}
 
-	// change the comparisons to be NotEqual so we can add the results for a total error count
-	Instruction::OtherOps cmp_op;
-	CmpInst::Predicate cmp_neq;
-	Type* vType = cmpInst->getOperand(0)->getType();
-	if (vType->isIntOrIntVectorTy()) {
-		// integer type
-		cmp_op = intCmpType;
-		cmp_neq = intCmpNotEqual;
-	} else if (vType->isFPOrFPVectorTy()) {
-		// floating point type
-		cmp_op = fpCmpType;
-		cmp_neq = fpCmpNotEqual;
-		// see the note in syncTerminator() about comparison predicate types
+	uint64_t v = 0;
+	if (ConstantInt* CI = dyn_cast<ConstantInt>(init)) {
+		if (CI->getBitWidth() > 64)
+			return false;
+		v = CI->getZExtValue();
+	} else if (ConstantFP* CF = dyn_cast<ConstantFP>(init)) {
+		APInt bits = CF->getValueAPF().bitcastToAPInt();
+		if (bits.getBitWidth() > 64)
+			return false;
+		v = bits.getZExtValue();
+	} else if (t->isArrayTy() || t->isStructTy()) {
+		const StructLayout* SL = t->isStructTy() ? DL.getStructLayout(cast<StructType>(t)) : nullptr;
+		unsigned numElements = t->isStructTy() ? t->getStructNumElements() : t->getArrayNumElements();
+		for (unsigned i = 0; i < numElements; i++) {
+			Constant* elem = init->getAggregateElement(i);
+			if (!elem)
+				return false;
+			uint64_t elemOffset = SL ? SL->getElementOffset(i) : i * DL.getTypeAllocSize(elem->getType());
+			if (!foldInitializerParity(DL, elem, offset + elemOffset, parity))
+				return false;
+		}
+		return true;
 	} else {
-		assert(false && "unsupported vector type");
+		return false;
 	}
-	CmpInst* newCmpInst = CmpInst::Create(cmp_op, cmp_neq, \
-			cmpInst->getOperand(0), cmpInst->getOperand(1), "ncmp");
-	newCmpInst->insertAfter(cmpInst);
-	CmpInst* newCmpInst2 = CmpInst::Create(cmp_op, cmp_neq, \
-			cmpInst2->getOperand(0), cmpInst2->getOperand(1), "ncmp");
-	newCmpInst2->insertAfter(cmpInst2);
-	cmpInst2->replaceAllUsesWith(newCmpInst2);
-	cmpInst2->eraseFromParent();
 
-	// need to OR the two cmp's first
-	BinaryOperator* cmpOr = BinaryOperator::Create(Instruction::BinaryOps::Or, \
-			newCmpInst, newCmpInst2, "reduceOr");
-	cmpOr->insertAfter(newCmpInst2);
+	uint64_t size = DL.getTypeStoreSize(t);
+	if (offset / PARITY_BLOCK_SIZE != (offset + size - 1) / PARITY_BLOCK_SIZE)
+		return false;
+	parity[offset / PARITY_BLOCK_SIZE] ^= foldToByte(v);
+	return true;
+}
 
-	BasicBlock* thisBlock = newCmpInst->getParent();
-	IRBuilder<> builder(thisBlock);
+// Only loads and stores of up to 64 bits that don't cross a block can be handled
+static bool isParityAccess(const DataLayout& DL, Type* t, unsigned align) {
+	if (t->isPointerTy() || t->isAggregateType())
+		return false;
+	uint64_t size = DL.getTypeStoreSize(t);
+	return (size <= 8) && (DL.getTypeSizeInBits(t) == size * 8) && (align >= size) && (PARITY_BLOCK_SIZE % size == 0);
+}
 
-	VectorType* typ = dyn_cast<VectorType>(newCmpInst->getType());
-	// have to extract each element
-	uint64_t nTypes = typ->getNumElements();
-	VectorType* newVType = VectorType::get(TMRErrorDetected->getValueType(), nTypes);
+/*
+ * A global can only be protected with parity if every access to it can be
+ *  found, so follow all of the pointers derived from it.
+ * It must be defined in this module, so the initial parity is known.
+ */
+bool dataflowProtection::canProtectWithParity(GlobalVariable* g) {
+	if (g->isConstant() || !g->hasInitializer() || g->isThreadLocal() || g->isExternallyInitialized())
+		return false;
+	if (globalsToRuntimeInit.find(g) != globalsToRuntimeInit.end())
+		return false;
 
-	// zero-extend the cmpOr result to be the same size as the TMR error counter
-	CastInst* zext = CastInst::Create(Instruction::CastOps::ZExt, cmpOr, newVType);
-	zext->insertAfter(cmpOr);
+	const DataLayout& DL = g->getParent()->getDataLayout();
+	uint64_t size = DL.getTypeAllocSize(g->getValueType());
+	std::vector<uint8_t> parity((size + PARITY_BLOCK_SIZE - 1) / PARITY_BLOCK_SIZE, 0);
+	if (!foldInitializerParity(DL, g->getInitializer(), 0, parity))
+		return false;
 
-	// the alternative to this is to implement a similar approach as is found in how
-	// syncTerminator() deals with struct types
-	CallInst* redAdd = builder.CreateAddReduce(zext);
-	redAdd->moveAfter(zext);
+	std::vector<Value*> worklist = {g};
+	std::set<Value*> seen;
+	while (!worklist.empty()) {
+		Value* ptr = worklist.back();
+		worklist.pop_back();
+		if (!seen.insert(ptr).second)
+			continue;
 
-	// add this to the global
-	// if there were no errors, then it's just adding 0
-	LoadInst* LI = new LoadInst(TMRErrorDetected, "errFlagLoad", thisBlock);
-	BinaryOperator* BI = BinaryOperator::CreateAdd(LI, redAdd, "errFlagAdd", thisBlock);
-	StoreInst* SI = new StoreInst(BI, TMRErrorDetected, thisBlock);
-	LI->moveAfter(redAdd);		BI->moveAfter(LI);		SI->moveAfter(BI);
+		for (User* u : ptr->users()) {
+			if (LoadInst* LI = dyn_cast<LoadInst>(u)) {
+				if (!isParityAccess(DL, LI->getType(), LI->getAlignment()))
+					return false;
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(u)) {
+				if (SI->getPointerOperand() != ptr)
+					return false;
+				if (!isParityAccess(DL, SI->getValueOperand()->getType(), SI->getAlignment()))
+					return false;
+			} else if (isa<GetElementPtrInst>(u) || isa<BitCastInst>(u)) {
+				worklist.push_back(u);
+			} else if (ConstantExpr* CE = dyn_cast<ConstantExpr>(u)) {
+				if (CE->getOpcode() != Instruction::GetElementPtr && CE->getOpcode() != Instruction::BitCast)
+					return false;
+				worklist.push_back(u);
+			} else if (GlobalVariable* user = dyn_cast<GlobalVariable>(u)) {
+				// llvm.used and annotations don't count
+				if (user->getSection() != "llvm.metadata")
+					return false;
+			} else if (isa<ConstantAggregate>(u)) {
+				worklist.push_back(u);
+			} else {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-	return;
+void dataflowProtection::insertParityChecks(Module& M) {
+	if (parityGlobals.empty() || noMemReplicationFlag)
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	Function* checkFn = getParityCheckFunction(M);
+	Function* updateFn = getParityUpdateFunction(M);
+
+	for (auto g : parityGlobals) {
+		uint64_t size = DL.getTypeAllocSize(g->getValueType());
+		uint64_t numBlocks = (size + PARITY_BLOCK_SIZE - 1) / PARITY_BLOCK_SIZE;
+		std::vector<uint8_t> parity(numBlocks, 0);
+		foldInitializerParity(DL, g->getInitializer(), 0, parity);
+
+		GlobalVariable* parityTable = new GlobalVariable(M,
+				ArrayType::get(Type::getInt8Ty(C), numBlocks), false, GlobalValue::InternalLinkage,
+				ConstantDataArray::get(C, parity), g->getName() + ".parity");
+		globalsToSkip.insert(parityTable);
+
+		Constant* base = ConstantExpr::getBitCast(g, bytePtrType);
+		Constant* table = ConstantExpr::getBitCast(parityTable, bytePtrType);
+		Constant* gSize = ConstantInt::get(Type::getInt64Ty(C), size);
+
+		// find all of the accesses, the same way canProtectWithParity() did
+		std::vector<LoadInst*> loads;
+		std::vector<StoreInst*> stores;
+		std::vector<Value*> worklist = {g};
+		std::set<Value*> seen;
+		while (!worklist.empty()) {
+			Value* ptr = worklist.back();
+			worklist.pop_back();
+			if (!seen.insert(ptr).second)
+				continue;
+			for (User* u : ptr->users()) {
+				if (LoadInst* LI = dyn_cast<LoadInst>(u))
+					loads.push_back(LI);
+				else if (StoreInst* SI = dyn_cast<StoreInst>(u))
+					stores.push_back(SI);
+				else if (!isa<GlobalVariable>(u))
+					worklist.push_back(u);
+			}
+		}
+
+		// the copies access the same memory, so only the originals need to be checked
+		for (auto LI : loads) {
+			if (getCloneOrig(LI))
+				continue;
+			IRBuilder<> builder(LI);
+			Value* addr = builder.CreateBitCast(LI->getPointerOperand(), bytePtrType);
+			builder.CreateCall(checkFn, {addr, base, table, gSize});
+			NumParityLoads++;
+		}
+
+		for (auto SI : stores) {
+			if (getCloneOrig(SI))
+				continue;
+			Value* ptr = SI->getPointerOperand();
+			Value* newVal = SI->getValueOperand();
+			IntegerType* bitsType = IntegerType::get(C, DL.getTypeSizeInBits(newVal->getType()));
+
+			IRBuilder<> builder(SI);
+			LoadInst* oldVal = builder.CreateLoad(newVal->getType(), ptr, "parityOld");
+			oldVal->setVolatile(SI->isVolatile());
+			builder.SetInsertPoint(SI->getNextNode());
+			Value* diff = builder.CreateXor(builder.CreateBitCast(oldVal, bitsType),
+					builder.CreateBitCast(newVal, bitsType));
+			Value* addr = builder.CreateBitCast(ptr, bytePtrType);
+			builder.CreateCall(updateFn, {addr, base, table, foldToByte(builder, diff)});
+			NumParityStores++;
+		}
+
+		if (verboseFlag)
+			errs() << info_string << " Protecting " << g->getName() << " with " << numBlocks << " parity bytes\n";
+	}
+}
+
+/*
+ * void __COAST_parityCheck(i8* addr, i8* base, i8* table, i64 size)
+ * Recomputes the parity of the block that addr is in, and calls the fault
+ *  handler if it doesn't match.  If it still doesn't match after the handler
+ *  returns, the block couldn't be repaired, and abort() is called.
+ */
+Function* dataflowProtection::getParityCheckFunction(Module& M) {
+	std::string name = "__COAST_parityCheck";
+	if (Function* existing = M.getFunction(name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	IntegerType* i64 = Type::getInt64Ty(C);
+	IntegerType* i8 = Type::getInt8Ty(C);
+	Type* intPtrType = M.getDataLayout().getIntPtrType(C);
+
+	Function* abortF = M.getFunction("abort");
+	if (!abortF) {
+		abortF = Function::Create(FunctionType::get(Type::getVoidTy(C), false),
+				GlobalValue::ExternalLinkage, "abort", &M);
+	}
+
+	// the application can provide its own handler, which may repair the block
+	Function* faultFn = M.getFunction(parity_fault_function_name);
+	if (!faultFn) {
+		faultFn = Function::Create(FunctionType::get(Type::getVoidTy(C), {bytePtrType}, false),
+				GlobalValue::InternalLinkage, parity_fault_function_name, &M);
+		BasicBlock* bb = BasicBlock::Create(C, "entry", faultFn);
+		CallInst::Create(abortF, "", bb);
+		new UnreachableInst(C, bb);
+	}
+
+	Function* checkFn = Function::Create(
+			FunctionType::get(Type::getVoidTy(C), {bytePtrType, bytePtrType, bytePtrType, i64}, false),
+			GlobalValue::InternalLinkage, name, &M);
+	auto arg = checkFn->arg_begin();
+	Value* addr = &*arg++;
+	Value* base = &*arg++;
+	Value* table = &*arg++;
+	Value* size = &*arg++;
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", checkFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", checkFn);
+	BasicBlock* byteBB = BasicBlock::Create(C, "byte", checkFn);
+	BasicBlock* doneBB = BasicBlock::Create(C, "done", checkFn);
+	BasicBlock* mismatchBB = BasicBlock::Create(C, "mismatch", checkFn);
+	BasicBlock* faultBB = BasicBlock::Create(C, "fault", checkFn);
+	BasicBlock* unrepairedBB = BasicBlock::Create(C, "unrepaired", checkFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", checkFn);
+	IRBuilder<> builder(entryBB);
+
+	Value* offset = builder.CreateSub(builder.CreatePtrToInt(addr, intPtrType), builder.CreatePtrToInt(base, intPtrType));
+	Value* block = builder.CreateZExtOrTrunc(builder.CreateLShr(offset, Log2_32(PARITY_BLOCK_SIZE)), i64);
+	Value* start = builder.CreateMul(block, ConstantInt::get(i64, PARITY_BLOCK_SIZE));
+	Value* remaining = builder.CreateSub(size, start);
+	Value* len = builder.CreateSelect(builder.CreateICmpULT(remaining, ConstantInt::get(i64, PARITY_BLOCK_SIZE)),
+			remaining, ConstantInt::get(i64, PARITY_BLOCK_SIZE));
+	Value* blockPtr = builder.CreateGEP(i8, base, start);
+	Value* parityPtr = builder.CreateGEP(i8, table, block);
+	builder.CreateBr(loopBB);
+
+	// the fault handler may have fixed the block, so this is run a second time after it
+	builder.SetInsertPoint(loopBB);
+	PHINode* second = builder.CreatePHI(builder.getInt1Ty(), 2, "second");
+	second->addIncoming(builder.getFalse(), entryBB);
+	builder.CreateBr(byteBB);
+
+	builder.SetInsertPoint(byteBB);
+	PHINode* idx = builder.CreatePHI(i64, 2, "i");
+	PHINode* sum = builder.CreatePHI(i8, 2, "parity");
+	idx->addIncoming(ConstantInt::get(i64, 0), loopBB);
+	sum->addIncoming(ConstantInt::get(i8, 0), loopBB);
+	LoadInst* byte = builder.CreateLoad(i8, builder.CreateGEP(i8, blockPtr, idx));
+	byte->setVolatile(true);
+	Value* nextSum = builder.CreateXor(sum, byte);
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(i64, 1));
+	idx->addIncoming(nextIdx, byteBB);
+	sum->addIncoming(nextSum, byteBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, len), byteBB, doneBB);
+
+	builder.SetInsertPoint(doneBB);
+	Value* expected = builder.CreateLoad(i8, parityPtr);
+	builder.CreateCondBr(builder.CreateICmpEQ(nextSum, expected), exitBB, mismatchBB);
+
+	builder.SetInsertPoint(mismatchBB);
+	builder.CreateCondBr(second, unrepairedBB, faultBB);
+
+	builder.SetInsertPoint(faultBB);
+	builder.CreateCall(faultFn, {blockPtr});
+	second->addIncoming(builder.getTrue(), faultBB);
+	builder.CreateBr(loopBB);
+
+	// the handler returned without fixing the block
+	builder.SetInsertPoint(unrepairedBB);
+	builder.CreateCall(abortF);
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(exitBB);
+	builder.CreateRetVoid();
+
+	return checkFn;
+}
+
+/*
+ * void __COAST_parityUpdate(i8* addr, i8* base, i8* table, i8 diff)
+ * XORs the difference made by a store into the parity of its block.
+ */
+Function* dataflowProtection::getParityUpdateFunction(Module& M) {
+	std::string name = "__COAST_parityUpdate";
+	if (Function* existing = M.getFunction(name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	Type* bytePtrType = Type::getInt8PtrTy(C);
+	IntegerType* i8 = Type::getInt8Ty(C);
+	Type* intPtrType = M.getDataLayout().getIntPtrType(C);
+
+	Function* updateFn = Function::Create(
+			FunctionType::get(Type::getVoidTy(C), {bytePtrType, bytePtrType, bytePtrType, i8}, false),
+			GlobalValue::InternalLinkage, name, &M);
+	updateFn->addFnAttr(Attribute::NoUnwind);
+	auto arg = updateFn->arg_begin();
+	Value* addr = &*arg++;
+	Value* base = &*arg++;
+	Value* table = &*arg++;
+	Value* diff = &*arg++;
+
+	IRBuilder<> builder(BasicBlock::Create(C, "entry", updateFn));
+	Value* offset = builder.CreateSub(builder.CreatePtrToInt(addr, intPtrType), builder.CreatePtrToInt(base, intPtrType));
+	Value* block = builder.CreateLShr(offset, Log2_32(PARITY_BLOCK_SIZE));
+	Value* parityPtr = builder.CreateGEP(i8, table, block);
+	builder.CreateStore(builder.CreateXor(builder.CreateLoad(i8, parityPtr), diff), parityPtr);
+	builder.CreateRetVoid();
+
+	return updateFn;
 }
 
 
@@ -1740,6 +3929,7 @@ void dataflowProtection::insertStackProtection(Module& M) {
 				// majority wins
 				SelectInst* sel = SelectInst::Create(cmp0, castRetValAgain,
 						loadRet2, tmr_vote_inst_name, ret);
+				NumVoters++;
 				// Get the address of the return address
 				CallInst* callAddrRetAddr = CallInst::Create(
 					addrOfRetAddrFunc,			/* FunctionCallee */
@@ -1762,7 +3952,7 @@ void dataflowProtection::insertStackProtection(Module& M) {
 				TerminatorInst* curTerminator = ret->getParent()->getTerminator();
 				Instruction* callRetAgain = castRetValAgain->getPrevNode();
 				startOfSyncLogic[curTerminator] = callRetAgain;
-				syncPoints.push_back(curTerminator);
+				syncPoints.insert(curTerminator);
 			}
 
 			else {
@@ -1775,7 +3965,7 @@ void dataflowProtection::insertStackProtection(Module& M) {
 			TerminatorInst* newTerm0 = newBlock0->getTerminator();
 			Instruction* callRetAgain = castRetValAgain->getPrevNode();
 			startOfSyncLogic[newTerm0] = callRetAgain;
-			syncPoints.push_back(newTerm0);
+			syncPoints.insert(newTerm0);
 			#ifdef ADDR_OF_RET_ADDR
 			}
 			#endif /* ADDR_OF_RET_ADDR */
@@ -197,6 +197,7 @@ void dataflowProtection::removeUnusedErrorBlocks(Module & M) {
 
 		if (errorBlock->getNumUses() == 0) {
 			errorBlock->eraseFromParent();
+			errBlockMap[&F] = nullptr;
 		}
 	}
 }
@@ -254,9 +255,12 @@ void dataflowProtection::removeUnusedGlobals(Module& M) {
 }
 
 void dataflowProtection::checkForUnusedClones(Module & M) {
-	for (auto cloneM : cloneMap) {
-		Value* orig = cloneM.first;
-		Value* clone = cloneM.second.first;
+	// erasing values below also drops their entries from the registry
+	for (auto orig : cloneRegistry.getOriginals()) {
+		if (!cloneRegistry.contains(orig))
+			continue;
+		Value* clone = cloneRegistry.getReplica(orig, 0);
+		Value* clone2 = cloneRegistry.getReplica(orig, 1);
 
 		if (clone->getNumUses() == 0) {
 			// Store instructions aren't cloned
@@ -302,7 +306,7 @@ void dataflowProtection::checkForUnusedClones(Module & M) {
 					inst->eraseFromParent();
 
 					if (TMR) {
-						Instruction* inst2 = dyn_cast<Instruction>(cloneM.second.second);
+						Instruction* inst2 = dyn_cast<Instruction>(clone2);
 						if (verboseFlag) errs() << "Removing unused local variable: " << *inst2 << "\n";
 						inst2->eraseFromParent();
 					}
@@ -316,7 +320,7 @@ void dataflowProtection::checkForUnusedClones(Module & M) {
 				if (verboseFlag) errs() << "Removing unused global string: " << *ce << "\n";
 				ce->destroyConstant();
 				if (TMR) {
-					ConstantExpr* ce2 = dyn_cast<ConstantExpr>(cloneM.second.second);
+					ConstantExpr* ce2 = dyn_cast<ConstantExpr>(clone2);
 					if (verboseFlag) errs() << "Removing unused global string: " << *ce2 << "\n";
 					ce2->destroyConstant();
 				}
@@ -341,7 +345,7 @@ void dataflowProtection::checkForUnusedClones(Module & M) {
 //					errs() << "Removing unused clone: " << *inst << "\n";
 //				inst->eraseFromParent();
 //				if (TMR) {
-//					Instruction* inst2 = dyn_cast<Instruction>(cloneM.second.second);
+//					Instruction* inst2 = dyn_cast<Instruction>(clone2);
 //					inst2->eraseFromParent();
 //				}
 //
@@ -533,9 +537,8 @@ void dataflowProtection::moveClonesToEndIfSegmented(Module & M) {
 
 					// if there are SIMD instructions, need to move the special compare operators
 					if (simdMap.find(cmpInst) != simdMap.end()) {
-						std::get<0>(simdMap[cmpInst])->moveBefore(cmpInst->getParent()->getTerminator());
-						std::get<1>(simdMap[cmpInst])->moveBefore(cmpInst->getParent()->getTerminator());
-						std::get<2>(simdMap[cmpInst])->moveBefore(cmpInst->getParent()->getTerminator());
+						simdMap[cmpInst].first->moveBefore(cmpInst->getParent()->getTerminator());
+						simdMap[cmpInst].second->moveBefore(cmpInst->getParent()->getTerminator());
 					}
 				}
 			}
@@ -913,6 +916,10 @@ void dataflowProtection::dumpModule(Module& M) {
 	for (GlobalVariable& g : M.getGlobalList()) {
 		errs() << g << "\n";
 	}
+	// -globalLayout=packed turns globals into aliases
+	for (GlobalAlias& a : M.aliases()) {
+		errs() << a << "\n";
+	}
 	errs() << "\n";
 	for (auto &f : M) {
 		errs() << f << "\n";
@@ -45,6 +45,8 @@ static GlobalFunctionSetMap unPtCallsWithPtGlbls;		/* Unprotected function calls
 static const std::set<Function*>* fnsToClone_ptr;
 
 static bool verifyDebug = false;
+// don't print anything while checking a plan, see checkGlobalScope()
+static bool quietScopeCheck = false;
 
 /*
  * Helper function that looks for stores that inherit from loads.
@@ -717,6 +719,56 @@ void dataflowProtection::walkUnPtStores(StoreRecordType &record) {
  * TODO: track pointers across function calls
  */
 void dataflowProtection::verifyOptions(Module& M) {
+	findScopeCrossings(M);
+
+    /* Print scope crossing warning messages */
+	// referencing protected globals from unprotected functions
+	printGlobalScopeErrorMessage(unPtWritesToPtGlbls, true, "written in");
+	printGlobalScopeErrorMessage(unPtReadsFromPtGlbls, true, "read in");
+	if (unPtReadsFromPtGlbls.size() > 0) {
+		errs() << " -- Please verify that these kinds of reads are read-only --\n";
+	}
+
+	// referencing unprotected globals from protected functions
+	printGlobalScopeErrorMessage(ptWritesToUnPtGlbls, false, "read from and written to inside");
+
+	// using globals across scope boundaries in function calls
+	printGlobalScopeErrorMessage(ptCallsWithUnPtGlbls, false, "used in a function call in");
+	printGlobalScopeErrorMessage(unPtCallsWithPtGlbls, true, "used in a function call in");
+	if ( (ptCallsWithUnPtGlbls.size() > 0) || (unPtCallsWithPtGlbls.size() > 0) ) {
+		errs() << " -- COAST currently does not support tracking global pointer crossings across function calls --\n";
+	}
+
+	// kill the compilation if we saw any of these errors
+	if ( 	(unPtWritesToPtGlbls.size()  > 0)  ||
+			(unPtReadsFromPtGlbls.size() > 0)  ||
+			(ptWritesToUnPtGlbls.size()  > 0)  ||
+			(ptCallsWithUnPtGlbls.size() > 0)  ||
+			(unPtCallsWithPtGlbls.size() > 0)  )
+	{
+		errs() << "\nExiting...\n";
+		// good place for debug
+		dumpModule(M);
+		std::exit(-1);
+	}
+
+	// print some more stats
+	if (verboseFlag && syncGlobalStores.size() > 0) {
+		errs() << info_string << " syncing before store\n";
+		for (auto si : syncGlobalStores) {
+			errs() << *si << "\n  in function '"
+				   << si->getParent()->getParent()->getName() << "'\n";
+		}
+	}
+
+	return;
+}
+
+
+/*
+ * Fills in the maps of uses across the scope boundary that verifyOptions() reports.
+ */
+void dataflowProtection::findScopeCrossings(Module& M) {
 	fnsToClone_ptr = &fnsToClone;
 
     // catalog all the loads across the replication boundary
@@ -880,7 +932,7 @@ void dataflowProtection::verifyOptions(Module& M) {
 					/* end other ConstantExpr use */
                 }
 
-				else {
+				else if (!quietScopeCheck) {
 					PRINT_STRING("-- unidentified global user:");
 					PRINT_VALUE(u);
 				}
@@ -940,9 +992,11 @@ void dataflowProtection::verifyOptions(Module& M) {
 			if (argIdx < 0) {
 				/* Then we couldn't find the relationship. Conservatively add to the list
 				 * of things that are not allowed. */
-				errs() << info_string << " Couldn't find argument index for call:\n" << *ci << "\n";
-				errs() << "  (using unprotected global '" << gv->getName() << "' in basic block '"
-					   << ci->getParent()->getName() << "' of function '" << parentF->getName() << "')\n";
+				if (!quietScopeCheck) {
+					errs() << info_string << " Couldn't find argument index for call:\n" << *ci << "\n";
+					errs() << "  (using unprotected global '" << gv->getName() << "' in basic block '"
+						   << ci->getParent()->getName() << "' of function '" << parentF->getName() << "')\n";
+				}
 				writeToGlobalMap(ptCallsWithUnPtGlbls, gv, parentF, ci);
 				continue;
 			}
@@ -965,9 +1019,11 @@ void dataflowProtection::verifyOptions(Module& M) {
 			if (argIdx < 0) {
 				/* Then we couldn't find the relationship. Conservatively add to the list
 				 * of things that are not allowed. */
-				errs() << info_string << " Couldn't find argument index for call:\n" << *ci << "\n";
-				errs() << "  (using protected global '" << gv->getName() << "' in basic block '"
-					   << ci->getParent()->getName() << "' of function '" << parentF->getName() << "')\n";
+				if (!quietScopeCheck) {
+					errs() << info_string << " Couldn't find argument index for call:\n" << *ci << "\n";
+					errs() << "  (using protected global '" << gv->getName() << "' in basic block '"
+						   << ci->getParent()->getName() << "' of function '" << parentF->getName() << "')\n";
+				}
 				writeToGlobalMap(unPtCallsWithPtGlbls, gv, parentF, ci);
 				continue;
 			}
@@ -1002,7 +1058,7 @@ void dataflowProtection::verifyOptions(Module& M) {
 //				errs() << *use << "\n";
 //			}
 
-			if (argIdx >= calledFunction->arg_size()) {
+			if ((argIdx >= calledFunction->arg_size()) && !quietScopeCheck) {
 				errs() << err_string
 					   << " function doesn't have that many arguments! (0 indexed)\n"
 					   << "  " << calledFunction->getName()
@@ -1032,51 +1088,50 @@ void dataflowProtection::verifyOptions(Module& M) {
     for (auto record : unPtStoreRecords) {
     	walkUnPtStores(record);
     }
+}
 
-    /* Print scope crossing warning messages */
-	// referencing protected globals from unprotected functions
-	printGlobalScopeErrorMessage(unPtWritesToPtGlbls, true, "written in");
-	printGlobalScopeErrorMessage(unPtReadsFromPtGlbls, true, "read in");
-	if (unPtReadsFromPtGlbls.size() > 0) {
-		errs() << " -- Please verify that these kinds of reads are read-only --\n";
-	}
 
-	// referencing unprotected globals from protected functions
-	printGlobalScopeErrorMessage(ptWritesToUnPtGlbls, false, "read from and written to inside");
 
-	// using globals across scope boundaries in function calls
-	printGlobalScopeErrorMessage(ptCallsWithUnPtGlbls, false, "used in a function call in");
-	printGlobalScopeErrorMessage(unPtCallsWithPtGlbls, true, "used in a function call in");
-	if ( (ptCallsWithUnPtGlbls.size() > 0) || (unPtCallsWithPtGlbls.size() > 0) ) {
-		errs() << " -- COAST currently does not support tracking global pointer crossings across function calls --\n";
-	}
-
-	// kill the compilation if we saw any of these errors
-	if ( 	(unPtWritesToPtGlbls.size()  > 0)  ||
-			(unPtReadsFromPtGlbls.size() > 0)  ||
-			(ptWritesToUnPtGlbls.size()  > 0)  ||
-			(ptCallsWithUnPtGlbls.size() > 0)  ||
-			(unPtCallsWithPtGlbls.size() > 0)  )
-	{
-		errs() << "\nExiting...\n";
-		// good place for debug
-		dumpModule(M);
-		std::exit(-1);
+/*
+ * Checks the same rules as verifyOptions() for the current scope, without
+ *  printing anything or exiting.  Used to check a plan before it is kept.
+ * Each global and function that break a rule are put in crossings, along with
+ *  whether the global is the protected one.
+ * Returns true if there weren't any.
+ */
+bool dataflowProtection::checkGlobalScope(Module& M, std::set<CrossingRecordType>& crossings) {
+	quietScopeCheck = true;
+	findScopeCrossings(M);
+	quietScopeCheck = false;
+
+	GlobalFunctionSetMap* ptGlobalMaps[] = {
+		&unPtWritesToPtGlbls, &unPtReadsFromPtGlbls, &unPtCallsWithPtGlbls
+	};
+	GlobalFunctionSetMap* unPtGlobalMaps[] = {
+		&ptWritesToUnPtGlbls, &ptCallsWithUnPtGlbls
+	};
+	for (auto globalMap : ptGlobalMaps) {
+		for (auto& item : *globalMap) {
+			for (auto& fnSet : item.second) {
+				crossings.insert(std::make_tuple(item.first, fnSet.first, true));
+			}
+		}
+		globalMap->clear();
 	}
-
-	// print some more stats
-	if (verboseFlag && syncGlobalStores.size() > 0) {
-		errs() << info_string << " syncing before store\n";
-		for (auto si : syncGlobalStores) {
-			errs() << *si << "\n  in function '"
-				   << si->getParent()->getParent()->getName() << "'\n";
+	for (auto globalMap : unPtGlobalMaps) {
+		for (auto& item : *globalMap) {
+			for (auto& fnSet : item.second) {
+				crossings.insert(std::make_tuple(item.first, fnSet.first, false));
+			}
 		}
+		globalMap->clear();
 	}
 
-	return;
+	// these are found again by verifyOptions() for the real scope
+	syncGlobalStores.clear();
+	return crossings.empty();
 }
 
-
 void dataflowProtection::printGlobalScopeErrorMessage(GlobalFunctionSetMap &globalMap,
 		bool globalPt, std::string directionMessage)
 {
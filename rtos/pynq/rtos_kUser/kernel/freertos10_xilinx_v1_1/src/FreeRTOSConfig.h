@@ -55,7 +55,10 @@
 
 #define configUSE_TIMERS 1
 
+// -scrubGlobals turns this on to run the scrubber in the idle task
+#ifndef configUSE_IDLE_HOOK
 #define configUSE_IDLE_HOOK 0
+#endif
 
 #define configUSE_TICK_HOOK 0
 
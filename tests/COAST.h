@@ -7,9 +7,13 @@
  * See documentation for how to use these properly.
  */
 
+#include <stdint.h>
+
 // Macros for variables, functions
 #define __NO_xMR __attribute__((annotate("no_xMR")))
 #define __xMR __attribute__((annotate("xMR")))
+// Keep one copy of this global, protected by parity, instead of replicating it
+#define __xMR_PARITY __attribute__((annotate("xMR_parity")))
 
 // Macro for function calls - same as replicateFnCalls
 #define __xMR_FN_CALL __attribute__((annotate("xMR_call")))
@@ -63,6 +67,28 @@
 //  on the function multiple times.
 #define __NO_xMR_ARG(num) __attribute__((annotate("no_xMR_arg-"#num)))
 
+// Created by COAST with -checkConstGlobals, returns how many blocks of the
+//  constant globals don't match their checksums
+unsigned int __COAST_checkConstGlobals(void);
+
+// With -threadCounters, adds up the counters of all of the threads (COAST_counters.c)
+// Reading TMR_ERROR_CNT or __SYNC_COUNT does the same thing, these give all 64 bits
+uint64_t __COAST_counters_total(int which);
+#define __COAST_ERROR_COUNT() __COAST_counters_total(0)
+#define __COAST_SYNC_COUNT() __COAST_counters_total(1)
+
+// With -scrubGlobals, checks the next max_bytes of the replicated globals and
+//  fixes copies that don't match (COAST_scrub.c).  Returns how many mismatches
+//  were found.  __COAST_scrub_idle() checks a fixed amount, for idle hooks
+unsigned int __COAST_scrub(unsigned int max_bytes);
+void __COAST_scrub_idle(void);
+extern unsigned long long __COAST_scrub_mismatched;
+extern unsigned long long __COAST_scrub_repaired;
+
+// Created by COAST with -profileSyncs, prints how often each sync point ran and
+//  how many errors it corrected.  Called at exit, unless there is no main()
+void __COAST_dumpSyncProfile(void);
+
 // convenience for no-inlining functions
 #define __COAST_NO_INLINE __attribute__((noinline))
 
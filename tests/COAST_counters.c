@@ -0,0 +1,121 @@
+/*
+ * COAST_counters.c
+ *
+ * Run-time support for -threadCounters.  Instead of every thread adding to
+ *  TMR_ERROR_CNT and __SYNC_COUNT, each thread gets its own 64-bit counters,
+ *  in a cache line that no other thread writes to.  Reading or writing one of
+ *  the globals in the program calls __COAST_counters_total() or
+ *  __COAST_counters_set() instead.
+ * When a thread exits, its counts are added to the retired totals, and its
+ *  counters are given to the next thread that needs some.
+ *
+ * This file is linked into the final executable as native code, it must not
+ *  go through the COAST pass itself.  Link with -lpthread.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+// must match THREAD_COUNTER_* in synchronization.cpp
+#define COUNTER_ERRORS          0
+#define COUNTER_SYNCS           1
+#define COUNTER_KINDS           2
+
+#define COUNTER_MAX_THREADS     256
+#define COUNTER_CACHE_LINE      64
+
+typedef struct {
+    uint64_t count[COUNTER_KINDS];
+    uint32_t in_use;
+    char pad[COUNTER_CACHE_LINE - COUNTER_KINDS * sizeof(uint64_t) - sizeof(uint32_t)];
+} thread_counters_t;
+
+static thread_counters_t counter_slots[COUNTER_MAX_THREADS] __attribute__((aligned(COUNTER_CACHE_LINE)));
+// how far into counter_slots has ever been used, only raised once a slot is claimed
+static uint32_t counter_num_slots;
+// counts from the threads that have exited, and from threads that didn't get a slot
+static uint64_t counter_retired[COUNTER_KINDS];
+
+static pthread_key_t counter_key;
+static pthread_once_t counter_once = PTHREAD_ONCE_INIT;
+
+// the counters of this thread, or 0 if it hasn't counted anything yet
+__thread uint64_t* __COAST_counters_mine;
+// for threads that don't get a slot of their own, only counted once they exit
+static __thread thread_counters_t counter_overflow;
+
+
+static void counter_retire(void* arg) {
+    thread_counters_t* slot = (thread_counters_t*)arg;
+    int k;
+
+    for (k = 0; k < COUNTER_KINDS; k++) {
+        __atomic_fetch_add(&counter_retired[k], slot->count[k], __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->count[k], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void counter_init(void) {
+    pthread_key_create(&counter_key, counter_retire);
+}
+
+// called the first time a thread counts something
+uint64_t* __COAST_counters_register(void) {
+    uint32_t i, n;
+
+    pthread_once(&counter_once, counter_init);
+
+    // claim the first free slot, either of a thread that exited or a new one,
+    //  the compare-exchange makes sure no other thread gets the same one
+    for (i = 0; i < COUNTER_MAX_THREADS; i++) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&counter_slots[i].in_use, &expected, 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == COUNTER_MAX_THREADS) {
+        pthread_setspecific(counter_key, &counter_overflow);
+        __COAST_counters_mine = counter_overflow.count;
+        return __COAST_counters_mine;
+    }
+
+    // then make sure the totals look at it
+    n = __atomic_load_n(&counter_num_slots, __ATOMIC_RELAXED);
+    while ( (n <= i) && !__atomic_compare_exchange_n(&counter_num_slots, &n, i + 1, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+        ;
+
+    pthread_setspecific(counter_key, &counter_slots[i]);
+    __COAST_counters_mine = counter_slots[i].count;
+    return __COAST_counters_mine;
+}
+
+/*
+ * Adds up the counters of every thread.  Threads that are still running may
+ *  count more while this is going on, so it's only exact once they're done.
+ */
+uint64_t __COAST_counters_total(int which) {
+    uint32_t i, n = __atomic_load_n(&counter_num_slots, __ATOMIC_ACQUIRE);
+    uint64_t total = __atomic_load_n(&counter_retired[which], __ATOMIC_RELAXED);
+
+    for (i = 0; i < n; i++)
+        total += __atomic_load_n(&counter_slots[i].count[which], __ATOMIC_RELAXED);
+    if (__COAST_counters_mine == counter_overflow.count)
+        total += counter_overflow.count[which];
+    return total;
+}
+
+// for example TMR_ERROR_CNT = 0, the value goes to the calling thread
+void __COAST_counters_set(int which, uint64_t value) {
+    uint32_t i, n = __atomic_load_n(&counter_num_slots, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+        __atomic_store_n(&counter_slots[i].count[which], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counter_retired[which], 0, __ATOMIC_RELAXED);
+    counter_overflow.count[which] = 0;
+
+    if (!__COAST_counters_mine)
+        __COAST_counters_register();
+    __COAST_counters_mine[which] = value;
+}
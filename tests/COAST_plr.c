@@ -0,0 +1,589 @@
+/*
+ * COAST_plr.c
+ *
+ * Run-time support for process-level redundancy (-PLR) on Linux.
+ * At the start of main() the program forks into several replicas, which all
+ *  run the same (unreplicated) code.  The library calls which talk to the
+ *  outside world are redirected here by the pass.  Each replica writes a
+ *  record of the call (the bytes it would output, or the input it asks for)
+ *  into its own ring in shared memory.  The first replica waits for all of
+ *  them, votes on the records, and is the only one which makes the real call.
+ *  Results of input calls are passed back to the others through shared memory.
+ * A replica which disagrees with the majority, crashes, or stops responding is
+ *  killed, and replaced with a copy of the first replica.  If the first replica
+ *  is the one that disagrees, it stops running the program and only votes from
+ *  then on, and a copy of one of the others takes its place.
+ *
+ * This file is linked into the final executable as native code, it must not
+ *  go through the COAST passes itself.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#define PLR_MAX_REPLICAS    8
+// how many calls the other replicas can run ahead of the first one
+#define PLR_RING_SIZE       16
+// larger outputs are split up, and larger inputs are read in pieces
+#define PLR_DATA_SIZE       4096
+#define PLR_CACHE_LINE      64
+// how many times to poll before giving up the core
+#define PLR_SPIN_COUNT      1024
+// a replica which doesn't reach a call this long after the first one is assumed to be stuck
+#define PLR_TIMEOUT_SEC     10
+
+// what a record is for, the ones from PLR_TIME on return something to the program
+enum {
+    PLR_OUTPUT_STREAM,
+    PLR_OUTPUT_FD,
+    PLR_EXIT,
+    PLR_TIME,
+    PLR_CLOCK,
+    PLR_GETCHAR,
+    PLR_FGETS,
+    PLR_READ
+};
+
+typedef struct {
+    uint32_t kind;
+    uint32_t len;
+    uint64_t handle;        // FILE*, file descriptor, or exit code
+    char data[PLR_DATA_SIZE];
+} plr_record;
+
+typedef struct {
+    int64_t result;
+    uint32_t len;
+    char data[PLR_DATA_SIZE];
+} plr_result;
+
+typedef struct {
+    uint64_t head;          // number of records this replica has written
+    char pad[PLR_CACHE_LINE - sizeof(uint64_t)];
+    plr_record ring[PLR_RING_SIZE];
+} plr_replica;
+
+typedef struct {
+    uint64_t released;      // number of calls the first replica has finished
+    int32_t respawn_id;     // replica to replace with a copy of another one, or -1
+    int32_t respawn_from;   // which one to copy
+    int32_t respawn_pid;    // the new copy, once it has been made
+    char pad[PLR_CACHE_LINE - sizeof(uint64_t) - 3 * sizeof(int32_t)];
+    plr_result results[PLR_RING_SIZE];
+    plr_replica replicas[PLR_MAX_REPLICAS];
+} plr_shared;
+
+static plr_shared* plr = 0;
+static int plr_num = 1;
+static int plr_id = 0;
+static uint64_t plr_seq = 0;
+// only used by the first replica, which votes and makes the calls
+static int plr_leader = 0;
+static int plr_supervising = 0;
+static pid_t plr_pids[PLR_MAX_REPLICAS];
+static unsigned long plr_faults = 0;
+
+
+//----------------------------------------------------------------------------//
+// Replicas
+//----------------------------------------------------------------------------//
+static void plr_wait(unsigned int* spins) {
+    if (++(*spins) >= PLR_SPIN_COUNT) {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static plr_record* plr_slot(int id, uint64_t seq) {
+    return &plr->replicas[id].ring[seq % PLR_RING_SIZE];
+}
+
+// returns 1 in the new replica
+static int plr_spawn(int id) {
+    pid_t pid;
+
+    // don't let the new replica inherit anything buffered
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0) {
+        plr_id = id;
+        plr_leader = 0;
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        return 1;
+    } else if (pid < 0) {
+        perror("COAST PLR: fork");
+        abort();
+    }
+    plr_pids[id] = pid;
+    return 0;
+}
+
+static void plr_fail(const char* reason, uint64_t seq) {
+    int i;
+    fprintf(stderr, "COAST PLR: %s at call %llu\n", reason, (unsigned long long)seq);
+    for (i = 0; i < plr_num; i++) {
+        if (plr_pids[i] > 0)
+            kill(plr_pids[i], SIGKILL);
+    }
+    abort();
+}
+
+// returns 1 in the new replica
+static int plr_replace(int id, uint64_t seq) {
+    if (plr_pids[id] > 0) {
+        kill(plr_pids[id], SIGKILL);
+        waitpid(plr_pids[id], 0, 0);
+    }
+    plr_faults++;
+    fprintf(stderr, "COAST PLR: replica %d failed at call %llu, replacing it\n",
+            id, (unsigned long long)seq);
+
+    // the new copy starts right after this call, like the first replica
+    __atomic_store_n(&plr->replicas[id].head, seq + 1, __ATOMIC_RELEASE);
+    return plr_spawn(id);
+}
+
+/*
+ * Once the first replica can't be trusted, the others are replaced with a copy
+ *  of one that agreed with the vote.  That replica makes the copy the next time
+ *  it stops at a call, see plr_serve().
+ */
+static void plr_respawn(int id, int from, uint64_t seq) {
+    unsigned int spins = 0;
+    time_t start = time(0);
+
+    if (plr_pids[id] > 0) {
+        kill(plr_pids[id], SIGKILL);
+        waitpid(plr_pids[id], 0, 0);
+    }
+    plr_pids[id] = 0;
+    plr_faults++;
+    fprintf(stderr, "COAST PLR: replica %d failed at call %llu, replacing it with a copy of replica %d\n",
+            id, (unsigned long long)seq, from);
+
+    __atomic_store_n(&plr->replicas[id].head, seq + 1, __ATOMIC_RELEASE);
+    plr->respawn_from = from;
+    plr->respawn_pid = 0;
+    __atomic_store_n(&plr->respawn_id, id, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&plr->respawn_id, __ATOMIC_ACQUIRE) >= 0) {
+        plr_wait(&spins);
+        if (!spins && (time(0) - start > PLR_TIMEOUT_SEC))
+            break;
+    }
+    if (plr->respawn_pid <= 0)
+        plr_fail("no replica could be copied", seq);
+    plr_pids[id] = plr->respawn_pid;
+}
+
+/*
+ * Called by the other replicas whenever they stop at a call.  If this one has
+ *  to make a copy of itself, it gives the copy the records it has written since
+ *  the last vote, and forks.  The copy is made a child of the first replica
+ *  (CLONE_PARENT), so that it can wait for it like the others.
+ */
+static void plr_serve(void) {
+    int id = __atomic_load_n(&plr->respawn_id, __ATOMIC_ACQUIRE);
+    uint64_t head = plr->replicas[plr_id].head;
+    uint64_t seq;
+    pid_t pid;
+
+    if ((id < 0) || (plr->respawn_from != plr_id))
+        return;
+
+    for (seq = __atomic_load_n(&plr->released, __ATOMIC_ACQUIRE); seq < head; seq++)
+        *plr_slot(id, seq) = *plr_slot(plr_id, seq);
+    __atomic_store_n(&plr->replicas[id].head, head, __ATOMIC_RELEASE);
+
+    pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    if (pid == 0) {
+        plr_id = id;
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        return;
+    } else if (pid < 0) {
+        perror("COAST PLR: clone");
+    }
+    plr->respawn_pid = pid;
+    __atomic_store_n(&plr->respawn_id, -1, __ATOMIC_RELEASE);
+}
+
+void __COAST_plr_init(int replicas) {
+    char* env = getenv("COAST_PLR_REPLICAS");
+    int i;
+
+    if (env)
+        replicas = atoi(env);
+    if (replicas > PLR_MAX_REPLICAS)
+        replicas = PLR_MAX_REPLICAS;
+    if (replicas < 2)
+        return;
+
+    plr = mmap(0, sizeof(plr_shared), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (plr == MAP_FAILED) {
+        perror("COAST PLR: mmap");
+        plr = 0;
+        return;
+    }
+
+    plr_num = replicas;
+    plr_leader = 1;
+    plr->respawn_id = -1;
+    for (i = 1; i < replicas; i++) {
+        if (plr_spawn(i))
+            break;
+    }
+}
+
+
+//----------------------------------------------------------------------------//
+// Voting
+//----------------------------------------------------------------------------//
+static int plr_same(const plr_record* a, const plr_record* b) {
+    return (a->kind == b->kind) && (a->len == b->len) && (a->handle == b->handle) &&
+            (memcmp(a->data, b->data, a->len) == 0);
+}
+
+// returns 0 if the replica died or is stuck
+static int plr_arrive(int id, uint64_t seq) {
+    unsigned int spins = 0;
+    time_t start = time(0);
+
+    while (__atomic_load_n(&plr->replicas[id].head, __ATOMIC_ACQUIRE) <= seq) {
+        plr_wait(&spins);
+        if (spins)
+            continue;
+        if ((plr_pids[id] > 0) && (waitpid(plr_pids[id], 0, WNOHANG) == plr_pids[id])) {
+            // it may have written the record (and the rest, up to its exit) since the last check
+            plr_pids[id] = 0;
+            return __atomic_load_n(&plr->replicas[id].head, __ATOMIC_ACQUIRE) > seq;
+        }
+        if (time(0) - start > PLR_TIMEOUT_SEC)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Returns the replica whose record the majority agrees with, or -1 if there
+ *  is no majority.  bad is set for the ones that disagree with it, died, or
+ *  are stuck.
+ */
+static int plr_vote(uint64_t seq, int* bad) {
+    int arrived[PLR_MAX_REPLICAS];
+    int votes[PLR_MAX_REPLICAS];
+    int winner = -1;
+    int i, j;
+
+    for (i = 0; i < plr_num; i++)
+        arrived[i] = ((i == 0) && !plr_supervising) ? 1 : plr_arrive(i, seq);
+
+    for (i = 0; i < plr_num; i++) {
+        votes[i] = 0;
+        if (!arrived[i])
+            continue;
+        for (j = 0; j < plr_num; j++) {
+            if (arrived[j] && plr_same(plr_slot(i, seq), plr_slot(j, seq)))
+                votes[i]++;
+        }
+        if ((winner < 0) || (votes[i] > votes[winner]))
+            winner = i;
+    }
+    if ((winner < 0) || (votes[winner] * 2 <= plr_num))
+        return -1;
+
+    for (i = 0; i < plr_num; i++)
+        bad[i] = !arrived[i] || !plr_same(plr_slot(i, seq), plr_slot(winner, seq));
+    return winner;
+}
+
+static int64_t plr_perform(const plr_record* rec, plr_result* res) {
+    FILE* stream = (FILE*)(uintptr_t)rec->handle;
+    uint32_t size;
+    char* s;
+
+    res->len = 0;
+    switch (rec->kind) {
+        case PLR_OUTPUT_STREAM:
+            return fwrite(rec->data, 1, rec->len, stream);
+        case PLR_OUTPUT_FD:
+            return write((int)rec->handle, rec->data, rec->len);
+        case PLR_EXIT:
+            return (int64_t)rec->handle;
+        case PLR_TIME:
+            return time(0);
+        case PLR_CLOCK:
+            return clock();
+        case PLR_GETCHAR:
+            return getchar();
+        case PLR_FGETS:
+            memcpy(&size, rec->data, sizeof(size));
+            s = fgets(res->data, size, stream);
+            if (!s)
+                return 0;
+            res->len = strlen(res->data) + 1;
+            return 1;
+        case PLR_READ:
+            memcpy(&size, rec->data, sizeof(size));
+            res->result = read((int)rec->handle, res->data, size);
+            if (res->result > 0)
+                res->len = res->result;
+            return res->result;
+    }
+    return 0;
+}
+
+static void plr_finish(int code) {
+    int i;
+
+    for (i = 0; i < plr_num; i++) {
+        if (plr_pids[i] > 0)
+            waitpid(plr_pids[i], 0, 0);
+    }
+    if (plr_faults)
+        fprintf(stderr, "COAST PLR: replaced %lu faulty replicas\n", plr_faults);
+    exit(code);
+}
+
+/*
+ * The first replica is the only one which can make the calls, and the parent
+ *  of the others.  Once it has disagreed with them, it stops running the
+ *  program, and only votes and makes the calls from then on, while a copy of a
+ *  good replica takes its place.  This never returns.
+ */
+static void plr_supervise(uint64_t seq, uint32_t kind, int64_t result, int winner, int* bad) {
+    plr_result* res;
+    int i;
+
+    plr_supervising = 1;
+    for (;;) {
+        if (kind == PLR_EXIT)
+            plr_finish((int)result);
+        for (i = 0; i < plr_num; i++) {
+            if (bad[i])
+                plr_respawn(i, winner, seq);
+        }
+
+        seq++;
+        winner = plr_vote(seq, bad);
+        if (winner < 0)
+            plr_fail("the replicas don't agree", seq);
+        kind = plr_slot(winner, seq)->kind;
+        res = &plr->results[seq % PLR_RING_SIZE];
+        result = res->result = plr_perform(plr_slot(winner, seq), res);
+        __atomic_store_n(&plr->released, seq + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Every redirected call goes through here.  The other replicas only wait for
+ *  the first one when they need the result of an input call, when they exit
+ *  (so they can still be copied), or when they are a whole ring ahead of it.
+ * Returns the result of the call, which is given in expected for outputs.
+ */
+static int64_t plr_call(uint32_t kind, uint64_t handle, const void* data, uint32_t len,
+        int64_t expected, void* out) {
+    uint64_t seq;
+    plr_record* rec;
+    plr_result* res;
+    unsigned int spins = 0;
+
+    if (!plr_leader)
+        plr_serve();
+    seq = plr_seq++;
+    res = &plr->results[seq % PLR_RING_SIZE];
+
+    while (seq - __atomic_load_n(&plr->released, __ATOMIC_ACQUIRE) >= PLR_RING_SIZE) {
+        if (!plr_leader)
+            plr_serve();
+        plr_wait(&spins);
+    }
+
+    rec = plr_slot(plr_id, seq);
+    rec->kind = kind;
+    rec->handle = handle;
+    rec->len = len;
+    memcpy(rec->data, data, len);
+    __atomic_store_n(&plr->replicas[plr_id].head, seq + 1, __ATOMIC_RELEASE);
+
+    if (plr_leader) {
+        int bad[PLR_MAX_REPLICAS];
+        int winner = plr_vote(seq, bad);
+        uint32_t winnerKind;
+        int i;
+
+        if (winner < 0)
+            plr_fail("the replicas don't agree", seq);
+        // the others may write over the record once the call is released
+        winnerKind = plr_slot(winner, seq)->kind;
+        res->result = plr_perform(plr_slot(winner, seq), res);
+        __atomic_store_n(&plr->released, seq + 1, __ATOMIC_RELEASE);
+        expected = res->result;
+
+        if (bad[0])
+            plr_supervise(seq, winnerKind, res->result, winner, bad);
+        // in the new copy, this stops with plr_id set to its replica number
+        for (i = 1; i < plr_num; i++) {
+            if (bad[i] && plr_replace(i, seq))
+                break;
+        }
+    }
+
+    if ((kind == PLR_EXIT) || (kind >= PLR_TIME)) {
+        while (__atomic_load_n(&plr->released, __ATOMIC_ACQUIRE) <= seq) {
+            if (!plr_leader)
+                plr_serve();
+            plr_wait(&spins);
+        }
+        if (out)
+            memcpy(out, res->data, res->len);
+        expected = res->result;
+    }
+    return expected;
+}
+
+static size_t plr_output(uint32_t kind, uint64_t handle, const char* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        uint32_t chunk = (len - done > PLR_DATA_SIZE) ? PLR_DATA_SIZE : (uint32_t)(len - done);
+        plr_call(kind, handle, data + done, chunk, chunk, 0);
+        done += chunk;
+    }
+    return len;
+}
+
+
+//----------------------------------------------------------------------------//
+// Wrappers
+//----------------------------------------------------------------------------//
+void __COAST_plr_exit(int code) {
+    if (!plr)
+        exit(code);
+
+    code = (int)plr_call(PLR_EXIT, (uint64_t)(unsigned int)code, 0, 0, code, 0);
+    // only the first replica flushes its buffers
+    if (!plr_leader)
+        _exit(0);
+    plr_finish(code);
+}
+
+static int plr_vfprintf(FILE* stream, const char* format, va_list args) {
+    char* buf;
+    int len = vasprintf(&buf, format, args);
+
+    if (len < 0)
+        return len;
+    plr_output(PLR_OUTPUT_STREAM, (uintptr_t)stream, buf, len);
+    free(buf);
+    return len;
+}
+
+int __COAST_plr_printf(const char* format, ...) {
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    if (plr)
+        len = plr_vfprintf(stdout, format, args);
+    else
+        len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
+
+int __COAST_plr_fprintf(FILE* stream, const char* format, ...) {
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    if (plr)
+        len = plr_vfprintf(stream, format, args);
+    else
+        len = vfprintf(stream, format, args);
+    va_end(args);
+    return len;
+}
+
+int __COAST_plr_puts(const char* s) {
+    size_t len = strlen(s);
+
+    if (!plr)
+        return puts(s);
+    plr_output(PLR_OUTPUT_STREAM, (uintptr_t)stdout, s, len);
+    plr_output(PLR_OUTPUT_STREAM, (uintptr_t)stdout, "\n", 1);
+    return (int)len + 1;
+}
+
+int __COAST_plr_putchar(int c) {
+    char ch = (char)c;
+
+    if (!plr)
+        return putchar(c);
+    plr_output(PLR_OUTPUT_STREAM, (uintptr_t)stdout, &ch, 1);
+    return (unsigned char)c;
+}
+
+size_t __COAST_plr_fwrite(const void* ptr, size_t size, size_t n, FILE* stream) {
+    if (!plr)
+        return fwrite(ptr, size, n, stream);
+    plr_output(PLR_OUTPUT_STREAM, (uintptr_t)stream, ptr, size * n);
+    return n;
+}
+
+ssize_t __COAST_plr_write(int fd, const void* buf, size_t count) {
+    if (!plr)
+        return write(fd, buf, count);
+    return plr_output(PLR_OUTPUT_FD, fd, buf, count);
+}
+
+time_t __COAST_plr_time(time_t* t) {
+    time_t now;
+
+    if (!plr)
+        return time(t);
+    now = (time_t)plr_call(PLR_TIME, 0, 0, 0, 0, 0);
+    if (t)
+        *t = now;
+    return now;
+}
+
+clock_t __COAST_plr_clock(void) {
+    if (!plr)
+        return clock();
+    return (clock_t)plr_call(PLR_CLOCK, 0, 0, 0, 0, 0);
+}
+
+int __COAST_plr_getchar(void) {
+    if (!plr)
+        return getchar();
+    return (int)plr_call(PLR_GETCHAR, 0, 0, 0, 0, 0);
+}
+
+char* __COAST_plr_fgets(char* s, int size, FILE* stream) {
+    uint32_t request = (size > PLR_DATA_SIZE) ? PLR_DATA_SIZE : (uint32_t)size;
+
+    if (!plr)
+        return fgets(s, size, stream);
+    if (plr_call(PLR_FGETS, (uintptr_t)stream, &request, sizeof(request), 0, s))
+        return s;
+    return 0;
+}
+
+ssize_t __COAST_plr_read(int fd, void* buf, size_t count) {
+    uint32_t request = (count > PLR_DATA_SIZE) ? PLR_DATA_SIZE : (uint32_t)count;
+
+    if (!plr)
+        return read(fd, buf, count);
+    return (ssize_t)plr_call(PLR_READ, fd, &request, sizeof(request), 0, buf);
+}
@@ -0,0 +1,152 @@
+/*
+ * COAST_rmt.c
+ *
+ * Run-time support for the redundant multithreading mode of COAST (-rmtFns).
+ * The leading copy of each function pushes its arguments, the values it loads
+ *  and the results of its calls into a single-producer/single-consumer queue,
+ *  along with a signature at each store, call and return.  A worker thread pops
+ *  the entry point of the trailing copy, which runs the same code using the
+ *  values from the queue and checks that it computes the same signatures.
+ *
+ * There is only one queue, so only one application thread may call these
+ *  functions.  The program aborts if a second one does.
+ *
+ * This file is linked into the final executable as native code, it must not
+ *  go through the COAST pass itself.  Link with -lpthread.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+// must be a power of 2
+#define RMT_QUEUE_SIZE      (1 << 16)
+#define RMT_CACHE_LINE      64
+// how many times to poll before giving up the core
+#define RMT_SPIN_COUNT      1024
+
+typedef void (*rmt_trail_fn)(void);
+
+static uint64_t rmt_queue[RMT_QUEUE_SIZE];
+
+// Each index is only written by one thread, so each gets its own cache line,
+//  along with that thread's cached copy of the other index
+static struct {
+    uint64_t head;          // next slot to write
+    uint64_t tail_cache;    // last value of tail seen by the producer
+    char pad[RMT_CACHE_LINE - 2 * sizeof(uint64_t)];
+} rmt_producer __attribute__((aligned(RMT_CACHE_LINE)));
+
+static struct {
+    uint64_t tail;          // next slot to read
+    uint64_t head_cache;    // last value of head seen by the consumer
+    uint64_t waiting;       // set while the consumer waits on an empty queue
+    char pad[RMT_CACHE_LINE - 3 * sizeof(uint64_t)];
+} rmt_consumer __attribute__((aligned(RMT_CACHE_LINE)));
+
+static pthread_t rmt_worker;
+// the application thread which runs the leading copies
+static pthread_t rmt_owner;
+static pthread_once_t rmt_once = PTHREAD_ONCE_INIT;
+
+
+static void rmt_wait(unsigned int* spins) {
+    if (++(*spins) >= RMT_SPIN_COUNT) {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+void __COAST_rmt_push(uint64_t value) {
+    uint64_t head = rmt_producer.head;
+    unsigned int spins = 0;
+
+    // only read the consumer's index again when the queue looks full
+    while (head - rmt_producer.tail_cache >= RMT_QUEUE_SIZE) {
+        rmt_producer.tail_cache = __atomic_load_n(&rmt_consumer.tail, __ATOMIC_ACQUIRE);
+        if (head - rmt_producer.tail_cache >= RMT_QUEUE_SIZE)
+            rmt_wait(&spins);
+    }
+
+    rmt_queue[head & (RMT_QUEUE_SIZE - 1)] = value;
+    __atomic_store_n(&rmt_producer.head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t __COAST_rmt_pop(void) {
+    uint64_t tail = rmt_consumer.tail;
+    unsigned int spins = 0;
+    uint64_t value;
+
+    while (tail == rmt_consumer.head_cache) {
+        rmt_consumer.head_cache = __atomic_load_n(&rmt_producer.head, __ATOMIC_ACQUIRE);
+        if (tail == rmt_consumer.head_cache) {
+            // everything pushed so far has been checked
+            if (!rmt_consumer.waiting)
+                __atomic_store_n(&rmt_consumer.waiting, 1, __ATOMIC_RELEASE);
+            rmt_wait(&spins);
+        }
+    }
+    // cleared before tail is, so __COAST_rmt_drain() can't see an old value
+    if (rmt_consumer.waiting)
+        __atomic_store_n(&rmt_consumer.waiting, 0, __ATOMIC_RELAXED);
+
+    value = rmt_queue[tail & (RMT_QUEUE_SIZE - 1)];
+    __atomic_store_n(&rmt_consumer.tail, tail + 1, __ATOMIC_RELEASE);
+    return value;
+}
+
+// runs the trailing copies that were pushed, until the end of a call (a 0)
+static void rmt_run(void) {
+    uint64_t word;
+    while ((word = __COAST_rmt_pop()) != 0) {
+        rmt_trail_fn trail = (rmt_trail_fn)(uintptr_t)word;
+        trail();
+    }
+}
+
+// called by a trailing copy where the leading copy called another function
+void __COAST_rmt_call(void) {
+    rmt_run();
+}
+
+static void* rmt_worker_loop(void* arg) {
+    (void)arg;
+    for (;;) {
+        rmt_run();
+    }
+    return 0;
+}
+
+static void rmt_start(void) {
+    rmt_owner = pthread_self();
+    pthread_create(&rmt_worker, 0, rmt_worker_loop, 0);
+    pthread_detach(rmt_worker);
+}
+
+// called at the start of the leading copy of a function
+void __COAST_rmt_begin(rmt_trail_fn trail) {
+    pthread_once(&rmt_once, rmt_start);
+    if (!pthread_equal(pthread_self(), rmt_owner)) {
+        fprintf(stderr, "COAST: functions in -rmtFns were called from more than one thread\n");
+        abort();
+    }
+    __COAST_rmt_push((uint64_t)(uintptr_t)trail);
+}
+
+// wait until the trailing thread has checked everything pushed so far
+void __COAST_rmt_drain(void) {
+    unsigned int spins = 0;
+
+    // nothing to wait for if this is the trailing thread (ie. the error handler),
+    //  or another application thread, which never pushes anything
+    if (rmt_producer.head == 0 || !pthread_equal(pthread_self(), rmt_owner))
+        return;
+
+    // the consumer is done once it has taken everything and is waiting for more,
+    //  which may be in the middle of a trailing copy that is waiting for a call to return
+    while ((__atomic_load_n(&rmt_consumer.tail, __ATOMIC_ACQUIRE) != rmt_producer.head) ||
+            !__atomic_load_n(&rmt_consumer.waiting, __ATOMIC_ACQUIRE))
+        rmt_wait(&spins);
+}
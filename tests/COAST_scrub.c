@@ -0,0 +1,241 @@
+/*
+ * COAST_scrub.c
+ *
+ * Run-time support for -scrubGlobals.  Before main() starts, every module
+ *  registers its replicated globals, with the addresses of all of the copies.
+ *  Each call to __COAST_scrub() compares the next part of them, and with TMR
+ *  writes the majority back to a copy that doesn't agree.  That way an upset
+ *  in data that is rarely read is fixed before another one hits a second copy.
+ * A call never looks at more bytes than it is asked to, so it can be made from
+ *  an idle hook or a timer callback with a fixed budget.  When the end of the
+ *  globals is reached, the next call starts over from the beginning.
+ *
+ * With COAST_SCRUB_FREERTOS_IDLE_HOOK defined, this file provides the FreeRTOS
+ *  idle hook, which scrubs COAST_SCRUB_CHUNK bytes every time around the idle
+ *  loop (configUSE_IDLE_HOOK must be 1).
+ *
+ * The program can write to a global while it is being checked.  If it has
+ *  only written the first of the three copies of a word when they are read,
+ *  the other two are the majority, and the new value is replaced with the old
+ *  one.  The program then writes the other copies, which outvote that one the
+ *  next time the word is voted on, and the next pass repairs it.  A copy is
+ *  only written if it still has the value that was read, so a store that
+ *  lands after the read is kept.  With DWC, a word is only reported if the
+ *  copies still differ when they are read again.
+ * Only one task or thread should be scrubbing at a time.
+ *
+ * This file is linked into the final executable as native code, it must not
+ *  go through the COAST pass itself.
+ */
+
+#include <stdint.h>
+
+// bytes checked by each call to __COAST_scrub_idle()
+#ifndef COAST_SCRUB_CHUNK
+#define COAST_SCRUB_CHUNK       256
+#endif
+// how many modules can register their globals
+#ifndef COAST_SCRUB_MAX_TABLES
+#define COAST_SCRUB_MAX_TABLES  16
+#endif
+// words compared before looking at the result
+#define SCRUB_BLOCK_WORDS       8
+
+typedef uintptr_t scrub_word_t;
+
+// must match the table made by registerScrubGlobals() in cloning.cpp
+typedef struct {
+    void* copy[3];          // copy[2] is 0 with DWC
+    uint64_t size;
+} scrub_region_t;
+
+typedef struct {
+    const scrub_region_t* regions;
+    uint32_t count;
+} scrub_table_t;
+
+static scrub_table_t scrub_tables[COAST_SCRUB_MAX_TABLES];
+static uint32_t scrub_num_tables;
+
+// where the next call starts
+static uint32_t scrub_table;
+static uint32_t scrub_region;
+static uint64_t scrub_offset;
+
+// words where the copies didn't agree, and copies that were fixed
+uint64_t __COAST_scrub_mismatched;
+uint64_t __COAST_scrub_repaired;
+
+
+// called by a constructor in each module compiled with -scrubGlobals
+void __COAST_scrub_register(const scrub_region_t* regions, uint32_t count) {
+    if (scrub_num_tables < COAST_SCRUB_MAX_TABLES) {
+        scrub_tables[scrub_num_tables].regions = regions;
+        scrub_tables[scrub_num_tables].count = count;
+        scrub_num_tables++;
+    }
+}
+
+/*
+ * Checks one element that didn't match when its block was compared, and
+ *  repairs it if two of the copies agree.  Returns 1 if the copies still
+ *  don't match.
+ */
+#define SCRUB_FIX_FUNCTION(name, type)                                          \
+static uint32_t name(type* a, type* b, type* c) {                               \
+    type va = __atomic_load_n(a, __ATOMIC_RELAXED);                             \
+    type vb = __atomic_load_n(b, __ATOMIC_RELAXED);                             \
+    type vc = c ? __atomic_load_n(c, __ATOMIC_RELAXED) : va;                    \
+    type majority;                                                              \
+                                                                                \
+    /* the program wrote to it since the block was compared */                 \
+    if (va == vb && va == vc)                                                   \
+        return 0;                                                               \
+    __COAST_scrub_mismatched++;                                                 \
+    if (!c)                                                                     \
+        return 1;                                                               \
+                                                                                \
+    if (va == vb || va == vc)                                                   \
+        majority = va;                                                          \
+    else if (vb == vc)                                                          \
+        majority = vb;                                                          \
+    else                                                                        \
+        return 1;                                                               \
+                                                                                \
+    /* a store that lands after the read is kept */                             \
+    if (va != majority && __atomic_compare_exchange_n(a, &va, majority, 0,      \
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))                                \
+        __COAST_scrub_repaired++;                                               \
+    if (vb != majority && __atomic_compare_exchange_n(b, &vb, majority, 0,      \
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))                                \
+        __COAST_scrub_repaired++;                                               \
+    if (vc != majority && __atomic_compare_exchange_n(c, &vc, majority, 0,      \
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))                                \
+        __COAST_scrub_repaired++;                                               \
+    return 1;                                                                   \
+}
+
+SCRUB_FIX_FUNCTION(scrub_fix_word, scrub_word_t)
+SCRUB_FIX_FUNCTION(scrub_fix_byte, uint8_t)
+
+/*
+ * Compares n words of the copies, starting at offset, a block at a time.
+ * The loop over a block has no branches, so the compiler can vectorize it,
+ *  and the slow path only runs for a block with a mismatch in it.
+ */
+static uint32_t scrub_words(const scrub_region_t* r, uint64_t offset, uint64_t n) {
+    scrub_word_t* a = (scrub_word_t*)((uint8_t*)r->copy[0] + offset);
+    scrub_word_t* b = (scrub_word_t*)((uint8_t*)r->copy[1] + offset);
+    scrub_word_t* c = r->copy[2] ? (scrub_word_t*)((uint8_t*)r->copy[2] + offset) : 0;
+    uint32_t found = 0;
+    uint64_t i, j;
+
+    for (i = 0; i < n; i += SCRUB_BLOCK_WORDS) {
+        uint64_t len = (n - i < SCRUB_BLOCK_WORDS) ? n - i : SCRUB_BLOCK_WORDS;
+        scrub_word_t diff = 0;
+
+        if (c) {
+            for (j = i; j < i + len; j++)
+                diff |= (a[j] ^ b[j]) | (a[j] ^ c[j]);
+        } else {
+            for (j = i; j < i + len; j++)
+                diff |= a[j] ^ b[j];
+        }
+        if (!diff)
+            continue;
+
+        for (j = i; j < i + len; j++)
+            found += scrub_fix_word(&a[j], &b[j], c ? &c[j] : 0);
+    }
+    return found;
+}
+
+// for the end of a region, or copies that aren't aligned to a word
+static uint32_t scrub_bytes(const scrub_region_t* r, uint64_t offset, uint64_t n) {
+    uint8_t* a = (uint8_t*)r->copy[0] + offset;
+    uint8_t* b = (uint8_t*)r->copy[1] + offset;
+    uint8_t* c = r->copy[2] ? (uint8_t*)r->copy[2] + offset : 0;
+    uint32_t found = 0;
+    uint64_t i;
+
+    for (i = 0; i < n; i++) {
+        if (a[i] != b[i] || (c && a[i] != c[i]))
+            found += scrub_fix_byte(&a[i], &b[i], c ? &c[i] : 0);
+    }
+    return found;
+}
+
+/*
+ * Checks up to budget bytes of a region, starting at offset.
+ * Returns how many bytes were checked, at least one.
+ */
+static uint64_t scrub_part(const scrub_region_t* r, uint64_t offset, uint64_t budget,
+        uint32_t* found) {
+    uint64_t left = r->size - offset;
+    uintptr_t addrs = (uintptr_t)r->copy[0] | (uintptr_t)r->copy[1] | (uintptr_t)r->copy[2];
+
+    if ((addrs % sizeof(scrub_word_t)) == 0 && left >= sizeof(scrub_word_t)) {
+        uint64_t words = budget / sizeof(scrub_word_t);
+        if (words == 0)
+            words = 1;
+        if (words > left / sizeof(scrub_word_t))
+            words = left / sizeof(scrub_word_t);
+        *found += scrub_words(r, offset, words);
+        return words * sizeof(scrub_word_t);
+    }
+
+    if (budget > left)
+        budget = left;
+    *found += scrub_bytes(r, offset, budget);
+    return budget;
+}
+
+/*
+ * Checks the next max_bytes bytes of the replicated globals (of each copy),
+ *  and returns how many words were found that didn't match.  Stops early at
+ *  the end of the globals.
+ */
+uint32_t __COAST_scrub(uint32_t max_bytes) {
+    uint64_t budget = max_bytes;
+    uint32_t found = 0;
+
+    while (budget > 0 && scrub_num_tables > 0) {
+        const scrub_table_t* t = &scrub_tables[scrub_table];
+        const scrub_region_t* r;
+
+        if (scrub_region >= t->count) {
+            scrub_region = 0;
+            scrub_offset = 0;
+            scrub_table++;
+            if (scrub_table >= scrub_num_tables) {
+                // start over next time
+                scrub_table = 0;
+                break;
+            }
+            continue;
+        }
+
+        r = &t->regions[scrub_region];
+        if (scrub_offset >= r->size) {
+            scrub_region++;
+            scrub_offset = 0;
+            continue;
+        }
+
+        uint64_t checked = scrub_part(r, scrub_offset, budget, &found);
+        scrub_offset += checked;
+        budget = (checked < budget) ? budget - checked : 0;
+    }
+    return found;
+}
+
+void __COAST_scrub_idle(void) {
+    __COAST_scrub(COAST_SCRUB_CHUNK);
+}
+
+#ifdef COAST_SCRUB_FREERTOS_IDLE_HOOK
+// overrides the weak one in the port layer
+void vApplicationIdleHook(void) {
+    __COAST_scrub_idle();
+}
+#endif
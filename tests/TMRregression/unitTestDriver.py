@@ -66,11 +66,47 @@ Loops: [1-9][0-9]+, Iterations: [1-9][0-9]*, Duration: [0-9]+ sec.
 C Converted Double Precision Whetstones: [0-9]+\.[0-9]+ MIPS
 """)
 
+# only the first store in record() is synced, and only the sites that ran are printed
+syncProfileRegex = re.compile(
+    r"^Success!\n"
+    r"site,function,block,kind,location,syncs,corrections\n"
+    r"(\d+,main,.*\n)*"
+    r"(\d+,record\w*,\w+,gep,\S*syncProfile\.c:28:\d+,10,0\n)?"
+    r"\d+,record\w*,\w+,store,\S*syncProfile\.c:28:\d+,10,0\n\Z", re.MULTILINE)
+# the tests that use unitTests/faultInjection.h either find the error or vote it out
+faultRegex = re.compile(r"^(Fault detected!|Success!)$", re.MULTILINE)
+
+
+# class that represents a check on the optimized IR
+class irCheck(object):
+    """A regex that <target>.opt.ll has to match, which shows that an
+    optimization really happened, not just that the output is still right."""
+    def __init__(self, rgx, count=None, cfg=None, notCfg=None):
+        self.irRegx = re.compile(rgx, re.MULTILINE)
+        self.count = count      # exact number of matches, instead of at least one
+        self.onlyCfg = cfg      # only check when the COAST configuration has this in it
+        self.notCfg = notCfg    # don't check when the COAST configuration has this in it
+
+    def applies(self, config):
+        if not config:
+            return False
+        if (self.onlyCfg is not None) and (self.onlyCfg not in config):
+            return False
+        if (self.notCfg is not None) and (self.notCfg in config):
+            return False
+        return True
+
+    def matches(self, ir):
+        found = len(self.irRegx.findall(ir))
+        if self.count is None:
+            return found > 0
+        return found == self.count
+
 
 # class that represents a configuration
 class runConfig(object):
     """docstring for runConfig."""
-    def __init__(self, f, ef=None, xc=None, op=None, nm=None, cf=False, hk=False, sn=False, xl=None, xlc=None, qtm=None, rgx=None, brd=None):
+    def __init__(self, f, ef=None, xc=None, op=None, nm=None, cf=False, hk=False, sn=False, xl=None, xlc=None, qtm=None, rgx=None, brd=None, ir=None):
         self.fname = f
         self.extraFiles = ef    # other files to use in compilation
         self.xcFlg = xc         # additional flags in clang compile step
@@ -84,6 +120,15 @@ class runConfig(object):
         self.qemuTime = qtm     # how long to wait before terminating QEMU
         self.outRegx = rgx      # regex for validating output printing
         self.board = brd        # specify default test target
+        self.irChecks = ir      # list of irCheck, for the optimized IR
+
+
+# the copies of the memcpy() are checked inside of the loop, the memset() value before it
+fusedMemOpsIR = [
+    irCheck(r"call \S+ @__COAST_memcpy\d_\d_w\d+_i\d+_check\(", notCfg="-noMemReplication"),
+    irCheck(r"call void @__COAST_memset\d_1_w\d+_i\d+\(", notCfg="-noMemReplication"),
+]
+
 
 # keep this up to date manually
 # dictionary of specific flags for each unitTest
@@ -96,9 +141,19 @@ customConfigs = [
         rgx=re.compile(r"counter = [2-4]")),
     runConfig("basicIR.c"),
     runConfig("bsearch_strcmp.c"),
+    runConfig("callArgsCheck.c", op="-replicateFnCalls=readValue", rgx=faultRegex,
+        ir=[irCheck(r"%and\d* = and i1 %ccmp\d*, %ccmp\d*", cfg="-DWC", notCfg="-deferChecks")]),
     runConfig("classTest.cpp"),
+    runConfig("coalescedChecks.c", xc="-O1",
+        op="-replicateFnCalls=readSensor -storeDataSync -coalesceChecks", rgx=faultRegex,
+        ir=[irCheck(r"%syncCheck\.merged\d* = and i1", cfg="-DWC", notCfg="-deferChecks")]),
     runConfig("cloneAfterCall.c", sn=True,
         rgx=re.compile(r"Bob \(16\): 3.7[0-9]*\nSuccess!\n", re.MULTILINE)),
+    runConfig("cloneRegistry.c", op="-verifyCloneRegistry"),
+    runConfig("cloneRegistry.c", nm="__SKIP_THIS", op="-replicaOffsets -verifyCloneRegistry"),
+    runConfig("cloneRegistry.c", sn=True, xc="-O1", op="-countSyncs -threadCounters -verifyCloneRegistry"),
+    runConfig("constGlobals.c", sn=True, nm="__SKIP_THIS", op="-checkConstGlobals"),
+    runConfig("constGlobals.c", sn=True, xc="-DNO_CONSTANTS", op="-checkConstGlobals"),
     runConfig("exceptions.cpp", \
         op="-replicateFnCalls=_ZNSt12_Vector_baseIiSaIiEE11_M_allocateEm,_ZSt27__uninitialized_default_n_aIPimiET_S1_T0_RSaIT1_E",  \
         nm="-ignoreFns=_ZNSt12_Vector_baseIiSaIiEE13_M_deallocateEPim"),
@@ -107,6 +162,10 @@ customConfigs = [
         ef="fSigTypes_ext.c"),
     runConfig("funcPtrStruct.c",
         rgx=re.compile(r"100 150\n(1 2 3\n){1,3}Finished", re.MULTILINE)),
+    runConfig("fusedMemOps.c", op="-fuseMemOps=check -runtimeInitGlobals=initTable", rgx=faultRegex,
+        ir=fusedMemOpsIR),
+    runConfig("fusedMemOps.c", xc="-DFAULT_IN_FILL", op="-fuseMemOps=check -runtimeInitGlobals=initTable", rgx=faultRegex,
+        ir=fusedMemOpsIR),
     runConfig("globalPointers.c", \
         xc="-g3", cf=True, sn=True),
     runConfig("halfProtected.c", op="-skipLibCalls=malloc"),
@@ -115,16 +174,40 @@ customConfigs = [
         xc="-O2"),
     runConfig("linkedList.c", xc="-g3", cf=True, sn=True),
     runConfig("load_store.c"),
+    runConfig("loopExitCheck.c", xc="-O1", op="-replicateFnCalls=getCount -loopSyncs", rgx=faultRegex,
+        ir=[irCheck(r"%loopCheck\d* = phi i1", cfg="-DWC")]),
     runConfig("mallocTest.c", sn=True,
         rgx=re.compile(r"^Finished", re.MULTILINE)),
     runConfig("nestedCalls.c", xc="-O2",\
         op="-replicateFnCalls=memset"),
+    runConfig("overheadBudget.c", op="-overheadBudget=1.3",
+        ir=[irCheck(r"^@total_DWC = ", count=0), irCheck(r"^@table_DWC = ", notCfg="-noMemReplication")]),
+    runConfig("parityGlobals.c", sn=True, nm="__SKIP_THIS", xl="-rdynamic -ldl"),
+    runConfig("parityGlobals.c", sn=True, nm="__SKIP_THIS", xc="-DNO_REPAIR", xl="-rdynamic -ldl"),
+    runConfig("plrReplicas.c", op="-PLR",
+        rgx=re.compile(r"^sum 1: 1056\nsum 2: 1584\nsum 3: 2112\nSuccess!$", re.MULTILINE)),
+    runConfig("plrReplicas.c", xc="-DFAULT_IN_OTHER", op="-PLR",
+        rgx=re.compile(r"^sum 1: 1056\nsum 2: 1584\nsum 3: 2112\nSuccess!$", re.MULTILINE)),
     runConfig("ptrArith.c", rgx=ptrArithRegex),
     runConfig("protectedLib.c", op="-protectedLibFn=sharedFunc"),
+    runConfig("replicaOffsets.c", nm="__SKIP_THIS", op="-replicateFnCalls=readValue -replicaOffsets",
+        rgx=faultRegex, ir=[irCheck(r"^@table\.xMR = internal "),
+                            irCheck(r"getelementptr i8, i8\* %[\w.]+, i64 [1-9]\d*")]),
+    runConfig("replicateFraction.c", xc="-O1", op="-replicateFnCalls=readValue -replicateFraction=0.25", rgx=faultRegex,
+        ir=[irCheck(r"DWC\d* = mul ", count=2), irCheck(r"DWC\d* = lshr ", count=0)]),
+    runConfig("replicateFraction.c", xc="-O1", op="-replicateFnCalls=readValue -replicateFraction=0.5", rgx=faultRegex,
+        ir=[irCheck(r"DWC\d* = mul ", count=2), irCheck(r"DWC\d* = lshr ", count=0)]),
+    runConfig("replicateFraction.c", xc="-O1", op="-replicateFnCalls=readValue -replicateFraction=0.75", rgx=faultRegex),
     runConfig("replReturn.c", sn=True, nm="__SKIP_THIS",
         op="-cloneReturn=returnTest -replicateFnCalls=malloc -cloneFns=testWrapper",
         rgx=re.compile(r"(0x[0-9A-Fa-f]+\n){2,3}Success!\n", re.MULTILINE)),
     runConfig("returnPointer.c"),
+    runConfig("rmtFunctions.c", sn=True, op="-rmtFns=sumSquares,square,average -ignoreGlbls=results",
+        rgx=faultRegex, ir=[irCheck(r"^define internal void @square\.trail\(\)", cfg="-DWC"),
+                            irCheck(r"call void @__COAST_rmt_call\(\)", cfg="-DWC")]),
+    runConfig("rollbackRecovery.c", sn=True, op="-rollback -storeDataSync", xl="-rdynamic -ldl"),
+    runConfig("rollbackRecovery.c", sn=True, op="-rollback -storeDataSync -fuseMemOps=check", xl="-rdynamic -ldl"),
+    runConfig("scrubGlobals.c", sn=True, nm="__SKIP_THIS", op="-scrubGlobals", xl="-rdynamic -ldl"),
     runConfig("segmenting.c"),
     runConfig("signalHandlers.c", hk=True,
         op="-skipLibCalls=__sysv_signal,signal"),
@@ -133,9 +216,17 @@ customConfigs = [
     runConfig("stackAttack.c", xc="-g3"),
     runConfig("stackProtect.c", qtm=1, xc="-g3", op="-protectStack"),
     runConfig("structCompare.c"),
+    runConfig("syncProfile.c", sn=True, xc="-g -O1", op="-profileSyncs -syncElim -storeDataSync",
+        rgx=syncProfileRegex),
+    runConfig("syncElimDominance.c", xc="-O1", op="-replicateFnCalls=readValue -syncElim", rgx=faultRegex,
+        ir=[irCheck(r"%ccmp\d* = icmp", count=2, cfg="-DWC")]),
     runConfig("testFuncPtrs.c"),
+    runConfig("threadCounters.c", sn=True, xc="-O1", op="-countSyncs -threadCounters",
+        xl="-lpthread"),
     runConfig("time_c.c", op="-skipLibCalls=clock -cloneAfterCall=time",
         rgx=timeCRegex),
+    runConfig("unprotectedOffset.c"),
+    runConfig("vecLanes.c", xc="-O3"),
 # The Travis Docker has GCC v7.5.0, Ubuntu 18.04. vecTest.cpp was tested on GCC v5.4.0, Ubuntu 16.04.
 # Between compiler versions, there were apparently significant changes to how vectors work,
 #  and these flags actually now break the test instead of fixing it.
@@ -257,6 +348,19 @@ def run(cfg, config, dir_path, board=None, no_clean=False):
     elif p.returncode:
         return p.returncode
 
+    # make sure the optimizations being tested were really done
+    if cfg.irChecks and any(c.applies(config) for c in cfg.irChecks):
+        ir_path = os.path.join(dir_path, target_name + ".opt.ll")
+        if not os.path.exists(ir_path):
+            print(" (No {}, skipping the IR checks)".format(os.path.basename(ir_path)))
+        else:
+            with open(ir_path) as ir_file:
+                ir = ir_file.read()
+            for c in cfg.irChecks:
+                if c.applies(config) and not c.matches(ir):
+                    print("IR didn't match: {}".format(c.irRegx.pattern))
+                    return -1
+
     # now run it
     try:
         runCmd = command + " {}".format(runProgName)
@@ -0,0 +1,51 @@
+/*
+ * callArgsCheck.c
+ *
+ * This unit test makes sure that DWC checks every argument of a call to a
+ *  function outside of the Scope of Replication, not just one of them.
+ * readValue() is called once for each copy (-replicateFnCalls=readValue), and
+ *  gives one copy of the second value a different result (see
+ *  faultInjection.h).  Both values are passed to printf(), so the copies of
+ *  the first argument match, and the copies of the second one don't.
+ * With DWC, the error handler must be called before anything is printed.
+ *  With TMR, the error is voted out and the values must be correct.
+ * The driver also makes sure that the DWC check compares both arguments.
+ */
+
+#define NUM_VALUES      2
+#define FAULTY_VALUE    1
+
+#define NUM_FAULT_IDS   NUM_VALUES
+#include "faultInjection.h"
+
+
+__attribute__((noinline))
+int readValue(int idx) {
+    int value = idx * 100 + 42;
+    if ( (COUNT_COPY(idx) == UPSET_COPY) && (idx == FAULTY_VALUE) ) {
+        value ^= 0x10;
+    }
+    return value;
+}
+
+
+int main() {
+    int a = readValue(0);
+    int b = readValue(1);
+
+    printf("values: %d %d\n", a, b);
+
+    // DWC should never get here
+    if (FAULT_MISSED(FAULTY_VALUE)) {
+        printf("Error! the fault in value %d was not detected\n", FAULTY_VALUE);
+        return 1;
+    }
+
+    if ( (a != 42) || (b != 142) ) {
+        printf("Error! the values should be 42 and 142\n");
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
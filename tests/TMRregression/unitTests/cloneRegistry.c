@@ -0,0 +1,77 @@
+/*
+ * cloneRegistry.c
+ *
+ * This unit test is run with -verifyCloneRegistry, which stops the compile if
+ *  an original and its copies are no longer matched up after a phase of the
+ *  pass.  It goes through the places that replace or erase values that
+ *  already have copies:
+ *  - the sum is stored to an unprotected global, which erases the copies of
+ *    the store;
+ *  - with -replicaOffsets, packing replaces the original of the table with an
+ *    alias, and the copies of the addresses used to read it with a variable
+ *    index are folded and erased;
+ *  - with -countSyncs -threadCounters, the copies of the protected load of
+ *    __SYNC_COUNT are replaced by the value that replaced the original.
+ * The program itself only has to get the right sum.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  16
+
+int table[TABLE_SIZE];
+
+int __NO_xMR lastSum;
+unsigned long long __NO_xMR __SYNC_COUNT = 0;
+unsigned long long __NO_xMR syncsSeen;
+
+
+__attribute__((noinline))
+void fillTable(void) {
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i * i + 1;
+    }
+}
+
+__attribute__((noinline))
+int sumTable(int n) {
+    int i;
+    int sum = 0;
+    for (i = 0; i < n; i++) {
+        sum += table[i];
+    }
+    return sum;
+}
+
+// protected, so the load of the counter is replicated as well
+__attribute__((noinline))
+unsigned long long syncsSoFar(void) {
+    return __SYNC_COUNT;
+}
+
+
+int main() {
+    int expected = 0;
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        expected += i * i + 1;
+    }
+
+    fillTable();
+    lastSum = sumTable(TABLE_SIZE);
+    syncsSeen = syncsSoFar();
+    printf("sum: %d\n", lastSum);
+
+    if (lastSum != expected) {
+        printf("Error! the sum should be %d\n", expected);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * coalescedChecks.c
+ *
+ * This unit test makes sure that a DWC check which -coalesceChecks merged
+ *  into an earlier one still finds an error.
+ * With -storeDataSync, each store in saveReadings() is a sync point, so DWC
+ *  splits the block after each one.  All of the values are ready before the
+ *  first store, so coalescing moves the checks of the later stores up to the
+ *  first one.  readSensor() is called once for each copy
+ *  (-replicateFnCalls=readSensor), and gives one copy of the last reading a
+ *  different value (see faultInjection.h), so only the last of the merged
+ *  checks fails.
+ * The readings are not replicated, so nothing after saveReadings() can see
+ *  the error; the merged check is the only place it can be found.
+ * With DWC, the error handler must be called.  With TMR, the error is voted
+ *  out and the readings must be correct.
+ * Compile it with -O1, otherwise every value goes through the stack and no
+ *  checks can be merged.
+ * The driver also makes sure that the checks were really merged.
+ */
+
+#define NUM_READINGS    4
+#define FAULTY_READING  (NUM_READINGS - 1)
+
+#define NUM_FAULT_IDS   NUM_READINGS
+#include "faultInjection.h"
+
+
+int __NO_xMR readings[NUM_READINGS];
+
+
+__attribute__((noinline))
+int readSensor(int idx) {
+    int value = idx * 10 + 7;
+    if ( (COUNT_COPY(idx) == UPSET_COPY) && (idx == FAULTY_READING) ) {
+        value ^= 0x100;
+    }
+    return value;
+}
+
+// all of the calls come first, so nothing stops the checks from being moved up
+__attribute__((noinline))
+void saveReadings(void) {
+    int r0 = readSensor(0);
+    int r1 = readSensor(1);
+    int r2 = readSensor(2);
+    int r3 = readSensor(3);
+    readings[0] = r0;
+    readings[1] = r1;
+    readings[2] = r2;
+    readings[3] = r3;
+}
+
+
+int main() {
+    saveReadings();
+
+    int i;
+    for (i = 0; i < NUM_READINGS; i++) {
+        if (readings[i] != i * 10 + 7) {
+            printf("Error! reading %d is %d\n", i, readings[i]);
+            return 1;
+        }
+    }
+
+    // DWC should never get here
+    if (FAULT_MISSED(FAULTY_READING)) {
+        printf("Error! the fault in reading %d was not detected\n", FAULTY_READING);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * constGlobals.c
+ *
+ * This unit test makes sure that __COAST_checkConstGlobals() finds an upset
+ *  in a constant global that -checkConstGlobals keeps as a single copy.
+ * The table is 512 bytes, so it has 2 checksum blocks.  The test flips a bit
+ *  in the second block (the page is made writable first), and the check must
+ *  find exactly one bad block.  After the bit is flipped back, it must find
+ *  none.
+ * Compiled with -DNO_CONSTANTS, there is nothing to check, but the function
+ *  must still be there and return 0.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  128
+#define FLIP_IDX    100
+
+#ifndef NO_CONSTANTS
+const unsigned int table[TABLE_SIZE] = {
+    0x0000, 0x79b1, 0xf362, 0x6d13, 0xe6c4, 0x6075, 0xda26, 0x53d7,
+    0xcd88, 0x4739, 0xc0ea, 0x3a9b, 0xb44c, 0x2dfd, 0xa7ae, 0x215f,
+    0x9b10, 0x14c1, 0x8e72, 0x0823, 0x81d4, 0xfb85, 0x7536, 0xeee7,
+    0x6898, 0xe249, 0x5bfa, 0xd5ab, 0x4f5c, 0xc90d, 0x42be, 0xbc6f,
+    0x3620, 0xafd1, 0x2982, 0xa333, 0x1ce4, 0x9695, 0x1046, 0x89f7,
+    0x03a8, 0x7d59, 0xf70a, 0x70bb, 0xea6c, 0x641d, 0xddce, 0x577f,
+    0xd130, 0x4ae1, 0xc492, 0x3e43, 0xb7f4, 0x31a5, 0xab56, 0x2507,
+    0x9eb8, 0x1869, 0x921a, 0x0bcb, 0x857c, 0xff2d, 0x78de, 0xf28f,
+    0x6c40, 0xe5f1, 0x5fa2, 0xd953, 0x5304, 0xccb5, 0x4666, 0xc017,
+    0x39c8, 0xb379, 0x2d2a, 0xa6db, 0x208c, 0x9a3d, 0x13ee, 0x8d9f,
+    0x0750, 0x8101, 0xfab2, 0x7463, 0xee14, 0x67c5, 0xe176, 0x5b27,
+    0xd4d8, 0x4e89, 0xc83a, 0x41eb, 0xbb9c, 0x354d, 0xaefe, 0x28af,
+    0xa260, 0x1c11, 0x95c2, 0x0f73, 0x8924, 0x02d5, 0x7c86, 0xf637,
+    0x6fe8, 0xe999, 0x634a, 0xdcfb, 0x56ac, 0xd05d, 0x4a0e, 0xc3bf,
+    0x3d70, 0xb721, 0x30d2, 0xaa83, 0x2434, 0x9de5, 0x1796, 0x9147,
+    0x0af8, 0x84a9, 0xfe5a, 0x780b, 0xf1bc, 0x6b6d, 0xe51e, 0x5ecf,
+};
+
+// flips one bit of the table, which is normally in read-only memory
+void flipBit(void) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t addr = (uintptr_t)&table[FLIP_IDX];
+    void* page = (void*)(addr & ~(uintptr_t)(pageSize - 1));
+    mprotect(page, pageSize, PROT_READ | PROT_WRITE);
+    *(volatile unsigned int*)&table[FLIP_IDX] ^= 0x8;
+    mprotect(page, pageSize, PROT_READ);
+}
+
+__attribute__((noinline))
+unsigned int sumTable(int n) {
+    unsigned int sum = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum += table[i];
+    }
+    return sum;
+}
+#endif
+
+
+int main() {
+    unsigned int bad = __COAST_checkConstGlobals();
+    if (bad != 0) {
+        printf("Error! %u blocks are bad before the upset\n", bad);
+        return 1;
+    }
+
+#ifndef NO_CONSTANTS
+    unsigned int before = sumTable(TABLE_SIZE);
+
+    flipBit();
+    bad = __COAST_checkConstGlobals();
+    if (bad != 1) {
+        printf("Error! %u blocks are bad after the upset\n", bad);
+        return 1;
+    }
+
+    flipBit();
+    bad = __COAST_checkConstGlobals();
+    if (bad != 0) {
+        printf("Error! %u blocks are bad after the repair\n", bad);
+        return 1;
+    }
+
+    if (sumTable(TABLE_SIZE) != before) {
+        printf("Error! the sum changed\n");
+        return 1;
+    }
+#endif
+
+    printf("Success!\n");
+    return 0;
+}
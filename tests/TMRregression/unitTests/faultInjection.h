@@ -0,0 +1,51 @@
+/*
+ * faultInjection.h
+ *
+ * Shared by the unit tests that make one copy of a replicated value wrong, and
+ *  then make sure that DWC finds the error, or TMR votes it out.
+ * The value comes from a function that is called once for each copy
+ *  (-replicateFnCalls or __xMR_FN_CALL), so the number of calls is also the
+ *  number of copies.  The function calls COUNT_COPY() each time, which returns
+ *  which copy this is, and the copy numbered UPSET_COPY is the one to change.
+ *  Without COAST there is only one copy, so nothing is changed.
+ * If the program is still running once it has used the value, FAULT_MISSED()
+ *  says whether DWC should have stopped it.
+ * The error handler prints "Fault detected!", which faultRegex in
+ *  unitTestDriver.py accepts along with "Success!".  Define CUSTOM_FAULT_HANDLER
+ *  before including this to write a different one.
+ * Define NUM_FAULT_IDS before including this to count more than one value.
+ */
+
+#ifndef __FAULT_INJECTION_H__
+#define __FAULT_INJECTION_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../COAST.h"
+
+
+#ifndef NUM_FAULT_IDS
+#define NUM_FAULT_IDS 1
+#endif
+
+// the second copy is the one that is changed
+#define UPSET_COPY 2
+
+// how many times each value was asked for, which is also the number of copies
+unsigned int __NO_xMR timesRead[NUM_FAULT_IDS];
+
+// counts one call for value id, and returns which copy it is for, from 1
+#define COUNT_COPY(id)      (++timesRead[(id)])
+// the changed copy of value id was made, so DWC should have stopped by now
+#define FAULT_MISSED(id)    (timesRead[(id)] == UPSET_COPY)
+
+
+#ifndef CUSTOM_FAULT_HANDLER
+void FAULT_DETECTED_DWC() {
+    printf("Fault detected!\n");
+    exit(0);
+}
+#endif
+
+#endif  /* __FAULT_INJECTION_H__ */
@@ -0,0 +1,120 @@
+/*
+ * fusedMemOps.c
+ *
+ * This unit test makes sure that -fuseMemOps=check still finds (DWC) or
+ *  corrects (TMR) an error in the data being copied or set.
+ * readBlock() and readFill() are called once for each copy (__xMR_FN_CALL),
+ *  and give one copy a different value (see faultInjection.h).  Nothing reads
+ *  the copies before the memcpy() or memset(), so the fused call is the only
+ *  place the error can be found.
+ * initTable is listed in -runtimeInitGlobals, so its copies start out as zero
+ *  and are filled in at the start of main().  With TMR, this is also done
+ *  with a fused loop.  If that doesn't work, two of the copies are still zero
+ *  and the vote picks the wrong value.
+ * With DWC, the error handler must be called at the memcpy(), which is the
+ *  first error.  Compiled with -DFAULT_IN_FILL, only the memset() has an
+ *  error, so the check there is tested too.  With TMR, the errors are voted
+ *  out and every value must be correct.
+ * The driver also makes sure that the calls were fused.
+ */
+
+#include <string.h>
+
+#define BLOCK_SIZE  64
+#define FILL_BYTE   0x5A
+
+// the values that get an error
+#define BLOCK_ID    0
+#define FILL_ID     1
+
+#ifdef FAULT_IN_FILL
+#define FAULTY_STAGE 2
+#else
+#define FAULTY_STAGE 1
+#endif
+
+// the error handler has to know which stage is running
+#define CUSTOM_FAULT_HANDLER
+#define NUM_FAULT_IDS   2
+#include "faultInjection.h"
+
+
+unsigned char copied[BLOCK_SIZE] __attribute__((aligned(8)));
+unsigned char filled[BLOCK_SIZE] __attribute__((aligned(8)));
+int initTable[8] __attribute__((aligned(8))) = {3, 1, 4, 1, 5, 9, 2, 6};
+
+// which part of the test is running, so the error handler knows if it was expected
+volatile int __NO_xMR stage;
+
+
+__NO_xMR __xMR_FN_CALL __attribute__((noinline))
+void readBlock(unsigned char* dst) {
+    int i;
+    for (i = 0; i < BLOCK_SIZE; i++) {
+        dst[i] = i * 7;
+    }
+    if ( (COUNT_COPY(BLOCK_ID) == UPSET_COPY) && (FAULTY_STAGE == 1) ) {
+        dst[BLOCK_SIZE - 3] ^= 0x10;
+    }
+}
+
+__NO_xMR __xMR_FN_CALL __attribute__((noinline))
+unsigned char readFill(void) {
+    return (COUNT_COPY(FILL_ID) == UPSET_COPY) ? (FILL_BYTE ^ 0x01) : FILL_BYTE;
+}
+
+__attribute__((noinline))
+void copyBlock(void) {
+    unsigned char buf[BLOCK_SIZE] __attribute__((aligned(8)));
+    readBlock(buf);
+    memcpy(copied, buf, BLOCK_SIZE);
+}
+
+__attribute__((noinline))
+void fillBlock(void) {
+    memset(filled, readFill(), BLOCK_SIZE);
+}
+
+
+int main() {
+    int i;
+    int sum = 0;
+    for (i = 0; i < 8; i++) {
+        sum += initTable[i] * (i + 1);
+    }
+    if (sum != 3 + 2 + 12 + 4 + 25 + 54 + 14 + 48) {
+        printf("Error! initTable was not initialized\n");
+        return 1;
+    }
+
+    stage = 1;
+    copyBlock();
+    stage = 2;
+    fillBlock();
+    stage = 3;
+
+    // DWC should never get here
+    if (FAULT_MISSED(FILL_ID)) {
+        printf("Error! the fault in stage %d was not detected\n", FAULTY_STAGE);
+        return 1;
+    }
+
+    for (i = 0; i < BLOCK_SIZE; i++) {
+        if ( (copied[i] != (unsigned char)(i * 7)) || (filled[i] != FILL_BYTE) ) {
+            printf("Error! byte %d is 0x%02x 0x%02x\n", i, copied[i], filled[i]);
+            return 1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
+
+void FAULT_DETECTED_DWC() {
+    if (stage == FAULTY_STAGE) {
+        printf("Fault detected!\n");
+        exit(0);
+    }
+    printf("Error! unexpected fault in stage %d\n", stage);
+    exit(1);
+}
@@ -0,0 +1,71 @@
+/*
+ * loopExitCheck.c
+ *
+ * This unit test makes sure that an error in a loop is still detected when
+ *  -loopSyncs moves the DWC check on the loop exit out of the loop.
+ * getCount() is called once for each copy (-replicateFnCalls=getCount), and
+ *  gives one copy a smaller count (see faultInjection.h), so the copies of
+ *  the loop compare stop agreeing halfway through the loop.  Only the first
+ *  copy decides when the loop exits, so the loop still runs to the end, and
+ *  the error has to be found by the check at the loop exit.
+ * With DWC, the error handler must be called.  With TMR, the error is voted
+ *  out and the sum must be correct.
+ * Compile it with -O1, otherwise the loop counter goes through the stack and
+ *  it isn't an induction variable that the check can be moved for.
+ * The driver also makes sure that the check was really moved.
+ */
+
+#include "faultInjection.h"
+
+
+#define COUNT 16
+
+int table[COUNT] = {
+     3,  1,  4,  1,  5,  9,  2,  6,
+     5,  3,  5,  8,  9,  7,  9,  3,
+};
+#define GOLDEN_SUM 80
+
+int __NO_xMR total;
+
+
+__attribute__((noinline))
+int getCount(void) {
+    if (COUNT_COPY(0) == UPSET_COPY) {
+        return COUNT / 2;
+    }
+    return COUNT;
+}
+
+__attribute__((noinline))
+void sumTable(void) {
+    int n = getCount();
+    int i = 0;
+    int sum = 0;
+    // Two at a time, so the exit test stays a "less than", and at least once,
+    //  so the only way out of the loop is the exit test.
+    do {
+        sum += table[i] + table[i + 1];
+        i += 2;
+    } while (i < n);
+    total = sum;
+}
+
+
+int main() {
+    sumTable();
+
+    if (total != GOLDEN_SUM) {
+        printf("Error! the sum is %d, not %d\n", total, GOLDEN_SUM);
+        return 1;
+    }
+
+    // DWC should never get here
+    if (FAULT_MISSED(0)) {
+        printf("Error! the fault in the loop count was not detected\n");
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * overheadBudget.c
+ *
+ * This unit test makes sure that a plan from -overheadBudget can be compiled.
+ * sumTable() runs most of the instructions, so the budget only has room to
+ *  protect main().  sumTable() writes to the global total, which main() reads.
+ *  If total were protected, verifyOptions() would stop the compilation because
+ *  an unprotected function writes to it.  The plan has to leave total
+ *  unprotected instead, and vote on (or check) the store to it in main().
+ * The driver also makes sure that total didn't get any copies, but table did.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  64
+#define NUM_ROUNDS  1000
+#define GOLDEN      (NUM_ROUNDS * (TABLE_SIZE * (TABLE_SIZE - 1) / 2))
+
+int table[TABLE_SIZE];
+int total;
+
+
+__attribute__((noinline))
+void sumTable(void) {
+    int round, i;
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < TABLE_SIZE; i++) {
+            total += table[i];
+        }
+    }
+}
+
+
+int main() {
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i;
+    }
+    total = 0;
+
+    sumTable();
+    if (total != GOLDEN) {
+        printf("Error! the total is %d, should be %d\n", total, GOLDEN);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * parityGlobals.c
+ *
+ * This unit test makes sure that an upset in a global protected with parity
+ *  is found, and that the block is checked again after the handler returns.
+ * The upset is made through a pointer from dlsym(), so COAST doesn't see the
+ *  store and the parity isn't updated.  The next load from that block must
+ *  call FAULT_DETECTED_PARITY(), which restores the block from a backup, and
+ *  the sum must then be correct.
+ * Compiled with -DNO_REPAIR, the handler returns without fixing anything, so
+ *  the parity still doesn't match and the program must abort.
+ * It must be linked with -rdynamic, so dlsym() can find the global.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "../../COAST.h"
+
+
+#define IMAGE_SIZE  64
+#define FAULTY_IDX  21
+
+int __xMR_PARITY image[IMAGE_SIZE];
+
+// a copy to repair from, and the address of the image that COAST can't see
+int __NO_xMR backup[IMAGE_SIZE];
+char* __NO_xMR imageAddr;
+unsigned int __NO_xMR timesRepaired;
+
+
+__NO_xMR
+void injectUpset(void) {
+    imageAddr = (char*)dlsym(RTLD_DEFAULT, "image");
+    if (!imageAddr) {
+        printf("Error! can't find the image\n");
+        exit(1);
+    }
+    ((volatile int*)imageAddr)[FAULTY_IDX] ^= 0x200;
+}
+
+__NO_xMR
+void onAbort(int sig) {
+#ifdef NO_REPAIR
+    static const char msg[] = "Success!\n";
+#else
+    static const char msg[] = "Error! aborted\n";
+#endif
+    write(1, msg, sizeof(msg) - 1);
+    _exit(0);
+}
+
+void FAULT_DETECTED_PARITY(void* block) {
+    timesRepaired++;
+#ifndef NO_REPAIR
+    size_t offset = (char*)block - imageAddr;
+    memcpy(block, (char*)backup + offset, 16);
+#endif
+}
+
+__attribute__((noinline))
+void fillImage(void) {
+    int i;
+    for (i = 0; i < IMAGE_SIZE; i++) {
+        image[i] = i * 5 + 3;
+        backup[i] = i * 5 + 3;
+    }
+}
+
+__attribute__((noinline))
+int sumImage(void) {
+    int i;
+    int sum = 0;
+    for (i = 0; i < IMAGE_SIZE; i++) {
+        sum += image[i];
+    }
+    return sum;
+}
+
+
+int main() {
+    signal(SIGABRT, onAbort);
+    fillImage();
+    int expected = sumImage();
+
+    injectUpset();
+    int sum = sumImage();
+
+#ifdef NO_REPAIR
+    printf("Error! the block wasn't checked again, sum is %d\n", sum);
+    return 1;
+#else
+    if (timesRepaired != 1) {
+        printf("Error! the handler was called %u times\n", timesRepaired);
+        return 1;
+    }
+    if (sum != expected) {
+        printf("Error! the sum is %d, should be %d\n", sum, expected);
+        return 1;
+    }
+    // the repaired block must still check out
+    if (sumImage() != expected || timesRepaired != 1) {
+        printf("Error! the block is still bad\n");
+        return 1;
+    }
+    printf("Success!\n");
+    return 0;
+#endif
+}
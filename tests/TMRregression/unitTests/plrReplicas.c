@@ -0,0 +1,87 @@
+/*
+ * plrReplicas.c
+ *
+ * This unit test makes sure that -PLR outvotes a replica with an error and
+ *  replaces it, even when it is the first replica, which makes the calls.
+ * Each replica adds up the same table a few times, and one of them gets the
+ *  wrong sum the second time.  By default that is the first replica, which is
+ *  the one the program was started as.  Compiled with -DFAULT_IN_OTHER, it is
+ *  the first of the other replicas to get there, which is picked with a
+ *  counter in shared memory, set up before main() (and so before the replicas
+ *  are started).
+ * Only the sums the majority agrees on are printed, so the output must always
+ *  be correct, and the program must not abort.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  32
+#define NUM_SUMS    4
+#define FAULTY_SUM  1
+
+int table[TABLE_SIZE];
+
+// the process the program was started as, and which replica gets the error
+pid_t __NO_xMR firstPid;
+int* __NO_xMR claimed;
+
+
+__NO_xMR __attribute__((constructor))
+void setupFault(void) {
+    firstPid = getpid();
+    claimed = mmap(0, sizeof(int), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (claimed == MAP_FAILED) {
+        printf("Error! can't map the counter\n");
+        exit(1);
+    }
+    *claimed = 0;
+}
+
+__NO_xMR __attribute__((noinline))
+int isFaulty(void) {
+#ifdef FAULT_IN_OTHER
+    if (getpid() == firstPid)
+        return 0;
+    return __atomic_fetch_add(claimed, 1, __ATOMIC_SEQ_CST) == 0;
+#else
+    return getpid() == firstPid;
+#endif
+}
+
+__attribute__((noinline))
+int sumTable(int times) {
+    int i;
+    int sum = 0;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        sum += table[i] * times;
+    }
+    return sum;
+}
+
+
+int main() {
+    int i;
+    int sum;
+
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i + 1;
+    }
+
+    for (i = 0; i < NUM_SUMS; i++) {
+        sum = sumTable(i + 1);
+        if ( (i == FAULTY_SUM) && isFaulty() ) {
+            sum ^= 0x100;
+        }
+        printf("sum %d: %d\n", i, sum);
+    }
+
+    printf("Success!\n");
+    return 0;
+}
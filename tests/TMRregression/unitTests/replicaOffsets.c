@@ -0,0 +1,93 @@
+/*
+ * replicaOffsets.c
+ *
+ * This unit test makes sure that with -replicaOffsets, each copy of a packed
+ *  global is really read from its own place in memory.
+ * The table is filled with memcpy(), which writes each copy through its own
+ *  global, so the copies can be different.  readValue() is called once for
+ *  each copy (-replicateFnCalls=readValue), and gives one copy of one entry a
+ *  different value (see faultInjection.h).  The table is then read with a
+ *  variable index, so the copies are read through the address of the original
+ *  plus a constant offset.  If that offset is wrong, the copies are read from
+ *  the wrong place, and either the fault is missed or the copies never match.
+ * With DWC, the error handler must be called.  With TMR, the error is voted
+ *  out and the sum must be correct.
+ * The driver also makes sure that the table was packed, and that the copies
+ *  are read through the original address plus an offset.
+ */
+
+#include <string.h>
+
+#define TABLE_SIZE  8
+#define FAULTY_IDX  5
+
+#define NUM_FAULT_IDS   TABLE_SIZE
+#include "faultInjection.h"
+
+
+// not a multiple of 8 bytes, so the copies need padding to stay aligned
+typedef struct {
+    int value;
+    short weight;
+} entry_t;
+
+entry_t table[TABLE_SIZE] __attribute__((aligned(16)));
+
+
+__attribute__((noinline))
+int readValue(int idx) {
+    int value = idx * 3 + 1;
+    if ( (COUNT_COPY(idx) == UPSET_COPY) && (idx == FAULTY_IDX) ) {
+        value ^= 0x40;
+    }
+    return value;
+}
+
+__attribute__((noinline))
+void fillTable(void) {
+    entry_t buf[TABLE_SIZE];
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        buf[i].value = readValue(i);
+        buf[i].weight = i + 1;
+    }
+    memcpy(table, buf, sizeof(table));
+}
+
+__attribute__((noinline))
+int sumTable(int n) {
+    int i;
+    int sum = 0;
+    for (i = 0; i < n; i++) {
+        sum += table[i].value * table[i].weight;
+    }
+    return sum;
+}
+
+
+int main() {
+    fillTable();
+
+    int expected = 0;
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        expected += (i * 3 + 1) * (i + 1);
+    }
+
+    int sum = sumTable(TABLE_SIZE);
+    printf("sum: %d\n", sum);
+
+    // DWC should never get here
+    if (FAULT_MISSED(FAULTY_IDX)) {
+        printf("Error! the fault in entry %d was not detected\n", FAULTY_IDX);
+        return 1;
+    }
+
+    if (sum != expected) {
+        printf("Error! the sum should be %d\n", expected);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
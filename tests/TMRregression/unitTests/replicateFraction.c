@@ -0,0 +1,73 @@
+/*
+ * replicateFraction.c
+ *
+ * This unit test makes sure that -replicateFraction leaves out the arithmetic
+ *  that a fault can't get through, and not the arithmetic that reaches the
+ *  output.
+ * readValue() is called once for each copy (-replicateFnCalls=readValue), and
+ *  gives one copy of the second value a different result (see
+ *  faultInjection.h).  Each value is scaled and printed, which has to stay
+ *  replicated.  Most of the arithmetic in main() only looks at a few high bits
+ *  of the values and ends in a comparison, so it scores low and is left out.
+ * If the scaling were left out instead, the copies would share it, and DWC
+ *  would never see the fault.  The driver runs this with a few fractions.
+ * With DWC, the error handler must be called before anything is printed.
+ *  With TMR, the error is voted out and the values must be correct.
+ * The driver also makes sure that the shifts were left out, and the
+ *  multiplies weren't.
+ */
+
+#define NUM_VALUES      2
+#define FAULTY_VALUE    1
+
+#define NUM_FAULT_IDS   NUM_VALUES
+#include "faultInjection.h"
+
+
+#define HIGH_BITS       0x50000000u
+// one of the high bits of v, which a fault in the low bits can't change
+#define BIT(v, n)       (((v) >> (n)) & 1)
+
+unsigned int results[NUM_VALUES];
+
+
+__attribute__((noinline))
+unsigned int readValue(int idx) {
+    unsigned int value = HIGH_BITS | (idx * 100 + 42);
+    if ( (COUNT_COPY(idx) == UPSET_COPY) && (idx == FAULTY_VALUE) ) {
+        value ^= 0x10;
+    }
+    return value;
+}
+
+
+int main() {
+    unsigned int a = readValue(0);
+    unsigned int b = readValue(1);
+
+    results[0] = a * 3 + 1;
+    results[1] = b * 3 + 1;
+
+    unsigned int highBits = BIT(a, 28) + BIT(a, 29) + BIT(a, 30) + BIT(a, 31) +
+                            BIT(b, 28) + BIT(b, 29) + BIT(b, 30) + BIT(b, 31);
+    if (highBits != 4) {
+        printf("Error! %u of the high bits are set, should be 4\n", highBits);
+        return 1;
+    }
+
+    printf("results: %u %u\n", results[0], results[1]);
+
+    // DWC should never get here
+    if (FAULT_MISSED(FAULTY_VALUE)) {
+        printf("Error! the fault in value %d was not detected\n", FAULTY_VALUE);
+        return 1;
+    }
+
+    if ( (results[0] != (HIGH_BITS | 42) * 3 + 1) || (results[1] != (HIGH_BITS | 142) * 3 + 1) ) {
+        printf("Error! the results are wrong\n");
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * rmtFunctions.c
+ *
+ * This unit test makes sure that functions in -rmtFns are checked by the
+ *  trailing thread, without false errors from their local variables.
+ * sumSquares() and average() keep their values in local variables, which are
+ *  at different addresses in each thread.  sumSquares() also calls square(),
+ *  which is checked by its own trailing copy, in the middle of the one for
+ *  sumSquares().  They are called many times with no faults, which must not
+ *  call the error handler.
+ * The fault comes from the floating point rounding mode, which each thread has
+ *  its own copy of.  Once the trailing thread has started, the application
+ *  thread rounds up instead, so average() computes a different value than the
+ *  trailing copy, and the error handler must be called.
+ * TMR doesn't use -rmtFns, so all three copies run in the same thread, and the
+ *  values must just be close enough.  getDivisor() is called once for each copy
+ *  (__xMR_FN_CALL), which tells the two apart.
+ * The driver also makes sure that square() got a trailing copy, and that
+ *  the trailing copy of sumSquares() runs it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fenv.h>
+
+#include "../../COAST.h"
+
+
+#define NUM_VALUES  16
+#define NUM_RUNS    1000
+
+int values[NUM_VALUES];
+int results[NUM_VALUES];
+
+// which part of the test is running, so the error handler knows if it was expected
+volatile int __NO_xMR stage;
+unsigned int __NO_xMR timesCalled;
+
+
+__attribute__((noinline))
+int square(int v) {
+    return v * v;
+}
+
+__attribute__((noinline))
+int sumSquares(int n) {
+    int squares[NUM_VALUES];
+    int i;
+    int sum = 0;
+    for (i = 0; i < n; i++) {
+        squares[i] = square(values[i]);
+    }
+    for (i = 0; i < n; i++) {
+        sum += squares[i];
+        results[i] = sum;
+    }
+    return sum;
+}
+
+__NO_xMR __xMR_FN_CALL __attribute__((noinline))
+int getDivisor(void) {
+    timesCalled++;
+    return 3;
+}
+
+__attribute__((noinline))
+double average(double total, int n) {
+    double avg = total / n;
+    return avg;
+}
+
+
+int main() {
+    int i, run;
+    int sum = 0;
+    double avg = 0;
+
+    for (i = 0; i < NUM_VALUES; i++) {
+        values[i] = i * 3 + 1;
+    }
+
+    stage = 1;
+    for (run = 0; run < NUM_RUNS; run++) {
+        sum = sumSquares(NUM_VALUES);
+        avg = average(sum + run, 3);
+    }
+    if ( (sum != 11896) || (results[NUM_VALUES - 1] != sum) ) {
+        printf("Error! the sum is %d, should be 11896\n", sum);
+        return 1;
+    }
+
+    stage = 2;
+    fesetround(FE_UPWARD);
+    avg = average(1.0, getDivisor());
+    fesetround(FE_TONEAREST);
+    stage = 3;
+
+    // DWC should never get here
+    if (timesCalled == 2) {
+        printf("Error! the fault was not detected\n");
+        return 1;
+    }
+
+    if ( (avg < 0.333333) || (avg > 0.333334) ) {
+        printf("Error! the average is %f\n", avg);
+        return 1;
+    }
+    printf("Success!\n");
+    return 0;
+}
+
+void FAULT_DETECTED_DWC() {
+    if (stage == 2) {
+        printf("Fault detected!\n");
+        exit(0);
+    }
+    printf("Error! unexpected fault in stage %d\n", stage);
+    exit(1);
+}
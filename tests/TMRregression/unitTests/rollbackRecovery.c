@@ -0,0 +1,140 @@
+/*
+ * rollbackRecovery.c
+ *
+ * This unit test makes sure that -rollback recovers from a transient error
+ *  with DWC, instead of calling the error handler.
+ * The upset is made by a SIGTRAP handler, through a pointer from dlsym(), so
+ *  COAST doesn't see the store, and there is no call that would commit the
+ *  undo log.  It changes the second copy of scratch, which the code wrote
+ *  after its last checkpoint, so undoing the stores and running again from
+ *  there gives the right value.  Only the first trap in each stage upsets it.
+ * Stage 1 writes more values in one loop than the undo log can hold, with the
+ *  upset in the last iteration.  Stage 2 does the same over many calls to a
+ *  small function.  Both only work if the log is emptied at each checkpoint.
+ * In stage 3, scratch is written before a memcpy().  With -fuseMemOps, that is
+ *  a call to a helper which COAST adds, and it must not commit the log, or
+ *  rolling back can't get to where scratch is written.
+ * With TMR, -rollback does nothing, and the upsets are voted out.
+ * It must be linked with -rdynamic, so dlsym() can find the copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <dlfcn.h>
+
+#include "../../COAST.h"
+
+
+// more than the 4096 entries in the undo log
+#define TABLE_SIZE      6000
+#define NUM_RUNS        3000
+#define HISTORY_SIZE    16
+#define BLOCK_SIZE      64
+
+int table[TABLE_SIZE];
+int history[HISTORY_SIZE];
+int total;
+int scratch;
+unsigned char source[BLOCK_SIZE];
+unsigned char copied[BLOCK_SIZE];
+
+// which part of the test is running, so the error handler can say which one failed
+volatile int __NO_xMR stage;
+volatile int __NO_xMR upsetDone;
+
+
+__NO_xMR
+void injectUpset(int sig) {
+    int* copy;
+    (void)sig;
+    if (upsetDone) {
+        return;
+    }
+    upsetDone = 1;
+    copy = (int*)dlsym(RTLD_DEFAULT, "scratch_DWC");
+    if (copy) {
+        *copy ^= 0x10;
+    }
+}
+
+__attribute__((noinline))
+void fillTable(void) {
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        scratch = i;
+        if (i == TABLE_SIZE - 1) {
+            __builtin_debugtrap();
+        }
+        table[i] = scratch;
+    }
+}
+
+__attribute__((noinline))
+void addUp(int value) {
+    history[value % HISTORY_SIZE] = value;
+    total += value;
+}
+
+__attribute__((noinline))
+void addLast(void) {
+    scratch = 1;
+    __builtin_debugtrap();
+    total += scratch;
+}
+
+__attribute__((noinline))
+void copyBlock(void) {
+    scratch = 1;
+    __builtin_debugtrap();
+    memcpy(copied, source, BLOCK_SIZE);
+    copied[0] = scratch;
+}
+
+
+int main() {
+    int i;
+
+    signal(SIGTRAP, injectUpset);
+
+    stage = 1;
+    upsetDone = 0;
+    fillTable();
+    for (i = 0; i < TABLE_SIZE; i++) {
+        if (table[i] != i) {
+            printf("Error! table[%d] is %d\n", i, table[i]);
+            return 1;
+        }
+    }
+
+    stage = 2;
+    upsetDone = 0;
+    for (i = 0; i < NUM_RUNS; i++) {
+        addUp(i);
+    }
+    addLast();
+    if (total != NUM_RUNS * (NUM_RUNS - 1) / 2 + 1) {
+        printf("Error! the total is %d\n", total);
+        return 1;
+    }
+
+    stage = 3;
+    upsetDone = 0;
+    for (i = 0; i < BLOCK_SIZE; i++) {
+        source[i] = i + 10;
+    }
+    copyBlock();
+    if ( (copied[0] != 1) || (copied[BLOCK_SIZE - 1] != BLOCK_SIZE + 9) ) {
+        printf("Error! copied %d ... %d\n", copied[0], copied[BLOCK_SIZE - 1]);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
+
+void FAULT_DETECTED_DWC() {
+    printf("Error! the upset in stage %d was not corrected\n", stage);
+    exit(1);
+}
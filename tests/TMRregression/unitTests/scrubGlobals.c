@@ -0,0 +1,144 @@
+/*
+ * scrubGlobals.c
+ *
+ * This unit test makes sure that __COAST_scrub() finds a copy of a global that
+ *  doesn't match the others, and that with TMR it is repaired.
+ * The upset is made through a pointer from dlsym(), so COAST doesn't see the
+ *  store.  With TMR, the copy must have its old value again after one pass over
+ *  the globals.  With DWC, the mismatch can only be counted, so the test puts
+ *  the old value back itself.
+ * With TMR, it then checks what happens when the program is in the middle of a
+ *  store while the scrubber runs: only the first copy has the new value, so
+ *  the scrubber writes the old one back to it.  Once the store has written the
+ *  other copies, they outvote it, and the next pass repairs it again.
+ * It must be linked with -rdynamic, so dlsym() can find the copies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  64
+#define FAULTY_IDX  21
+#define RACE_IDX    40
+#define NEW_VALUE   1234
+
+int table[TABLE_SIZE];
+
+// the copies of the table, which COAST can't see
+int* __NO_xMR copies[3];
+int __NO_xMR numCopies;
+
+
+__attribute__((noinline))
+void initTable(void) {
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i * 5;
+    }
+}
+
+// protected, so the value is voted on
+__attribute__((noinline))
+int hasValue(int i, int v) {
+    if (table[i] != v) {
+        return 0;
+    }
+    return 1;
+}
+
+
+__NO_xMR
+void findCopies(void) {
+    copies[0] = (int*)dlsym(RTLD_DEFAULT, "table");
+    copies[1] = (int*)dlsym(RTLD_DEFAULT, "table_DWC");
+    copies[2] = (int*)dlsym(RTLD_DEFAULT, "table_TMR");
+    if (!copies[0] || !copies[1]) {
+        printf("Error! can't find the copies of the table\n");
+        exit(1);
+    }
+    numCopies = copies[2] ? 3 : 2;
+}
+
+// goes over all of the globals once
+__NO_xMR
+unsigned int scrubAll(void) {
+    return __COAST_scrub(1 << 20);
+}
+
+__NO_xMR
+void checkCounts(const char* step, unsigned int found, unsigned int mismatched,
+        unsigned int repaired) {
+    if ( (found != 1) || (__COAST_scrub_mismatched != mismatched) ||
+            (__COAST_scrub_repaired != repaired) ) {
+        printf("Error! %s: found %u, %llu mismatched, %llu repaired\n", step, found,
+                __COAST_scrub_mismatched, __COAST_scrub_repaired);
+        exit(1);
+    }
+}
+
+__NO_xMR
+void testUpset(void) {
+    unsigned int found;
+
+    copies[numCopies - 1][FAULTY_IDX] ^= 0x40;
+    found = scrubAll();
+    checkCounts("upset", found, 1, (numCopies == 3) ? 1 : 0);
+
+    if (numCopies == 2) {
+        copies[1][FAULTY_IDX] ^= 0x40;
+    } else if (copies[2][FAULTY_IDX] != FAULTY_IDX * 5) {
+        printf("Error! the copy has %d\n", copies[2][FAULTY_IDX]);
+        exit(1);
+    }
+}
+
+__NO_xMR
+void testStore(void) {
+    unsigned int found;
+
+    // the store has only written the first copy so far
+    copies[0][RACE_IDX] = NEW_VALUE;
+    found = scrubAll();
+    checkCounts("store", found, 2, 2);
+    if (copies[0][RACE_IDX] != RACE_IDX * 5) {
+        printf("Error! the first copy has %d\n", copies[0][RACE_IDX]);
+        exit(1);
+    }
+
+    // and now the other copies
+    copies[1][RACE_IDX] = NEW_VALUE;
+    copies[2][RACE_IDX] = NEW_VALUE;
+    if (!hasValue(RACE_IDX, NEW_VALUE)) {
+        printf("Error! the new value was outvoted\n");
+        exit(1);
+    }
+
+    found = scrubAll();
+    checkCounts("next pass", found, 3, 3);
+    if (copies[0][RACE_IDX] != NEW_VALUE) {
+        printf("Error! the first copy still has %d\n", copies[0][RACE_IDX]);
+        exit(1);
+    }
+}
+
+
+int main() {
+    initTable();
+    findCopies();
+
+    testUpset();
+    if (numCopies == 3) {
+        testStore();
+    }
+
+    if (!hasValue(FAULTY_IDX, FAULTY_IDX * 5)) {
+        printf("Error! table[%d] is wrong\n", FAULTY_IDX);
+        return 1;
+    }
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * syncElimDominance.c
+ *
+ * This unit test makes sure that -syncElim only skips a sync when an earlier
+ *  sync on the same value always runs first.
+ * readValue() is called once for each copy (-replicateFnCalls=readValue), and
+ *  gives one copy a different result (see faultInjection.h).  The value is
+ *  passed to printf() three times.  The first call is behind a branch that
+ *  isn't taken, so it doesn't dominate the second call, which still has to be
+ *  checked.  The third call is dominated by the second, so it is the one that
+ *  can be skipped.
+ * With DWC, the error handler must be called before the value is printed.
+ *  With TMR, the error is voted out and the value must be correct every time.
+ * Compile it with -O1, otherwise each use of the value is a separate load and
+ *  there is nothing to skip.
+ * The driver also makes sure that only the third sync was skipped.
+ */
+
+#include "faultInjection.h"
+
+
+#define GOLDEN_VALUE 42
+
+// never set, but the compiler can't know that
+volatile int __NO_xMR verbose = 0;
+
+
+__attribute__((noinline))
+int readValue(void) {
+    int value = GOLDEN_VALUE;
+    if (COUNT_COPY(0) == UPSET_COPY) {
+        value ^= 0x10;
+    }
+    return value;
+}
+
+
+int main() {
+    int v = readValue();
+
+    if (verbose) {
+        printf("read %d\n", v);
+    }
+    printf("value: %d\n", v);
+    printf("value again: %d\n", v);
+
+    // DWC should never get here
+    if (FAULT_MISSED(0)) {
+        printf("Error! the fault in the value was not detected\n");
+        return 1;
+    }
+
+    if (v != GOLDEN_VALUE) {
+        printf("Error! the value should be %d\n", GOLDEN_VALUE);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * syncProfile.c
+ *
+ * This unit test makes sure that -profileSyncs prints how many times each sync
+ *  point ran when the program exits.
+ * record() is called NUM_VALUES times, and its first store syncs on v every
+ *  time.  The second store has the same value, so with -syncElim it doesn't
+ *  get any sync logic, and must not show up in the profile at all.
+ * The output is checked by the regex in unitTestDriver.py, which has the line
+ *  numbers of the two stores.  Compile with -g, so the sites have a location.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../COAST.h"
+
+
+#define NUM_VALUES  10
+
+int first[NUM_VALUES];
+int second[NUM_VALUES];
+
+
+__attribute__((noinline))
+void record(int i, int x) {
+    int v = x * 3 + 1;
+    first[i] = v;
+    second[i] = v;
+}
+
+
+int main() {
+    int i;
+
+    for (i = 0; i < NUM_VALUES; i++) {
+        record(i, i);
+    }
+
+    for (i = 0; i < NUM_VALUES; i++) {
+        if ( (first[i] != i * 3 + 1) || (second[i] != first[i]) ) {
+            printf("Error! first[%d] is %d, second[%d] is %d\n", i, first[i], i, second[i]);
+            return 1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
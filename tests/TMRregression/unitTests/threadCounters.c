@@ -0,0 +1,145 @@
+/*
+ * threadCounters.c
+ *
+ * This unit test makes sure that -threadCounters adds up the counts of every
+ *  thread, including threads that have already exited.
+ * work() is run once by main() to see how many syncs it takes, then the
+ *  counters are reset and it is run by several threads at the same time.  The
+ *  totals must be the same as running it that many times.
+ * getUpset() is called once for each copy (__xMR_FN_CALL), and the last copy
+ *  gets a different value at every call after the first one, which TMR votes
+ *  out and counts as an error.  Its value only goes into one branch, so there
+ *  is one error for each call.  The first call in each thread only finds out
+ *  how many copies there are, since with DWC there is no upset.
+ * Nothing is counted unless it is TMR with -countErrors, in which case the
+ *  totals are all 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../../COAST.h"
+
+
+#define NUM_THREADS 4
+#define NUM_VALUES  16
+#define NUM_RUNS    2000
+#define NUM_UPSETS  5
+
+int values[NUM_VALUES];
+int __NO_xMR results[NUM_THREADS + 1];
+
+unsigned int __NO_xMR TMR_ERROR_CNT = 0;
+unsigned long long __NO_xMR __SYNC_COUNT = 0;
+
+__thread unsigned int __NO_xMR timesCalled;
+__thread unsigned int __NO_xMR numCopies;
+
+
+__NO_xMR __xMR_FN_CALL __attribute__((noinline))
+int getUpset(void) {
+    timesCalled++;
+    // only TMR can correct the upset
+    return (numCopies == 3) && (timesCalled % 3 == 0);
+}
+
+__NO_xMR __attribute__((noinline))
+void addResult(int id, int v) {
+    results[id] += v;
+}
+
+__attribute__((noinline))
+void initValues(void) {
+    int i;
+    for (i = 0; i < NUM_VALUES; i++) {
+        values[i] = i * 3 + 1;
+    }
+}
+
+__attribute__((noinline))
+void countCopies(void) {
+    getUpset();
+}
+
+__attribute__((noinline))
+void work(int id) {
+    int i, v;
+    for (i = 0; i < NUM_RUNS; i++) {
+        v = values[i % NUM_VALUES];
+        addResult(id, v);
+        // the copy that takes this branch is outvoted
+        if ( (i % (NUM_RUNS / NUM_UPSETS) == 0) && getUpset() ) {
+            addResult(id, v);
+        }
+    }
+}
+
+// protected, so the loads of the counter are replicated as well
+__attribute__((noinline))
+unsigned long long syncsSoFar(void) {
+    return __SYNC_COUNT;
+}
+
+__NO_xMR
+void startWork(uintptr_t id) {
+    countCopies();
+    numCopies = timesCalled;
+    work(id);
+}
+
+__NO_xMR
+void* worker(void* arg) {
+    startWork((uintptr_t)arg);
+    return 0;
+}
+
+
+__NO_xMR
+int main() {
+    pthread_t threads[NUM_THREADS];
+    unsigned long long syncsOnce;
+    unsigned int errorsOnce;
+    uintptr_t t;
+    int i;
+
+    initValues();
+    __SYNC_COUNT = 0;
+
+    // the main thread first
+    startWork(NUM_THREADS);
+    syncsOnce = __SYNC_COUNT;
+    errorsOnce = TMR_ERROR_CNT;
+    if ( (syncsOnce > 0) && (errorsOnce != ((numCopies == 3) ? NUM_UPSETS : 0)) ) {
+        printf("Error! %llu syncs and %u errors in one thread\n", syncsOnce, errorsOnce);
+        return 1;
+    }
+
+    __SYNC_COUNT = 0;
+    TMR_ERROR_CNT = 0;
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_create(&threads[t], 0, worker, (void*)t);
+    }
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_join(threads[t], 0);
+    }
+
+    if (syncsSoFar() != syncsOnce * NUM_THREADS) {
+        printf("Error! %llu syncs, should be %llu\n", syncsSoFar(), syncsOnce * NUM_THREADS);
+        return 1;
+    }
+    if (TMR_ERROR_CNT != errorsOnce * NUM_THREADS) {
+        printf("Error! %u errors, should be %u\n", TMR_ERROR_CNT, errorsOnce * NUM_THREADS);
+        return 1;
+    }
+    for (i = 0; i <= NUM_THREADS; i++) {
+        if (results[i] != results[NUM_THREADS]) {
+            printf("Error! results[%d] is %d\n", i, results[i]);
+            return 1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
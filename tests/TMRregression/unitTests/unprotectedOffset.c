@@ -0,0 +1,76 @@
+/*
+ * unprotectedOffset.c
+ *
+ * This unit test makes sure that a local variable keeps all of its copies when
+ *  the value stored to it comes from an unprotected global.
+ * lookupUsed() stores the distance between two unprotected pointers to a local
+ *  variable, and then uses it as an array index.  That makes the store a sync
+ *  point for values loaded from unprotected globals.  The clones of such a
+ *  store used to be erased, which left the copies of the local variable with
+ *  whatever was on the stack, so the copies of the index pointed somewhere else.
+ * fillStack() leaves a pattern on the stack first, so the copies can't happen
+ *  to hold the right value.
+ * Compile it without optimizations, so the local variable stays on the stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../COAST.h"
+
+
+#define TABLE_SIZE  64
+#define USED        37
+#define GOLDEN      (USED * 3 + 1)
+
+int table[TABLE_SIZE];
+
+char __NO_xMR buffer[TABLE_SIZE];
+char* __NO_xMR bufferStart;
+char* __NO_xMR bufferEnd;
+
+
+__NO_xMR __attribute__((noinline))
+void setBuffer(void) {
+    bufferStart = buffer;
+    bufferEnd = buffer + USED;
+}
+
+__NO_xMR __attribute__((noinline))
+void fillStack(void) {
+    volatile unsigned char junk[512];
+    unsigned int i;
+    for (i = 0; i < sizeof(junk); i++) {
+        junk[i] = 0xA5;
+    }
+}
+
+__attribute__((noinline))
+int lookupUsed(void) {
+    long used = bufferEnd - bufferStart;
+    return table[used];
+}
+
+
+int main() {
+    int i;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i * 3 + 1;
+    }
+    setBuffer();
+
+    fillStack();
+    int value = lookupUsed();
+    if (value != GOLDEN) {
+        printf("Error! the value is %d, should be %d\n", value, GOLDEN);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
+
+void FAULT_DETECTED_DWC() {
+    printf("Error! the copies of the local variable don't match\n");
+    exit(1);
+}
@@ -0,0 +1,140 @@
+/*
+ * vecLanes.c
+ *
+ * This unit test makes sure that COAST can vote on, count errors in, and
+ *  check vectors of any width and element type.  None of this code uses
+ *  intrinsics; instead it is written so the loop vectorizer and the SLP
+ *  vectorizer will turn it into vector code, so it has to be compiled
+ *  with XCFLAGS="-O3" (and without -fno-vectorize).
+ * Compare the run time against the unprotected version to see the cost
+ *  of protecting vectorized code.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/**************************** COAST configuration *****************************/
+#include "../../COAST.h"
+
+//this is only used when compiled with flag -countErrors
+unsigned int __NO_xMR TMR_ERROR_CNT = 0;
+
+
+#define ARRAY_SIZE  256
+#define NUM_LOOPS   1000
+
+uint8_t  bytes[ARRAY_SIZE];
+int16_t  shorts[ARRAY_SIZE];
+int64_t  longs[ARRAY_SIZE];
+float    floats[ARRAY_SIZE];
+double   doubles[ARRAY_SIZE];
+
+// 3 lanes, so the vector width is not a power of 2
+typedef float float3 __attribute__((ext_vector_type(3)));
+
+
+void initArrays(void) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        bytes[i] = (uint8_t)i;
+        shorts[i] = (int16_t)(i - ARRAY_SIZE/2);
+        longs[i] = (int64_t)i * 100000;
+        floats[i] = (float)i / 4;
+        doubles[i] = (double)i / 8;
+    }
+}
+
+// each of these loops should be vectorized with a different lane type
+__attribute__((noinline))
+void scaleBytes(uint8_t scale) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        bytes[i] = bytes[i] * scale + 1;
+    }
+}
+
+__attribute__((noinline))
+void scaleShorts(int16_t scale) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        shorts[i] = shorts[i] * scale - 3;
+    }
+}
+
+__attribute__((noinline))
+void scaleLongs(int64_t scale) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        longs[i] = longs[i] * scale + i;
+    }
+}
+
+__attribute__((noinline))
+void scaleFloats(float scale) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        floats[i] = floats[i] * scale + 0.5f;
+    }
+}
+
+__attribute__((noinline))
+void scaleDoubles(double scale) {
+    int i;
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        doubles[i] = doubles[i] * scale + 0.25;
+    }
+}
+
+// vector return value, synchronized at the terminator
+__attribute__((noinline))
+float3 addFloat3(float3 a, float3 b) {
+    return a + b;
+}
+
+
+int main() {
+    int i;
+    uint64_t byteSum = 0;
+    int64_t shortSum = 0, longSum = 0;
+    double floatSum = 0, doubleSum = 0;
+    float3 v = {1.0f, 2.0f, 3.0f};
+    float3 step = {0.5f, 0.25f, 0.125f};
+
+    initArrays();
+    for (i = 0; i < NUM_LOOPS; i++) {
+        scaleBytes(3);
+        scaleShorts(-1);
+        scaleLongs(1);
+        scaleFloats(0.5f);
+        scaleDoubles(0.5);
+        v = addFloat3(v, step);
+    }
+
+    for (i = 0; i < ARRAY_SIZE; i++) {
+        byteSum += bytes[i];
+        shortSum += shorts[i];
+        longSum += longs[i];
+        floatSum += floats[i];
+        doubleSum += doubles[i];
+    }
+
+    printf("%llu %lld %lld %.3f %.3f\n", (unsigned long long)byteSum,
+            (long long)shortSum, (long long)longSum, floatSum, doubleSum);
+    printf("%.3f %.3f %.3f\n", v.x, v.y, v.z);
+    printf("TMR errors: %d\n", TMR_ERROR_CNT);
+
+    // the 64-bit loop has a closed form and the floating point loops converge,
+    //  the other sums are printed so they can be compared with the unprotected run
+    if ((longSum == 3264000000LL + 32640LL * NUM_LOOPS) &&
+            (floatSum > 255.9 && floatSum < 256.1) &&
+            (doubleSum > 127.9 && doubleSum < 128.1) &&
+            (v.x == 501.0f) && (v.y == 252.0f) && (v.z == 128.0f) &&
+            (TMR_ERROR_CNT == 0)) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return -1;
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * rmtBenchmark.c
+ *
+ * Multiplies two matrices one row at a time, and prints how long it took.
+ * With -rmtFns=multiplyRow, each row is computed once and checked by the
+ *  trailing thread, so the run time should stay close to the unprotected one
+ *  if there is a free core for it.  Build with -TMR or -DWC instead to compare
+ *  against the copies running on one core.
+ * The matrices are not replicated, so all of the builds read and write the
+ *  same memory.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "COAST.h"
+
+#define N       128
+#define ROUNDS  500
+
+int __NO_xMR matA[N][N];
+int __NO_xMR matB[N][N];
+int __NO_xMR matC[N][N];
+
+
+__attribute__((noinline))
+void multiplyRow(int row) {
+    int i, j;
+    for (j = 0; j < N; j++) {
+        int sum = 0;
+        for (i = 0; i < N; i++)
+            sum += matA[row][i] * matB[i][j];
+        matC[row][j] = sum;
+    }
+}
+
+__NO_xMR double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+__NO_xMR int main() {
+    int round, row, col;
+    unsigned int checksum = 0;
+    double start;
+
+    for (row = 0; row < N; row++) {
+        for (col = 0; col < N; col++) {
+            matA[row][col] = row + col;
+            matB[row][col] = row - col;
+        }
+    }
+
+    // with -rmtFns, the calls to clock_gettime() wait for the trailing thread
+    start = seconds();
+    for (round = 0; round < ROUNDS; round++) {
+        for (row = 0; row < N; row++)
+            multiplyRow(row);
+    }
+    printf("%d rounds: %.3f s\n", ROUNDS, seconds() - start);
+
+    for (row = 0; row < N; row++) {
+        for (col = 0; col < N; col++)
+            checksum = checksum * 31 + matC[row][col];
+    }
+    printf("checksum: %08x\n", checksum);
+    return 0;
+}
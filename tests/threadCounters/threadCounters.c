@@ -0,0 +1,63 @@
+/*
+ * threadCounters.c
+ *
+ * Runs the same amount of protected work on 1, 2, 4 and 8 threads.
+ * With -countErrors and -countSyncs, every sync point adds to a counter, so if
+ *  the counters are shared the run time goes up with the number of threads
+ *  instead of staying flat.  Build with and without -threadCounters to compare.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "COAST.h"
+
+#define MAX_THREADS 8
+#define ITERATIONS  (1 << 22)
+
+unsigned int __NO_xMR TMR_ERROR_CNT = 0;
+unsigned long long __NO_xMR __SYNC_COUNT = 0;
+
+static uint32_t results[MAX_THREADS];
+
+// protected, every loop iteration has a few sync points
+uint32_t crunch(uint32_t seed, uint32_t n) {
+    uint32_t x = seed;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        x = x * 1664525u + 1013904223u;
+        if (x & 0x100)
+            x ^= x >> 7;
+    }
+    return x;
+}
+
+__NO_xMR void* worker(void* arg) {
+    uintptr_t id = (uintptr_t)arg;
+    results[id] = crunch((uint32_t)id, ITERATIONS);
+    return 0;
+}
+
+__NO_xMR double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+__NO_xMR int main() {
+    pthread_t threads[MAX_THREADS];
+    uintptr_t n, t;
+
+    for (n = 1; n <= MAX_THREADS; n *= 2) {
+        double start = seconds();
+        for (t = 0; t < n; t++)
+            pthread_create(&threads[t], 0, worker, (void*)t);
+        for (t = 0; t < n; t++)
+            pthread_join(threads[t], 0);
+        printf("%lu threads: %.3f s\n", (unsigned long)n, seconds() - start);
+    }
+
+    printf("TMR errors: %u, syncs: %llu\n", TMR_ERROR_CNT, __SYNC_COUNT);
+    return 0;
+}
@@ -0,0 +1,123 @@
+###########################################################
+# driver for checking how compile time scales with
+#  the number of synchronization points
+###########################################################
+
+
+import os
+import sys
+import time
+import shlex
+import pathlib
+import argparse
+import tempfile
+import subprocess as sp
+
+this_dir = pathlib.Path(__file__).resolve().parent
+makefile_path = this_dir / "makefile.customFile"
+
+
+def setUpArgs():
+    parser = argparse.ArgumentParser(description="Make sure the time spent in the DWC and TMR passes grows linearly with the number of sync points")
+    parser.add_argument('passes', type=str, help='opt passes to run on generated IR')
+    parser.add_argument('--size', '-s', help='number of sync points in the smaller test (default 2000)', type=int, default=2000)
+    parser.add_argument('--ratio', '-r', help='largest allowed ratio of run times when the size is doubled (default 3.0)', type=float, default=3.0)
+    parser.add_argument('--tolerance', '-t', help='seconds of slack added to the allowed run time, for noise from other processes (default 1.0)', type=float, default=1.0)
+    parser.add_argument('--repeat', help='number of times each size is run, the fastest one is used (default 3)', type=int, default=3)
+    return parser.parse_args()
+
+
+def createSyncHeavyIRFile(tempFile, size):
+    # Every block has a store (which is a sync point with -storeDataSync) of a value
+    #  that is used again afterwards, so the voted value must be propagated using
+    #  dominance information.
+    lines = []
+    lines.append("@sink = global i32 0, align 4")
+    lines.append("")
+    lines.append("define i32 @stress(i32 %a) {")
+    lines.append("entry:")
+    lines.append("  br label %bb0")
+    prev = "%a"
+    for i in range(size):
+        lines.append("bb{}:".format(i))
+        lines.append("  %v{i} = add i32 %a, {i}".format(i=i))
+        lines.append("  store i32 %v{i}, i32* @sink, align 4".format(i=i))
+        lines.append("  %w{i} = add i32 {p}, %v{i}".format(i=i, p=prev))
+        nextBlock = "bb{}".format(i+1) if i+1 < size else "exit"
+        lines.append("  br label %{}".format(nextBlock))
+        prev = "%w{}".format(i)
+    lines.append("exit:")
+    lines.append("  ret i32 {}".format(prev))
+    lines.append("}")
+    tempFile.write("\n".join(lines) + "\n")
+    tempFile.flush()
+
+
+def runOpt(srcDir, targetPath, passes):
+    # only run the optimizer, the back end doesn't matter here
+    cmd = "make --file={mk} 'PROJECT_SRC={dir}' 'TARGET={tgt}' 'OPT_PASSES={ps}' {tgt}.opt.bc"
+    cmd = cmd.format(
+        mk=makefile_path,
+        dir=srcDir,
+        tgt=targetPath,
+        ps=passes)
+    # print(cmd)
+    start = time.perf_counter()
+    proc = sp.Popen(shlex.split(cmd), cwd=srcDir, stdout=sp.PIPE)
+    output = proc.communicate()[0]
+    elapsed = time.perf_counter() - start
+    # print errors
+    if proc.returncode:
+        print(output.decode())
+    return proc.returncode, elapsed
+
+
+def timeSize(td, size, passes, repeat):
+    # the fastest run is the one least disturbed by whatever else is running
+    llSuffix = ".lbc"
+    best = None
+    with tempfile.NamedTemporaryFile(mode='w', dir=str(td), suffix=llSuffix) as llFile:
+        createSyncHeavyIRFile(llFile, size)
+        rawFileName = llFile.name.replace(llSuffix, "")
+        rawFileName = os.path.basename(rawFileName)
+        for _ in range(repeat):
+            # make won't rebuild an output that is up to date
+            optFile = os.path.join(str(td), rawFileName + ".opt.bc")
+            if os.path.exists(optFile):
+                os.remove(optFile)
+            rc, elapsed = runOpt(str(td), rawFileName, passes)
+            if rc:
+                return rc, elapsed
+            if best is None or elapsed < best:
+                best = elapsed
+    return 0, best
+
+
+def main():
+    args = setUpArgs()
+    # stores are only sync points when this is set
+    passes = args.passes + " -storeDataSync"
+
+    with tempfile.TemporaryDirectory(dir=str(this_dir)) as td:
+        rc0, t0 = timeSize(td, args.size, passes, args.repeat)
+        rc1, t1 = timeSize(td, args.size * 2, passes, args.repeat)
+        if rc0 or rc1:
+            print("Error running configuration {}".format(passes))
+            return 1
+
+    ratio = t1 / t0
+    print("{} sync points: {:.2f}s, {} sync points: {:.2f}s (ratio {:.2f})".format(
+        args.size, t0, args.size * 2, t1, ratio))
+    # quadratic growth would be a ratio of about 4, the tolerance keeps short
+    #  run times (where starting make and opt is most of the time) from failing
+    if t1 > args.ratio * t0 + args.tolerance:
+        print("Compile time grows faster than expected for configuration {}".format(passes))
+        return 1
+
+    # if success
+    print("Success!")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())